@@ -0,0 +1,117 @@
+#include <dnswire/collector.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+/*
+ * Each shard only touches its own counter so no locking is needed.
+ */
+struct shard_counter {
+    size_t dnstaps;
+    char   pad[64 - sizeof(size_t)];
+};
+
+static void received(size_t shard, const struct dnstap* d, void* ctx)
+{
+    ((struct shard_counter*)ctx)[shard].dnstaps++;
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: collector <IP> <port> <shards>\n");
+        return 1;
+    }
+
+    struct sockaddr_storage addr_store;
+    struct sockaddr_in*     addr = (struct sockaddr_in*)&addr_store;
+    socklen_t               addrlen;
+    size_t                  shards = atoi(argv[3]);
+
+    memset(&addr_store, 0, sizeof(addr_store));
+    if (strchr(argv[1], ':')) {
+        addr->sin_family = AF_INET6;
+        addrlen          = sizeof(struct sockaddr_in6);
+        if (inet_pton(AF_INET6, argv[1], &((struct sockaddr_in6*)addr)->sin6_addr) != 1) {
+            fprintf(stderr, "inet_pton(%s) failed: %s\n", argv[1], strerror(errno));
+            return 1;
+        }
+        ((struct sockaddr_in6*)addr)->sin6_port = htons(atoi(argv[2]));
+    } else {
+        addr->sin_family = AF_INET;
+        addrlen          = sizeof(struct sockaddr_in);
+        if (inet_pton(AF_INET, argv[1], &addr->sin_addr) != 1) {
+            fprintf(stderr, "inet_pton(%s) failed: %s\n", argv[1], strerror(errno));
+            return 1;
+        }
+        addr->sin_port = htons(atoi(argv[2]));
+    }
+    if (!shards) {
+        fprintf(stderr, "invalid number of shards\n");
+        return 1;
+    }
+
+    struct shard_counter counters[shards];
+    memset(counters, 0, sizeof(counters));
+
+    /*
+     * We initialize the collector with the number of shards, each shard
+     * will have its own listening socket (SO_REUSEPORT) and thread.
+     */
+
+    struct dnswire_collector collector;
+
+    if (dnswire_collector_init(&collector, (struct sockaddr*)addr, addrlen, shards) != dnswire_ok) {
+        fprintf(stderr, "Unable to initialize dnswire collector\n");
+        return 1;
+    }
+    dnswire_collector_allow_bidirectional(collector, true);
+    dnswire_collector_set_callback(collector, received, counters);
+
+    if (dnswire_collector_listen(&collector) != dnswire_ok) {
+        fprintf(stderr, "dnswire_collector_listen() failed: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("listening with %zu shards%s\n", shards, collector.reuseport ? " (SO_REUSEPORT)" : "");
+
+    /*
+     * Block the signals we want to stop on before starting the threads, so
+     * that only the main thread will receive them.
+     */
+
+    sigset_t set;
+    int      sig;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, 0);
+
+    if (dnswire_collector_start(&collector) != dnswire_ok) {
+        fprintf(stderr, "dnswire_collector_start() failed\n");
+        return 1;
+    }
+
+    sigwait(&set, &sig);
+    printf("stopping\n");
+
+    dnswire_collector_stop(&collector);
+    dnswire_collector_join(&collector);
+
+    size_t i;
+    for (i = 0; i < shards; i++) {
+        struct dnswire_collector_stats stats;
+
+        dnswire_collector_stats(&collector, i, &stats);
+        printf("shard %zu: accepted %zu closed %zu errors %zu dnstaps %zu (counted %zu)\n", i, stats.accepted, stats.closed, stats.errors, stats.dnstaps, counters[i].dnstaps);
+    }
+
+    dnswire_collector_destroy(&collector);
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <dnswire/reader.h>
+#include <dnswire/columnar.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: columnar <input DNSTAP file> <output columnar file> [none|zstd|lz4 [rows per group]]\n");
+        return 1;
+    }
+
+    enum dnswire_compression compression = dnswire_compression_none;
+    if (argc > 3) {
+        if (!strcmp(argv[3], "zstd")) {
+            compression = dnswire_compression_zstd;
+        } else if (!strcmp(argv[3], "lz4")) {
+            compression = dnswire_compression_lz4;
+        } else if (strcmp(argv[3], "none")) {
+            fprintf(stderr, "Unknown compression %s\n", argv[3]);
+            return 1;
+        }
+    }
+
+    /*
+     * The input is read with a decompressor so that compressed DNSTAP
+     * files can be converted as well, uncompressed files are passed
+     * through as is.
+     */
+
+    struct dnswire_reader       reader;
+    struct dnswire_decompressor decompressor;
+
+    if (dnswire_reader_init(&reader) != dnswire_ok
+        || dnswire_decompressor_init(&decompressor) != dnswire_ok) {
+        fprintf(stderr, "Unable to initialize dnswire reader\n");
+        return 1;
+    }
+    dnswire_reader_set_decompressor(reader, &decompressor);
+
+    /*
+     * The columnar writer keeps a group of rows in memory, column by
+     * column, and writes each column of the group as its own chunk so a
+     * scan only has to read the columns it uses.
+     */
+
+    struct dnswire_columnar_writer writer;
+
+    if (dnswire_columnar_writer_init(&writer, compression) != dnswire_ok) {
+        fprintf(stderr, "Unable to initialize columnar writer (compression %s not available?)\n", dnswire_compression_string[compression]);
+        return 1;
+    }
+    if (argc > 4) {
+        dnswire_columnar_writer_set_group_rows(writer, strtoul(argv[4], 0, 10));
+    }
+
+    int in = open(argv[1], O_RDONLY);
+    if (in < 0) {
+        fprintf(stderr, "open(%s) failed: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    int out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        fprintf(stderr, "open(%s) failed: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+    if (dnswire_columnar_writer_open(&writer, out) != dnswire_ok) {
+        fprintf(stderr, "Unable to write %s\n", argv[2]);
+        return 1;
+    }
+
+    size_t rows = 0;
+    int    done = 0, ret = 0;
+
+    while (!done) {
+        switch (dnswire_reader_read(&reader, in)) {
+        case dnswire_have_dnstap:
+            if (dnswire_columnar_writer_write(&writer, dnswire_reader_dnstap(reader)) != dnswire_ok) {
+                fprintf(stderr, "dnswire_columnar_writer_write() error\n");
+                done = ret = 1;
+                break;
+            }
+            rows++;
+            break;
+        case dnswire_again:
+        case dnswire_need_more:
+            break;
+        case dnswire_endofdata:
+            done = 1;
+            break;
+        default:
+            fprintf(stderr, "dnswire_reader_read() error\n");
+            done = ret = 1;
+        }
+    }
+
+    if (dnswire_columnar_writer_close(&writer) != dnswire_ok) {
+        fprintf(stderr, "dnswire_columnar_writer_close() error\n");
+        ret = 1;
+    }
+    printf("converted %zu rows into %zu groups\n", rows, writer.num_groups);
+
+    dnswire_columnar_writer_destroy(&writer);
+    dnswire_reader_destroy(reader);
+    dnswire_decompressor_destroy(&decompressor);
+    close(in);
+    close(out);
+
+    return ret;
+}
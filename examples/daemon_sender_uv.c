@@ -1,4 +1,4 @@
-#include <tinyframe/tinyframe.h>
+#include <dnswire/publisher.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,43 +10,42 @@
 #include "create_dnstap.c"
 
 #define BUF_SIZE 4096
+#define MAX_BUFS 16
 
-enum client_state {
-    no_state,
-    writing_start,
-    started,
-    writing_frame,
-};
-
-struct client;
 struct client {
-    struct client*    next;
-    size_t            id;
-    enum client_state state;
-    uv_tcp_t          conn;
-    char              rbuf[BUF_SIZE];
-    uv_write_t        wreq;
-    uv_buf_t          wbuf;
-    uint8_t           buf[BUF_SIZE];
+    size_t                           id;
+    struct dnswire_publisher_client* pub;
+    uv_tcp_t                         conn;
+    char                             rbuf[BUF_SIZE];
+    uv_write_t                       wreq;
+    uv_buf_t                         wbufs[MAX_BUFS];
+    struct dnswire_frame*            frames[MAX_BUFS];
+    size_t                           num_frames;
 };
 
-struct client* clients   = 0;
-size_t         client_id = 1;
-
-static char content_type[] = "protobuf:dnstap.Dnstap";
+struct dnswire_publisher publisher;
+size_t                   client_id = 1;
 
 uv_loop_t* loop;
 
 struct client* client_new()
 {
-    struct client* c = malloc(sizeof(struct client));
+    struct client* c = calloc(1, sizeof(struct client));
     if (c) {
         c->conn.data = c;
-        c->next      = clients;
         c->id        = client_id++;
-        c->state     = no_state;
-        c->wbuf.base = (void*)c->buf;
-        clients      = c;
+
+        /*
+         * Adding the client to the publisher gives it its own queue of
+         * frames, which starts with the control start frame.
+         *
+         * We use -1 for the file descriptor since frames will be popped
+         * from the queue and written using libuv.
+         */
+        if (!(c->pub = dnswire_publisher_add_client(&publisher, -1, c))) {
+            free(c);
+            return 0;
+        }
     }
     return c;
 }
@@ -55,23 +54,17 @@ void client_close(uv_handle_t* handle)
 {
     struct client* c = handle->data;
 
-    if (clients == c) {
-        clients = c->next;
-    } else {
-        struct client* prev = clients;
-
-        while (prev) {
-            if (prev->next == c) {
-                prev->next = c->next;
-                break;
-            }
-            prev = prev->next;
-        }
-    }
-
+    dnswire_publisher_remove_client(&publisher, c->pub);
     free(c);
 }
 
+void client_shutdown(struct client* c)
+{
+    if (!uv_is_closing((uv_handle_t*)&c->conn)) {
+        uv_close((uv_handle_t*)&c->conn, client_close);
+    }
+}
+
 void client_alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
 {
     buf->base = ((struct client*)handle->data)->rbuf;
@@ -91,24 +84,64 @@ void client_read(uv_stream_t* client, ssize_t nread, const uv_buf_t* buf)
         } else {
             printf("client %zu disconnected\n", ((struct client*)client->data)->id);
         }
-        uv_close((uv_handle_t*)client, client_close);
+        client_shutdown(client->data);
+    }
+}
+
+void client_write(uv_write_t* req, int status);
+
+void client_flush(struct client* c)
+{
+    if (c->num_frames || uv_is_closing((uv_handle_t*)&c->conn)) {
+        return;
+    }
+
+    /*
+     * Take the frames queued for the client, the frames themselves are
+     * shared with all other clients so we only take references to them
+     * and write them directly from where they were encoded.
+     */
+
+    struct dnswire_frame* f;
+    while (c->num_frames < MAX_BUFS && (f = dnswire_publisher_pop(&publisher, c->pub))) {
+        c->wbufs[c->num_frames]  = uv_buf_init((char*)f->data, f->length);
+        c->frames[c->num_frames] = f;
+        c->num_frames++;
+    }
+
+    if (c->num_frames) {
+        uv_write(&c->wreq, (uv_stream_t*)&c->conn, c->wbufs, c->num_frames, client_write);
+    } else if (c->pub->state == dnswire_publisher_client_evicted) {
+        printf("client %zu: too slow, evicted\n", c->id);
+        client_shutdown(c);
     }
 }
 
 void client_write(uv_write_t* req, int status)
 {
+    struct client* c = req->handle->data;
+
     /*
-     * After a write we check that there was no errors and then set the
-     * client in a state that allows `tick()` to send DNSTAP messages to it.
+     * After a write we release our references to the frames, check that
+     * there was no errors and then continue with what has been queued
+     * since.
      */
 
+    size_t i;
+    for (i = 0; i < c->num_frames; i++) {
+        dnswire_frame_unref(c->frames[i]);
+    }
+    c->num_frames = 0;
+
     if (status) {
-        fprintf(stderr, "client_write() error: %s\n", uv_strerror(status));
-        uv_close((uv_handle_t*)req->handle, client_close);
+        if (status != UV_ECANCELED) {
+            fprintf(stderr, "client_write() error: %s\n", uv_strerror(status));
+        }
+        client_shutdown(c);
         return;
     }
 
-    ((struct client*)req->handle->data)->state = started;
+    client_flush(c);
 }
 
 void on_new_connection(uv_stream_t* server, int status)
@@ -135,27 +168,10 @@ void on_new_connection(uv_stream_t* server, int status)
 
         uv_read_start((uv_stream_t*)&client->conn, client_alloc_buffer, client_read);
 
-        struct tinyframe_writer writer = TINYFRAME_WRITER_INITIALIZER;
-
-        /*
-         * First we write, to the buffer, a control start with a content type
-         * control field for the DNSTAP protobuf content type.
-         *
-         * Then we send it.
-         */
-
-        if (tinyframe_write_control_start(&writer, client->buf, BUF_SIZE, content_type, sizeof(content_type) - 1) != tinyframe_ok) {
-            fprintf(stderr, "tinyframe_write_control_start() failed\n");
-            uv_close((uv_handle_t*)&client->conn, client_close);
-            return;
-        }
         printf("client %zu: sending control start and content type\n", client->id);
-
-        client->wbuf.len = writer.bytes_wrote;
-        uv_write((uv_write_t*)&client->wreq, (uv_stream_t*)&client->conn, &client->wbuf, 1, client_write);
-        client->state = writing_start;
+        client_flush(client);
     } else {
-        uv_close((uv_handle_t*)&client->conn, client_close);
+        client_shutdown(client);
     }
 }
 
@@ -173,43 +189,31 @@ void tick(uv_timer_t* handle)
     struct dnstap d = create_dnstap("daemon_sender_uv");
 
     /*
-     * Now that the message is prepared we can begin encapsulating it in
-     * protobuf and Frame Streams.
-     *
-     * First we ask what the encoded size of the protobuf message would be
-     * and then we allocate a buffer with of that size plus the size of
-     * a Frame Streams frame header.
+     * Now that the message is prepared we publish it, it will be encoded
+     * once into a reference counted frame which is then queued for all
+     * clients.
      *
-     * Then we encode the DNSTAP message and put it after the frame header
-     * and call `tinyframe_set_header()` to set the header.
+     * If a client's queue is full the frame is dropped for that client,
+     * and if that continues for too long the client is evicted.
      */
 
-    size_t  frame_len = dnstap_encode_protobuf_size(&d);
-    uint8_t frame[TINYFRAME_HEADER_SIZE + frame_len];
-    dnstap_encode_protobuf(&d, &frame[TINYFRAME_HEADER_SIZE]);
-    tinyframe_set_header(frame, frame_len);
-
-    if (sizeof(frame) > BUF_SIZE) {
-        fprintf(stderr, "frame larger the client's buffers\n");
+    if (dnswire_publisher_publish_dnstap(&publisher, &d) != dnswire_ok) {
+        fprintf(stderr, "dnswire_publisher_publish_dnstap() failed\n");
         exit(1);
     }
 
     /*
-     * We now loop over all the connected clients and send the message
-     * to those that are currently not busy.
+     * We now loop over all the connected clients and send what they have
+     * queued, clients that are busy writing will continue when done.
      */
 
-    struct client* c = clients;
-    while (c) {
-        if (c->state == started) {
-            c->wbuf.len = sizeof(frame);
-            memcpy(c->buf, frame, sizeof(frame));
-            uv_write((uv_write_t*)&c->wreq, (uv_stream_t*)&c->conn, &c->wbuf, 1, client_write);
-            c->state = writing_frame;
+    struct dnswire_publisher_client* p = dnswire_publisher_clients(publisher);
+    while (p) {
+        struct client* c = p->ctx;
 
-            printf("client %zu: sending DNSTAP\n", c->id);
-        }
-        c = c->next;
+        p = p->next;
+        printf("client %zu: sending DNSTAP\n", c->id);
+        client_flush(c);
     }
 }
 
@@ -235,6 +239,11 @@ int main(int argc, const char* argv[])
         uv_ip4_addr(argv[1], port, (struct sockaddr_in*)&addr);
     }
 
+    if (dnswire_publisher_init(&publisher) != dnswire_ok) {
+        fprintf(stderr, "Unable to initialize dnswire publisher\n");
+        return 1;
+    }
+
     loop = uv_default_loop();
 
     uv_tcp_t server;
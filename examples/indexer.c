@@ -0,0 +1,95 @@
+#include <dnswire/index.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: indexer <input DNSTAP file> <output index file> [frames per block [Bloom filter bytes]]\n");
+        return 1;
+    }
+
+    size_t block_frames = argc > 3 ? strtoul(argv[3], 0, 10) : DNSWIRE_INDEX_DEFAULT_BLOCK_FRAMES;
+    size_t bloom_size   = argc > 4 ? strtoul(argv[4], 0, 10) : 0;
+
+    /*
+     * Build the index by scanning the file, only the frames are decoded
+     * and nothing is kept in memory but the blocks.
+     */
+
+    struct dnswire_index index;
+
+    if (dnswire_index_init(&index, block_frames) != dnswire_ok) {
+        fprintf(stderr, "Unable to initialize dnswire index\n");
+        return 1;
+    }
+
+    /*
+     * Optionally add Bloom filters over the client address and QNAME of
+     * each block, so readers looking for a client or a name can skip the
+     * blocks that can not have it.
+     */
+
+    if (dnswire_index_set_bloom_size(&index, bloom_size) != dnswire_ok) {
+        fprintf(stderr, "Unable to set Bloom filter size\n");
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "open(%s) failed: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    if (dnswire_index_build(&index, fd) != dnswire_ok) {
+        fprintf(stderr, "Unable to index %s\n", argv[1]);
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    /*
+     * Save the index next to the file, readers can then load it and use
+     * `dnswire_reader_seek_time()` to jump to the first block of a time
+     * range.
+     */
+
+    if ((fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        fprintf(stderr, "open(%s) failed: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+    if (dnswire_index_save(&index, fd) != dnswire_ok) {
+        fprintf(stderr, "Unable to write index %s\n", argv[2]);
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    size_t   i, frames = 0;
+    uint64_t min = UINT64_MAX, max = 0;
+    for (i = 0; i < dnswire_index_blocks(index); i++) {
+        struct dnswire_index_block* block = dnswire_index_block(index, i);
+
+        frames += block->frames;
+        if (block->min < min) {
+            min = block->min;
+        }
+        if (block->max > max) {
+            max = block->max;
+        }
+    }
+    printf("%zu frames in %zu blocks", frames, dnswire_index_blocks(index));
+    if (min <= max) {
+        printf(", time %" PRIu64 " - %" PRIu64, min, max);
+    }
+    printf("\n");
+
+    dnswire_index_destroy(&index);
+
+    return 0;
+}
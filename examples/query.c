@@ -0,0 +1,221 @@
+#include <dnswire/query.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: query [-t threads] [-w <column><op><value> ...] [-s <column>[,<column> ...]] [-g <column>] [-n limit] <columnar file>\n"
+                    "  -w: filter rows, op is one of == != < <= > >=, can be given many times\n"
+                    "  -s: print the columns of the matching rows\n"
+                    "  -g: count the matching rows by the value of the column\n"
+                    "  -n: limit the number of rows or groups (top N) printed\n");
+}
+
+static int column(const char* name, size_t len)
+{
+    int i;
+
+    for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+        if (strlen(dnswire_column_string[i]) == len && !strncmp(dnswire_column_string[i], name, len)) {
+            return i;
+        }
+    }
+    fprintf(stderr, "Unknown column %.*s\n", (int)len, name);
+    return -1;
+}
+
+static int is_address(enum dnswire_column c)
+{
+    return c == dnswire_column_query_address || c == dnswire_column_response_address;
+}
+
+/*
+ * Parse "<column><op><value>", addresses are given in text form and other
+ * bytes columns as strings.
+ */
+static int add_filter(struct dnswire_query* q, const char* arg)
+{
+    static const char* const ops[] = { "==", "!=", "<=", ">=", "<", ">" };
+    static const enum dnswire_query_op op_of[] = { dnswire_query_eq, dnswire_query_ne, dnswire_query_le, dnswire_query_ge, dnswire_query_lt, dnswire_query_gt };
+    const char* at;
+    size_t      i;
+    int         c;
+
+    for (at = arg; *at && !strchr("=!<>", *at); at++)
+        ;
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (!strncmp(at, ops[i], strlen(ops[i]))) {
+            break;
+        }
+    }
+    if (i == sizeof(ops) / sizeof(ops[0])) {
+        fprintf(stderr, "Invalid filter %s\n", arg);
+        return -1;
+    }
+    if ((c = column(arg, at - arg)) < 0) {
+        return -1;
+    }
+    const char* value = at + strlen(ops[i]);
+
+    if (is_address(c)) {
+        uint8_t addr[16];
+
+        if (inet_pton(AF_INET, value, addr) == 1) {
+            return dnswire_query_add_filter_bytes(q, c, op_of[i], addr, 4) == dnswire_ok ? 0 : -1;
+        }
+        if (inet_pton(AF_INET6, value, addr) == 1) {
+            return dnswire_query_add_filter_bytes(q, c, op_of[i], addr, 16) == dnswire_ok ? 0 : -1;
+        }
+        fprintf(stderr, "Invalid address %s\n", value);
+        return -1;
+    }
+    if (dnswire_column_is_bytes(c)) {
+        return dnswire_query_add_filter_bytes(q, c, op_of[i], (const uint8_t*)value, strlen(value)) == dnswire_ok ? 0 : -1;
+    }
+    return dnswire_query_add_filter(q, c, op_of[i], strtoull(value, 0, 0)) == dnswire_ok ? 0 : -1;
+}
+
+static void print_value(enum dnswire_column c, uint64_t value, const uint8_t* bytes, size_t length)
+{
+    char   buf[INET6_ADDRSTRLEN];
+    size_t i;
+
+    if (!dnswire_column_is_bytes(c)) {
+        printf("%lu", (unsigned long)value);
+        return;
+    }
+    if (is_address(c) && (length == 4 || length == 16) && inet_ntop(length == 4 ? AF_INET : AF_INET6, bytes, buf, sizeof(buf))) {
+        printf("%s", buf);
+        return;
+    }
+    for (i = 0; i < length; i++) {
+        if (bytes[i] < ' ' || bytes[i] > '~' || bytes[i] == '\\') {
+            printf("\\x%02x", bytes[i]);
+        } else {
+            putchar(bytes[i]);
+        }
+    }
+}
+
+static void print_row(const struct dnswire_column_data* columns, size_t row, void* ctx)
+{
+    const struct dnswire_query* q = ctx;
+    size_t                      i;
+
+    for (i = 0; i < q->num_project; i++) {
+        const struct dnswire_column_data* c = &columns[q->project[i]];
+
+        if (i) {
+            putchar(' ');
+        }
+        if (!dnswire_column_data_is_present(*c, row)) {
+            printf("-");
+        } else if (dnswire_column_is_bytes(q->project[i])) {
+            print_value(q->project[i], 0, dnswire_column_data_bytes(*c, row), dnswire_column_data_length(*c, row));
+        } else {
+            print_value(q->project[i], dnswire_column_data_value(*c, row), 0, 0);
+        }
+    }
+    putchar('\n');
+}
+
+int main(int argc, char* argv[])
+{
+    struct dnswire_query q;
+    size_t               threads = 1, i;
+    int                  opt;
+
+    if (dnswire_query_init(&q) != dnswire_ok) {
+        fprintf(stderr, "Unable to initialize query\n");
+        return 1;
+    }
+
+    while ((opt = getopt(argc, argv, "t:w:s:g:n:")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = strtoul(optarg, 0, 10);
+            break;
+        case 'w':
+            if (add_filter(&q, optarg)) {
+                return 1;
+            }
+            break;
+        case 's': {
+            const char* at = optarg;
+            while (*at) {
+                size_t len = strcspn(at, ",");
+                int    c   = column(at, len);
+                if (c < 0 || dnswire_query_add_project(&q, c) != dnswire_ok) {
+                    return 1;
+                }
+                at += len + (at[len] == ',');
+            }
+            break;
+        }
+        case 'g': {
+            int c = column(optarg, strlen(optarg));
+            if (c < 0) {
+                return 1;
+            }
+            dnswire_query_set_group_by(q, c);
+            break;
+        }
+        case 'n':
+            dnswire_query_set_limit(q, strtoul(optarg, 0, 10));
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (optind >= argc || !threads) {
+        usage();
+        return 1;
+    }
+    dnswire_query_set_callback(q, print_row, &q);
+
+    /*
+     * Open the archive, only the footer is read until the query runs and
+     * then only the columns it needs of the row groups that are not
+     * skipped.
+     */
+
+    struct dnswire_columnar_reader reader;
+
+    int fd = open(argv[optind], O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "open(%s) failed: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if (dnswire_columnar_reader_init(&reader) != dnswire_ok
+        || dnswire_columnar_reader_open(&reader, fd) != dnswire_ok) {
+        fprintf(stderr, "Unable to open columnar archive %s\n", argv[optind]);
+        return 1;
+    }
+
+    if (dnswire_query_run(&q, &reader, threads) != dnswire_ok) {
+        fprintf(stderr, "dnswire_query_run() error\n");
+        return 1;
+    }
+
+    for (i = 0; i < dnswire_query_groups(q); i++) {
+        struct dnswire_query_group* g = dnswire_query_group(q, i);
+
+        printf("%zu ", g->count);
+        print_value(q.group_by, g->value, g->bytes, g->length);
+        putchar('\n');
+    }
+    fprintf(stderr, "matched %zu rows, scanned %zu and skipped %zu of %zu groups, read %zu bytes\n", dnswire_query_matched(q), dnswire_query_scanned(q), dnswire_query_skipped(q), dnswire_columnar_reader_groups(reader), dnswire_query_bytes_read(q));
+
+    dnswire_query_destroy(&q);
+    dnswire_columnar_reader_destroy(&reader);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+#include <dnswire/relay.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int unix_socket(const char* file)
+{
+    struct sockaddr_un path;
+
+    memset(&path, 0, sizeof(struct sockaddr_un));
+    path.sun_family = AF_UNIX;
+    strncpy(path.sun_path, file, sizeof(path.sun_path) - 1);
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        fprintf(stderr, "socket() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (connect(sockfd, (struct sockaddr*)&path, sizeof(struct sockaddr_un))) {
+        fprintf(stderr, "connect(%s) failed: %s\n", file, strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: relay <input unix socket path> <output unix socket path> [ <output unix socket path> ... ]\n");
+        return 1;
+    }
+
+    /*
+     * We first initialize the relay, it will read the incoming stream in
+     * raw mode so that frames are never decoded.
+     */
+
+    struct dnswire_relay relay;
+
+    if (dnswire_relay_init(&relay) != dnswire_ok) {
+        fprintf(stderr, "Unable to initialize dnswire relay\n");
+        return 1;
+    }
+    if (dnswire_relay_allow_bidirectional(relay, true) != dnswire_ok) {
+        fprintf(stderr, "Unable to set dnswire relay to bidirectional mode\n");
+        return 1;
+    }
+
+    /*
+     * Connect to all the destinations, each get its own queue of frames so
+     * that a slow destination will only drop its own frames and not stall
+     * the others.
+     */
+
+    int i;
+    for (i = 2; i < argc; i++) {
+        int fd = unix_socket(argv[i]);
+        if (fd < 0) {
+            return 1;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        if (dnswire_relay_add_destination(&relay, fd, true, DNSWIRE_FRAME_QUEUE_DEFAULT_SIZE, dnswire_frame_queue_drop_oldest) != dnswire_ok) {
+            fprintf(stderr, "Unable to add destination %s\n", argv[i]);
+            return 1;
+        }
+        printf("connected to %s\n", argv[i]);
+    }
+
+    /*
+     * Now we listen for the sender on the given path and accept one
+     * connection.
+     */
+
+    struct sockaddr_un path;
+
+    memset(&path, 0, sizeof(struct sockaddr_un));
+    path.sun_family = AF_UNIX;
+    strncpy(path.sun_path, argv[1], sizeof(path.sun_path) - 1);
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        fprintf(stderr, "socket() failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if (bind(sockfd, (struct sockaddr*)&path, sizeof(struct sockaddr_un))) {
+        fprintf(stderr, "bind() failed: %s\n", strerror(errno));
+        close(sockfd);
+        return 1;
+    }
+    if (listen(sockfd, 1)) {
+        fprintf(stderr, "listen() failed: %s\n", strerror(errno));
+        close(sockfd);
+        return 1;
+    }
+    int clifd = accept(sockfd, 0, 0);
+    if (clifd < 0) {
+        fprintf(stderr, "accept() failed: %s\n", strerror(errno));
+        close(sockfd);
+        return 1;
+    }
+    printf("accepted sender\n");
+
+    /*
+     * We now poll the sender for input and each destination for output
+     * when it has something to write, until the sender has stopped and
+     * all destinations are done (or have failed).
+     */
+
+    size_t        n   = dnswire_relay_destinations(relay);
+    struct pollfd pfd[n + 1];
+    int           input_done = 0;
+
+    while (1) {
+        size_t active = 0, d;
+
+        /*
+         * If the reader has data buffered that it has not decoded yet we
+         * call it again without waiting for more input, and if it needs
+         * to respond to the sender we wait until we can write.
+         */
+        int input_buffered = 0;
+
+        pfd[0].fd = input_done ? -1 : clifd;
+        switch (relay.reader.state) {
+        case dnswire_reader_decoding_control:
+        case dnswire_reader_decoding:
+            input_buffered = !input_done;
+            pfd[0].events  = POLLIN;
+            break;
+        case dnswire_reader_encoding_accept:
+        case dnswire_reader_writing_accept:
+        case dnswire_reader_encoding_finish:
+        case dnswire_reader_writing_finish:
+            pfd[0].events = POLLOUT;
+            break;
+        default:
+            pfd[0].events = POLLIN;
+        }
+        for (d = 0; d < n; d++) {
+            struct dnswire_relay_destination* dst = dnswire_relay_destination(relay, d);
+
+            pfd[d + 1].fd     = -1;
+            pfd[d + 1].events = 0;
+            switch (dst->state) {
+            case dnswire_relay_destination_relaying:
+                if (dnswire_frame_queue_is_empty(dst->queue) && !dst->stop) {
+                    active++;
+                    break;
+                }
+                // fallthrough
+            case dnswire_relay_destination_starting:
+            case dnswire_relay_destination_stopping:
+                pfd[d + 1].fd     = dst->fd;
+                pfd[d + 1].events = POLLIN | POLLOUT;
+                active++;
+                break;
+            default:
+                break;
+            }
+        }
+        if (input_done && !active) {
+            break;
+        }
+
+        if (poll(pfd, n + 1, input_buffered ? 0 : -1) < 0) {
+            fprintf(stderr, "poll() failed: %s\n", strerror(errno));
+            break;
+        }
+
+        if (input_buffered || pfd[0].revents) {
+            switch (dnswire_relay_read(&relay, clifd)) {
+            case dnswire_have_frame:
+            case dnswire_again:
+            case dnswire_need_more:
+                break;
+            case dnswire_endofdata:
+                printf("sender stopped\n");
+                input_done = 1;
+                break;
+            default:
+                fprintf(stderr, "dnswire_relay_read() error\n");
+                dnswire_relay_stop(&relay);
+                input_done = 1;
+            }
+        }
+
+        for (d = 0; d < n; d++) {
+            if (pfd[d + 1].revents && dnswire_relay_write(&relay, d) == dnswire_error) {
+                fprintf(stderr, "destination %s failed\n", argv[d + 2]);
+            }
+        }
+    }
+
+    for (i = 0; i < (int)n; i++) {
+        struct dnswire_relay_destination* dst = dnswire_relay_destination(relay, i);
+
+        printf("%s: %s, queued %zu written %zu dropped %zu\n", argv[i + 2], dnswire_relay_destination_state_string[dst->state], dst->queue.queued, dst->queue.written, dst->queue.dropped);
+        close(dst->fd);
+    }
+    printf("received %zu\n", dnswire_relay_received(relay));
+
+    dnswire_relay_destroy(&relay);
+    shutdown(clifd, SHUT_RDWR);
+    close(clifd);
+    close(sockfd);
+    unlink(argv[1]);
+
+    return 0;
+}
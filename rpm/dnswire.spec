@@ -17,14 +17,17 @@ BuildRequires:  automake
 BuildRequires:  libtool
 BuildRequires:  pkgconfig
 BuildRequires:  tinyframe-devel
+BuildRequires:  libzstd-devel
 %if 0%{?suse_version} || 0%{?sle_version}
 %if 0%{?is_opensuse} || 0%{?sle_version} == 150200
 BuildRequires:  protobuf-c
 %endif
 BuildRequires:  libprotobuf-c-devel
+BuildRequires:  liblz4-devel
 %else
 BuildRequires:  protobuf-c-compiler
 BuildRequires:  protobuf-c-devel
+BuildRequires:  lz4-devel
 %endif
 
 %description
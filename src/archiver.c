@@ -0,0 +1,396 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/archiver.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+enum dnswire_result dnswire_archiver_init(struct dnswire_archiver* handle)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_archiver));
+
+    handle->fd       = -1;
+    handle->direct   = true;
+    handle->buf_size = DNSWIRE_ARCHIVER_DEFAULT_BUF_SIZE;
+    pthread_mutex_init(&handle->lock, 0);
+    pthread_cond_init(&handle->cond, 0);
+
+    return dnswire_ok;
+}
+
+void dnswire_archiver_destroy(struct dnswire_archiver* handle)
+{
+    assert(handle);
+
+    if (handle->opened) {
+        dnswire_archiver_close(handle);
+    }
+    free(handle->frame);
+    handle->frame = 0;
+    free(handle->bufs[0]);
+    handle->bufs[0] = 0;
+    free(handle->bufs[1]);
+    handle->bufs[1] = 0;
+    pthread_mutex_destroy(&handle->lock);
+    pthread_cond_destroy(&handle->cond);
+}
+
+/*
+ * Write a buffer and, if not using O_DIRECT, flush it and drop it from the
+ * page cache. Only the range just written is flushed so that the rest of
+ * the file system is not affected.
+ */
+static int _write_block(struct dnswire_archiver* handle, const uint8_t* buf, size_t len, uint64_t offset)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = pwrite(handle->fd, buf + done, len - done, (off_t)(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+#ifdef O_DIRECT
+            // some file systems accept O_DIRECT when opening but not when writing
+            if (errno == EINVAL && handle->direct) {
+                int flags = fcntl(handle->fd, F_GETFL);
+                if (flags != -1 && !fcntl(handle->fd, F_SETFL, flags & ~O_DIRECT)) {
+                    __trace("pwrite() with O_DIRECT failed, falling back to buffered");
+                    pthread_mutex_lock(&handle->lock);
+                    handle->direct = false;
+                    pthread_mutex_unlock(&handle->lock);
+                    continue;
+                }
+            }
+#endif
+            __trace("pwrite() failed: %s", strerror(errno));
+            return -1;
+        }
+        done += n;
+    }
+
+    if (handle->direct) {
+        return 0;
+    }
+
+#if HAVE_SYNC_FILE_RANGE
+    if (sync_file_range(handle->fd, (off_t)offset, (off_t)len, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER)) {
+        __trace("sync_file_range() failed: %s", strerror(errno));
+        return -1;
+    }
+#elif HAVE_FDATASYNC
+    if (fdatasync(handle->fd)) {
+        __trace("fdatasync() failed: %s", strerror(errno));
+        return -1;
+    }
+#else
+    if (fsync(handle->fd)) {
+        __trace("fsync() failed: %s", strerror(errno));
+        return -1;
+    }
+#endif
+
+#if HAVE_POSIX_FADVISE
+    {
+        // not fatal, it is only advice
+        int err = posix_fadvise(handle->fd, (off_t)offset, (off_t)len, POSIX_FADV_DONTNEED);
+        if (err) {
+            __trace("posix_fadvise() failed: %s", strerror(err));
+        }
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * Writes the buffers handed over by the encoding side.
+ */
+static void* _io(void* arg)
+{
+    struct dnswire_archiver* handle = arg;
+
+    pthread_mutex_lock(&handle->lock);
+    while (1) {
+        while (!handle->stop && !handle->busy) {
+            pthread_cond_wait(&handle->cond, &handle->lock);
+        }
+        if (!handle->busy) {
+            break;
+        }
+        const uint8_t* buf    = handle->bufs[handle->pending];
+        size_t         len    = handle->pending_len;
+        uint64_t       offset = handle->pending_offset;
+        pthread_mutex_unlock(&handle->lock);
+
+        int err = _write_block(handle, buf, len, offset);
+
+        pthread_mutex_lock(&handle->lock);
+        if (err) {
+            handle->failed = true;
+        }
+        handle->blocks++;
+        handle->busy = false;
+        pthread_cond_broadcast(&handle->cond);
+    }
+    pthread_mutex_unlock(&handle->lock);
+
+    return 0;
+}
+
+/*
+ * Hand the active buffer to the background thread and switch to the other
+ * one, waiting only if the other one is still being written.
+ */
+static enum dnswire_result _submit(struct dnswire_archiver* handle, size_t len)
+{
+    bool failed;
+
+    pthread_mutex_lock(&handle->lock);
+    if (handle->busy) {
+        handle->stalls++;
+        while (handle->busy) {
+            pthread_cond_wait(&handle->cond, &handle->lock);
+        }
+    }
+    failed = handle->failed;
+    if (!failed) {
+        handle->busy           = true;
+        handle->pending        = handle->active;
+        handle->pending_len    = len;
+        handle->pending_offset = handle->offset;
+        pthread_cond_broadcast(&handle->cond);
+    }
+    pthread_mutex_unlock(&handle->lock);
+
+    if (failed) {
+        return dnswire_error;
+    }
+
+    handle->active ^= 1;
+    handle->offset += len;
+    handle->fill = 0;
+
+    return dnswire_ok;
+}
+
+static enum dnswire_result _append(struct dnswire_archiver* handle, const uint8_t* data, size_t len)
+{
+    while (len) {
+        size_t n = handle->buf_size - handle->fill;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&handle->bufs[handle->active][handle->fill], data, n);
+        handle->fill += n;
+        data += n;
+        len -= n;
+
+        if (handle->fill == handle->buf_size && _submit(handle, handle->buf_size) != dnswire_ok) {
+            return dnswire_error;
+        }
+    }
+
+    return dnswire_ok;
+}
+
+static enum dnswire_result _encode(struct dnswire_archiver* handle)
+{
+    enum dnswire_result res;
+
+    while (1) {
+        res = dnswire_encoder_encode(&handle->encoder, handle->frame, handle->frame_size);
+        __trace("encode %s", dnswire_result_string[res]);
+
+        switch (res) {
+        case dnswire_ok:
+        case dnswire_again:
+        case dnswire_endofdata:
+            if (_append(handle, handle->frame, dnswire_encoder_encoded(handle->encoder)) != dnswire_ok) {
+                return dnswire_error;
+            }
+            return res;
+
+        case dnswire_need_more: {
+            if (handle->frame_size >= DNSWIRE_MAXIMUM_BUF_SIZE) {
+                return dnswire_error;
+            }
+
+            size_t   size  = handle->frame_size * 2;
+            uint8_t* frame = realloc(handle->frame, size);
+            if (!frame) {
+                return dnswire_error;
+            }
+            handle->frame      = frame;
+            handle->frame_size = size;
+            continue;
+        }
+        default:
+            return res;
+        }
+    }
+}
+
+enum dnswire_result dnswire_archiver_open(struct dnswire_archiver* handle, const char* path)
+{
+    assert(handle);
+    assert(path);
+    assert(!handle->opened);
+
+    if (!handle->buf_size || handle->buf_size % DNSWIRE_ARCHIVER_ALIGNMENT) {
+        return dnswire_error;
+    }
+
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (!handle->bufs[i] && posix_memalign((void**)&handle->bufs[i], DNSWIRE_ARCHIVER_ALIGNMENT, handle->buf_size)) {
+            handle->bufs[i] = 0;
+            return dnswire_error;
+        }
+    }
+    if (!handle->frame) {
+        if (!(handle->frame = malloc(DNSWIRE_DEFAULT_BUF_SIZE))) {
+            return dnswire_error;
+        }
+        handle->frame_size = DNSWIRE_DEFAULT_BUF_SIZE;
+    }
+
+    handle->fd = -1;
+#ifdef O_DIRECT
+    if (handle->direct) {
+        // file systems without support fail with EINVAL
+        handle->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (handle->fd < 0) {
+            __trace("open(O_DIRECT) failed: %s", strerror(errno));
+        }
+    }
+#endif
+    if (handle->fd < 0) {
+        handle->direct = false;
+        if ((handle->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+            return dnswire_error;
+        }
+    }
+
+    handle->encoder = (struct dnswire_encoder)DNSWIRE_ENCODER_INITIALIZER;
+    handle->active  = 0;
+    handle->fill    = 0;
+    handle->offset  = 0;
+    handle->busy    = false;
+    handle->stop    = false;
+    handle->failed  = false;
+
+    if (pthread_create(&handle->thread, 0, _io, handle)) {
+        close(handle->fd);
+        handle->fd = -1;
+        return dnswire_error;
+    }
+    handle->started = true;
+    handle->opened  = true;
+
+    // write START so the file is complete even if nothing else is written
+    if (_encode(handle) != dnswire_again) {
+        dnswire_archiver_close(handle);
+        return dnswire_error;
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_archiver_write(struct dnswire_archiver* handle, const struct dnstap* dnstap)
+{
+    assert(handle);
+    assert(dnstap);
+    assert(handle->opened);
+
+    dnswire_encoder_set_dnstap(handle->encoder, dnstap);
+
+    return _encode(handle) == dnswire_ok ? dnswire_ok : dnswire_error;
+}
+
+enum dnswire_result dnswire_archiver_close(struct dnswire_archiver* handle)
+{
+    assert(handle);
+    assert(handle->opened);
+
+    enum dnswire_result res    = dnswire_ok;
+    bool                padded = false;
+
+    if (handle->encoder.state == dnswire_encoder_frames) {
+        if (dnswire_encoder_stop(&handle->encoder) != dnswire_ok
+            || _encode(handle) != dnswire_endofdata) {
+            res = dnswire_error;
+        }
+    }
+
+    // O_DIRECT needs the last buffer padded, the padding is truncated below
+    uint64_t end = handle->offset + handle->fill;
+    if (handle->fill) {
+        size_t len = handle->fill;
+        bool   direct;
+
+        // the background thread falls back to buffered if O_DIRECT writes fail
+        pthread_mutex_lock(&handle->lock);
+        direct = handle->direct;
+        pthread_mutex_unlock(&handle->lock);
+        if (direct && len % DNSWIRE_ARCHIVER_ALIGNMENT) {
+            size_t pad = DNSWIRE_ARCHIVER_ALIGNMENT - len % DNSWIRE_ARCHIVER_ALIGNMENT;
+            memset(&handle->bufs[handle->active][len], 0, pad);
+            len += pad;
+            padded = true;
+        }
+        if (_submit(handle, len) != dnswire_ok) {
+            res = dnswire_error;
+        }
+    }
+
+    pthread_mutex_lock(&handle->lock);
+    handle->stop = true;
+    pthread_cond_broadcast(&handle->cond);
+    pthread_mutex_unlock(&handle->lock);
+    if (handle->started) {
+        pthread_join(handle->thread, 0);
+        handle->started = false;
+    }
+    if (handle->failed) {
+        res = dnswire_error;
+    }
+
+    if (padded && ftruncate(handle->fd, (off_t)end)) {
+        res = dnswire_error;
+    }
+    if (close(handle->fd)) {
+        res = dnswire_error;
+    }
+    handle->fd     = -1;
+    handle->opened = false;
+
+    return res;
+}
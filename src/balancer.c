@@ -0,0 +1,366 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/balancer.h"
+#include "dnswire/trace.h"
+#include "util.h"
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+const char* const dnswire_balancer_endpoint_health_string[] = {
+    "healthy",
+    "stalled",
+    "down",
+};
+
+#define __health(h, s)                                                                                                            \
+    __trace("health %s => %s", dnswire_balancer_endpoint_health_string[(h)->health], dnswire_balancer_endpoint_health_string[s]); \
+    (h)->health = s;
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// FNV-1a with a final avalanche so that short keys spread over the ring
+static uint32_t _hash(const uint8_t* key, size_t len)
+{
+    uint32_t hash = _fnv1a32(key, len);
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+enum dnswire_result dnswire_balancer_init(struct dnswire_balancer* handle)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_balancer));
+    handle->vnodes        = DNSWIRE_BALANCER_DEFAULT_VNODES;
+    handle->stall_fill    = DNSWIRE_BALANCER_DEFAULT_STALL_FILL;
+    handle->stall_timeout = DNSWIRE_BALANCER_DEFAULT_STALL_TIMEOUT;
+
+    return dnswire_ok;
+}
+
+void dnswire_balancer_destroy(struct dnswire_balancer* handle)
+{
+    assert(handle);
+
+    size_t i;
+    for (i = 0; i < handle->num_endpoints; i++) {
+        dnswire_relay_destination_destroy(&handle->endpoints[i].destination);
+    }
+    free(handle->endpoints);
+    free(handle->ring);
+    handle->endpoints     = 0;
+    handle->num_endpoints = 0;
+    handle->ring          = 0;
+    handle->ring_size     = 0;
+}
+
+static int _vnode_cmp(const void* a, const void* b)
+{
+    uint32_t ha = ((const struct dnswire_balancer_vnode*)a)->hash, hb = ((const struct dnswire_balancer_vnode*)b)->hash;
+
+    return ha < hb ? -1 : ha > hb;
+}
+
+static enum dnswire_result _add_vnodes(struct dnswire_balancer* handle, size_t endpoint)
+{
+    struct dnswire_balancer_vnode* ring = realloc(handle->ring, sizeof(struct dnswire_balancer_vnode) * (handle->ring_size + handle->vnodes));
+    if (!ring) {
+        return dnswire_error;
+    }
+    handle->ring = ring;
+
+    size_t v;
+    for (v = 0; v < handle->vnodes; v++) {
+        uint8_t key[8] = {
+            endpoint >> 24, endpoint >> 16, endpoint >> 8, endpoint,
+            v >> 24, v >> 16, v >> 8, v
+        };
+
+        handle->ring[handle->ring_size].hash     = _hash(key, sizeof(key));
+        handle->ring[handle->ring_size].endpoint = endpoint;
+        handle->ring_size++;
+    }
+    qsort(handle->ring, handle->ring_size, sizeof(struct dnswire_balancer_vnode), _vnode_cmp);
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_balancer_add_endpoint(struct dnswire_balancer* handle, int fd, bool bidirectional, size_t queue_size, enum dnswire_frame_queue_policy policy)
+{
+    assert(handle);
+
+    if (!handle->vnodes) {
+        return dnswire_error;
+    }
+
+    struct dnswire_balancer_endpoint* endpoints = realloc(handle->endpoints, sizeof(struct dnswire_balancer_endpoint) * (handle->num_endpoints + 1));
+    if (!endpoints) {
+        return dnswire_error;
+    }
+    handle->endpoints = endpoints;
+
+    struct dnswire_balancer_endpoint* e = &handle->endpoints[handle->num_endpoints];
+    memset(e, 0, sizeof(struct dnswire_balancer_endpoint));
+    e->health        = dnswire_balancer_endpoint_healthy;
+    e->last_progress = _now();
+    e->bidirectional = bidirectional;
+    e->queue_size    = queue_size;
+    e->policy        = policy;
+
+    if (dnswire_relay_destination_init(&e->destination, fd, bidirectional, queue_size, policy) != dnswire_ok) {
+        return dnswire_error;
+    }
+    if (_add_vnodes(handle, handle->num_endpoints) != dnswire_ok) {
+        dnswire_relay_destination_destroy(&e->destination);
+        return dnswire_error;
+    }
+    handle->num_endpoints++;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_balancer_reconnect(struct dnswire_balancer* handle, size_t endpoint, int fd)
+{
+    assert(handle);
+    assert(endpoint < handle->num_endpoints);
+
+    struct dnswire_balancer_endpoint* e = &handle->endpoints[endpoint];
+
+    dnswire_relay_destination_destroy(&e->destination);
+    if (dnswire_relay_destination_init(&e->destination, fd, e->bidirectional, e->queue_size, e->policy) != dnswire_ok) {
+        __health(e, dnswire_balancer_endpoint_down);
+        return dnswire_error;
+    }
+    e->last_bytes    = 0;
+    e->last_progress = _now();
+    __health(e, dnswire_balancer_endpoint_healthy);
+
+    return dnswire_ok;
+}
+
+static void _update(struct dnswire_balancer* handle, struct dnswire_balancer_endpoint* e, uint64_t now)
+{
+    struct dnswire_frame_queue* q = &e->destination.queue;
+
+    if (e->destination.state == dnswire_relay_destination_failed) {
+        if (e->health != dnswire_balancer_endpoint_down) {
+            __health(e, dnswire_balancer_endpoint_down);
+        }
+        return;
+    }
+
+    if (q->bytes != e->last_bytes || !q->len) {
+        e->last_bytes    = q->bytes;
+        e->last_progress = now;
+    }
+    bool slow = handle->stall_timeout && q->len && now - e->last_progress >= handle->stall_timeout;
+
+    switch (e->health) {
+    case dnswire_balancer_endpoint_healthy:
+        if (slow || q->len * 100 >= q->size * handle->stall_fill) {
+            __health(e, dnswire_balancer_endpoint_stalled);
+        }
+        break;
+
+    case dnswire_balancer_endpoint_stalled:
+        if (!slow && q->len * 200 < q->size * handle->stall_fill) {
+            __health(e, dnswire_balancer_endpoint_healthy);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*
+ * Quick check when routing, only the queue fill is considered and
+ * recovery is left to `_update()`.
+ */
+static inline bool _usable(struct dnswire_balancer* handle, struct dnswire_balancer_endpoint* e)
+{
+    if (e->health != dnswire_balancer_endpoint_healthy || !dnswire_relay_destination_is_active(e->destination)) {
+        return false;
+    }
+    if (e->destination.queue.len * 100 >= e->destination.queue.size * handle->stall_fill) {
+        __health(e, dnswire_balancer_endpoint_stalled);
+        return false;
+    }
+    return true;
+}
+
+static struct dnswire_balancer_endpoint* _route(struct dnswire_balancer* handle, const uint8_t* key, size_t len, struct dnswire_balancer_endpoint** primary)
+{
+    if (!handle->ring_size) {
+        return 0;
+    }
+
+    uint32_t hash = _hash(key, len);
+    size_t   lo = 0, hi = handle->ring_size;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (handle->ring[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    size_t i;
+    for (i = 0; i < handle->ring_size; i++) {
+        struct dnswire_balancer_endpoint* e = &handle->endpoints[handle->ring[(lo + i) % handle->ring_size].endpoint];
+
+        if (!i && primary) {
+            *primary = e;
+        }
+        if (_usable(handle, e)) {
+            return e;
+        }
+    }
+
+    return 0;
+}
+
+struct dnswire_balancer_endpoint* dnswire_balancer_route(struct dnswire_balancer* handle, const uint8_t* key, size_t len)
+{
+    assert(handle);
+    assert(key || !len);
+
+    return _route(handle, key, len, 0);
+}
+
+enum dnswire_result dnswire_balancer_write_frame(struct dnswire_balancer* handle, struct dnswire_frame* frame, const uint8_t* key, size_t len)
+{
+    assert(handle);
+    assert(frame);
+
+    struct dnswire_balancer_endpoint *e = 0, *primary = 0;
+
+    if (key && len) {
+        e = _route(handle, key, len, &primary);
+    } else {
+        size_t i;
+        for (i = 0; i < handle->num_endpoints; i++) {
+            struct dnswire_balancer_endpoint* c = &handle->endpoints[(handle->next + i) % handle->num_endpoints];
+
+            if (_usable(handle, c)) {
+                handle->next = (handle->next + i + 1) % handle->num_endpoints;
+                e = primary = c;
+                break;
+            }
+        }
+    }
+
+    if (!e) {
+        handle->unrouted++;
+        return dnswire_error;
+    }
+    if (e == primary) {
+        handle->routed++;
+    } else {
+        handle->rerouted++;
+    }
+
+    return dnswire_frame_queue_push(&e->destination.queue, frame);
+}
+
+enum dnswire_result dnswire_balancer_write_dnstap(struct dnswire_balancer* handle, const struct dnstap* dnstap)
+{
+    assert(handle);
+    assert(dnstap);
+
+    size_t len = dnstap_encode_protobuf_size(dnstap);
+    if (!len) {
+        return dnswire_error;
+    }
+
+    struct dnswire_frame* frame = dnswire_frame_new(len);
+    if (!frame) {
+        return dnswire_error;
+    }
+    dnstap_encode_protobuf(dnstap, dnswire_frame_payload(frame));
+
+    enum dnswire_result res;
+    if (dnstap_message_has_query_address(*dnstap)) {
+        res = dnswire_balancer_write_frame(handle, frame, dnstap_message_query_address(*dnstap), dnstap_message_query_address_length(*dnstap));
+    } else if (dnstap_has_identity(*dnstap)) {
+        res = dnswire_balancer_write_frame(handle, frame, dnstap_identity(*dnstap), dnstap_identity_length(*dnstap));
+    } else {
+        res = dnswire_balancer_write_frame(handle, frame, 0, 0);
+    }
+    dnswire_frame_unref(frame);
+
+    return res;
+}
+
+enum dnswire_result dnswire_balancer_write(struct dnswire_balancer* handle, size_t endpoint)
+{
+    assert(handle);
+    assert(endpoint < handle->num_endpoints);
+
+    struct dnswire_balancer_endpoint* e   = &handle->endpoints[endpoint];
+    enum dnswire_result               res = dnswire_relay_destination_write(&e->destination);
+
+    _update(handle, e, _now());
+
+    return res;
+}
+
+void dnswire_balancer_check(struct dnswire_balancer* handle)
+{
+    assert(handle);
+
+    uint64_t now = _now();
+    size_t   i;
+
+    for (i = 0; i < handle->num_endpoints; i++) {
+        _update(handle, &handle->endpoints[i], now);
+    }
+}
+
+enum dnswire_result dnswire_balancer_stop(struct dnswire_balancer* handle)
+{
+    assert(handle);
+
+    size_t i;
+    for (i = 0; i < handle->num_endpoints; i++) {
+        handle->endpoints[i].destination.stop = true;
+    }
+
+    return dnswire_ok;
+}
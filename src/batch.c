@@ -0,0 +1,292 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/batch.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <string.h>
+
+enum dnswire_result dnswire_batch_init(struct dnswire_batch* handle, size_t capacity)
+{
+    assert(handle);
+
+    size_t i;
+
+    memset(handle, 0, sizeof(struct dnswire_batch));
+
+    if (!capacity) {
+        return dnswire_error;
+    }
+    handle->capacity = capacity;
+
+    for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+        if (dnswire_column_data_reset(&handle->columns[i], i, capacity) != dnswire_ok) {
+            dnswire_batch_destroy(handle);
+            return dnswire_error;
+        }
+    }
+
+    return dnswire_ok;
+}
+
+void dnswire_batch_destroy(struct dnswire_batch* handle)
+{
+    assert(handle);
+
+    size_t i;
+
+    for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+        dnswire_column_data_destroy(&handle->columns[i]);
+    }
+    handle->rows = 0;
+}
+
+enum dnswire_result dnswire_batch_clear(struct dnswire_batch* handle)
+{
+    assert(handle);
+
+    size_t i;
+
+    for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+        if (dnswire_column_data_reset(&handle->columns[i], i, handle->capacity) != dnswire_ok) {
+            return dnswire_error;
+        }
+    }
+    handle->rows = 0;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_batch_add(struct dnswire_batch* handle, const struct dnstap* d)
+{
+    assert(handle);
+    assert(d);
+
+    if (handle->rows >= handle->capacity) {
+        return dnswire_error;
+    }
+    if (dnswire_column_data_add(handle->columns, d) != dnswire_ok) {
+        return dnswire_error;
+    }
+    handle->rows++;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_batch_read(struct dnswire_batch* handle, struct dnswire_reader* reader, int fd)
+{
+    assert(handle);
+    assert(reader);
+
+    while (handle->rows < handle->capacity) {
+        enum dnswire_result res = dnswire_reader_read(reader, fd);
+
+        switch (res) {
+        case dnswire_have_dnstap:
+            if (dnswire_batch_add(handle, dnswire_reader_dnstap(*reader)) != dnswire_ok) {
+                return dnswire_error;
+            }
+            break;
+        case dnswire_need_more:
+            // the reader has buffer space and wants to read more
+            break;
+        default:
+            __trace("reader returned %s with %zu rows", dnswire_result_string[res], handle->rows);
+            return res;
+        }
+    }
+
+    return dnswire_ok;
+}
+
+/*
+ * Arrow export, the release callbacks free whatever the array or schema
+ * owns including children that have not been moved by the consumer.
+ */
+
+static void _release_array(struct ArrowArray* array)
+{
+    int64_t i;
+
+    for (i = 0; array->children && i < array->n_children; i++) {
+        if (array->children[i] && array->children[i]->release) {
+            array->children[i]->release(array->children[i]);
+        }
+        free(array->children[i]);
+    }
+    free(array->children);
+    for (i = 0; array->buffers && i < array->n_buffers; i++) {
+        free((void*)array->buffers[i]);
+    }
+    free(array->buffers);
+    array->release = 0;
+}
+
+static void _release_schema(struct ArrowSchema* schema)
+{
+    int64_t i;
+
+    for (i = 0; i < schema->n_children; i++) {
+        if (schema->children[i]->release) {
+            schema->children[i]->release(schema->children[i]);
+        }
+        free(schema->children[i]);
+    }
+    free(schema->children);
+    schema->release = 0;
+}
+
+static void _schema(struct ArrowSchema* schema, const char* format, const char* name)
+{
+    memset(schema, 0, sizeof(struct ArrowSchema));
+    schema->format  = format;
+    schema->name    = name;
+    schema->flags   = ARROW_FLAG_NULLABLE;
+    schema->release = _release_schema;
+}
+
+/*
+ * Move the buffers of the column to the array, `buffers` must have room
+ * for 3 pointers.
+ */
+static void _export(struct dnswire_column_data* c, enum dnswire_column column, const void** buffers, struct ArrowArray* array)
+{
+    bool   bytes = dnswire_column_is_bytes(column);
+    size_t i, nulls = 0;
+
+    for (i = 0; i < c->rows; i++) {
+        nulls += !dnswire_column_data_is_present(*c, i);
+    }
+
+    memset(array, 0, sizeof(struct ArrowArray));
+    array->length     = c->rows;
+    array->null_count = nulls;
+    array->buffers    = buffers;
+    array->release    = _release_array;
+
+    buffers[0] = c->present;
+    if (bytes) {
+        array->n_buffers = 3;
+        buffers[1]       = c->offsets;
+        buffers[2]       = c->data;
+        free(c->values);
+    } else {
+        array->n_buffers = 2;
+        buffers[1]       = c->values;
+        free(c->offsets);
+        free(c->data);
+    }
+    memset(c, 0, sizeof(struct dnswire_column_data));
+}
+
+enum dnswire_result dnswire_column_data_export(struct dnswire_column_data* handle, enum dnswire_column column, struct ArrowArray* array, struct ArrowSchema* schema)
+{
+    assert(handle);
+    assert(column < DNSWIRE_COLUMNS);
+    assert(array);
+
+    const void** buffers;
+
+    // binary arrays always have an offset for the first row
+    if (dnswire_column_is_bytes(column) && !handle->offsets && !(handle->offsets = calloc(1, sizeof(uint32_t)))) {
+        return dnswire_error;
+    }
+    if (!(buffers = calloc(3, sizeof(void*)))) {
+        return dnswire_error;
+    }
+
+    _export(handle, column, buffers, array);
+    if (schema) {
+        _schema(schema, dnswire_column_is_bytes(column) ? "z" : "L", dnswire_column_string[column]);
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_batch_export(struct dnswire_batch* handle, struct ArrowArray* array, struct ArrowSchema* schema)
+{
+    assert(handle);
+    assert(array);
+
+    struct ArrowArray* a;
+    size_t             i;
+
+    /*
+     * Allocate everything first so that nothing is moved out of the
+     * batch unless the export succeeds.
+     */
+    memset(array, 0, sizeof(struct ArrowArray));
+    array->length     = handle->rows;
+    array->n_buffers  = 1;
+    array->n_children = DNSWIRE_COLUMNS;
+    array->release    = _release_array;
+    if (!(array->buffers = calloc(1, sizeof(void*)))
+        || !(array->children = calloc(DNSWIRE_COLUMNS, sizeof(struct ArrowArray*)))) {
+        array->n_children = 0;
+        _release_array(array);
+        return dnswire_error;
+    }
+    for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+        struct dnswire_column_data* c = &handle->columns[i];
+
+        if (!(array->children[i] = a = calloc(1, sizeof(struct ArrowArray)))) {
+            _release_array(array);
+            return dnswire_error;
+        }
+        a->release = _release_array;
+        if (!(a->buffers = calloc(3, sizeof(void*)))
+            || (dnswire_column_is_bytes(i) && !c->offsets && !(c->offsets = calloc(1, sizeof(uint32_t))))) {
+            _release_array(array);
+            return dnswire_error;
+        }
+    }
+
+    if (schema) {
+        _schema(schema, "+s", "");
+        schema->flags = 0;
+        if (!(schema->children = calloc(DNSWIRE_COLUMNS, sizeof(struct ArrowSchema*)))) {
+            _release_array(array);
+            return dnswire_error;
+        }
+        schema->n_children = DNSWIRE_COLUMNS;
+        for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+            if (!(schema->children[i] = malloc(sizeof(struct ArrowSchema)))) {
+                schema->n_children = i;
+                _release_schema(schema);
+                _release_array(array);
+                return dnswire_error;
+            }
+            _schema(schema->children[i], dnswire_column_is_bytes(i) ? "z" : "L", dnswire_column_string[i]);
+        }
+    }
+
+    for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+        a = array->children[i];
+        _export(&handle->columns[i], i, a->buffers, a);
+    }
+    __trace("exported %zu rows", handle->rows);
+    handle->rows = 0;
+
+    return dnswire_ok;
+}
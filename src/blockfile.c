@@ -0,0 +1,600 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/blockfile.h"
+#include "dnswire/trace.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HEADER_SIZE 16
+#define INDEX_BLOCK_SIZE 36
+#define TRAILER_SIZE 24
+
+static int _write(int fd, const uint8_t* data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int _pread(int fd, uint8_t* data, size_t len, uint64_t offset)
+{
+    while (len) {
+        ssize_t n = pread(fd, data, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (!n) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+enum dnswire_result dnswire_blockfile_writer_init(struct dnswire_blockfile_writer* handle, enum dnswire_compression compression)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_blockfile_writer));
+
+    if (!dnswire_compression_is_available(compression)) {
+        return dnswire_error;
+    }
+    handle->fd          = -1;
+    handle->compression = compression;
+    handle->block_size  = DNSWIRE_BLOCKFILE_DEFAULT_BLOCK_SIZE;
+
+    return dnswire_ok;
+}
+
+void dnswire_blockfile_writer_destroy(struct dnswire_blockfile_writer* handle)
+{
+    assert(handle);
+
+    if (handle->opened) {
+        dnswire_blockfile_writer_close(handle);
+    }
+    free(handle->buf);
+    handle->buf = 0;
+    free(handle->out);
+    handle->out = 0;
+    free(handle->blocks);
+    handle->blocks = 0;
+}
+
+enum dnswire_result dnswire_blockfile_writer_open(struct dnswire_blockfile_writer* handle, int fd)
+{
+    assert(handle);
+    assert(!handle->opened);
+
+    uint8_t header[HEADER_SIZE];
+
+    if (!handle->block_size || handle->block_size > UINT32_MAX - DNSWIRE_MAXIMUM_BUF_SIZE) {
+        return dnswire_error;
+    }
+
+    // a block is flushed once past the block size, so make room for a
+    // frame of the maximum size after it
+    size_t size = handle->block_size + DNSWIRE_MAXIMUM_BUF_SIZE;
+    if (handle->size < size) {
+        uint8_t* buf = realloc(handle->buf, size);
+        if (!buf) {
+            return dnswire_error;
+        }
+        handle->buf  = buf;
+        handle->size = size;
+    }
+    size = dnswire_compression_bound(handle->compression, handle->size);
+    if (handle->out_size < size) {
+        uint8_t* out = realloc(handle->out, size);
+        if (!out) {
+            return dnswire_error;
+        }
+        handle->out      = out;
+        handle->out_size = size;
+    }
+
+    memcpy(header, DNSWIRE_BLOCKFILE_MAGIC, 8);
+    _put32(&header[8], handle->compression);
+    _put32(&header[12], handle->block_size);
+    if (_write(fd, header, sizeof(header))) {
+        return dnswire_error;
+    }
+
+    handle->fd         = fd;
+    handle->at         = 0;
+    handle->offset     = sizeof(header);
+    handle->num_blocks = 0;
+    handle->opened     = true;
+
+    return dnswire_ok;
+}
+
+static enum dnswire_result _encode(struct dnswire_blockfile_writer* handle, enum dnswire_result expect)
+{
+    enum dnswire_result res = dnswire_encoder_encode(&handle->encoder, &handle->buf[handle->at], handle->size - handle->at);
+    __trace("encode %s", dnswire_result_string[res]);
+
+    if (res != expect) {
+        return dnswire_error;
+    }
+    handle->at += dnswire_encoder_encoded(handle->encoder);
+
+    return dnswire_ok;
+}
+
+static struct dnswire_blockfile_block* _block(struct dnswire_blockfile_writer* handle)
+{
+    return &handle->blocks[handle->num_blocks];
+}
+
+/*
+ * End the block with STOP, compress and write it and add it to the index.
+ */
+static enum dnswire_result _flush(struct dnswire_blockfile_writer* handle)
+{
+    struct dnswire_blockfile_block* block = _block(handle);
+    size_t                          len   = handle->out_size;
+
+    if (dnswire_encoder_stop(&handle->encoder) != dnswire_ok
+        || _encode(handle, dnswire_endofdata) != dnswire_ok
+        || dnswire_compression_compress(handle->compression, handle->level, handle->buf, handle->at, handle->out, &len) != dnswire_ok
+        || _write(handle->fd, handle->out, len)) {
+        return dnswire_error;
+    }
+
+    block->offset = handle->offset;
+    block->length = len;
+    block->size   = handle->at;
+    handle->num_blocks++;
+    handle->offset += len;
+    handle->at = 0;
+    __trace("block %zu size %u length %u", handle->num_blocks - 1, block->size, block->length);
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_blockfile_writer_write(struct dnswire_blockfile_writer* handle, const struct dnstap* dnstap)
+{
+    assert(handle);
+    assert(dnstap);
+    assert(handle->opened);
+
+    struct dnswire_blockfile_block* block;
+
+    if (!handle->at) {
+        // start a new block
+        if (handle->num_blocks == handle->blocks_size) {
+            size_t                          size   = handle->blocks_size ? handle->blocks_size * 2 : 64;
+            struct dnswire_blockfile_block* blocks = realloc(handle->blocks, size * sizeof(struct dnswire_blockfile_block));
+            if (!blocks) {
+                return dnswire_error;
+            }
+            handle->blocks      = blocks;
+            handle->blocks_size = size;
+        }
+        block         = _block(handle);
+        block->frames = 0;
+        block->min    = UINT64_MAX;
+        block->max    = 0;
+
+        handle->encoder = (struct dnswire_encoder)DNSWIRE_ENCODER_INITIALIZER;
+        if (_encode(handle, dnswire_again) != dnswire_ok) {
+            return dnswire_error;
+        }
+    }
+    block = _block(handle);
+
+    dnswire_encoder_set_dnstap(handle->encoder, dnstap);
+    if (_encode(handle, dnswire_ok) != dnswire_ok) {
+        return dnswire_error;
+    }
+    block->frames++;
+    if (dnstap_message_has_query_time_sec(*dnstap)) {
+        uint64_t t = dnstap_message_query_time_sec(*dnstap);
+        if (t < block->min) {
+            block->min = t;
+        }
+        if (t > block->max) {
+            block->max = t;
+        }
+    }
+    if (dnstap_message_has_response_time_sec(*dnstap)) {
+        uint64_t t = dnstap_message_response_time_sec(*dnstap);
+        if (t < block->min) {
+            block->min = t;
+        }
+        if (t > block->max) {
+            block->max = t;
+        }
+    }
+
+    if (handle->at >= handle->block_size) {
+        return _flush(handle);
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_blockfile_writer_close(struct dnswire_blockfile_writer* handle)
+{
+    assert(handle);
+    assert(handle->opened);
+
+    uint8_t  entry[INDEX_BLOCK_SIZE], trailer[TRAILER_SIZE];
+    uint64_t index = 0;
+    size_t   i;
+
+    handle->opened = false;
+
+    if (handle->at && _flush(handle) != dnswire_ok) {
+        return dnswire_error;
+    }
+
+    index = handle->offset;
+    for (i = 0; i < handle->num_blocks; i++) {
+        const struct dnswire_blockfile_block* block = &handle->blocks[i];
+
+        _put64(&entry[0], block->offset);
+        _put32(&entry[8], block->length);
+        _put32(&entry[12], block->size);
+        _put32(&entry[16], block->frames);
+        _put64(&entry[20], block->min);
+        _put64(&entry[28], block->max);
+        if (_write(handle->fd, entry, sizeof(entry))) {
+            return dnswire_error;
+        }
+    }
+
+    _put64(&trailer[0], index);
+    _put64(&trailer[8], handle->num_blocks);
+    memcpy(&trailer[16], DNSWIRE_BLOCKFILE_MAGIC, 8);
+    if (_write(handle->fd, trailer, sizeof(trailer))) {
+        return dnswire_error;
+    }
+    handle->fd = -1;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_blockfile_reader_init(struct dnswire_blockfile_reader* handle)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_blockfile_reader));
+    handle->fd      = -1;
+    handle->decoder = (struct dnswire_decoder)DNSWIRE_DECODER_INITIALIZER;
+
+    return dnswire_ok;
+}
+
+void dnswire_blockfile_reader_destroy(struct dnswire_blockfile_reader* handle)
+{
+    assert(handle);
+
+    dnswire_decoder_cleanup(handle->decoder);
+    free(handle->blocks);
+    handle->blocks     = 0;
+    handle->num_blocks = 0;
+    free(handle->in);
+    handle->in = 0;
+    free(handle->buf);
+    handle->buf = 0;
+}
+
+enum dnswire_result dnswire_blockfile_reader_open(struct dnswire_blockfile_reader* handle, int fd)
+{
+    assert(handle);
+
+    uint8_t     header[HEADER_SIZE], trailer[TRAILER_SIZE];
+    uint8_t*    index;
+    uint64_t    offset, num, end;
+    struct stat st;
+    size_t      i;
+
+    if (fstat(fd, &st) || st.st_size < HEADER_SIZE + TRAILER_SIZE) {
+        return dnswire_error;
+    }
+    end = (uint64_t)st.st_size - TRAILER_SIZE;
+
+    if (_pread(fd, header, sizeof(header), 0)
+        || memcmp(header, DNSWIRE_BLOCKFILE_MAGIC, 8)
+        || _pread(fd, trailer, sizeof(trailer), end)
+        || memcmp(&trailer[16], DNSWIRE_BLOCKFILE_MAGIC, 8)) {
+        return dnswire_error;
+    }
+    handle->compression = _get32(&header[8]);
+    if (!dnswire_compression_is_available(handle->compression)) {
+        __trace("compression %u not available", _get32(&header[8]));
+        return dnswire_error;
+    }
+
+    offset = _get64(&trailer[0]);
+    num    = _get64(&trailer[8]);
+    if (offset < HEADER_SIZE || offset > end || num != (end - offset) / INDEX_BLOCK_SIZE || (end - offset) % INDEX_BLOCK_SIZE) {
+        return dnswire_error;
+    }
+
+    free(handle->blocks);
+    handle->blocks     = 0;
+    handle->num_blocks = 0;
+    if (num) {
+        if (!(index = malloc(num * INDEX_BLOCK_SIZE))) {
+            return dnswire_error;
+        }
+        if (!(handle->blocks = calloc(num, sizeof(struct dnswire_blockfile_block)))
+            || _pread(fd, index, num * INDEX_BLOCK_SIZE, offset)) {
+            free(index);
+            return dnswire_error;
+        }
+        for (i = 0; i < num; i++) {
+            struct dnswire_blockfile_block* block = &handle->blocks[i];
+            const uint8_t*                  entry = &index[i * INDEX_BLOCK_SIZE];
+
+            block->offset = _get64(&entry[0]);
+            block->length = _get32(&entry[8]);
+            block->size   = _get32(&entry[12]);
+            block->frames = _get32(&entry[16]);
+            block->min    = _get64(&entry[20]);
+            block->max    = _get64(&entry[28]);
+            block->seek   = i && block[-1].seek > block->max ? block[-1].seek : block->max;
+            if (block->offset < HEADER_SIZE || block->offset > offset || block->length > offset - block->offset) {
+                free(index);
+                return dnswire_error;
+            }
+        }
+        free(index);
+    }
+    handle->num_blocks = num;
+    handle->fd         = fd;
+
+    return dnswire_blockfile_reader_seek(handle, 0);
+}
+
+enum dnswire_result dnswire_blockfile_reader_seek(struct dnswire_blockfile_reader* handle, size_t block)
+{
+    assert(handle);
+
+    if (block > handle->num_blocks) {
+        return dnswire_error;
+    }
+    handle->start   = block;
+    handle->current = block;
+    handle->at      = 0;
+    handle->left    = 0;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_blockfile_reader_seek_time(struct dnswire_blockfile_reader* handle, uint64_t t)
+{
+    assert(handle);
+
+    size_t lo = 0, hi = handle->num_blocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (handle->blocks[mid].seek < t) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    dnswire_blockfile_reader_seek(handle, lo);
+
+    return lo == handle->num_blocks ? dnswire_endofdata : dnswire_ok;
+}
+
+/*
+ * Read and decompress a block into the given buffers, growing them if
+ * needed.
+ */
+static enum dnswire_result _load(const struct dnswire_blockfile_reader* handle, size_t idx, uint8_t** in, size_t* in_size, uint8_t** buf, size_t* size)
+{
+    const struct dnswire_blockfile_block* block = &handle->blocks[idx];
+    size_t                                len   = block->size;
+
+    if (*in_size < block->length) {
+        uint8_t* b = realloc(*in, block->length);
+        if (!b) {
+            return dnswire_error;
+        }
+        *in      = b;
+        *in_size = block->length;
+    }
+    if (*size < block->size) {
+        uint8_t* b = realloc(*buf, block->size);
+        if (!b) {
+            return dnswire_error;
+        }
+        *buf  = b;
+        *size = block->size;
+    }
+
+    if (_pread(handle->fd, *in, block->length, block->offset)
+        || dnswire_compression_decompress(handle->compression, *in, block->length, *buf, &len) != dnswire_ok) {
+        return dnswire_error;
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_blockfile_reader_next(struct dnswire_blockfile_reader* handle)
+{
+    assert(handle);
+
+    while (1) {
+        while (handle->left) {
+            switch (dnswire_decoder_decode(&handle->decoder, &handle->buf[handle->at], handle->left)) {
+            case dnswire_again:
+                handle->at += dnswire_decoder_decoded(handle->decoder);
+                handle->left -= dnswire_decoder_decoded(handle->decoder);
+                continue;
+
+            case dnswire_have_dnstap:
+                handle->at += dnswire_decoder_decoded(handle->decoder);
+                handle->left -= dnswire_decoder_decoded(handle->decoder);
+                return dnswire_have_dnstap;
+
+            case dnswire_endofdata:
+                handle->left = 0;
+                break;
+
+            default:
+                return dnswire_error;
+            }
+        }
+
+        if (handle->current >= handle->num_blocks) {
+            return dnswire_endofdata;
+        }
+        if (_load(handle, handle->current, &handle->in, &handle->in_size, &handle->buf, &handle->size) != dnswire_ok) {
+            return dnswire_error;
+        }
+        dnswire_decoder_cleanup(handle->decoder);
+        handle->decoder = (struct dnswire_decoder)DNSWIRE_DECODER_INITIALIZER;
+        handle->at      = 0;
+        handle->left    = handle->blocks[handle->current].size;
+        handle->current++;
+    }
+}
+
+struct _run {
+    struct dnswire_blockfile_reader* handle;
+    pthread_mutex_t                  lock;
+    size_t                           next;
+    enum dnswire_result              result;
+};
+
+static enum dnswire_result _process(struct dnswire_blockfile_reader* handle, size_t idx, const uint8_t* buf, size_t len)
+{
+    struct dnswire_decoder decoder = DNSWIRE_DECODER_INITIALIZER;
+    enum dnswire_result    res     = dnswire_error;
+
+    while (len) {
+        res = dnswire_decoder_decode(&decoder, buf, len);
+        if (res != dnswire_again && res != dnswire_have_dnstap) {
+            break;
+        }
+        if (res == dnswire_have_dnstap && handle->callback) {
+            handle->callback(idx, dnswire_decoder_dnstap(decoder), handle->ctx);
+        }
+        buf += dnswire_decoder_decoded(decoder);
+        len -= dnswire_decoder_decoded(decoder);
+    }
+    dnswire_decoder_cleanup(decoder);
+
+    // a block must end with STOP
+    return res == dnswire_endofdata ? dnswire_ok : dnswire_error;
+}
+
+static void* _worker(void* arg)
+{
+    struct _run* run = arg;
+    uint8_t *    in = 0, *buf = 0;
+    size_t       in_size = 0, size = 0;
+
+    while (1) {
+        pthread_mutex_lock(&run->lock);
+        size_t idx = run->next++;
+        bool   ok  = run->result == dnswire_ok;
+        pthread_mutex_unlock(&run->lock);
+
+        if (!ok || idx >= run->handle->num_blocks) {
+            break;
+        }
+        if (_load(run->handle, idx, &in, &in_size, &buf, &size) != dnswire_ok
+            || _process(run->handle, idx, buf, run->handle->blocks[idx].size) != dnswire_ok) {
+            pthread_mutex_lock(&run->lock);
+            run->result = dnswire_error;
+            pthread_mutex_unlock(&run->lock);
+            break;
+        }
+    }
+    free(in);
+    free(buf);
+
+    return 0;
+}
+
+enum dnswire_result dnswire_blockfile_reader_run(struct dnswire_blockfile_reader* handle, size_t threads)
+{
+    assert(handle);
+    assert(threads);
+
+    struct _run run = {
+        .handle = handle,
+        .next   = handle->start,
+        .result = dnswire_ok,
+    };
+    pthread_t* tids;
+    size_t     i, started;
+
+    if (threads > handle->num_blocks - handle->start) {
+        threads = handle->num_blocks - handle->start;
+    }
+    if (!threads) {
+        return dnswire_ok;
+    }
+    if (!(tids = calloc(threads, sizeof(pthread_t)))) {
+        return dnswire_error;
+    }
+    pthread_mutex_init(&run.lock, 0);
+
+    for (started = 0; started < threads; started++) {
+        if (pthread_create(&tids[started], 0, _worker, &run)) {
+            pthread_mutex_lock(&run.lock);
+            run.result = dnswire_error;
+            pthread_mutex_unlock(&run.lock);
+            break;
+        }
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(tids[i], 0);
+    }
+    pthread_mutex_destroy(&run.lock);
+    free(tids);
+
+    return run.result;
+}
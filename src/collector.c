@@ -0,0 +1,451 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/collector.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#define __stat_inc(s, f) __atomic_add_fetch(&(s).f, 1, __ATOMIC_RELAXED)
+#define __stat_dec(s, f) __atomic_sub_fetch(&(s).f, 1, __ATOMIC_RELAXED)
+
+static int _nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+enum dnswire_result dnswire_collector_init(struct dnswire_collector* handle, const struct sockaddr* addr, socklen_t addrlen, size_t shards)
+{
+    assert(handle);
+    assert(addr);
+    assert(shards);
+
+    memset(handle, 0, sizeof(struct dnswire_collector));
+
+    if (addrlen > sizeof(handle->addr)) {
+        return dnswire_error;
+    }
+    memcpy(&handle->addr, addr, addrlen);
+    handle->addrlen = addrlen;
+    handle->backlog = DNSWIRE_COLLECTOR_DEFAULT_BACKLOG;
+
+    if (!(handle->shards = calloc(shards, sizeof(struct dnswire_collector_shard)))) {
+        return dnswire_error;
+    }
+    handle->num_shards = shards;
+
+    size_t i;
+    for (i = 0; i < shards; i++) {
+        handle->shards[i].collector = handle;
+        handle->shards[i].id        = i;
+        handle->shards[i].listen_fd = -1;
+        handle->shards[i].wake[0]   = -1;
+        handle->shards[i].wake[1]   = -1;
+    }
+
+    return dnswire_ok;
+}
+
+static void _close_connection(struct dnswire_collector_shard* shard, struct dnswire_collector_connection* conn)
+{
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        shard->connections = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    shard->num_connections--;
+    __stat_dec(shard->stats, active);
+
+    close(conn->fd);
+    dnswire_reader_destroy(conn->reader);
+    if (conn->source) {
+        if (shard->collector->pool) {
+            dnswire_pool_flush(shard->collector->pool, &conn->batch);
+        }
+        dnswire_pool_source_unref(conn->source);
+    }
+    free(conn);
+}
+
+void dnswire_collector_destroy(struct dnswire_collector* handle)
+{
+    assert(handle);
+
+    size_t i;
+    for (i = 0; i < handle->num_shards; i++) {
+        struct dnswire_collector_shard* shard = &handle->shards[i];
+
+        assert(!shard->started);
+        while (shard->connections) {
+            _close_connection(shard, shard->connections);
+        }
+        if (shard->listen_fd > -1 && (handle->reuseport || !i)) {
+            close(shard->listen_fd);
+        }
+        if (shard->wake[0] > -1) {
+            close(shard->wake[0]);
+            close(shard->wake[1]);
+        }
+    }
+    free(handle->shards);
+    handle->shards     = 0;
+    handle->num_shards = 0;
+}
+
+static int _listen(struct dnswire_collector* handle, bool reuseport)
+{
+    int fd = socket(handle->addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int on = 1;
+    if (handle->addr.ss_family != AF_UNIX) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    }
+#ifdef SO_REUSEPORT
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+        close(fd);
+        return -1;
+    }
+#endif
+    if (bind(fd, (struct sockaddr*)&handle->addr, handle->addrlen)
+        || listen(fd, handle->backlog)
+        || _nonblock(fd)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+enum dnswire_result dnswire_collector_listen(struct dnswire_collector* handle)
+{
+    assert(handle);
+    assert(handle->shards);
+
+#ifdef SO_REUSEPORT
+    handle->reuseport = handle->addr.ss_family != AF_UNIX;
+#else
+    handle->reuseport = false;
+#endif
+
+    size_t i;
+    for (i = 0; i < handle->num_shards; i++) {
+        struct dnswire_collector_shard* shard = &handle->shards[i];
+
+        if (pipe(shard->wake) || _nonblock(shard->wake[0]) || _nonblock(shard->wake[1])) {
+            return dnswire_error;
+        }
+
+        if (i && !handle->reuseport) {
+            shard->listen_fd = handle->shards[0].listen_fd;
+            continue;
+        }
+        if ((shard->listen_fd = _listen(handle, handle->reuseport)) < 0) {
+            return dnswire_error;
+        }
+        if (!i && handle->addr.ss_family != AF_UNIX) {
+            // so that the other shards binds to the same port if it was 0
+            handle->addrlen = sizeof(handle->addr);
+            if (getsockname(shard->listen_fd, (struct sockaddr*)&handle->addr, &handle->addrlen)) {
+                return dnswire_error;
+            }
+        }
+    }
+
+    return dnswire_ok;
+}
+
+static void _accept(struct dnswire_collector* handle, struct dnswire_collector_shard* shard)
+{
+    while (1) {
+        int fd = accept(shard->listen_fd, 0, 0);
+        if (fd < 0) {
+            // EAGAIN, or another shard got it if the socket is shared
+            return;
+        }
+
+        struct dnswire_collector_connection* conn = calloc(1, sizeof(struct dnswire_collector_connection));
+        if (!conn || _nonblock(fd) || dnswire_reader_init(&conn->reader) != dnswire_ok) {
+            __stat_inc(shard->stats, errors);
+            free(conn);
+            close(fd);
+            continue;
+        }
+        if (dnswire_reader_allow_bidirectional(&conn->reader, handle->allow_bidirectional) != dnswire_ok
+            || (handle->pool && !(conn->source = dnswire_pool_source_new(shard)))) {
+            __stat_inc(shard->stats, errors);
+            dnswire_reader_destroy(conn->reader);
+            free(conn);
+            close(fd);
+            continue;
+        }
+        if (handle->pool) {
+            dnswire_reader_set_raw(conn->reader, true);
+        }
+        conn->fd = fd;
+
+        conn->next = shard->connections;
+        if (conn->next) {
+            conn->next->prev = conn;
+        }
+        shard->connections = conn;
+        shard->num_connections++;
+        __stat_inc(shard->stats, accepted);
+        __stat_inc(shard->stats, active);
+    }
+}
+
+/*
+ * Read and decode all that is available on the connection, returns false
+ * if the connection was closed.
+ */
+static bool _process(struct dnswire_collector* handle, size_t idx, struct dnswire_collector_connection* conn)
+{
+    struct dnswire_collector_shard* shard = &handle->shards[idx];
+
+    while (1) {
+        switch (dnswire_reader_read(&conn->reader, conn->fd)) {
+        case dnswire_have_dnstap:
+            __stat_inc(shard->stats, dnstaps);
+            if (handle->callback) {
+                handle->callback(idx, dnswire_reader_dnstap(conn->reader), handle->ctx);
+            }
+            continue;
+
+        case dnswire_have_frame:
+            __stat_inc(shard->stats, dnstaps);
+            if (dnswire_pool_add(handle->pool, &conn->batch, conn->source, dnswire_reader_frame(conn->reader), dnswire_reader_frame_length(conn->reader)) != dnswire_ok) {
+                __stat_inc(shard->stats, errors);
+                _close_connection(shard, conn);
+                return false;
+            }
+            continue;
+
+        case dnswire_again:
+        case dnswire_need_more:
+            switch (conn->reader.state) {
+            case dnswire_reader_decoding_control:
+            case dnswire_reader_decoding:
+            case dnswire_reader_encoding_accept:
+            case dnswire_reader_encoding_finish:
+                // buffered data or something to encode, no need to wait
+                continue;
+
+            default:
+                // don't hold on to a partial batch while waiting
+                if (conn->batch && dnswire_pool_flush(handle->pool, &conn->batch) != dnswire_ok) {
+                    __stat_inc(shard->stats, errors);
+                    _close_connection(shard, conn);
+                    return false;
+                }
+                return true;
+            }
+
+        case dnswire_endofdata:
+            __stat_inc(shard->stats, closed);
+            _close_connection(shard, conn);
+            return false;
+
+        default:
+            __stat_inc(shard->stats, errors);
+            _close_connection(shard, conn);
+            return false;
+        }
+    }
+}
+
+enum dnswire_result dnswire_collector_run(struct dnswire_collector* handle, size_t idx)
+{
+    assert(handle);
+    assert(idx < handle->num_shards);
+
+    struct dnswire_collector_shard*       shard = &handle->shards[idx];
+    struct pollfd*                        pfd   = 0;
+    struct dnswire_collector_connection** conns = 0;
+    size_t                                size  = 0;
+    enum dnswire_result                   res   = dnswire_ok;
+
+    if (shard->listen_fd < 0) {
+        return dnswire_error;
+    }
+
+    while (!__atomic_load_n(&handle->stop, __ATOMIC_ACQUIRE)) {
+        if (size < shard->num_connections + 2) {
+            size_t                                n  = shard->num_connections + 16;
+            struct pollfd*                        p  = realloc(pfd, sizeof(struct pollfd) * n);
+            struct dnswire_collector_connection** cs = p ? realloc(conns, sizeof(struct dnswire_collector_connection*) * n) : 0;
+            if (p) {
+                pfd = p;
+            }
+            if (!cs) {
+                res = dnswire_error;
+                break;
+            }
+            conns = cs;
+            size  = n;
+        }
+
+        pfd[0].fd     = shard->wake[0];
+        pfd[0].events = POLLIN;
+        pfd[1].fd     = shard->listen_fd;
+        pfd[1].events = POLLIN;
+
+        struct dnswire_collector_connection* conn;
+        size_t                               n = 2;
+        for (conn = shard->connections; conn; conn = conn->next, n++) {
+            pfd[n].fd = conn->fd;
+            switch (conn->reader.state) {
+            case dnswire_reader_writing_accept:
+            case dnswire_reader_writing_finish:
+                pfd[n].events = POLLOUT;
+                break;
+            default:
+                pfd[n].events = POLLIN;
+            }
+            conns[n] = conn;
+        }
+
+        if (poll(pfd, n, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            res = dnswire_error;
+            break;
+        }
+
+        if (pfd[0].revents) {
+            char buf[16];
+            while (read(shard->wake[0], buf, sizeof(buf)) > 0)
+                ;
+            continue;
+        }
+
+        size_t i;
+        for (i = 2; i < n; i++) {
+            if (pfd[i].revents) {
+                _process(handle, idx, conns[i]);
+            }
+        }
+        if (pfd[1].revents) {
+            _accept(handle, shard);
+        }
+    }
+
+    free(pfd);
+    free(conns);
+
+    return res;
+}
+
+static void* _thread(void* arg)
+{
+    struct dnswire_collector_shard* shard = arg;
+
+    if (dnswire_collector_run(shard->collector, shard->id) != dnswire_ok) {
+        __trace("shard %zu failed", shard->id);
+    }
+
+    return 0;
+}
+
+enum dnswire_result dnswire_collector_start(struct dnswire_collector* handle)
+{
+    assert(handle);
+
+    size_t i;
+    for (i = 0; i < handle->num_shards; i++) {
+        struct dnswire_collector_shard* shard = &handle->shards[i];
+
+        if (shard->listen_fd < 0 || pthread_create(&shard->thread, 0, _thread, shard)) {
+            dnswire_collector_stop(handle);
+            dnswire_collector_join(handle);
+            return dnswire_error;
+        }
+        shard->started = true;
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_collector_stop(struct dnswire_collector* handle)
+{
+    assert(handle);
+
+    __atomic_store_n(&handle->stop, true, __ATOMIC_RELEASE);
+
+    size_t i;
+    for (i = 0; i < handle->num_shards; i++) {
+        if (handle->shards[i].wake[1] > -1 && write(handle->shards[i].wake[1], "", 1) < 0 && errno != EAGAIN) {
+            return dnswire_error;
+        }
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_collector_join(struct dnswire_collector* handle)
+{
+    assert(handle);
+
+    enum dnswire_result res = dnswire_ok;
+
+    size_t i;
+    for (i = 0; i < handle->num_shards; i++) {
+        struct dnswire_collector_shard* shard = &handle->shards[i];
+
+        if (shard->started) {
+            if (pthread_join(shard->thread, 0)) {
+                res = dnswire_error;
+            }
+            shard->started = false;
+        }
+    }
+
+    return res;
+}
+
+void dnswire_collector_stats(const struct dnswire_collector* handle, size_t idx, struct dnswire_collector_stats* stats)
+{
+    assert(handle);
+    assert(idx < handle->num_shards);
+    assert(stats);
+
+    const struct dnswire_collector_stats* s = &handle->shards[idx].stats;
+
+    stats->accepted = __atomic_load_n(&s->accepted, __ATOMIC_RELAXED);
+    stats->active   = __atomic_load_n(&s->active, __ATOMIC_RELAXED);
+    stats->closed   = __atomic_load_n(&s->closed, __ATOMIC_RELAXED);
+    stats->errors   = __atomic_load_n(&s->errors, __ATOMIC_RELAXED);
+    stats->dnstaps  = __atomic_load_n(&s->dnstaps, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,1107 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/columnar.h"
+#include "dnswire/trace.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char* const dnswire_column_string[] = {
+    "identity",
+    "version",
+    "extra",
+    "type",
+    "message_type",
+    "socket_family",
+    "socket_protocol",
+    "query_address",
+    "response_address",
+    "query_port",
+    "response_port",
+    "query_time_sec",
+    "query_time_nsec",
+    "query_message",
+    "query_zone",
+    "response_time_sec",
+    "response_time_nsec",
+    "response_message",
+    "policy_type",
+    "policy_rule",
+    "policy_action",
+    "policy_match",
+    "policy_value",
+    "dns_id",
+    "dns_flags",
+    "dns_qdcount",
+    "dns_ancount",
+    "dns_nscount",
+    "dns_arcount",
+};
+
+const char* const dnswire_column_encoding_string[] = {
+    "plain",
+    "delta",
+    "varint",
+    "bitpack",
+    "dict",
+};
+
+/*
+ * If a column holds bytes and how it is encoded by the writer.
+ */
+static const struct {
+    bool                         bytes;
+    enum dnswire_column_encoding encoding;
+} _columns[DNSWIRE_COLUMNS] = {
+    [dnswire_column_identity]           = { true, dnswire_column_encoding_dict },
+    [dnswire_column_version]            = { true, dnswire_column_encoding_dict },
+    [dnswire_column_extra]              = { true, dnswire_column_encoding_plain },
+    [dnswire_column_type]               = { false, dnswire_column_encoding_bitpack },
+    [dnswire_column_message_type]       = { false, dnswire_column_encoding_bitpack },
+    [dnswire_column_socket_family]      = { false, dnswire_column_encoding_bitpack },
+    [dnswire_column_socket_protocol]    = { false, dnswire_column_encoding_bitpack },
+    [dnswire_column_query_address]      = { true, dnswire_column_encoding_dict },
+    [dnswire_column_response_address]   = { true, dnswire_column_encoding_dict },
+    [dnswire_column_query_port]         = { false, dnswire_column_encoding_dict },
+    [dnswire_column_response_port]      = { false, dnswire_column_encoding_dict },
+    [dnswire_column_query_time_sec]     = { false, dnswire_column_encoding_delta },
+    [dnswire_column_query_time_nsec]    = { false, dnswire_column_encoding_varint },
+    [dnswire_column_query_message]      = { true, dnswire_column_encoding_plain },
+    [dnswire_column_query_zone]         = { true, dnswire_column_encoding_dict },
+    [dnswire_column_response_time_sec]  = { false, dnswire_column_encoding_delta },
+    [dnswire_column_response_time_nsec] = { false, dnswire_column_encoding_varint },
+    [dnswire_column_response_message]   = { true, dnswire_column_encoding_plain },
+    [dnswire_column_policy_type]        = { true, dnswire_column_encoding_dict },
+    [dnswire_column_policy_rule]        = { true, dnswire_column_encoding_plain },
+    [dnswire_column_policy_action]      = { false, dnswire_column_encoding_bitpack },
+    [dnswire_column_policy_match]       = { false, dnswire_column_encoding_bitpack },
+    [dnswire_column_policy_value]       = { true, dnswire_column_encoding_plain },
+    [dnswire_column_dns_id]             = { false, dnswire_column_encoding_varint },
+    [dnswire_column_dns_flags]          = { false, dnswire_column_encoding_dict },
+    [dnswire_column_dns_qdcount]        = { false, dnswire_column_encoding_bitpack },
+    [dnswire_column_dns_ancount]        = { false, dnswire_column_encoding_bitpack },
+    [dnswire_column_dns_nscount]        = { false, dnswire_column_encoding_bitpack },
+    [dnswire_column_dns_arcount]        = { false, dnswire_column_encoding_bitpack },
+};
+
+#define HEADER_SIZE 16
+#define CHUNK_SIZE 33
+#define TRAILER_SIZE 24
+
+bool dnswire_column_is_bytes(enum dnswire_column column)
+{
+    assert(column < DNSWIRE_COLUMNS);
+
+    return _columns[column].bytes;
+}
+
+static int _write(int fd, const uint8_t* data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int _pread(int fd, uint8_t* data, size_t len, uint64_t offset)
+{
+    while (len) {
+        ssize_t n = pread(fd, data, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (!n) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/*
+ * Grow an array to hold at least `need` elements, new space is zeroed.
+ */
+static int _grow(void* ptr, size_t* size, size_t need, size_t elem)
+{
+    void** p = ptr;
+
+    if (need <= *size) {
+        return 0;
+    }
+    size_t n = *size ? *size : 64;
+    while (n < need) {
+        n *= 2;
+    }
+    uint8_t* b = realloc(*p, n * elem);
+    if (!b) {
+        return -1;
+    }
+    memset(b + *size * elem, 0, (n - *size) * elem);
+    *p    = b;
+    *size = n;
+    return 0;
+}
+
+void dnswire_column_data_destroy(struct dnswire_column_data* handle)
+{
+    assert(handle);
+
+    free(handle->present);
+    free(handle->values);
+    free(handle->offsets);
+    free(handle->data);
+    memset(handle, 0, sizeof(struct dnswire_column_data));
+}
+
+/*
+ * Make room for `rows` rows and clear them.
+ */
+static int _reset(struct dnswire_column_data* c, bool bytes, size_t rows)
+{
+    if (_grow(&c->present, &c->present_size, (rows + 7) / 8, 1)
+        || (bytes ? _grow(&c->offsets, &c->offsets_size, rows + 1, sizeof(uint32_t)) : _grow(&c->values, &c->values_size, rows, sizeof(uint64_t)))) {
+        return -1;
+    }
+    memset(c->present, 0, c->present_size);
+    c->rows     = 0;
+    c->data_len = 0;
+    if (bytes) {
+        c->offsets[0] = 0;
+    }
+    return 0;
+}
+
+enum dnswire_result dnswire_column_data_reset(struct dnswire_column_data* handle, enum dnswire_column column, size_t rows)
+{
+    assert(handle);
+    assert(column < DNSWIRE_COLUMNS);
+
+    return _reset(handle, _columns[column].bytes, rows) ? dnswire_error : dnswire_ok;
+}
+
+static int _add_value(struct dnswire_column_data* c, bool present, uint64_t v)
+{
+    size_t i = c->rows;
+
+    if (_grow(&c->present, &c->present_size, (i + 8) / 8, 1)
+        || _grow(&c->values, &c->values_size, i + 1, sizeof(uint64_t))) {
+        return -1;
+    }
+    if (present) {
+        c->present[i >> 3] |= 1 << (i & 7);
+    }
+    c->values[i] = present ? v : 0;
+    c->rows++;
+    return 0;
+}
+
+static int _add_bytes(struct dnswire_column_data* c, bool present, const uint8_t* data, size_t len)
+{
+    size_t i = c->rows;
+
+    if (!present) {
+        len = 0;
+    }
+    // offsets are exported as Arrow binary which has signed 32 bit offsets
+    if (_grow(&c->present, &c->present_size, (i + 8) / 8, 1)
+        || _grow(&c->offsets, &c->offsets_size, i + 2, sizeof(uint32_t))
+        || c->data_len + len > INT32_MAX
+        || _grow(&c->data, &c->data_size, c->data_len + len, 1)) {
+        return -1;
+    }
+    if (present) {
+        c->present[i >> 3] |= 1 << (i & 7);
+        memcpy(&c->data[c->data_len], data, len);
+    }
+    c->data_len += len;
+    c->offsets[i + 1] = c->data_len;
+    c->rows++;
+    return 0;
+}
+
+/*
+ * Encoding into the chunk.
+ */
+
+static int _reserve(struct dnswire_columnar_writer* handle, size_t len)
+{
+    return _grow(&handle->chunk, &handle->chunk_size, handle->chunk_len + len, 1);
+}
+
+static int _put_varint(struct dnswire_columnar_writer* handle, uint64_t v)
+{
+    if (_reserve(handle, 10)) {
+        return -1;
+    }
+    while (v >= 0x80) {
+        handle->chunk[handle->chunk_len++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    handle->chunk[handle->chunk_len++] = (uint8_t)v;
+    return 0;
+}
+
+static int _put_bytes(struct dnswire_columnar_writer* handle, const uint8_t* data, size_t len)
+{
+    if (_put_varint(handle, len) || _reserve(handle, len)) {
+        return -1;
+    }
+    memcpy(&handle->chunk[handle->chunk_len], data, len);
+    handle->chunk_len += len;
+    return 0;
+}
+
+/*
+ * Pack the values LSB first with the bits needed for the largest, the
+ * width is written first as one byte.
+ */
+static int _put_packed(struct dnswire_columnar_writer* handle, const uint64_t* values, size_t n)
+{
+    uint64_t max = 0;
+    unsigned width = 0;
+    size_t   i, bit = 0;
+
+    for (i = 0; i < n; i++) {
+        max |= values[i];
+    }
+    while (width < 64 && max >> width) {
+        width++;
+    }
+
+    size_t len = (n * width + 7) / 8;
+    if (_reserve(handle, 1 + len)) {
+        return -1;
+    }
+    handle->chunk[handle->chunk_len++] = width;
+
+    uint8_t* out = &handle->chunk[handle->chunk_len];
+    memset(out, 0, len);
+    for (i = 0; i < n; i++) {
+        unsigned b = 0;
+        while (b < width) {
+            unsigned off  = bit & 7;
+            unsigned take = 8 - off < width - b ? 8 - off : width - b;
+            out[bit >> 3] |= ((values[i] >> b) & ((1u << take) - 1)) << off;
+            b += take;
+            bit += take;
+        }
+    }
+    handle->chunk_len += len;
+    return 0;
+}
+
+/*
+ * Dictionary encode the present values, returns 1 if there are too many
+ * distinct values for a dictionary to be worth it.
+ */
+static int _put_dict(struct dnswire_columnar_writer* handle, const struct dnswire_column_data* c, bool bytes, uint64_t* indexes, size_t n)
+{
+    size_t    mask = 15, i, k = 0, count = 0;
+    uint32_t *table, *entries;
+    int       ret = 0;
+
+    while (mask + 1 < n * 2) {
+        mask = mask * 2 + 1;
+    }
+    table   = calloc(mask + 1, sizeof(uint32_t));
+    entries = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (!table || !entries) {
+        free(table);
+        free(entries);
+        return -1;
+    }
+
+    for (i = 0; i < c->rows; i++) {
+        if (!dnswire_column_data_is_present(*c, i)) {
+            continue;
+        }
+        uint64_t h = bytes ? _fnv1a64(dnswire_column_data_bytes(*c, i), dnswire_column_data_length(*c, i)) : _fnv1a64((const uint8_t*)&c->values[i], sizeof(uint64_t));
+        size_t   s = h & mask;
+
+        while (table[s]) {
+            size_t e = entries[table[s] - 1];
+            if (bytes ? dnswire_column_data_length(*c, e) == dnswire_column_data_length(*c, i) && !memcmp(dnswire_column_data_bytes(*c, e), dnswire_column_data_bytes(*c, i), dnswire_column_data_length(*c, i))
+                      : c->values[e] == c->values[i]) {
+                break;
+            }
+            s = (s + 1) & mask;
+        }
+        if (!table[s]) {
+            entries[count++] = i;
+            table[s]         = count;
+        }
+        indexes[k++] = table[s] - 1;
+    }
+
+    if (count > 16 && count > n / 2) {
+        ret = 1;
+    } else if (_put_varint(handle, count)) {
+        ret = -1;
+    } else {
+        for (i = 0; i < count && !ret; i++) {
+            if (bytes) {
+                ret = _put_bytes(handle, dnswire_column_data_bytes(*c, entries[i]), dnswire_column_data_length(*c, entries[i]));
+            } else {
+                ret = _put_varint(handle, c->values[entries[i]]);
+            }
+        }
+        if (!ret) {
+            ret = _put_packed(handle, indexes, n);
+        }
+    }
+    free(table);
+    free(entries);
+
+    return ret;
+}
+
+/*
+ * Encode a column of the group into the chunk, returns the encoding used.
+ */
+static int _encode(struct dnswire_columnar_writer* handle, enum dnswire_column column, enum dnswire_column_encoding* encoding)
+{
+    const struct dnswire_column_data* c     = &handle->columns[column];
+    bool                              bytes = _columns[column].bytes;
+    size_t                            bitmap = (c->rows + 7) / 8, n = 0, i;
+    uint64_t*                         tmp;
+    int                               ret = 0;
+
+    handle->chunk_len = 0;
+    if (_reserve(handle, bitmap)) {
+        return -1;
+    }
+    memcpy(handle->chunk, c->present, bitmap);
+    handle->chunk_len = bitmap;
+
+    for (i = 0; i < c->rows; i++) {
+        n += dnswire_column_data_is_present(*c, i);
+    }
+    if (!(tmp = malloc((n ? n : 1) * sizeof(uint64_t)))) {
+        return -1;
+    }
+
+    *encoding = _columns[column].encoding;
+    if (*encoding == dnswire_column_encoding_dict) {
+        size_t at = handle->chunk_len;
+
+        if ((ret = _put_dict(handle, c, bytes, tmp, n)) == 1) {
+            handle->chunk_len = at;
+            *encoding         = bytes ? dnswire_column_encoding_plain : dnswire_column_encoding_varint;
+            ret               = 0;
+        }
+    }
+
+    switch (ret ? dnswire_column_encoding_dict : *encoding) {
+    case dnswire_column_encoding_plain:
+        for (i = 0; i < c->rows && !ret; i++) {
+            if (dnswire_column_data_is_present(*c, i)) {
+                ret = _put_bytes(handle, dnswire_column_data_bytes(*c, i), dnswire_column_data_length(*c, i));
+            }
+        }
+        break;
+
+    case dnswire_column_encoding_delta: {
+        uint64_t prev = 0;
+        for (i = 0; i < c->rows && !ret; i++) {
+            if (dnswire_column_data_is_present(*c, i)) {
+                int64_t d = (int64_t)(c->values[i] - prev);
+                ret       = _put_varint(handle, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+                prev      = c->values[i];
+            }
+        }
+        break;
+    }
+
+    case dnswire_column_encoding_varint:
+        for (i = 0; i < c->rows && !ret; i++) {
+            if (dnswire_column_data_is_present(*c, i)) {
+                ret = _put_varint(handle, c->values[i]);
+            }
+        }
+        break;
+
+    case dnswire_column_encoding_bitpack:
+        for (i = 0, n = 0; i < c->rows; i++) {
+            if (dnswire_column_data_is_present(*c, i)) {
+                tmp[n++] = c->values[i];
+            }
+        }
+        ret = _put_packed(handle, tmp, n);
+        break;
+
+    case dnswire_column_encoding_dict:
+        break;
+    }
+    free(tmp);
+
+    return ret;
+}
+
+enum dnswire_result dnswire_columnar_writer_init(struct dnswire_columnar_writer* handle, enum dnswire_compression compression)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_columnar_writer));
+
+    if (!dnswire_compression_is_available(compression)) {
+        return dnswire_error;
+    }
+    handle->fd          = -1;
+    handle->compression = compression;
+    handle->group_rows  = DNSWIRE_COLUMNAR_DEFAULT_GROUP_ROWS;
+
+    return dnswire_ok;
+}
+
+void dnswire_columnar_writer_destroy(struct dnswire_columnar_writer* handle)
+{
+    assert(handle);
+
+    size_t i;
+
+    if (handle->opened) {
+        dnswire_columnar_writer_close(handle);
+    }
+    for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+        dnswire_column_data_destroy(&handle->columns[i]);
+    }
+    free(handle->chunk);
+    handle->chunk = 0;
+    free(handle->out);
+    handle->out = 0;
+    free(handle->groups);
+    handle->groups = 0;
+}
+
+enum dnswire_result dnswire_columnar_writer_open(struct dnswire_columnar_writer* handle, int fd)
+{
+    assert(handle);
+    assert(!handle->opened);
+
+    uint8_t header[HEADER_SIZE];
+    size_t  i;
+
+    if (!handle->group_rows || handle->group_rows > UINT32_MAX) {
+        return dnswire_error;
+    }
+    for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+        if (_reset(&handle->columns[i], _columns[i].bytes, handle->group_rows)) {
+            return dnswire_error;
+        }
+    }
+
+    memcpy(header, DNSWIRE_COLUMNAR_MAGIC, 8);
+    _put32(&header[8], handle->compression);
+    _put32(&header[12], DNSWIRE_COLUMNS);
+    if (_write(fd, header, sizeof(header))) {
+        return dnswire_error;
+    }
+
+    handle->fd         = fd;
+    handle->rows       = 0;
+    handle->offset     = sizeof(header);
+    handle->num_groups = 0;
+    handle->opened     = true;
+
+    return dnswire_ok;
+}
+
+/*
+ * Encode, compress and write each column of the group and add the group
+ * to the footer.
+ */
+static enum dnswire_result _flush(struct dnswire_columnar_writer* handle)
+{
+    struct dnswire_columnar_group* group;
+    size_t                         i;
+
+    if (_grow(&handle->groups, &handle->groups_size, handle->num_groups + 1, sizeof(struct dnswire_columnar_group))) {
+        return dnswire_error;
+    }
+    group       = &handle->groups[handle->num_groups];
+    group->rows = handle->rows;
+
+    for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+        struct dnswire_columnar_chunk*    chunk = &group->chunks[i];
+        const struct dnswire_column_data* c     = &handle->columns[i];
+        const uint8_t*                    out;
+        size_t                            len, r;
+
+        chunk->min = UINT64_MAX;
+        chunk->max = 0;
+        for (r = 0; r < c->rows; r++) {
+            if (!dnswire_column_data_is_present(*c, r)) {
+                continue;
+            }
+            if (_columns[i].bytes) {
+                chunk->min = 0;
+                chunk->max = UINT64_MAX;
+                break;
+            }
+            if (c->values[r] < chunk->min) {
+                chunk->min = c->values[r];
+            }
+            if (c->values[r] > chunk->max) {
+                chunk->max = c->values[r];
+            }
+        }
+
+        if (_encode(handle, i, &chunk->encoding) || handle->chunk_len > UINT32_MAX) {
+            return dnswire_error;
+        }
+        out = handle->chunk;
+        len = handle->chunk_len;
+        if (handle->compression != dnswire_compression_none) {
+            if (_grow(&handle->out, &handle->out_size, dnswire_compression_bound(handle->compression, handle->chunk_len), 1)) {
+                return dnswire_error;
+            }
+            len = handle->out_size;
+            if (dnswire_compression_compress(handle->compression, handle->level, handle->chunk, handle->chunk_len, handle->out, &len) != dnswire_ok) {
+                return dnswire_error;
+            }
+            out = handle->out;
+        }
+        if (_write(handle->fd, out, len)) {
+            return dnswire_error;
+        }
+        chunk->offset = handle->offset;
+        chunk->length = len;
+        chunk->size   = handle->chunk_len;
+        handle->offset += len;
+        __trace("group %zu column %s %s %zu -> %zu", handle->num_groups, dnswire_column_string[i], dnswire_column_encoding_string[chunk->encoding], handle->chunk_len, len);
+
+        if (_reset(&handle->columns[i], _columns[i].bytes, handle->group_rows)) {
+            return dnswire_error;
+        }
+    }
+    handle->num_groups++;
+    handle->rows = 0;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_column_data_add(struct dnswire_column_data* columns, const struct dnstap* d)
+{
+    assert(columns);
+    assert(d);
+
+    bool           msg     = dnstap_has_message(*d);
+    bool           policy  = msg && dnstap_message_has_policy(*d);
+    const uint8_t* dns     = 0;
+    size_t         dns_len = 0, rows = columns[0].rows, i;
+
+    if (msg && dnstap_message_has_query_message(*d)) {
+        dns     = dnstap_message_query_message(*d);
+        dns_len = dnstap_message_query_message_length(*d);
+    } else if (msg && dnstap_message_has_response_message(*d)) {
+        dns     = dnstap_message_response_message(*d);
+        dns_len = dnstap_message_response_message_length(*d);
+    }
+    bool header = dns && dns_len >= 12;
+
+#define _bytes(col, has, field) _add_bytes(&columns[col], has, has ? field(*d) : 0, has ? field##_length(*d) : 0)
+#define _value(col, has, v) _add_value(&columns[col], has, has ? (uint64_t)(v) : 0)
+#define _dns16(o) (uint64_t)(dns[o] << 8 | dns[o + 1])
+    if (_bytes(dnswire_column_identity, dnstap_has_identity(*d), dnstap_identity)
+        || _bytes(dnswire_column_version, dnstap_has_version(*d), dnstap_version)
+        || _bytes(dnswire_column_extra, dnstap_has_extra(*d), dnstap_extra)
+        || _value(dnswire_column_type, true, dnstap_type(*d))
+        || _value(dnswire_column_message_type, msg, dnstap_message_type(*d))
+        || _value(dnswire_column_socket_family, msg && dnstap_message_has_socket_family(*d), dnstap_message_socket_family(*d))
+        || _value(dnswire_column_socket_protocol, msg && dnstap_message_has_socket_protocol(*d), dnstap_message_socket_protocol(*d))
+        || _bytes(dnswire_column_query_address, msg && dnstap_message_has_query_address(*d), dnstap_message_query_address)
+        || _bytes(dnswire_column_response_address, msg && dnstap_message_has_response_address(*d), dnstap_message_response_address)
+        || _value(dnswire_column_query_port, msg && dnstap_message_has_query_port(*d), dnstap_message_query_port(*d))
+        || _value(dnswire_column_response_port, msg && dnstap_message_has_response_port(*d), dnstap_message_response_port(*d))
+        || _value(dnswire_column_query_time_sec, msg && dnstap_message_has_query_time_sec(*d), dnstap_message_query_time_sec(*d))
+        || _value(dnswire_column_query_time_nsec, msg && dnstap_message_has_query_time_nsec(*d), dnstap_message_query_time_nsec(*d))
+        || _bytes(dnswire_column_query_message, msg && dnstap_message_has_query_message(*d), dnstap_message_query_message)
+        || _bytes(dnswire_column_query_zone, msg && dnstap_message_has_query_zone(*d), dnstap_message_query_zone)
+        || _value(dnswire_column_response_time_sec, msg && dnstap_message_has_response_time_sec(*d), dnstap_message_response_time_sec(*d))
+        || _value(dnswire_column_response_time_nsec, msg && dnstap_message_has_response_time_nsec(*d), dnstap_message_response_time_nsec(*d))
+        || _bytes(dnswire_column_response_message, msg && dnstap_message_has_response_message(*d), dnstap_message_response_message)
+        || _add_bytes(&columns[dnswire_column_policy_type], policy && dnstap_message_policy_has_type(*d), policy && dnstap_message_policy_has_type(*d) ? (const uint8_t*)dnstap_message_policy_type(*d) : 0, policy && dnstap_message_policy_has_type(*d) ? dnstap_message_policy_type_length(*d) : 0)
+        || _bytes(dnswire_column_policy_rule, policy && dnstap_message_policy_has_rule(*d), dnstap_message_policy_rule)
+        || _value(dnswire_column_policy_action, policy && dnstap_message_policy_has_action(*d), dnstap_message_policy_action(*d))
+        || _value(dnswire_column_policy_match, policy && dnstap_message_policy_has_match(*d), dnstap_message_policy_match(*d))
+        || _bytes(dnswire_column_policy_value, policy && dnstap_message_policy_has_value(*d), dnstap_message_policy_value)
+        || _value(dnswire_column_dns_id, header, _dns16(0))
+        || _value(dnswire_column_dns_flags, header, _dns16(2))
+        || _value(dnswire_column_dns_qdcount, header, _dns16(4))
+        || _value(dnswire_column_dns_ancount, header, _dns16(6))
+        || _value(dnswire_column_dns_nscount, header, _dns16(8))
+        || _value(dnswire_column_dns_arcount, header, _dns16(10))) {
+        // remove the partly added row so the columns stay aligned
+        for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+            struct dnswire_column_data* c = &columns[i];
+
+            if (c->rows > rows) {
+                c->present[rows >> 3] &= ~(1 << (rows & 7));
+                if (_columns[i].bytes) {
+                    c->data_len = c->offsets[rows];
+                }
+                c->rows = rows;
+            }
+        }
+        return dnswire_error;
+    }
+#undef _bytes
+#undef _value
+#undef _dns16
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_columnar_writer_write(struct dnswire_columnar_writer* handle, const struct dnstap* d)
+{
+    assert(handle);
+    assert(d);
+    assert(handle->opened);
+
+    if (dnswire_column_data_add(handle->columns, d) != dnswire_ok) {
+        return dnswire_error;
+    }
+
+    if (++handle->rows >= handle->group_rows) {
+        return _flush(handle);
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_columnar_writer_close(struct dnswire_columnar_writer* handle)
+{
+    assert(handle);
+    assert(handle->opened);
+
+    uint8_t  entry[4 + DNSWIRE_COLUMNS * CHUNK_SIZE], trailer[TRAILER_SIZE];
+    uint64_t footer;
+    size_t   i, j;
+
+    handle->opened = false;
+
+    if (handle->rows && _flush(handle) != dnswire_ok) {
+        return dnswire_error;
+    }
+
+    footer = handle->offset;
+    for (i = 0; i < handle->num_groups; i++) {
+        const struct dnswire_columnar_group* group = &handle->groups[i];
+
+        _put32(entry, group->rows);
+        for (j = 0; j < DNSWIRE_COLUMNS; j++) {
+            uint8_t* p = &entry[4 + j * CHUNK_SIZE];
+
+            _put64(p, group->chunks[j].offset);
+            _put32(p + 8, group->chunks[j].length);
+            _put32(p + 12, group->chunks[j].size);
+            p[16] = group->chunks[j].encoding;
+            _put64(p + 17, group->chunks[j].min);
+            _put64(p + 25, group->chunks[j].max);
+        }
+        if (_write(handle->fd, entry, sizeof(entry))) {
+            return dnswire_error;
+        }
+    }
+
+    _put64(&trailer[0], footer);
+    _put64(&trailer[8], handle->num_groups);
+    memcpy(&trailer[16], DNSWIRE_COLUMNAR_MAGIC, 8);
+    if (_write(handle->fd, trailer, sizeof(trailer))) {
+        return dnswire_error;
+    }
+    handle->fd = -1;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_columnar_reader_init(struct dnswire_columnar_reader* handle)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_columnar_reader));
+    handle->fd = -1;
+
+    return dnswire_ok;
+}
+
+void dnswire_columnar_reader_destroy(struct dnswire_columnar_reader* handle)
+{
+    assert(handle);
+
+    free(handle->groups);
+    handle->groups     = 0;
+    handle->num_groups = 0;
+    free(handle->in);
+    handle->in = 0;
+    free(handle->raw);
+    handle->raw = 0;
+}
+
+enum dnswire_result dnswire_columnar_reader_open(struct dnswire_columnar_reader* handle, int fd)
+{
+    assert(handle);
+
+    uint8_t     header[HEADER_SIZE], trailer[TRAILER_SIZE];
+    uint8_t*    footer;
+    uint64_t    offset, num, end;
+    size_t      columns, entry_size, i, j;
+    struct stat st;
+
+    if (fstat(fd, &st) || st.st_size < HEADER_SIZE + TRAILER_SIZE) {
+        return dnswire_error;
+    }
+    end = (uint64_t)st.st_size - TRAILER_SIZE;
+
+    if (_pread(fd, header, sizeof(header), 0)
+        || memcmp(header, DNSWIRE_COLUMNAR_MAGIC, 8)
+        || _pread(fd, trailer, sizeof(trailer), end)
+        || memcmp(&trailer[16], DNSWIRE_COLUMNAR_MAGIC, 8)) {
+        return dnswire_error;
+    }
+    handle->compression = _get32(&header[8]);
+    if (!dnswire_compression_is_available(handle->compression)) {
+        return dnswire_error;
+    }
+    columns    = _get32(&header[12]);
+    entry_size = 4 + columns * CHUNK_SIZE;
+
+    offset = _get64(&trailer[0]);
+    num    = _get64(&trailer[8]);
+    if (offset < HEADER_SIZE || offset > end || num != (end - offset) / entry_size || (end - offset) % entry_size) {
+        return dnswire_error;
+    }
+
+    free(handle->groups);
+    handle->groups     = 0;
+    handle->num_groups = 0;
+    if (num) {
+        if (!(footer = malloc(num * entry_size))) {
+            return dnswire_error;
+        }
+        if (!(handle->groups = calloc(num, sizeof(struct dnswire_columnar_group)))
+            || _pread(fd, footer, num * entry_size, offset)) {
+            free(footer);
+            return dnswire_error;
+        }
+        for (i = 0; i < num; i++) {
+            struct dnswire_columnar_group* group = &handle->groups[i];
+            const uint8_t*                 entry = &footer[i * entry_size];
+
+            group->rows = _get32(entry);
+            for (j = 0; j < columns && j < DNSWIRE_COLUMNS; j++) {
+                struct dnswire_columnar_chunk* chunk = &group->chunks[j];
+                const uint8_t*                 p     = &entry[4 + j * CHUNK_SIZE];
+
+                chunk->offset   = _get64(p);
+                chunk->length   = _get32(p + 8);
+                chunk->size     = _get32(p + 12);
+                chunk->encoding = p[16];
+                chunk->min      = _get64(p + 17);
+                chunk->max      = _get64(p + 25);
+                if (chunk->offset < HEADER_SIZE || chunk->offset > offset || chunk->length > offset - chunk->offset || chunk->encoding > dnswire_column_encoding_dict) {
+                    free(footer);
+                    return dnswire_error;
+                }
+            }
+        }
+        free(footer);
+    }
+    handle->num_groups = num;
+    handle->columns    = columns;
+    handle->fd         = fd;
+
+    return dnswire_ok;
+}
+
+/*
+ * Decoding from the chunk.
+ */
+
+struct _in {
+    const uint8_t* p;
+    size_t         left;
+};
+
+static int _get_varint(struct _in* in, uint64_t* v)
+{
+    unsigned shift = 0;
+
+    *v = 0;
+    while (in->left && shift < 64) {
+        uint8_t b = *in->p++;
+        in->left--;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+static int _get_bytes(struct _in* in, const uint8_t** data, size_t* len)
+{
+    uint64_t l;
+
+    if (_get_varint(in, &l) || l > in->left) {
+        return -1;
+    }
+    *data = in->p;
+    *len  = l;
+    in->p += l;
+    in->left -= l;
+    return 0;
+}
+
+static int _get_packed(struct _in* in, uint64_t* values, size_t n)
+{
+    unsigned width;
+    size_t   i, bit = 0;
+
+    if (!in->left || (width = *in->p) > 64) {
+        return -1;
+    }
+    in->p++;
+    in->left--;
+
+    size_t len = (n * width + 7) / 8;
+    if (len > in->left) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        unsigned b = 0;
+        values[i]  = 0;
+        while (b < width) {
+            unsigned off  = bit & 7;
+            unsigned take = 8 - off < width - b ? 8 - off : width - b;
+            values[i] |= (uint64_t)((in->p[bit >> 3] >> off) & ((1u << take) - 1)) << b;
+            b += take;
+            bit += take;
+        }
+    }
+    in->p += len;
+    in->left -= len;
+    return 0;
+}
+
+static int _append(struct dnswire_column_data* c, const uint8_t* data, size_t len)
+{
+    if (c->data_len + len > UINT32_MAX || _grow(&c->data, &c->data_size, c->data_len + len, 1)) {
+        return -1;
+    }
+    memcpy(&c->data[c->data_len], data, len);
+    c->data_len += len;
+    return 0;
+}
+
+static int _decode(const uint8_t* chunk, size_t len, size_t rows, bool bytes, enum dnswire_column_encoding encoding, struct dnswire_column_data* c)
+{
+    struct _in in     = { chunk, len };
+    size_t     bitmap = (rows + 7) / 8, n = 0, i, k;
+    uint64_t * tmp    = 0, *dict = 0;
+    int        ret    = 0;
+
+    if (_reset(c, bytes, rows) || len < bitmap) {
+        return -1;
+    }
+    memcpy(c->present, chunk, bitmap);
+    in.p += bitmap;
+    in.left -= bitmap;
+    c->rows = rows;
+    for (i = 0; i < rows; i++) {
+        n += dnswire_column_data_is_present(*c, i);
+    }
+
+    switch (encoding) {
+    case dnswire_column_encoding_plain:
+        if (!bytes) {
+            return -1;
+        }
+        for (i = 0; i < rows && !ret; i++) {
+            if (dnswire_column_data_is_present(*c, i)) {
+                const uint8_t* data;
+                size_t         l;
+                ret = _get_bytes(&in, &data, &l) || _append(c, data, l);
+            }
+            c->offsets[i + 1] = c->data_len;
+        }
+        break;
+
+    case dnswire_column_encoding_delta:
+    case dnswire_column_encoding_varint: {
+        uint64_t prev = 0, v;
+        if (bytes) {
+            return -1;
+        }
+        for (i = 0; i < rows && !ret; i++) {
+            if (!dnswire_column_data_is_present(*c, i)) {
+                c->values[i] = 0;
+                continue;
+            }
+            if ((ret = _get_varint(&in, &v))) {
+                break;
+            }
+            if (encoding == dnswire_column_encoding_delta) {
+                prev += (v >> 1) ^ -(v & 1);
+                v = prev;
+            }
+            c->values[i] = v;
+        }
+        break;
+    }
+
+    case dnswire_column_encoding_bitpack:
+        if (bytes || !(tmp = malloc((n ? n : 1) * sizeof(uint64_t))) || _get_packed(&in, tmp, n)) {
+            ret = -1;
+            break;
+        }
+        for (i = 0, k = 0; i < rows; i++) {
+            c->values[i] = dnswire_column_data_is_present(*c, i) ? tmp[k++] : 0;
+        }
+        break;
+
+    case dnswire_column_encoding_dict: {
+        uint64_t        count;
+        const uint8_t** data = 0;
+        size_t*         lens = 0;
+
+        if (_get_varint(&in, &count) || count > in.left || (n && !count)) {
+            ret = -1;
+            break;
+        }
+        if (!(tmp = malloc((n ? n : 1) * sizeof(uint64_t)))
+            || (bytes ? !(data = malloc((count ? count : 1) * sizeof(*data))) || !(lens = malloc((count ? count : 1) * sizeof(*lens)))
+                      : !(dict = malloc((count ? count : 1) * sizeof(uint64_t))))) {
+            free(data);
+            free(lens);
+            ret = -1;
+            break;
+        }
+        for (i = 0; i < count && !ret; i++) {
+            ret = bytes ? _get_bytes(&in, &data[i], &lens[i]) : _get_varint(&in, &dict[i]);
+        }
+        if (!ret) {
+            ret = _get_packed(&in, tmp, n);
+        }
+        for (i = 0, k = 0; i < rows && !ret; i++) {
+            if (dnswire_column_data_is_present(*c, i)) {
+                uint64_t idx = tmp[k++];
+                if (idx >= count) {
+                    ret = -1;
+                    break;
+                }
+                if (bytes) {
+                    ret = _append(c, data[idx], lens[idx]);
+                } else {
+                    c->values[i] = dict[idx];
+                }
+            } else if (!bytes) {
+                c->values[i] = 0;
+            }
+            if (bytes) {
+                c->offsets[i + 1] = c->data_len;
+            }
+        }
+        free(data);
+        free(lens);
+        break;
+    }
+
+    default:
+        ret = -1;
+    }
+    free(tmp);
+    free(dict);
+
+    return ret;
+}
+
+enum dnswire_result dnswire_columnar_reader_read(struct dnswire_columnar_reader* handle, size_t group, enum dnswire_column column, struct dnswire_column_data* data)
+{
+    assert(handle);
+    assert(group < handle->num_groups);
+    assert(column < DNSWIRE_COLUMNS);
+    assert(data);
+
+    const struct dnswire_columnar_chunk* chunk = &handle->groups[group].chunks[column];
+    size_t                               rows  = handle->groups[group].rows;
+    const uint8_t*                       raw;
+
+    if (column >= handle->columns) {
+        // not in the file, no rows are present
+        if (_reset(data, _columns[column].bytes, rows)) {
+            return dnswire_error;
+        }
+        data->rows = rows;
+        if (_columns[column].bytes) {
+            memset(data->offsets, 0, (rows + 1) * sizeof(uint32_t));
+        } else {
+            memset(data->values, 0, rows * sizeof(uint64_t));
+        }
+        return dnswire_ok;
+    }
+
+    if (_grow(&handle->in, &handle->in_size, chunk->length, 1)
+        || _pread(handle->fd, handle->in, chunk->length, chunk->offset)) {
+        return dnswire_error;
+    }
+    handle->bytes_read += chunk->length;
+    raw = handle->in;
+
+    if (handle->compression != dnswire_compression_none) {
+        size_t len = chunk->size;
+
+        if (_grow(&handle->raw, &handle->raw_size, chunk->size ? chunk->size : 1, 1)
+            || dnswire_compression_decompress(handle->compression, handle->in, chunk->length, handle->raw, &len) != dnswire_ok) {
+            return dnswire_error;
+        }
+        raw = handle->raw;
+    } else if (chunk->size != chunk->length) {
+        return dnswire_error;
+    }
+
+    if (_decode(raw, chunk->size, rows, _columns[column].bytes, chunk->encoding, data)) {
+        return dnswire_error;
+    }
+
+    return dnswire_ok;
+}
@@ -0,0 +1,758 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/compression.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+const char* const dnswire_compression_string[] = {
+    "none",
+    "zstd",
+    "lz4",
+};
+
+enum dnswire_compression dnswire_compression_detect(const uint8_t* data, size_t len)
+{
+    assert(data);
+
+    if (len < 4) {
+        return dnswire_compression_none;
+    }
+    if (data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd) {
+        return dnswire_compression_zstd;
+    }
+    if (data[0] == 0x04 && data[1] == 0x22 && data[2] == 0x4d && data[3] == 0x18) {
+        return dnswire_compression_lz4;
+    }
+    return dnswire_compression_none;
+}
+
+bool dnswire_compression_is_available(enum dnswire_compression compression)
+{
+    switch (compression) {
+    case dnswire_compression_none:
+#if HAVE_ZSTD
+    case dnswire_compression_zstd:
+#endif
+#if HAVE_LZ4
+    case dnswire_compression_lz4:
+#endif
+        return true;
+    default:
+        break;
+    }
+    return false;
+}
+
+size_t dnswire_compression_bound(enum dnswire_compression compression, size_t len)
+{
+    switch (compression) {
+#if HAVE_ZSTD
+    case dnswire_compression_zstd:
+        return ZSTD_compressBound(len);
+#endif
+#if HAVE_LZ4
+    case dnswire_compression_lz4:
+        return LZ4F_compressFrameBound(len, 0);
+#endif
+    default:
+        break;
+    }
+    return len;
+}
+
+enum dnswire_result dnswire_compression_compress(enum dnswire_compression compression, int level, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len)
+{
+    assert(in);
+    assert(out);
+    assert(out_len);
+
+    switch (compression) {
+    case dnswire_compression_none:
+        if (*out_len < in_len) {
+            return dnswire_error;
+        }
+        memcpy(out, in, in_len);
+        *out_len = in_len;
+        return dnswire_ok;
+
+#if HAVE_ZSTD
+    case dnswire_compression_zstd: {
+        size_t n = ZSTD_compress(out, *out_len, in, in_len, level);
+        if (ZSTD_isError(n)) {
+            __trace("ZSTD_compress() failed: %s", ZSTD_getErrorName(n));
+            return dnswire_error;
+        }
+        *out_len = n;
+        return dnswire_ok;
+    }
+#endif
+#if HAVE_LZ4
+    case dnswire_compression_lz4: {
+        LZ4F_preferences_t prefs;
+
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.compressionLevel = level;
+        size_t n               = LZ4F_compressFrame(out, *out_len, in, in_len, &prefs);
+        if (LZ4F_isError(n)) {
+            return dnswire_error;
+        }
+        *out_len = n;
+        return dnswire_ok;
+    }
+#endif
+    default:
+        break;
+    }
+    return dnswire_error;
+}
+
+enum dnswire_result dnswire_compression_decompress(enum dnswire_compression compression, const uint8_t* in, size_t in_len, uint8_t* out, size_t* out_len)
+{
+    assert(in);
+    assert(out);
+    assert(out_len);
+
+    switch (compression) {
+    case dnswire_compression_none:
+        if (*out_len != in_len) {
+            return dnswire_error;
+        }
+        memcpy(out, in, in_len);
+        return dnswire_ok;
+
+#if HAVE_ZSTD
+    case dnswire_compression_zstd: {
+        size_t n = ZSTD_decompress(out, *out_len, in, in_len);
+        if (ZSTD_isError(n) || n != *out_len) {
+            return dnswire_error;
+        }
+        return dnswire_ok;
+    }
+#endif
+#if HAVE_LZ4
+    case dnswire_compression_lz4: {
+        LZ4F_dctx* ctx;
+        size_t     done = 0, left;
+
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION))) {
+            return dnswire_error;
+        }
+        do {
+            size_t n = *out_len - done, used = in_len;
+
+            left = LZ4F_decompress(ctx, out + done, &n, in, &used, 0);
+            if (LZ4F_isError(left) || (!n && !used)) {
+                break;
+            }
+            done += n;
+            in += used;
+            in_len -= used;
+        } while (left);
+        LZ4F_freeDecompressionContext(ctx);
+
+        return !left && done == *out_len ? dnswire_ok : dnswire_error;
+    }
+#endif
+    default:
+        break;
+    }
+    return dnswire_error;
+}
+
+/*
+ * What to do with the compressed stream after a batch.
+ */
+#define MODE_CONTINUE 0
+#define MODE_FLUSH 1
+#define MODE_END 2
+
+enum dnswire_result dnswire_compressor_init(struct dnswire_compressor* handle, enum dnswire_compression compression)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_compressor));
+
+    switch (compression) {
+#if HAVE_ZSTD
+    case dnswire_compression_zstd:
+        break;
+#endif
+#if HAVE_LZ4
+    case dnswire_compression_lz4:
+        break;
+#endif
+    default:
+        return dnswire_error;
+    }
+
+    handle->compression = compression;
+    handle->fd          = -1;
+    handle->buf_size    = DNSWIRE_COMPRESSOR_DEFAULT_BUF_SIZE;
+    pthread_mutex_init(&handle->lock, 0);
+    pthread_cond_init(&handle->cond, 0);
+
+    return dnswire_ok;
+}
+
+static void _free_ctx(struct dnswire_compressor* handle)
+{
+    if (!handle->ctx) {
+        return;
+    }
+    switch (handle->compression) {
+#if HAVE_ZSTD
+    case dnswire_compression_zstd:
+        ZSTD_freeCCtx(handle->ctx);
+        break;
+#endif
+#if HAVE_LZ4
+    case dnswire_compression_lz4:
+        LZ4F_freeCompressionContext(handle->ctx);
+        break;
+#endif
+    default:
+        break;
+    }
+    handle->ctx = 0;
+}
+
+void dnswire_compressor_destroy(struct dnswire_compressor* handle)
+{
+    assert(handle);
+
+    if (handle->opened) {
+        dnswire_compressor_close(handle);
+    }
+    _free_ctx(handle);
+    free(handle->bufs[0]);
+    handle->bufs[0] = 0;
+    free(handle->bufs[1]);
+    handle->bufs[1] = 0;
+    free(handle->out);
+    handle->out = 0;
+    pthread_mutex_destroy(&handle->lock);
+    pthread_cond_destroy(&handle->cond);
+}
+
+#if HAVE_ZSTD || HAVE_LZ4
+/*
+ * Write all of it, waiting for non-blocking file descriptors to become
+ * writable.
+ */
+static int _write_all(struct dnswire_compressor* handle, const uint8_t* data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(handle->fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = { handle->fd, POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            __trace("write() failed: %s", strerror(errno));
+            return -1;
+        } else if (!n) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+        handle->bytes_out += n;
+    }
+    return 0;
+}
+#endif
+
+#if HAVE_ZSTD
+static int _compress_zstd(struct dnswire_compressor* handle, const uint8_t* data, size_t len, int mode)
+{
+    ZSTD_inBuffer     in  = { data, len, 0 };
+    ZSTD_EndDirective end = mode == MODE_END ? ZSTD_e_end : mode == MODE_FLUSH ? ZSTD_e_flush : ZSTD_e_continue;
+    size_t            left;
+
+    do {
+        ZSTD_outBuffer out = { handle->out, handle->out_size, 0 };
+
+        left = ZSTD_compressStream2(handle->ctx, &out, &in, end);
+        if (ZSTD_isError(left)) {
+            __trace("ZSTD_compressStream2() failed: %s", ZSTD_getErrorName(left));
+            return -1;
+        }
+        if (_write_all(handle, handle->out, out.pos)) {
+            return -1;
+        }
+    } while (end == ZSTD_e_continue ? in.pos < in.size : left > 0);
+
+    return 0;
+}
+#endif
+
+#if HAVE_LZ4
+static int _compress_lz4(struct dnswire_compressor* handle, const uint8_t* data, size_t len, int mode)
+{
+    size_t n;
+
+    if (!handle->begun) {
+        LZ4F_preferences_t prefs;
+
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.compressionLevel = handle->level;
+        n                      = LZ4F_compressBegin(handle->ctx, handle->out, handle->out_size, &prefs);
+        if (LZ4F_isError(n) || _write_all(handle, handle->out, n)) {
+            return -1;
+        }
+        handle->begun = true;
+    }
+    if (len) {
+        n = LZ4F_compressUpdate(handle->ctx, handle->out, handle->out_size, data, len, 0);
+        if (LZ4F_isError(n) || _write_all(handle, handle->out, n)) {
+            return -1;
+        }
+    }
+    if (mode == MODE_FLUSH) {
+        n = LZ4F_flush(handle->ctx, handle->out, handle->out_size, 0);
+        if (LZ4F_isError(n) || _write_all(handle, handle->out, n)) {
+            return -1;
+        }
+    } else if (mode == MODE_END) {
+        n = LZ4F_compressEnd(handle->ctx, handle->out, handle->out_size, 0);
+        if (LZ4F_isError(n) || _write_all(handle, handle->out, n)) {
+            return -1;
+        }
+        handle->begun = false;
+    }
+
+    return 0;
+}
+#endif
+
+static int _compress(struct dnswire_compressor* handle, const uint8_t* data, size_t len, int mode)
+{
+    switch (handle->compression) {
+#if HAVE_ZSTD
+    case dnswire_compression_zstd:
+        return _compress_zstd(handle, data, len, mode);
+#endif
+#if HAVE_LZ4
+    case dnswire_compression_lz4:
+        return _compress_lz4(handle, data, len, mode);
+#endif
+    default:
+        break;
+    }
+    return -1;
+}
+
+/*
+ * Compresses and writes the batches handed over by the producer.
+ */
+static void* _compressing(void* arg)
+{
+    struct dnswire_compressor* handle = arg;
+
+    pthread_mutex_lock(&handle->lock);
+    while (1) {
+        while (!handle->stop && !handle->busy) {
+            pthread_cond_wait(&handle->cond, &handle->lock);
+        }
+        if (!handle->busy) {
+            break;
+        }
+        const uint8_t* data = handle->bufs[handle->pending];
+        size_t         len  = handle->pending_len;
+        int            mode = handle->pending_mode;
+        pthread_mutex_unlock(&handle->lock);
+
+        int err = _compress(handle, data, len, mode);
+
+        pthread_mutex_lock(&handle->lock);
+        if (err) {
+            handle->failed = true;
+        }
+        handle->batches++;
+        handle->busy = false;
+        pthread_cond_broadcast(&handle->cond);
+    }
+    pthread_mutex_unlock(&handle->lock);
+
+    return 0;
+}
+
+/*
+ * Hand the active batch to the background thread and switch to the other
+ * one, if flushing or ending also wait for it to be written.
+ */
+static enum dnswire_result _submit(struct dnswire_compressor* handle, int mode)
+{
+    bool failed;
+
+    pthread_mutex_lock(&handle->lock);
+    if (handle->busy) {
+        handle->stalls++;
+        while (handle->busy) {
+            pthread_cond_wait(&handle->cond, &handle->lock);
+        }
+    }
+    if (!handle->failed) {
+        handle->busy         = true;
+        handle->pending      = handle->active;
+        handle->pending_len  = handle->fill;
+        handle->pending_mode = mode;
+        pthread_cond_broadcast(&handle->cond);
+
+        if (mode != MODE_CONTINUE) {
+            while (handle->busy) {
+                pthread_cond_wait(&handle->cond, &handle->lock);
+            }
+        }
+    }
+    failed = handle->failed;
+    pthread_mutex_unlock(&handle->lock);
+
+    if (failed) {
+        return dnswire_error;
+    }
+
+    handle->active ^= 1;
+    handle->fill = 0;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_compressor_open(struct dnswire_compressor* handle, int fd)
+{
+    assert(handle);
+    assert(!handle->opened);
+
+    if (!handle->buf_size) {
+        return dnswire_error;
+    }
+
+    int i;
+    for (i = 0; i < 2; i++) {
+        if (!handle->bufs[i] && !(handle->bufs[i] = malloc(handle->buf_size))) {
+            return dnswire_error;
+        }
+    }
+
+    _free_ctx(handle);
+    switch (handle->compression) {
+#if HAVE_ZSTD
+    case dnswire_compression_zstd:
+        if (!(handle->ctx = ZSTD_createCCtx())) {
+            return dnswire_error;
+        }
+        if (handle->level) {
+            ZSTD_CCtx_setParameter(handle->ctx, ZSTD_c_compressionLevel, handle->level);
+        }
+        if (handle->workers) {
+            // not fatal, libzstd may be built without multithreading
+            size_t err = ZSTD_CCtx_setParameter(handle->ctx, ZSTD_c_nbWorkers, handle->workers);
+            if (ZSTD_isError(err)) {
+                __trace("ZSTD_c_nbWorkers failed: %s", ZSTD_getErrorName(err));
+            }
+        }
+        handle->out_size = ZSTD_CStreamOutSize();
+        break;
+#endif
+#if HAVE_LZ4
+    case dnswire_compression_lz4:
+        if (LZ4F_isError(LZ4F_createCompressionContext((LZ4F_cctx**)&handle->ctx, LZ4F_VERSION))) {
+            handle->ctx = 0;
+            return dnswire_error;
+        }
+        handle->out_size = LZ4F_compressBound(handle->buf_size, 0) + LZ4F_HEADER_SIZE_MAX;
+        break;
+#endif
+    default:
+        return dnswire_error;
+    }
+
+    free(handle->out);
+    if (!(handle->out = malloc(handle->out_size))) {
+        return dnswire_error;
+    }
+
+    handle->fd     = fd;
+    handle->active = 0;
+    handle->fill   = 0;
+    handle->begun  = false;
+    handle->busy   = false;
+    handle->stop   = false;
+    handle->failed = false;
+
+    if (pthread_create(&handle->thread, 0, _compressing, handle)) {
+        return dnswire_error;
+    }
+    handle->started = true;
+    handle->opened  = true;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_compressor_write(struct dnswire_compressor* handle, const uint8_t* data, size_t len)
+{
+    assert(handle);
+    assert(data);
+    assert(handle->opened);
+
+    handle->bytes_in += len;
+    while (len) {
+        size_t n = handle->buf_size - handle->fill;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&handle->bufs[handle->active][handle->fill], data, n);
+        handle->fill += n;
+        data += n;
+        len -= n;
+
+        if (handle->fill == handle->buf_size && _submit(handle, MODE_CONTINUE) != dnswire_ok) {
+            return dnswire_error;
+        }
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_compressor_flush(struct dnswire_compressor* handle)
+{
+    assert(handle);
+    assert(handle->opened);
+
+    return _submit(handle, MODE_FLUSH);
+}
+
+enum dnswire_result dnswire_compressor_close(struct dnswire_compressor* handle)
+{
+    assert(handle);
+    assert(handle->opened);
+
+    enum dnswire_result res = _submit(handle, MODE_END);
+
+    pthread_mutex_lock(&handle->lock);
+    handle->stop = true;
+    pthread_cond_broadcast(&handle->cond);
+    pthread_mutex_unlock(&handle->lock);
+    if (handle->started) {
+        pthread_join(handle->thread, 0);
+        handle->started = false;
+    }
+    handle->fd     = -1;
+    handle->opened = false;
+
+    return res;
+}
+
+enum dnswire_result dnswire_decompressor_init(struct dnswire_decompressor* handle)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_decompressor));
+
+    if (!(handle->buf = malloc(DNSWIRE_MAXIMUM_BUF_SIZE))) {
+        return dnswire_error;
+    }
+    handle->size = DNSWIRE_MAXIMUM_BUF_SIZE;
+
+    return dnswire_ok;
+}
+
+void dnswire_decompressor_destroy(struct dnswire_decompressor* handle)
+{
+    assert(handle);
+
+    if (handle->ctx) {
+        switch (handle->compression) {
+#if HAVE_ZSTD
+        case dnswire_compression_zstd:
+            ZSTD_freeDCtx(handle->ctx);
+            break;
+#endif
+#if HAVE_LZ4
+        case dnswire_compression_lz4:
+            LZ4F_freeDecompressionContext(handle->ctx);
+            break;
+#endif
+        default:
+            break;
+        }
+        handle->ctx = 0;
+    }
+    free(handle->buf);
+    handle->buf = 0;
+}
+
+static int _detect(struct dnswire_decompressor* handle)
+{
+    handle->compression = dnswire_compression_detect(&handle->buf[handle->at], handle->left);
+    handle->detected    = true;
+    __trace("detected %s", dnswire_compression_string[handle->compression]);
+
+    switch (handle->compression) {
+    case dnswire_compression_none:
+        return 0;
+#if HAVE_ZSTD
+    case dnswire_compression_zstd:
+        return (handle->ctx = ZSTD_createDCtx()) ? 0 : -1;
+#endif
+#if HAVE_LZ4
+    case dnswire_compression_lz4:
+        if (LZ4F_isError(LZ4F_createDecompressionContext((LZ4F_dctx**)&handle->ctx, LZ4F_VERSION))) {
+            handle->ctx = 0;
+            return -1;
+        }
+        return 0;
+#endif
+    default:
+        break;
+    }
+
+    // compressed but not supported by this build
+    errno = EPROTONOSUPPORT;
+    return -1;
+}
+
+/*
+ * Decompress what is buffered, returns how much was decompressed or -1 on
+ * error. Consumes input even if it does not produce any output.
+ */
+static ssize_t _decompress(struct dnswire_decompressor* handle, uint8_t* data, size_t len)
+{
+    size_t n;
+
+    switch (handle->compression) {
+    case dnswire_compression_none:
+        n = handle->left < len ? handle->left : len;
+        memcpy(data, &handle->buf[handle->at], n);
+        handle->at += n;
+        handle->left -= n;
+        return n;
+
+#if HAVE_ZSTD
+    case dnswire_compression_zstd: {
+        ZSTD_inBuffer  in  = { &handle->buf[handle->at], handle->left, 0 };
+        ZSTD_outBuffer out = { data, len, 0 };
+
+        n = ZSTD_decompressStream(handle->ctx, &out, &in);
+        if (ZSTD_isError(n)) {
+            __trace("ZSTD_decompressStream() failed: %s", ZSTD_getErrorName(n));
+            errno = EINVAL;
+            return -1;
+        }
+        handle->at += in.pos;
+        handle->left -= in.pos;
+        return out.pos;
+    }
+#endif
+#if HAVE_LZ4
+    case dnswire_compression_lz4: {
+        size_t in_len = handle->left;
+
+        n = len;
+        if (LZ4F_isError(LZ4F_decompress(handle->ctx, data, &n, &handle->buf[handle->at], &in_len, 0))) {
+            errno = EINVAL;
+            return -1;
+        }
+        handle->at += in_len;
+        handle->left -= in_len;
+        return n;
+    }
+#endif
+    default:
+        break;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+ssize_t dnswire_decompressor_read(struct dnswire_decompressor* handle, int fd, uint8_t* data, size_t len)
+{
+    assert(handle);
+    assert(handle->buf);
+    assert(data);
+
+    while (1) {
+        if (handle->detected && (handle->left || handle->more)) {
+            size_t  left = handle->left;
+            ssize_t n    = _decompress(handle, data, len);
+            if (n < 0) {
+                return n;
+            }
+            // a full output may have left decompressed data in the context
+            handle->more = (size_t)n == len;
+            if (n) {
+                return n;
+            }
+            if (left && handle->left == left) {
+                // no progress, the frame must be broken
+                errno = EINVAL;
+                return -1;
+            }
+            if (handle->left) {
+                continue;
+            }
+        }
+        if (!handle->left) {
+            handle->at = 0;
+            if (handle->detected && handle->compression == dnswire_compression_none) {
+                return read(fd, data, len);
+            }
+        } else if (handle->at) {
+            memmove(handle->buf, &handle->buf[handle->at], handle->left);
+            handle->at = 0;
+        }
+
+        ssize_t nread = read(fd, &handle->buf[handle->left], handle->size - handle->left);
+        if (nread < 0) {
+            return nread;
+        }
+        handle->left += nread;
+
+        if (!handle->detected && (handle->left >= 4 || (!nread && handle->left))) {
+            if (_detect(handle)) {
+                return -1;
+            }
+            continue;
+        }
+        if (!nread) {
+            return 0;
+        }
+    }
+}
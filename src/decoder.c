@@ -165,6 +165,9 @@ enum dnswire_result dnswire_decoder_decode(struct dnswire_decoder* handle, const
     case dnswire_decoder_reading_frames:
         switch (tinyframe_read(&handle->reader, data, len)) {
         case tinyframe_have_frame:
+            if (handle->raw) {
+                return dnswire_have_frame;
+            }
             dnstap_cleanup(&handle->dnstap);
             if (dnstap_decode_protobuf(&handle->dnstap, handle->reader.frame.data, handle->reader.frame.length)) {
                 return dnswire_error;
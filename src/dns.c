@@ -0,0 +1,576 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/dns.h"
+#include "dnswire/trace.h"
+#include "util.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(HAVE_IMMINTRIN_H) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+enum dnswire_result dnswire_dns_parse(struct dnswire_dns* handle, const uint8_t* buf, size_t len)
+{
+    assert(handle);
+
+    size_t at, labels = 0;
+
+    memset(handle, 0, sizeof(struct dnswire_dns));
+
+    if (!buf || len < DNSWIRE_DNS_HEADER_SIZE) {
+        return dnswire_error;
+    }
+    handle->id      = _get16(&buf[0]);
+    handle->flags   = _get16(&buf[2]);
+    handle->qdcount = _get16(&buf[4]);
+    handle->ancount = _get16(&buf[6]);
+    handle->nscount = _get16(&buf[8]);
+    handle->arcount = _get16(&buf[10]);
+    handle->end     = DNSWIRE_DNS_HEADER_SIZE;
+
+    if (!handle->qdcount) {
+        return dnswire_ok;
+    }
+
+    /*
+     * Walk the labels of QNAME, a name in the question is never
+     * compressed in practice so pointers (and extended label types) are
+     * not followed.
+     */
+    at = DNSWIRE_DNS_HEADER_SIZE;
+    while (1) {
+        if (at >= len) {
+            return dnswire_error;
+        }
+        uint8_t l = buf[at];
+        if (!l) {
+            break;
+        }
+        if (l > 63) {
+            return dnswire_error;
+        }
+        at += 1 + l;
+        labels++;
+        if (at + 1 - DNSWIRE_DNS_HEADER_SIZE > DNSWIRE_DNS_MAX_NAME) {
+            return dnswire_error;
+        }
+    }
+    at++;
+    if (len - at < 4) {
+        return dnswire_error;
+    }
+
+    handle->has_question = true;
+    handle->qname        = &buf[DNSWIRE_DNS_HEADER_SIZE];
+    handle->qname_length = at - DNSWIRE_DNS_HEADER_SIZE;
+    handle->labels       = labels;
+    handle->qtype        = _get16(&buf[at]);
+    handle->qclass       = _get16(&buf[at + 2]);
+    handle->end          = at + 4;
+
+    return dnswire_ok;
+}
+
+size_t dnswire_dns_parse_batch(struct dnswire_dns* handle, enum dnswire_result* results, const uint8_t* const* bufs, const size_t* lens, size_t n)
+{
+    assert(handle);
+    assert(results);
+    assert(bufs);
+    assert(lens);
+
+    size_t i, parsed = 0;
+
+    for (i = 0; i < n; i++) {
+        results[i] = dnswire_dns_parse(&handle[i], bufs[i], lens[i]);
+        parsed += results[i] == dnswire_ok;
+    }
+
+    return parsed;
+}
+
+/*
+ * Skip a name, it ends with the root label or a compression pointer.
+ */
+static inline int _skip_name(const uint8_t* buf, size_t len, size_t* at)
+{
+    while (*at < len) {
+        uint8_t l = buf[*at];
+
+        if (!l) {
+            (*at)++;
+            return 0;
+        }
+        if ((l & 0xc0) == 0xc0) {
+            *at += 2;
+            return *at <= len ? 0 : -1;
+        }
+        if (l > 63) {
+            return -1;
+        }
+        *at += 1 + l;
+    }
+    return -1;
+}
+
+static enum dnswire_result _options(struct dnswire_dns_edns* handle, const uint8_t* p, size_t len)
+{
+    while (len) {
+        if (len < 4) {
+            return dnswire_error;
+        }
+        uint16_t code = _get16(p), olen = _get16(p + 2);
+        p += 4;
+        len -= 4;
+        if (olen > len) {
+            return dnswire_error;
+        }
+
+        switch (code) {
+        case DNSWIRE_DNS_EDNS_ECS:
+            if (olen < 4) {
+                return dnswire_error;
+            }
+            handle->has_ecs            = true;
+            handle->ecs_family         = _get16(p);
+            handle->ecs_source         = p[2];
+            handle->ecs_scope          = p[3];
+            handle->ecs_address        = p + 4;
+            handle->ecs_address_length = olen - 4;
+            break;
+
+        case DNSWIRE_DNS_EDNS_COOKIE:
+            handle->has_cookie    = true;
+            handle->cookie        = p;
+            handle->cookie_length = olen;
+            break;
+        }
+        handle->options++;
+        p += olen;
+        len -= olen;
+    }
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_dns_edns(struct dnswire_dns_edns* handle, const struct dnswire_dns* dns, const uint8_t* buf, size_t len)
+{
+    assert(handle);
+    assert(dns);
+
+    size_t at = dns->end, i, skip;
+
+    memset(handle, 0, sizeof(struct dnswire_dns_edns));
+
+    if (!buf || at < DNSWIRE_DNS_HEADER_SIZE || at > len || (dns->qdcount && !dns->has_question)) {
+        // not parsed, or not successfully
+        return dnswire_error;
+    }
+    if (!dns->arcount) {
+        return dnswire_ok;
+    }
+
+    // any other questions than the one parsed
+    for (i = 1; i < dns->qdcount; i++) {
+        if (_skip_name(buf, len, &at) || len - at < 4) {
+            return dnswire_error;
+        }
+        at += 4;
+    }
+
+    /*
+     * Skip the answer and authority records and look for the OPT in the
+     * additional records.
+     */
+    skip = (size_t)dns->ancount + dns->nscount;
+    for (i = 0; i < skip + dns->arcount; i++) {
+        size_t name = at;
+
+        if (_skip_name(buf, len, &at) || len - at < 10) {
+            return dnswire_error;
+        }
+        uint16_t type = _get16(&buf[at]), rdlength = _get16(&buf[at + 8]);
+        if (len - at - 10 < rdlength) {
+            return dnswire_error;
+        }
+
+        if (i >= skip && type == DNSWIRE_DNS_TYPE_OPT && !buf[name]) {
+            handle->present        = true;
+            handle->udp_size       = _get16(&buf[at + 2]);
+            handle->extended_rcode = buf[at + 4];
+            handle->version        = buf[at + 5];
+            handle->do_bit         = (buf[at + 6] & 0x80) ? true : false;
+            return _options(handle, &buf[at + 10], rdlength);
+        }
+        at += 10 + rdlength;
+    }
+
+    return dnswire_ok;
+}
+
+size_t dnswire_dns_edns_batch(struct dnswire_dns_edns* handle, enum dnswire_result* results, const struct dnswire_dns* dns, const uint8_t* const* bufs, const size_t* lens, size_t n)
+{
+    assert(handle);
+    assert(results);
+    assert(dns);
+    assert(bufs);
+    assert(lens);
+
+    size_t i, present = 0;
+
+    for (i = 0; i < n; i++) {
+        results[i] = dnswire_dns_edns(&handle[i], &dns[i], bufs[i], lens[i]);
+        present += handle[i].present;
+    }
+
+    return present;
+}
+
+/*
+ * Header statistics, messages are gathered in chunks small enough that
+ * the 16 bit counters used while counting a chunk can not overflow.
+ */
+
+#define STATS_CHUNK 256
+
+void dnswire_dns_stats_clear(struct dnswire_dns_stats* handle)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_dns_stats));
+}
+
+void dnswire_dns_stats_merge(struct dnswire_dns_stats* handle, const struct dnswire_dns_stats* other)
+{
+    assert(handle);
+    assert(other);
+
+    size_t i;
+
+    handle->messages += other->messages;
+    handle->invalid += other->invalid;
+    handle->qr += other->qr;
+    handle->aa += other->aa;
+    handle->tc += other->tc;
+    handle->rd += other->rd;
+    handle->ra += other->ra;
+    handle->ad += other->ad;
+    handle->cd += other->cd;
+    for (i = 0; i < 16; i++) {
+        handle->opcode[i] += other->opcode[i];
+        handle->rcode[i] += other->rcode[i];
+    }
+    handle->questions += other->questions;
+    for (i = 0; i < 256; i++) {
+        handle->qtype[i] += other->qtype[i];
+    }
+    handle->qtype_other += other->qtype_other;
+}
+
+static inline int _qtype(const uint8_t* msg, size_t len, uint16_t* qtype)
+{
+    size_t at = DNSWIRE_DNS_HEADER_SIZE;
+
+    while (at < len) {
+        uint8_t l = msg[at];
+
+        if (!l) {
+            if (len - at < 3) {
+                return -1;
+            }
+            *qtype = _get16(&msg[at + 1]);
+            return 0;
+        }
+        if (l > 63) {
+            return -1;
+        }
+        at += 1 + l;
+    }
+    return -1;
+}
+
+// QR, AA, TC, RD, RA, AD, CD
+static const unsigned _flag_bits[7] = { 15, 10, 9, 8, 7, 5, 4 };
+
+#ifdef USE_X86_SIMD
+__attribute__((target("sse2"))) static size_t _count_flags_sse2(const uint16_t* flags, size_t n, size_t* counts)
+{
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i       qr = _mm_setzero_si128(), aa = qr, tc = qr, rd = qr, ra = qr, ad = qr, cd = qr;
+    uint16_t      lanes[8];
+    size_t        i, j;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&flags[i]);
+        qr        = _mm_add_epi16(qr, _mm_and_si128(_mm_srli_epi16(v, 15), one));
+        aa        = _mm_add_epi16(aa, _mm_and_si128(_mm_srli_epi16(v, 10), one));
+        tc        = _mm_add_epi16(tc, _mm_and_si128(_mm_srli_epi16(v, 9), one));
+        rd        = _mm_add_epi16(rd, _mm_and_si128(_mm_srli_epi16(v, 8), one));
+        ra        = _mm_add_epi16(ra, _mm_and_si128(_mm_srli_epi16(v, 7), one));
+        ad        = _mm_add_epi16(ad, _mm_and_si128(_mm_srli_epi16(v, 5), one));
+        cd        = _mm_add_epi16(cd, _mm_and_si128(_mm_srli_epi16(v, 4), one));
+    }
+
+    __m128i acc[7] = { qr, aa, tc, rd, ra, ad, cd };
+    for (j = 0; j < 7; j++) {
+        _mm_storeu_si128((__m128i*)lanes, acc[j]);
+        counts[j] += lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    }
+    return i;
+}
+#endif
+
+static void _count_flags(struct dnswire_dns_stats* handle, const uint16_t* flags, size_t n)
+{
+    size_t counts[7] = { 0 }, i = 0, j;
+
+#ifdef USE_X86_SIMD
+    if (n >= 8 && __builtin_cpu_supports("sse2")) {
+        i = _count_flags_sse2(flags, n, counts);
+    }
+#endif
+    for (; i < n; i++) {
+        for (j = 0; j < 7; j++) {
+            counts[j] += (flags[i] >> _flag_bits[j]) & 1;
+        }
+    }
+
+    handle->qr += counts[0];
+    handle->aa += counts[1];
+    handle->tc += counts[2];
+    handle->rd += counts[3];
+    handle->ra += counts[4];
+    handle->ad += counts[5];
+    handle->cd += counts[6];
+}
+
+void dnswire_dns_stats_add(struct dnswire_dns_stats* handle, const uint8_t* const* msgs, const size_t* lens, size_t n)
+{
+    assert(handle);
+    assert(msgs || !n);
+    assert(lens || !n);
+
+    uint16_t flags[STATS_CHUNK], qtypes[STATS_CHUNK];
+    uint16_t opcode[4][16], rcode[4][16], qtype[4][256];
+    size_t   i = 0, j, k;
+
+    while (i < n) {
+        size_t m = 0, q = 0, end = n - i > STATS_CHUNK ? i + STATS_CHUNK : n;
+
+        /*
+         * Gather the flags and QTYPEs of the chunk.
+         */
+        for (; i < end; i++) {
+            if (!msgs[i] || lens[i] < DNSWIRE_DNS_HEADER_SIZE) {
+                handle->invalid++;
+                continue;
+            }
+            flags[m++] = _get16(&msgs[i][2]);
+            if (_get16(&msgs[i][4]) && !_qtype(msgs[i], lens[i], &qtypes[q])) {
+                q++;
+            }
+        }
+        handle->messages += m;
+        handle->questions += q;
+
+        _count_flags(handle, flags, m);
+
+        /*
+         * Histograms with four sets of counters used in turn, so that
+         * runs of the same value do not wait on the previous increment.
+         */
+        memset(opcode, 0, sizeof(opcode));
+        memset(rcode, 0, sizeof(rcode));
+        for (j = 0; j < m; j++) {
+            opcode[j & 3][(flags[j] >> 11) & 0xf]++;
+            rcode[j & 3][flags[j] & 0xf]++;
+        }
+        for (k = 0; k < 16; k++) {
+            handle->opcode[k] += opcode[0][k] + opcode[1][k] + opcode[2][k] + opcode[3][k];
+            handle->rcode[k] += rcode[0][k] + rcode[1][k] + rcode[2][k] + rcode[3][k];
+        }
+
+        if (q) {
+            memset(qtype, 0, sizeof(qtype));
+            for (j = 0; j < q; j++) {
+                if (qtypes[j] < 256) {
+                    qtype[j & 3][qtypes[j]]++;
+                } else {
+                    handle->qtype_other++;
+                }
+            }
+            for (k = 0; k < 256; k++) {
+                handle->qtype[k] += qtype[0][k] + qtype[1][k] + qtype[2][k] + qtype[3][k];
+            }
+        }
+    }
+}
+
+void dnswire_dns_stats_add_column(struct dnswire_dns_stats* handle, const struct dnswire_column_data* column)
+{
+    assert(handle);
+    assert(column);
+
+    const uint8_t* msgs[STATS_CHUNK];
+    size_t         lens[STATS_CHUNK], i, m = 0;
+
+    for (i = 0; i < column->rows; i++) {
+        if (!dnswire_column_data_is_present(*column, i)) {
+            continue;
+        }
+        msgs[m]   = dnswire_column_data_bytes(*column, i);
+        lens[m++] = dnswire_column_data_length(*column, i);
+        if (m == STATS_CHUNK) {
+            dnswire_dns_stats_add(handle, msgs, lens, m);
+            m = 0;
+        }
+    }
+    if (m) {
+        dnswire_dns_stats_add(handle, msgs, lens, m);
+    }
+}
+
+/*
+ * Lowercase kernels, SSE2 and AVX2 move 'A'..'Z' to the lowest signed
+ * values by adding 0x80 - 'A' so one signed compare finds them.
+ */
+
+static void _lower(uint8_t* out, const uint8_t* in, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        out[i] = in[i] >= 'A' && in[i] <= 'Z' ? in[i] | 0x20 : in[i];
+    }
+}
+
+#ifdef USE_X86_SIMD
+__attribute__((target("sse2"))) static void _lower_sse2(uint8_t* out, const uint8_t* in, size_t len)
+{
+    const __m128i shift = _mm_set1_epi8(0x80 - 'A');
+    const __m128i limit = _mm_set1_epi8(-128 + 26);
+    const __m128i bit   = _mm_set1_epi8(0x20);
+    size_t        i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v     = _mm_loadu_si128((const __m128i*)&in[i]);
+        __m128i upper = _mm_cmplt_epi8(_mm_add_epi8(v, shift), limit);
+        _mm_storeu_si128((__m128i*)&out[i], _mm_or_si128(v, _mm_and_si128(upper, bit)));
+    }
+    _lower(&out[i], &in[i], len - i);
+}
+
+__attribute__((target("avx2"))) static void _lower_avx2(uint8_t* out, const uint8_t* in, size_t len)
+{
+    const __m256i shift = _mm256_set1_epi8(0x80 - 'A');
+    const __m256i limit = _mm256_set1_epi8(-128 + 26);
+    const __m256i bit   = _mm256_set1_epi8(0x20);
+    size_t        i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v     = _mm256_loadu_si256((const __m256i*)&in[i]);
+        __m256i upper = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, shift));
+        _mm256_storeu_si256((__m256i*)&out[i], _mm256_or_si256(v, _mm256_and_si256(upper, bit)));
+    }
+    _lower(&out[i], &in[i], len - i);
+}
+#endif
+
+void dnswire_dns_name_lower(uint8_t* out, const uint8_t* in, size_t len)
+{
+    assert(out || !len);
+    assert(in || !len);
+
+#ifdef USE_X86_SIMD
+    if (len >= 32 && __builtin_cpu_supports("avx2")) {
+        _lower_avx2(out, in, len);
+        return;
+    }
+    if (len >= 16 && __builtin_cpu_supports("sse2")) {
+        _lower_sse2(out, in, len);
+        return;
+    }
+#endif
+    _lower(out, in, len);
+}
+
+ssize_t dnswire_dns_name_string(const uint8_t* name, size_t length, char* out, size_t size)
+{
+    assert(name || !length);
+    assert(out);
+
+    size_t at = 0, o = 0;
+
+    while (at < length) {
+        uint8_t l = name[at++];
+
+        if (!l) {
+            if (!o) {
+                if (o + 1 >= size) {
+                    return -1;
+                }
+                out[o++] = '.';
+            }
+            if (o >= size) {
+                return -1;
+            }
+            out[o] = 0;
+            return o;
+        }
+        if (l > 63 || l > length - at) {
+            return -1;
+        }
+        for (; l; l--, at++) {
+            uint8_t c = name[at];
+
+            if (c <= ' ' || c > '~') {
+                if (o + 4 >= size) {
+                    return -1;
+                }
+                snprintf(&out[o], 5, "\\%03u", c);
+                o += 4;
+            } else if (strchr(".\\\"();@$", c)) {
+                if (o + 2 >= size) {
+                    return -1;
+                }
+                out[o++] = '\\';
+                out[o++] = c;
+            } else {
+                if (o + 1 >= size) {
+                    return -1;
+                }
+                out[o++] = c;
+            }
+        }
+        if (o + 1 >= size) {
+            return -1;
+        }
+        out[o++] = '.';
+    }
+
+    // no root label
+    return -1;
+}
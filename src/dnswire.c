@@ -31,4 +31,5 @@ const char* const dnswire_result_string[] = {
     "have_dnstap",
     "endofdata",
     "bidirectional",
+    "have_frame",
 };
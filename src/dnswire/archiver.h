@@ -0,0 +1,109 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/encoder.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_archiver
+#define __dnswire_h_archiver 1
+
+/*
+ * A file writer for local archiving that keeps the written data out of the
+ * page cache, so that archiving does not evict the pages the DNS server
+ * itself relies on.
+ *
+ * Frames are encoded into one of two aligned buffers and once full the
+ * buffer is written by a background thread while encoding continues into
+ * the other, encoding only waits if the disk can not keep up (counted as
+ * stalls).
+ *
+ * The file is opened with O_DIRECT if requested and supported by the
+ * file system, full buffers are then written directly at aligned offsets
+ * and the last buffer is padded and the file truncated when closed.
+ * Otherwise the buffers are written normally and flushed with
+ * `sync_file_range()` (or `fdatasync()`) and then dropped from the page
+ * cache with `posix_fadvise(POSIX_FADV_DONTNEED)`.
+ *
+ * Attributes:
+ * - direct: If O_DIRECT should be tried, after opening if it is used, it
+ *   is also turned off if the file system fails the first O_DIRECT write
+ * - frame: Scratch buffer frames are encoded into before being copied to
+ *   the aligned buffers
+ * - active, fill: The buffer being filled and how much is in it
+ * - offset: The file offset of the active buffer
+ * - opened: If a file is open
+ * - busy, pending, pending_len, pending_offset: The buffer being written
+ *   by the background thread
+ * - blocks, stalls: Counters of buffers written and of times encoding had
+ *   to wait for the background thread
+ */
+struct dnswire_archiver {
+    int                    fd;
+    bool                   direct, opened;
+    struct dnswire_encoder encoder;
+    uint8_t*               frame;
+    size_t                 frame_size;
+
+    uint8_t* bufs[2];
+    size_t   buf_size, active, fill;
+    uint64_t offset;
+
+    pthread_t       thread;
+    bool            started, stop, failed;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bool            busy;
+    size_t          pending, pending_len;
+    uint64_t        pending_offset;
+
+    size_t blocks, stalls;
+};
+
+#define DNSWIRE_ARCHIVER_ALIGNMENT 4096
+#define DNSWIRE_ARCHIVER_DEFAULT_BUF_SIZE (1024 * 1024)
+
+enum dnswire_result dnswire_archiver_init(struct dnswire_archiver*);
+void                dnswire_archiver_destroy(struct dnswire_archiver*);
+
+/*
+ * The buffer size must be a multiple of DNSWIRE_ARCHIVER_ALIGNMENT and set
+ * before opening, if O_DIRECT can not be used (or is not wanted) the file
+ * is written normally and dropped from the page cache after each buffer.
+ */
+#define dnswire_archiver_set_buf_size(a, v) (a).buf_size = v
+#define dnswire_archiver_set_direct(a, v) (a).direct = v
+#define dnswire_archiver_is_direct(a) (a).direct
+
+/*
+ * Open the file and start the background thread, write DNSTAP messages
+ * and close it to write the STOP frame and what is left in the buffer.
+ */
+enum dnswire_result dnswire_archiver_open(struct dnswire_archiver*, const char*);
+enum dnswire_result dnswire_archiver_write(struct dnswire_archiver*, const struct dnstap*);
+enum dnswire_result dnswire_archiver_close(struct dnswire_archiver*);
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/frame.h>
+#include <dnswire/relay.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_balancer
+#define __dnswire_h_balancer 1
+
+enum dnswire_balancer_endpoint_health {
+    dnswire_balancer_endpoint_healthy = 0,
+    dnswire_balancer_endpoint_stalled = 1,
+    dnswire_balancer_endpoint_down    = 2,
+};
+extern const char* const dnswire_balancer_endpoint_health_string[];
+
+/*
+ * Attributes:
+ * - destination: The connection to the endpoint, see
+ *   `struct dnswire_relay_destination`
+ * - health: The endpoint is stalled if its queue fill reaches the stall
+ *   limit or if nothing has been written for the stall timeout while frames
+ *   are queued, and healthy again once the queue is below half the limit
+ *   and progress is made, it is down if the connection has failed
+ * - last_bytes, last_progress: Used to detect progress
+ * - bidirectional, queue_size, policy: Used when reconnecting
+ */
+struct dnswire_balancer_endpoint {
+    struct dnswire_relay_destination      destination;
+    enum dnswire_balancer_endpoint_health health;
+    size_t                                last_bytes;
+    uint64_t                              last_progress;
+    bool                                  bidirectional;
+    size_t                                queue_size;
+    enum dnswire_frame_queue_policy       policy;
+};
+
+struct dnswire_balancer_vnode {
+    uint32_t hash;
+    size_t   endpoint;
+};
+
+/*
+ * Consistent-hash messages over a set of endpoints (collectors) by client
+ * address or identity.
+ *
+ * Each endpoint has a number of virtual nodes on a hash ring and a key is
+ * sent to the endpoint of the first virtual node at or after its hash. An
+ * endpoint that is not healthy is skipped, but kept on the ring, so only
+ * its own keys move to the following endpoints and they move back when it
+ * is healthy again.
+ *
+ * Attributes:
+ * - vnodes: Virtual nodes per endpoint, set before adding endpoints
+ * - stall_fill: Queue fill, in percent, at which an endpoint is stalled
+ * - stall_timeout: Milliseconds without progress, while frames are queued,
+ *   before an endpoint is stalled, 0 to disable
+ * - routed, rerouted, unrouted: Counters of frames sent to their endpoint,
+ *   sent to another endpoint and not sent since no endpoint was healthy
+ */
+struct dnswire_balancer {
+    struct dnswire_balancer_endpoint* endpoints;
+    size_t                            num_endpoints;
+    struct dnswire_balancer_vnode*    ring;
+    size_t                            ring_size, next;
+
+    size_t   vnodes, stall_fill;
+    uint64_t stall_timeout;
+
+    size_t routed, rerouted, unrouted;
+};
+
+#define DNSWIRE_BALANCER_DEFAULT_VNODES 128
+#define DNSWIRE_BALANCER_DEFAULT_STALL_FILL 75
+#define DNSWIRE_BALANCER_DEFAULT_STALL_TIMEOUT 100
+
+enum dnswire_result dnswire_balancer_init(struct dnswire_balancer*);
+void                dnswire_balancer_destroy(struct dnswire_balancer*);
+
+#define dnswire_balancer_set_vnodes(b, n) (b).vnodes = n
+#define dnswire_balancer_set_stall_fill(b, f) (b).stall_fill = f
+#define dnswire_balancer_set_stall_timeout(b, ms) (b).stall_timeout = ms
+#define dnswire_balancer_endpoints(b) (b).num_endpoints
+#define dnswire_balancer_endpoint(b, i) (&(b).endpoints[i])
+
+enum dnswire_result dnswire_balancer_add_endpoint(struct dnswire_balancer*, int, bool, size_t, enum dnswire_frame_queue_policy);
+enum dnswire_result dnswire_balancer_reconnect(struct dnswire_balancer*, size_t, int);
+
+/*
+ * Route a key to a healthy endpoint, returns NULL if there is none.
+ */
+struct dnswire_balancer_endpoint* dnswire_balancer_route(struct dnswire_balancer*, const uint8_t*, size_t);
+
+/*
+ * Queue a frame, or a DNSTAP message keyed by its query address or else
+ * its identity, frames without a key are sent round-robin.
+ *
+ * Returns dnswire_ok if queued, dnswire_again if a frame was dropped by the
+ * endpoint's queue or dnswire_error if no endpoint was healthy.
+ */
+enum dnswire_result dnswire_balancer_write_frame(struct dnswire_balancer*, struct dnswire_frame*, const uint8_t*, size_t);
+enum dnswire_result dnswire_balancer_write_dnstap(struct dnswire_balancer*, const struct dnstap*);
+enum dnswire_result dnswire_balancer_write(struct dnswire_balancer*, size_t);
+void                dnswire_balancer_check(struct dnswire_balancer*);
+enum dnswire_result dnswire_balancer_stop(struct dnswire_balancer*);
+
+#endif
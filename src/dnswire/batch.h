@@ -0,0 +1,154 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/reader.h>
+#include <dnswire/columnar.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_batch
+#define __dnswire_h_batch 1
+
+/*
+ * The Arrow C Data Interface, see
+ * https://arrow.apache.org/docs/format/CDataInterface.html
+ *
+ * These are defined by the specification and only needs to be defined
+ * once, even if there are other headers defining them.
+ */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    // Array type description
+    const char*          format;
+    const char*          name;
+    const char*          metadata;
+    int64_t              flags;
+    int64_t              n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema*  dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowSchema*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+struct ArrowArray {
+    // Array data description
+    int64_t             length;
+    int64_t             null_count;
+    int64_t             offset;
+    int64_t             n_buffers;
+    int64_t             n_children;
+    const void**        buffers;
+    struct ArrowArray** children;
+    struct ArrowArray*  dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowArray*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+#endif // ARROW_C_DATA_INTERFACE
+
+/*
+ * A batch of decoded DNSTAP messages stored as a struct of arrays, one
+ * column per field (see `enum dnswire_column`), so that messages can be
+ * processed a column at a time instead of one `struct dnstap` at a time.
+ *
+ * Numeric columns are arrays of 64 bit values and bytes columns are
+ * offsets into a bytes arena, each with a bitmap of the rows that have a
+ * value. This is the same layout as Arrow uses for its `uint64` and
+ * `binary` arrays so the columns can be exported without copying.
+ *
+ * Attributes:
+ * - capacity: The number of rows the batch holds when full
+ * - rows: The number of rows in the batch
+ * - columns: The values of each column
+ */
+struct dnswire_batch {
+    size_t                     capacity, rows;
+    struct dnswire_column_data columns[DNSWIRE_COLUMNS];
+};
+
+#define DNSWIRE_BATCH_DEFAULT_CAPACITY 4096
+
+enum dnswire_result dnswire_batch_init(struct dnswire_batch*, size_t);
+void                dnswire_batch_destroy(struct dnswire_batch*);
+
+#define dnswire_batch_rows(b) (b).rows
+#define dnswire_batch_is_full(b) ((b).rows >= (b).capacity)
+#define dnswire_batch_column(b, c) (&(b).columns[c])
+
+/*
+ * Remove all rows from the batch.
+ */
+enum dnswire_result dnswire_batch_clear(struct dnswire_batch*);
+
+/*
+ * Add a DNSTAP message to the batch as a row, fails if the batch is full.
+ */
+enum dnswire_result dnswire_batch_add(struct dnswire_batch*, const struct dnstap*);
+
+/*
+ * Read and decode DNSTAP messages from the file descriptor with the
+ * reader into the batch until it is full.
+ *
+ * Returns `dnswire_ok` when the batch is full, `dnswire_endofdata` when
+ * the stream has ended (the batch may still have rows) or what the reader
+ * returned otherwise: `dnswire_again` if it made progress without a
+ * message or the file descriptor would block (call again or poll), or
+ * `dnswire_error`.
+ */
+enum dnswire_result dnswire_batch_read(struct dnswire_batch*, struct dnswire_reader*, int);
+
+/*
+ * Export the batch as an Arrow struct array with one child array per
+ * column, named as in `dnswire_column_string[]`. Numeric columns are
+ * exported as `uint64` and bytes columns as `binary`.
+ *
+ * The buffers of the batch are moved to the array without copying and
+ * are freed when the consumer calls its release callback, the batch is
+ * left empty and allocates new buffers as rows are added.
+ *
+ * The schema is optional, if given it describes the array and must also
+ * be released by the consumer.
+ */
+enum dnswire_result dnswire_batch_export(struct dnswire_batch*, struct ArrowArray*, struct ArrowSchema*);
+
+/*
+ * Export a single column, as returned by `dnswire_columnar_reader_read()`
+ * for example, as an Arrow array in the same way as the batch.
+ */
+enum dnswire_result dnswire_column_data_export(struct dnswire_column_data*, enum dnswire_column, struct ArrowArray*, struct ArrowSchema*);
+
+#endif
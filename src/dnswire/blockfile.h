@@ -0,0 +1,162 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/encoder.h>
+#include <dnswire/decoder.h>
+#include <dnswire/compression.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_blockfile
+#define __dnswire_h_blockfile 1
+
+/*
+ * A seekable container of independently compressed blocks, each block is
+ * a complete DNSTAP stream (START, DATA frames and STOP) so that it can be
+ * decompressed and decoded on its own. The blocks are followed by an index
+ * of their offsets and time ranges, found from the trailer at the end of
+ * the file.
+ *
+ * The file is a header, the blocks, the index and the trailer, all big
+ * endian:
+ * - header: magic (8 bytes), compression (32 bits), block size (32 bits)
+ * - per block in the index: offset (64 bits), length (32 bits), size
+ *   uncompressed (32 bits), frames (32 bits), min (64 bits), max (64 bits)
+ * - trailer: index offset (64 bits), number of blocks (64 bits), magic
+ *   (8 bytes)
+ *
+ * Attributes:
+ * - offset, length: Where the compressed block is in the file
+ * - size: The size of the block uncompressed
+ * - frames: Number of DNSTAP messages in the block
+ * - min, max: The lowest and highest `query_time_sec`/`response_time_sec`
+ *   of the messages in the block
+ * - seek: The highest time in this and all previous blocks, used to find
+ *   the block to seek to
+ */
+struct dnswire_blockfile_block {
+    uint64_t offset, min, max, seek;
+    uint32_t length, size, frames;
+};
+
+#define DNSWIRE_BLOCKFILE_MAGIC "DNSWBLK1"
+#define DNSWIRE_BLOCKFILE_DEFAULT_BLOCK_SIZE (1024 * 1024)
+
+/*
+ * Frames are encoded into the block until it reaches the block size, it
+ * is then compressed and written. Closing writes the last block, the
+ * index and the trailer but does not close the file descriptor.
+ *
+ * Attributes:
+ * - buf, size, at: The block being encoded
+ * - out, out_size: The compressed block
+ * - offset: Where the next block will be written
+ * - blocks, num_blocks: The index
+ */
+struct dnswire_blockfile_writer {
+    int                      fd;
+    enum dnswire_compression compression;
+    int                      level;
+    size_t                   block_size;
+    bool                     opened;
+
+    struct dnswire_encoder encoder;
+    uint8_t*               buf;
+    size_t                 size, at;
+    uint8_t*               out;
+    size_t                 out_size;
+    uint64_t               offset;
+
+    struct dnswire_blockfile_block* blocks;
+    size_t                          num_blocks, blocks_size;
+};
+
+/*
+ * Initialize with the compression to use, fails if the library was not
+ * built with it.
+ */
+enum dnswire_result dnswire_blockfile_writer_init(struct dnswire_blockfile_writer*, enum dnswire_compression);
+void                dnswire_blockfile_writer_destroy(struct dnswire_blockfile_writer*);
+
+#define dnswire_blockfile_writer_set_level(w, v) (w).level = v
+#define dnswire_blockfile_writer_set_block_size(w, v) (w).block_size = v
+#define dnswire_blockfile_writer_blocks(w) (w).num_blocks
+
+enum dnswire_result dnswire_blockfile_writer_open(struct dnswire_blockfile_writer*, int);
+enum dnswire_result dnswire_blockfile_writer_write(struct dnswire_blockfile_writer*, const struct dnstap*);
+enum dnswire_result dnswire_blockfile_writer_close(struct dnswire_blockfile_writer*);
+
+/*
+ * Opening reads the trailer and the index, messages can then be read in
+ * order with `dnswire_blockfile_reader_next()` or all blocks processed in
+ * parallel with `dnswire_blockfile_reader_run()`, each thread reading,
+ * decompressing and decoding one block at a time. Both start at the block
+ * last seeked to, either directly or to the first block that may have
+ * messages at or after the given time.
+ *
+ * The callback is called with the index of the block, messages of a block
+ * are given in order but blocks are processed in any order.
+ *
+ * Attributes:
+ * - start: The block to start from
+ * - current, in, buf, at, left, decoder: The block being read by
+ *   `dnswire_blockfile_reader_next()`
+ */
+struct dnswire_blockfile_reader {
+    int                      fd;
+    enum dnswire_compression compression;
+
+    struct dnswire_blockfile_block* blocks;
+    size_t                          num_blocks, start;
+
+    size_t                 current;
+    uint8_t*               in;
+    size_t                 in_size;
+    uint8_t*               buf;
+    size_t                 size, at, left;
+    struct dnswire_decoder decoder;
+
+    void (*callback)(size_t, const struct dnstap*, void*);
+    void* ctx;
+};
+
+enum dnswire_result dnswire_blockfile_reader_init(struct dnswire_blockfile_reader*);
+void                dnswire_blockfile_reader_destroy(struct dnswire_blockfile_reader*);
+
+#define dnswire_blockfile_reader_set_callback(r, f, c) \
+    (r).callback = f;                                  \
+    (r).ctx      = c
+#define dnswire_blockfile_reader_blocks(r) (r).num_blocks
+#define dnswire_blockfile_reader_block(r, i) (&(r).blocks[i])
+#define dnswire_blockfile_reader_compression(r) (r).compression
+#define dnswire_blockfile_reader_dnstap(r) dnswire_decoder_dnstap((r).decoder)
+
+enum dnswire_result dnswire_blockfile_reader_open(struct dnswire_blockfile_reader*, int);
+enum dnswire_result dnswire_blockfile_reader_seek(struct dnswire_blockfile_reader*, size_t);
+enum dnswire_result dnswire_blockfile_reader_seek_time(struct dnswire_blockfile_reader*, uint64_t);
+enum dnswire_result dnswire_blockfile_reader_next(struct dnswire_blockfile_reader*);
+enum dnswire_result dnswire_blockfile_reader_run(struct dnswire_blockfile_reader*, size_t);
+
+#endif
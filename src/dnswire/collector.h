@@ -0,0 +1,141 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/pool.h>
+#include <dnswire/reader.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#ifndef __dnswire_h_collector
+#define __dnswire_h_collector 1
+
+/*
+ * Per shard statistics, only updated by the shard's thread and read
+ * atomically with `dnswire_collector_stats()`.
+ *
+ * Attributes:
+ * - accepted: Connections accepted
+ * - active: Connections currently open
+ * - closed: Connections that ended with the stream being stopped
+ * - errors: Connections closed because of errors (or closed by the peer
+ *   without stopping the stream)
+ * - dnstaps: DNSTAP messages received, or frames submitted to the pool
+ */
+struct dnswire_collector_stats {
+    size_t accepted, active, closed, errors, dnstaps;
+};
+
+struct dnswire_collector_connection;
+struct dnswire_collector_connection {
+    struct dnswire_collector_connection *next, *prev;
+    int                                  fd;
+    struct dnswire_reader                reader;
+    struct dnswire_pool_source*          source;
+    struct dnswire_pool_batch*           batch;
+};
+
+struct dnswire_collector;
+
+/*
+ * Attributes:
+ * - collector, id: The collector the shard belongs to and its index
+ * - listen_fd: The shard's own listening socket, bound with SO_REUSEPORT,
+ *   or the socket shared by all shards if SO_REUSEPORT is not available
+ * - wake: Pipe used to wake the shard's event loop when stopping
+ * - connections: The shard's connections, each with its own reader
+ */
+struct dnswire_collector_shard {
+    struct dnswire_collector*            collector;
+    size_t                               id;
+    int                                  listen_fd;
+    int                                  wake[2];
+    pthread_t                            thread;
+    bool                                 started;
+    struct dnswire_collector_connection* connections;
+    size_t                               num_connections;
+    struct dnswire_collector_stats       stats;
+};
+
+/*
+ * A collector that listens on one address with N shards, each with its own
+ * event loop and set of `dnswire_reader` handles and nothing shared between
+ * them so that no locks are needed. Each shard has its own socket bound
+ * with SO_REUSEPORT and the kernel distributes the connections.
+ *
+ * Shards can be run as threads with `dnswire_collector_start()` or in the
+ * calling thread with `dnswire_collector_run()`, for example in processes
+ * forked after `dnswire_collector_listen()`.
+ *
+ * The callback is called by the shard that received the DNSTAP message,
+ * with the index of the shard so that any state can be kept per shard.
+ *
+ * If a pool is set the readers are put in raw mode and the shards only do
+ * the framing, the frames are submitted in batches to the pool and decoded
+ * by its workers which calls the pool's callback instead, with the shard
+ * (`struct dnswire_collector_shard*`) as the source context. Each connection
+ * is its own source so an ordered pool keeps the order per connection.
+ *
+ * Attributes:
+ * - addr: The address to listen on, updated with the bound address (port)
+ *   once listening
+ * - reuseport: If each shard has its own socket
+ */
+struct dnswire_collector {
+    struct sockaddr_storage         addr;
+    socklen_t                       addrlen;
+    int                             backlog;
+    bool                            allow_bidirectional, reuseport;
+    struct dnswire_collector_shard* shards;
+    size_t                          num_shards;
+
+    void (*callback)(size_t, const struct dnstap*, void*);
+    void*                ctx;
+    struct dnswire_pool* pool;
+
+    bool stop;
+};
+
+#define DNSWIRE_COLLECTOR_DEFAULT_BACKLOG 128
+
+enum dnswire_result dnswire_collector_init(struct dnswire_collector*, const struct sockaddr*, socklen_t, size_t);
+void                dnswire_collector_destroy(struct dnswire_collector*);
+
+#define dnswire_collector_set_callback(c, f, x) \
+    (c).callback = f;                           \
+    (c).ctx      = x
+#define dnswire_collector_allow_bidirectional(c, b) (c).allow_bidirectional = b
+#define dnswire_collector_set_backlog(c, b) (c).backlog = b
+#define dnswire_collector_set_pool(c, p) (c).pool = p
+#define dnswire_collector_shards(c) (c).num_shards
+
+enum dnswire_result dnswire_collector_listen(struct dnswire_collector*);
+enum dnswire_result dnswire_collector_run(struct dnswire_collector*, size_t);
+enum dnswire_result dnswire_collector_start(struct dnswire_collector*);
+enum dnswire_result dnswire_collector_stop(struct dnswire_collector*);
+enum dnswire_result dnswire_collector_join(struct dnswire_collector*);
+void                dnswire_collector_stats(const struct dnswire_collector*, size_t, struct dnswire_collector_stats*);
+
+#endif
@@ -0,0 +1,259 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/compression.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_columnar
+#define __dnswire_h_columnar 1
+
+/*
+ * The columns of the columnar format, one for each field of the DNSTAP
+ * message and the fields of the DNS header parsed from the query message
+ * (or the response message if there is no query message).
+ */
+enum dnswire_column {
+    dnswire_column_identity           = 0,
+    dnswire_column_version            = 1,
+    dnswire_column_extra              = 2,
+    dnswire_column_type               = 3,
+    dnswire_column_message_type       = 4,
+    dnswire_column_socket_family      = 5,
+    dnswire_column_socket_protocol    = 6,
+    dnswire_column_query_address      = 7,
+    dnswire_column_response_address   = 8,
+    dnswire_column_query_port         = 9,
+    dnswire_column_response_port      = 10,
+    dnswire_column_query_time_sec     = 11,
+    dnswire_column_query_time_nsec    = 12,
+    dnswire_column_query_message      = 13,
+    dnswire_column_query_zone         = 14,
+    dnswire_column_response_time_sec  = 15,
+    dnswire_column_response_time_nsec = 16,
+    dnswire_column_response_message   = 17,
+    dnswire_column_policy_type        = 18,
+    dnswire_column_policy_rule        = 19,
+    dnswire_column_policy_action      = 20,
+    dnswire_column_policy_match       = 21,
+    dnswire_column_policy_value       = 22,
+    dnswire_column_dns_id             = 23,
+    dnswire_column_dns_flags          = 24,
+    dnswire_column_dns_qdcount        = 25,
+    dnswire_column_dns_ancount        = 26,
+    dnswire_column_dns_nscount        = 27,
+    dnswire_column_dns_arcount        = 28,
+};
+#define DNSWIRE_COLUMNS 29
+extern const char* const dnswire_column_string[];
+
+/*
+ * How a column is encoded, chosen per column:
+ * - plain: Length and bytes of each value (messages and other blobs)
+ * - delta: Zigzag varint of the difference to the previous value
+ *   (timestamps)
+ * - varint: Each value as a varint
+ * - bitpack: Each value packed with the bits needed for the largest value
+ *   (enums and counts)
+ * - dict: A dictionary of the distinct values and bit packed indexes into
+ *   it (addresses, ports, identities), falls back to plain or varint if
+ *   the values are mostly distinct
+ */
+enum dnswire_column_encoding {
+    dnswire_column_encoding_plain   = 0,
+    dnswire_column_encoding_delta   = 1,
+    dnswire_column_encoding_varint  = 2,
+    dnswire_column_encoding_bitpack = 3,
+    dnswire_column_encoding_dict    = 4,
+};
+extern const char* const dnswire_column_encoding_string[];
+
+/*
+ * If the column holds bytes (or numeric values).
+ */
+bool dnswire_column_is_bytes(enum dnswire_column);
+
+/*
+ * The values of a column for a number of rows, as the writer collects
+ * them and as the reader decodes them.
+ *
+ * Attributes:
+ * - present: Bitmap of the rows that have a value, LSB first
+ * - values: The value of each row for numeric columns, 0 if not present
+ * - offsets, data: For bytes columns, the value of row `i` is in `data`
+ *   from `offsets[i]` to `offsets[i + 1]`
+ */
+struct dnswire_column_data {
+    size_t    rows;
+    uint8_t*  present;
+    uint64_t* values;
+    uint32_t* offsets;
+    uint8_t*  data;
+    size_t    present_size, values_size, offsets_size, data_size, data_len;
+};
+
+#define DNSWIRE_COLUMN_DATA_INITIALIZER { .rows = 0 }
+#define dnswire_column_data_is_present(c, i) (((c).present[(i) >> 3] >> ((i)&7)) & 1)
+#define dnswire_column_data_value(c, i) (c).values[i]
+#define dnswire_column_data_bytes(c, i) (&(c).data[(c).offsets[i]])
+#define dnswire_column_data_length(c, i) (size_t)((c).offsets[(i) + 1] - (c).offsets[i])
+void dnswire_column_data_destroy(struct dnswire_column_data*);
+
+/*
+ * Clear the column data and make room for a number of rows.
+ */
+enum dnswire_result dnswire_column_data_reset(struct dnswire_column_data*, enum dnswire_column, size_t);
+
+/*
+ * Add a row to each of the `DNSWIRE_COLUMNS` columns from a DNSTAP
+ * message, the DNS header is parsed from the query message or else the
+ * response message.
+ *
+ * The bytes of a column are limited to `INT32_MAX`, as for Arrow binary
+ * arrays, a message that does not fit fails and is not added to any
+ * column.
+ */
+enum dnswire_result dnswire_column_data_add(struct dnswire_column_data*, const struct dnstap*);
+
+/*
+ * Where a column of a row group is in the file.
+ *
+ * Attributes:
+ * - offset, length: The (compressed) chunk in the file
+ * - size: The size of the chunk uncompressed
+ * - min, max: The lowest and highest value of numeric columns (0 and
+ *   `UINT64_MAX` for bytes columns), `min` is higher than `max` if no row
+ *   has a value, used to skip groups
+ */
+struct dnswire_columnar_chunk {
+    uint64_t                     offset;
+    uint32_t                     length, size;
+    enum dnswire_column_encoding encoding;
+    uint64_t                     min, max;
+};
+
+struct dnswire_columnar_group {
+    size_t                        rows;
+    struct dnswire_columnar_chunk chunks[DNSWIRE_COLUMNS];
+};
+
+#define DNSWIRE_COLUMNAR_MAGIC "DNSWCOL1"
+#define DNSWIRE_COLUMNAR_DEFAULT_GROUP_ROWS 65536
+
+/*
+ * A columnar archive of DNSTAP messages, the messages are collected in row
+ * groups and once a group is full each column of it is encoded, compressed
+ * and written as its own chunk. The chunks are found from the footer at
+ * the end of the file so that a scan only reads the columns it needs.
+ *
+ * The file is a header, the chunks, the footer and the trailer, all big
+ * endian:
+ * - header: magic (8 bytes), compression (32 bits), columns (32 bits)
+ * - footer per group: rows (32 bits) and per column: offset (64 bits),
+ *   length (32 bits), size (32 bits), encoding (8 bits), min (64 bits),
+ *   max (64 bits)
+ * - trailer: footer offset (64 bits), number of groups (64 bits), magic
+ *   (8 bytes)
+ *
+ * Each chunk is the presence bitmap of the rows followed by the values
+ * of the present rows in the column's encoding.
+ *
+ * Attributes:
+ * - group_rows: The number of rows in a group
+ * - columns, rows: The group being collected
+ * - chunk: The chunk being encoded, `out` the compressed chunk
+ * - offset: Where the next chunk will be written
+ * - groups, num_groups: The footer
+ */
+struct dnswire_columnar_writer {
+    int                      fd;
+    enum dnswire_compression compression;
+    int                      level;
+    size_t                   group_rows;
+    bool                     opened;
+
+    struct dnswire_column_data columns[DNSWIRE_COLUMNS];
+    size_t                     rows;
+
+    uint8_t* chunk;
+    size_t   chunk_size, chunk_len;
+    uint8_t* out;
+    size_t   out_size;
+    uint64_t offset;
+
+    struct dnswire_columnar_group* groups;
+    size_t                         num_groups, groups_size;
+};
+
+enum dnswire_result dnswire_columnar_writer_init(struct dnswire_columnar_writer*, enum dnswire_compression);
+void                dnswire_columnar_writer_destroy(struct dnswire_columnar_writer*);
+
+#define dnswire_columnar_writer_set_level(w, v) (w).level = v
+#define dnswire_columnar_writer_set_group_rows(w, v) (w).group_rows = v
+
+/*
+ * Closing writes the last group, the footer and the trailer but does not
+ * close the file descriptor.
+ */
+enum dnswire_result dnswire_columnar_writer_open(struct dnswire_columnar_writer*, int);
+enum dnswire_result dnswire_columnar_writer_write(struct dnswire_columnar_writer*, const struct dnstap*);
+enum dnswire_result dnswire_columnar_writer_close(struct dnswire_columnar_writer*);
+
+/*
+ * Reads columns of row groups, columns that are not in the file (written
+ * by an older version) are read as not present in any row.
+ *
+ * Attributes:
+ * - columns: Number of columns in the file
+ * - in, raw: The chunk read and uncompressed
+ * - bytes_read: How much of the file that has been read for chunks
+ */
+struct dnswire_columnar_reader {
+    int                      fd;
+    enum dnswire_compression compression;
+    size_t                   columns;
+
+    struct dnswire_columnar_group* groups;
+    size_t                         num_groups;
+
+    uint8_t* in;
+    size_t   in_size;
+    uint8_t* raw;
+    size_t   raw_size;
+
+    size_t bytes_read;
+};
+
+enum dnswire_result dnswire_columnar_reader_init(struct dnswire_columnar_reader*);
+void                dnswire_columnar_reader_destroy(struct dnswire_columnar_reader*);
+
+#define dnswire_columnar_reader_groups(r) (r).num_groups
+#define dnswire_columnar_reader_group_rows(r, g) (r).groups[g].rows
+#define dnswire_columnar_reader_bytes_read(r) (r).bytes_read
+
+enum dnswire_result dnswire_columnar_reader_open(struct dnswire_columnar_reader*, int);
+enum dnswire_result dnswire_columnar_reader_read(struct dnswire_columnar_reader*, size_t, enum dnswire_column, struct dnswire_column_data*);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#ifndef __dnswire_h_compression
+#define __dnswire_h_compression 1
+
+/*
+ * Streaming compression of DNSTAP files and sockets, which compression is
+ * available depends on what the library was built with.
+ */
+enum dnswire_compression {
+    dnswire_compression_none = 0,
+    dnswire_compression_zstd = 1,
+    dnswire_compression_lz4  = 2,
+};
+extern const char* const dnswire_compression_string[];
+
+/*
+ * Detect the compression of a stream from its first bytes (the magic
+ * number of a zstd or LZ4 frame), needs at least 4 bytes.
+ */
+enum dnswire_compression dnswire_compression_detect(const uint8_t*, size_t);
+
+/*
+ * One-shot compression for formats that compress blocks independently,
+ * `dnswire_compression_bound()` gives the largest a compressed block can
+ * be. The length given is the size of the output buffer and is set to
+ * how much was written to it, decompressing fails unless the output is
+ * filled exactly. The level is ignored for no compression, which only
+ * copies.
+ */
+bool                dnswire_compression_is_available(enum dnswire_compression);
+size_t              dnswire_compression_bound(enum dnswire_compression, size_t);
+enum dnswire_result dnswire_compression_compress(enum dnswire_compression, int, const uint8_t*, size_t, uint8_t*, size_t*);
+enum dnswire_result dnswire_compression_decompress(enum dnswire_compression, const uint8_t*, size_t, uint8_t*, size_t*);
+
+/*
+ * The compressor takes the output of a writer in batches and compresses
+ * and writes them to the file descriptor in a background thread, the
+ * producer only copies the data and waits if both batches are in use
+ * (counted as stalls).
+ *
+ * Set it on the writer with `dnswire_writer_set_compressor()` and open it
+ * on the same file descriptor given to `dnswire_writer_write()`. Only the
+ * data direction is compressed, if the writer is bidirectional the
+ * compressor is flushed before waiting for ACCEPT and FINISH. Closing the
+ * compressor ends the compressed frame but does not close the file
+ * descriptor.
+ *
+ * Attributes:
+ * - level: The compression level, 0 for the library default
+ * - workers: Number of zstd worker threads, 0 to compress in the
+ *   background thread only (for archives where throughput matters)
+ * - ctx: The zstd or LZ4 compression context
+ * - bufs, buf_size, active, fill: The batches and the one being filled
+ * - out, out_size: Compressed output, used by the background thread
+ * - busy, pending, pending_len, pending_mode: The batch being compressed
+ *   and if the stream should be flushed or ended after it
+ * - bytes_in, bytes_out, batches, stalls: Counters
+ */
+struct dnswire_compressor {
+    enum dnswire_compression compression;
+    int                      level, workers;
+    int                      fd;
+    void*                    ctx;
+    bool                     opened, begun;
+
+    uint8_t* bufs[2];
+    size_t   buf_size, active, fill;
+    uint8_t* out;
+    size_t   out_size;
+
+    pthread_t       thread;
+    bool            started, stop, failed;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bool            busy;
+    size_t          pending, pending_len;
+    int             pending_mode;
+
+    size_t bytes_in, bytes_out, batches, stalls;
+};
+
+#define DNSWIRE_COMPRESSOR_DEFAULT_BUF_SIZE (128 * 1024)
+
+/*
+ * Initialize with the compression to use, fails if the library was not
+ * built with it.
+ */
+enum dnswire_result dnswire_compressor_init(struct dnswire_compressor*, enum dnswire_compression);
+void                dnswire_compressor_destroy(struct dnswire_compressor*);
+
+#define dnswire_compressor_set_level(c, v) (c).level = v
+#define dnswire_compressor_set_workers(c, v) (c).workers = v
+#define dnswire_compressor_set_buf_size(c, v) (c).buf_size = v
+
+/*
+ * Flushing waits until everything written so far has been compressed and
+ * written to the file descriptor.
+ */
+enum dnswire_result dnswire_compressor_open(struct dnswire_compressor*, int);
+enum dnswire_result dnswire_compressor_write(struct dnswire_compressor*, const uint8_t*, size_t);
+enum dnswire_result dnswire_compressor_flush(struct dnswire_compressor*);
+enum dnswire_result dnswire_compressor_close(struct dnswire_compressor*);
+
+/*
+ * The decompressor detects the compression from the start of the stream
+ * and decompresses directly into the reader's buffer, streams that are
+ * not compressed are passed through as is.
+ *
+ * Set it on the reader with `dnswire_reader_set_decompressor()`, a reader
+ * with a decompressor can not seek.
+ *
+ * Attributes:
+ * - detected: If the compression has been detected from the stream
+ * - ctx: The zstd or LZ4 decompression context
+ * - buf, size, at, left: Compressed input not yet decompressed
+ * - more: If the last read filled the output, the context may have more
+ *   decompressed data even if there is no input left
+ */
+struct dnswire_decompressor {
+    enum dnswire_compression compression;
+    bool                     detected, more;
+    void*                    ctx;
+
+    uint8_t* buf;
+    size_t   size, at, left;
+};
+
+enum dnswire_result dnswire_decompressor_init(struct dnswire_decompressor*);
+void                dnswire_decompressor_destroy(struct dnswire_decompressor*);
+
+#define dnswire_decompressor_compression(d) (d).compression
+
+/*
+ * Read and decompress from the file descriptor, with the same semantics
+ * as `read()`.
+ */
+ssize_t dnswire_decompressor_read(struct dnswire_decompressor*, int, uint8_t*, size_t);
+
+#endif
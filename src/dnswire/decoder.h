@@ -46,6 +46,7 @@ struct dnswire_decoder {
 
     unsigned ready_support_dnstap_protobuf : 1;
     unsigned accept_support_dnstap_protobuf : 1;
+    unsigned raw : 1;
 };
 
 #define DNSWIRE_DECODER_INITIALIZER                \
@@ -59,6 +60,14 @@ struct dnswire_decoder {
 #define dnswire_decoder_dnstap(d) (&(d).dnstap)
 #define dnswire_decoder_cleanup(d) dnstap_cleanup(&(d).dnstap)
 
+/*
+ * Raw mode: frames are not decoded as DNSTAP, instead `dnswire_have_frame`
+ * is returned and the frame can be accessed until the next call to decode.
+ */
+#define dnswire_decoder_set_raw(d, v) (d).raw = (v) ? 1 : 0
+#define dnswire_decoder_frame(d) (d).reader.frame.data
+#define dnswire_decoder_frame_length(d) (size_t)((d).reader.frame.length)
+
 enum dnswire_result dnswire_decoder_decode(struct dnswire_decoder*, const uint8_t*, size_t);
 
 #endif
@@ -0,0 +1,195 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/columnar.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#ifndef __dnswire_h_dns
+#define __dnswire_h_dns 1
+
+/*
+ * The header and question of a DNS message in wire format, as found in
+ * `query_message` and `response_message`.
+ *
+ * Parsing does not allocate or copy, the QNAME is a view into the
+ * message buffer in wire format (length prefixed labels ending with the
+ * root label) and is only valid as long as the buffer is.
+ *
+ * Attributes:
+ * - id, flags, qdcount, ancount, nscount, arcount: The header
+ * - has_question: If the message has a question (QDCOUNT > 0)
+ * - qname, qname_length: The QNAME including the root label
+ * - labels: The number of labels in QNAME, not counting the root
+ * - qtype, qclass: The QTYPE and QCLASS
+ * - end: The offset after the header and question, where the answer
+ *   section starts
+ */
+struct dnswire_dns {
+    uint16_t id, flags, qdcount, ancount, nscount, arcount;
+
+    bool           has_question;
+    const uint8_t* qname;
+    size_t         qname_length, labels;
+    uint16_t       qtype, qclass;
+
+    size_t end;
+};
+
+#define DNSWIRE_DNS_HEADER_SIZE 12
+#define DNSWIRE_DNS_MAX_NAME 255
+
+#define dnswire_dns_qr(d) (((d).flags >> 15) & 1)
+#define dnswire_dns_opcode(d) (((d).flags >> 11) & 0xf)
+#define dnswire_dns_aa(d) (((d).flags >> 10) & 1)
+#define dnswire_dns_tc(d) (((d).flags >> 9) & 1)
+#define dnswire_dns_rd(d) (((d).flags >> 8) & 1)
+#define dnswire_dns_ra(d) (((d).flags >> 7) & 1)
+#define dnswire_dns_ad(d) (((d).flags >> 5) & 1)
+#define dnswire_dns_cd(d) (((d).flags >> 4) & 1)
+#define dnswire_dns_rcode(d) ((d).flags & 0xf)
+
+/*
+ * Parse the header and question of a DNS message, fails if the message
+ * is truncated or the QNAME is not a valid uncompressed name.
+ */
+enum dnswire_result dnswire_dns_parse(struct dnswire_dns*, const uint8_t*, size_t);
+
+/*
+ * Parse a number of messages, with the result of each in `results`, and
+ * return how many were parsed successfully.
+ */
+size_t dnswire_dns_parse_batch(struct dnswire_dns*, enum dnswire_result*, const uint8_t* const*, const size_t*, size_t);
+
+/*
+ * The EDNS0 metadata of a DNS message from its OPT record.
+ *
+ * Attributes:
+ * - present: If the message has an OPT record, nothing else is set if not
+ * - udp_size: The requestor's UDP payload size (the class of the OPT)
+ * - extended_rcode, version, do_bit: From the TTL of the OPT
+ * - has_ecs, ecs_family, ecs_source, ecs_scope, ecs_address,
+ *   ecs_address_length: The Client Subnet option (RFC 7871), the address
+ *   is a view into the message buffer
+ * - has_cookie, cookie, cookie_length: The DNS Cookie option (RFC 7873),
+ *   client cookie and server cookie if present, also a view
+ * - options: The number of options in the OPT record
+ */
+struct dnswire_dns_edns {
+    bool     present;
+    uint16_t udp_size;
+    uint8_t  extended_rcode, version;
+    bool     do_bit;
+
+    bool           has_ecs;
+    uint16_t       ecs_family;
+    uint8_t        ecs_source, ecs_scope;
+    const uint8_t* ecs_address;
+    size_t         ecs_address_length;
+
+    bool           has_cookie;
+    const uint8_t* cookie;
+    size_t         cookie_length;
+
+    size_t options;
+};
+
+#define DNSWIRE_DNS_TYPE_OPT 41
+#define DNSWIRE_DNS_EDNS_ECS 8
+#define DNSWIRE_DNS_EDNS_COOKIE 10
+
+#define dnswire_dns_edns_rcode(d, e) ((e).extended_rcode << 4 | dnswire_dns_rcode(d))
+
+/*
+ * Find the OPT record of a message already parsed with
+ * `dnswire_dns_parse()` and extract its EDNS0 metadata. The answer and
+ * authority records are skipped by their lengths without being decoded,
+ * names are only walked to their end (or first compression pointer).
+ *
+ * Returns `dnswire_ok` with `present` set if there was an OPT record, or
+ * `dnswire_error` if the message is malformed before it was found.
+ */
+enum dnswire_result dnswire_dns_edns(struct dnswire_dns_edns*, const struct dnswire_dns*, const uint8_t*, size_t);
+
+/*
+ * Extract the EDNS0 metadata of a number of parsed messages, with the
+ * result of each in `results`, and return how many had an OPT record.
+ */
+size_t dnswire_dns_edns_batch(struct dnswire_dns_edns*, enum dnswire_result*, const struct dnswire_dns*, const uint8_t* const*, const size_t*, size_t);
+
+/*
+ * Histograms of the header fields and QTYPE of many messages, meant to be
+ * cleared and collected per time interval (a second, a minute).
+ *
+ * Attributes:
+ * - messages: The number of messages counted
+ * - invalid: Messages too short for a header, not counted in the rest
+ * - qr, aa, tc, rd, ra, ad, cd: The number of messages with the flag set
+ * - opcode, rcode: Histograms of the OPCODE and RCODE (from the header)
+ * - questions: Messages with a question, counted in the QTYPE histogram
+ * - qtype, qtype_other: Histogram of QTYPE below 256 and the number of
+ *   messages with a higher QTYPE
+ */
+struct dnswire_dns_stats {
+    size_t messages, invalid;
+    size_t qr, aa, tc, rd, ra, ad, cd;
+    size_t opcode[16], rcode[16];
+    size_t questions, qtype[256], qtype_other;
+};
+
+void dnswire_dns_stats_clear(struct dnswire_dns_stats*);
+void dnswire_dns_stats_merge(struct dnswire_dns_stats*, const struct dnswire_dns_stats*);
+
+/*
+ * Count a number of messages, given as pointers and lengths. The headers
+ * and QTYPEs are first gathered into small arrays and then counted, the
+ * flags with SSE2 when available and the histograms with interleaved
+ * counters to avoid stalls on repeated values.
+ */
+void dnswire_dns_stats_add(struct dnswire_dns_stats*, const uint8_t* const*, const size_t*, size_t);
+
+/*
+ * Count the present rows of a message column such as
+ * `dnswire_column_query_message` of a `dnswire_batch`.
+ */
+void dnswire_dns_stats_add_column(struct dnswire_dns_stats*, const struct dnswire_column_data*);
+
+/*
+ * Lowercase (ASCII) a name in wire format, or any number of names after
+ * each other such as the data of a column, from `in` to `out` which may
+ * be the same. Label lengths are never in the uppercase range so the
+ * whole name is converted at once, using AVX2 or SSE2 when available.
+ */
+void dnswire_dns_name_lower(uint8_t*, const uint8_t*, size_t);
+
+/*
+ * Convert a name in wire format to text, with a trailing dot and
+ * characters that are not printable or special escaped as `\DDD` or
+ * `\X`. Returns the length of the text (without the terminating nul) or
+ * -1 if the name is invalid or the buffer too small.
+ */
+ssize_t dnswire_dns_name_string(const uint8_t*, size_t, char*, size_t);
+
+#endif
@@ -33,6 +33,7 @@ enum dnswire_result {
     dnswire_have_dnstap   = 4,
     dnswire_endofdata     = 5,
     dnswire_bidirectional = 6,
+    dnswire_have_frame    = 7,
 };
 extern const char* const dnswire_result_string[];
 
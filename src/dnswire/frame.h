@@ -0,0 +1,111 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+
+#include <tinyframe/tinyframe.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_frame
+#define __dnswire_h_frame 1
+
+/*
+ * A reference counted, immutable, Frame Streams data frame.
+ *
+ * The frame is encoded once (header and payload) and can then be shared by
+ * reference between any number of queues, destinations or threads without
+ * being copied. The last `dnswire_frame_unref()` frees it.
+ *
+ * Attributes:
+ * - refs: The number of references held, modified atomically
+ * - length: The length of `data`, which is the frame header and payload
+ */
+struct dnswire_frame {
+    size_t  refs;
+    size_t  length;
+    uint8_t data[];
+};
+
+struct dnswire_frame* dnswire_frame_new(size_t);
+struct dnswire_frame* dnswire_frame_copy(const uint8_t*, size_t);
+
+#define dnswire_frame_payload(f) (&(f)->data[TINYFRAME_HEADER_SIZE])
+#define dnswire_frame_payload_length(f) ((f)->length - TINYFRAME_HEADER_SIZE)
+
+static inline struct dnswire_frame* dnswire_frame_ref(struct dnswire_frame* frame)
+{
+    __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+    return frame;
+}
+
+static inline void dnswire_frame_unref(struct dnswire_frame* frame)
+{
+    if (!__atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL)) {
+        free(frame);
+    }
+}
+
+enum dnswire_frame_queue_policy {
+    dnswire_frame_queue_drop_newest = 0,
+    dnswire_frame_queue_drop_oldest = 1,
+};
+extern const char* const dnswire_frame_queue_policy_string[];
+
+/*
+ * A bounded FIFO of frame references with a drop policy, used to give each
+ * output its own backlog and backpressure.
+ *
+ * Attributes:
+ * - size: The maximum number of frames in the queue
+ * - at: Where in the ring the oldest frame is
+ * - len: The number of frames in the queue
+ * - offset: How much of the oldest frame that has already been written
+ * - queued, written, dropped: Counters of frames, popped frames are counted
+ *   as written
+ * - bytes: Counter of bytes written or popped
+ */
+struct dnswire_frame_queue {
+    enum dnswire_frame_queue_policy policy;
+
+    struct dnswire_frame** frames;
+    size_t                 size, at, len, offset;
+
+    size_t queued, written, dropped, bytes;
+};
+
+#define DNSWIRE_FRAME_QUEUE_DEFAULT_SIZE 1024
+#define DNSWIRE_FRAME_QUEUE_MAX_IOV 64
+
+enum dnswire_result dnswire_frame_queue_init(struct dnswire_frame_queue*, size_t, enum dnswire_frame_queue_policy);
+void                dnswire_frame_queue_destroy(struct dnswire_frame_queue*);
+
+#define dnswire_frame_queue_length(q) (q).len
+#define dnswire_frame_queue_is_empty(q) (!(q).len)
+#define dnswire_frame_queue_is_full(q) ((q).len >= (q).size)
+
+enum dnswire_result   dnswire_frame_queue_push(struct dnswire_frame_queue*, struct dnswire_frame*);
+enum dnswire_result   dnswire_frame_queue_write(struct dnswire_frame_queue*, int);
+struct dnswire_frame* dnswire_frame_queue_pop(struct dnswire_frame_queue*);
+void                  dnswire_frame_queue_clear(struct dnswire_frame_queue*);
+
+#endif
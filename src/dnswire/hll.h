@@ -0,0 +1,167 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/columnar.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#ifndef __dnswire_h_hll
+#define __dnswire_h_hll 1
+
+#define DNSWIRE_HLL_MIN_PRECISION 4
+#define DNSWIRE_HLL_MAX_PRECISION 18
+#define DNSWIRE_HLL_DEFAULT_PRECISION 14
+
+/*
+ * A HyperLogLog sketch estimating the number of distinct values added,
+ * such as unique clients or QNAMEs per window.
+ *
+ * Values are hashed to 64 bits so no large range correction is needed,
+ * and the estimate uses the improved estimator by Ertl which is accurate
+ * from zero to very large counts without empirical bias tables. The
+ * standard error is about 1.04 / sqrt(2^precision), 0.8% with the
+ * default precision using 16 KiB.
+ *
+ * Sketches with the same precision are merged by taking the largest of
+ * each register, which is the same as having added the values of both
+ * to one, so sketches of many collectors or windows can be combined.
+ *
+ * Attributes:
+ * - precision, size: The number of index bits and registers (2^precision)
+ * - registers: One byte per register
+ */
+struct dnswire_hll {
+    uint8_t  precision;
+    size_t   size;
+    uint8_t* registers;
+};
+
+enum dnswire_result dnswire_hll_init(struct dnswire_hll*, uint8_t);
+void                dnswire_hll_destroy(struct dnswire_hll*);
+void                dnswire_hll_clear(struct dnswire_hll*);
+
+void dnswire_hll_add(struct dnswire_hll*, const uint8_t*, size_t);
+
+/*
+ * Add a number of values, given as pointers and lengths. The values are
+ * hashed a chunk at a time into an array first, which lets the hashes of
+ * independent values overlap, and then the registers are updated.
+ */
+void dnswire_hll_add_batch(struct dnswire_hll*, const uint8_t* const*, const size_t*, size_t);
+
+/*
+ * Add the present rows of a bytes column, such as
+ * `dnswire_column_query_address` of a `dnswire_batch`.
+ */
+void dnswire_hll_add_column(struct dnswire_hll*, const struct dnswire_column_data*);
+
+/*
+ * Merge a sketch into another, fails if the precision differs.
+ */
+enum dnswire_result dnswire_hll_merge(struct dnswire_hll*, const struct dnswire_hll*);
+
+/*
+ * Return the estimated number of distinct values.
+ */
+uint64_t dnswire_hll_estimate(const struct dnswire_hll*);
+
+/*
+ * A sketch is serialized as a 4 byte header ("HL", version, precision)
+ * followed by the registers.
+ */
+#define DNSWIRE_HLL_HEADER_SIZE 4
+#define DNSWIRE_HLL_VERSION 1
+#define dnswire_hll_serialized_size(h) (DNSWIRE_HLL_HEADER_SIZE + (h).size)
+
+/*
+ * Serialize a sketch into a buffer, returns the number of bytes written
+ * or -1 if the buffer is too small.
+ */
+ssize_t dnswire_hll_serialize(const struct dnswire_hll*, uint8_t*, size_t);
+
+/*
+ * Initialize a sketch from a serialized one.
+ */
+enum dnswire_result dnswire_hll_deserialize(struct dnswire_hll*, const uint8_t*, size_t);
+
+/*
+ * Merge a serialized sketch directly into a sketch without decoding it
+ * first, fails if it is invalid or the precision differs.
+ */
+enum dnswire_result dnswire_hll_merge_serialized(struct dnswire_hll*, const uint8_t*, size_t);
+
+/*
+ * A sketch for each distinct key, such as unique QNAMEs per zone.
+ *
+ * The number of keys is limited to bound the memory used, values of new
+ * keys when full are dropped.
+ *
+ * Attributes:
+ * - precision: The precision of the sketches
+ * - entries, num_entries, max_entries: The keys and their sketches
+ * - index, index_size: Open-addressing index, entry index + 1 or 0 if
+ *   empty
+ * - dropped: Values dropped because there were too many keys
+ */
+struct dnswire_hll_group_entry {
+    uint8_t*           key;
+    size_t             length;
+    uint32_t           hash;
+    struct dnswire_hll hll;
+};
+
+struct dnswire_hll_group {
+    uint8_t                         precision;
+    struct dnswire_hll_group_entry* entries;
+    size_t                          num_entries, max_entries;
+    uint32_t*                       index;
+    size_t                          index_size;
+    size_t                          dropped;
+};
+
+enum dnswire_result dnswire_hll_group_init(struct dnswire_hll_group*, uint8_t, size_t);
+void                dnswire_hll_group_destroy(struct dnswire_hll_group*);
+
+/*
+ * Remove all keys, such as at the start of a new window.
+ */
+void dnswire_hll_group_clear(struct dnswire_hll_group*);
+
+#define dnswire_hll_group_entries(g) (g).num_entries
+#define dnswire_hll_group_entry(g, i) (&(g).entries[i])
+#define dnswire_hll_group_dropped(g) (g).dropped
+
+/*
+ * Add a value to the sketch of a key, returns `dnswire_again` if the key
+ * is new and there are already too many keys.
+ */
+enum dnswire_result dnswire_hll_group_add(struct dnswire_hll_group*, const uint8_t*, size_t, const uint8_t*, size_t);
+
+/*
+ * Return the sketch of a key or NULL if it has none.
+ */
+struct dnswire_hll* dnswire_hll_group_get(struct dnswire_hll_group*, const uint8_t*, size_t);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_index
+#define __dnswire_h_index 1
+
+/*
+ * Attributes:
+ * - offset: Offset of the block's first frame in the file
+ * - frames: Number of frames in the block
+ * - min, max: The lowest and highest `query_time_sec`/`response_time_sec`
+ *   of the block, min is larger than max if the block has no times
+ * - seek: The highest max of this and all previous blocks, not stored
+ */
+struct dnswire_index_block {
+    uint64_t offset;
+    uint32_t frames;
+    uint64_t min, max, seek;
+};
+
+/*
+ * A sidecar time index for a DNSTAP file, maps the offset of every Nth
+ * frame to the time range of the messages in the block so that a reader
+ * can seek to the first block that may have messages for a given time
+ * instead of decoding the file from the start.
+ *
+ * The index can be built while writing by setting it on the writer with
+ * `dnswire_writer_set_index()` or from an existing file with
+ * `dnswire_index_build()`, and is stored in its own file with
+ * `dnswire_index_save()`.
+ *
+ * Optionally each block can also have Bloom filters over the
+ * `query_address` and the QNAME of `query_message` (or `response_message`
+ * if there is no query), so that a reader looking for a client or a name
+ * can skip all blocks that can not have a match.
+ *
+ * Attributes:
+ * - block_frames: Frames per block, at most `DNSWIRE_INDEX_MAX_BLOCK_FRAMES`
+ * - end: Offset after the last indexed frame
+ * - bloom_size: Size in bytes of each Bloom filter, 0 if not used and at
+ *   most `DNSWIRE_INDEX_MAX_BLOOM_SIZE`
+ * - blooms: The Bloom filters, address and QNAME for each block
+ */
+struct dnswire_index {
+    size_t                      block_frames;
+    struct dnswire_index_block* blocks;
+    size_t                      num_blocks, size;
+    uint64_t                    end;
+    size_t                      bloom_size;
+    uint8_t*                    blooms;
+};
+
+#define DNSWIRE_INDEX_DEFAULT_BLOCK_FRAMES 1024
+#define DNSWIRE_INDEX_DEFAULT_BLOOM_SIZE 1024
+#define DNSWIRE_INDEX_MAX_BLOCK_FRAMES (16 * 1024 * 1024)
+#define DNSWIRE_INDEX_MAX_BLOOM_SIZE (1024 * 1024)
+#define DNSWIRE_INDEX_BLOOM_HASHES 5
+#define DNSWIRE_INDEX_MAGIC "DNSWIDX1"
+
+enum dnswire_result dnswire_index_init(struct dnswire_index*, size_t);
+void                dnswire_index_destroy(struct dnswire_index*);
+
+#define dnswire_index_blocks(i) (i).num_blocks
+#define dnswire_index_block(i, n) (&(i).blocks[n])
+#define dnswire_index_block_end(i, n) ((n) + 1 < (i).num_blocks ? (i).blocks[(n) + 1].offset : (i).end)
+#define dnswire_index_address_bloom(i, n) (&(i).blooms[(n) * 2 * (i).bloom_size])
+#define dnswire_index_qname_bloom(i, n) (&(i).blooms[((n) * 2 + 1) * (i).bloom_size])
+
+enum dnswire_result dnswire_index_set_bloom_size(struct dnswire_index*, size_t);
+
+enum dnswire_result dnswire_index_add(struct dnswire_index*, uint64_t, size_t, const struct dnstap*);
+enum dnswire_result dnswire_index_find(const struct dnswire_index*, uint64_t, uint64_t*);
+enum dnswire_result dnswire_index_build(struct dnswire_index*, int);
+enum dnswire_result dnswire_index_save(const struct dnswire_index*, int);
+enum dnswire_result dnswire_index_load(struct dnswire_index*, int);
+
+/*
+ * Check if a block may have messages for the address (4 or 16 bytes) or
+ * the name (as text, case insensitive), always true if the index has no
+ * Bloom filters.
+ */
+bool dnswire_index_may_have_address(const struct dnswire_index*, size_t, const uint8_t*, size_t);
+bool dnswire_index_may_have_qname(const struct dnswire_index*, size_t, const char*);
+
+#endif
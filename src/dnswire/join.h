@@ -0,0 +1,180 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_join
+#define __dnswire_h_join 1
+
+/*
+ * The key a query is stored under until its response is seen: the
+ * addresses, ports and protocol of the messages, the DNS ID and which
+ * pair of message types it is (client, resolver, etc), packed into a
+ * fixed size so it can be compared and hashed as words.
+ */
+#define DNSWIRE_JOIN_KEY_SIZE 40
+
+/*
+ * An entry of the open-addressing table, `time` is the query time in
+ * nanoseconds and `hash` the hash of the key.
+ */
+struct dnswire_join_entry {
+    uint8_t  key[DNSWIRE_JOIN_KEY_SIZE];
+    uint64_t time;
+    uint32_t hash;
+    bool     used;
+};
+
+/*
+ * A log-linear histogram of latency in microseconds, values below 16 get
+ * their own bucket and above that each power of two is split into 8
+ * buckets, so a bucket is never wider than 12.5% of its value.
+ *
+ * Attributes:
+ * - buckets: The number of latencies in each bucket
+ * - count, sum, min, max: The number of latencies, their sum, smallest
+ *   and largest in nanoseconds
+ */
+#define DNSWIRE_JOIN_HISTOGRAM_BUCKETS 512
+
+struct dnswire_join_histogram {
+    size_t   buckets[DNSWIRE_JOIN_HISTOGRAM_BUCKETS];
+    size_t   count;
+    uint64_t sum, min, max;
+};
+
+void dnswire_join_histogram_clear(struct dnswire_join_histogram*);
+void dnswire_join_histogram_add(struct dnswire_join_histogram*, uint64_t);
+void dnswire_join_histogram_merge(struct dnswire_join_histogram*, const struct dnswire_join_histogram*);
+
+/*
+ * Return the latency in nanoseconds at or below which the given fraction
+ * (0.0 - 1.0) of all latencies are, as the upper bound of its bucket.
+ */
+uint64_t dnswire_join_histogram_percentile(const struct dnswire_join_histogram*, double);
+
+/*
+ * A matched query and response given to the callback.
+ *
+ * Attributes:
+ * - response: The response message
+ * - query_time, response_time: In nanoseconds, the time of the query is
+ *   from the query message
+ * - latency: The response time minus the query time, 0 if the response
+ *   was before the query
+ */
+struct dnswire_join_match {
+    const struct dnstap* response;
+    uint64_t             query_time, response_time, latency;
+};
+
+/*
+ * A streaming join of queries and responses, such as CLIENT_QUERY with
+ * CLIENT_RESPONSE, by addresses, ports, protocol and DNS ID to get the
+ * latency of each query.
+ *
+ * Queries are kept in a fixed size open-addressing table (linear probing
+ * with backward shift deletion so there are no tombstones), the memory
+ * used is set by the number of outstanding queries given at init and
+ * never grows. Queries without a response within the timeout are
+ * expired, the table is swept a few entries at a time as messages are
+ * added and fully by `dnswire_join_expire()`. If the table is still full
+ * the query is dropped.
+ *
+ * Time is taken from the messages, not the clock, so a stream can be
+ * joined from a file as well as live.
+ *
+ * Attributes:
+ * - table, size, used, max_used: The table, its size (a power of two),
+ *   entries in use and the most that may be used
+ * - timeout: In nanoseconds
+ * - now: The latest time seen in the messages
+ * - sweep: The next entry to check for expiry
+ * - histogram: The latency of all matches
+ * - queries, responses: The number of queries and responses added
+ * - matched: Responses that matched a query
+ * - expired: Queries that timed out without a response
+ * - unmatched: Responses without a query
+ * - duplicates: Queries with the same key as an outstanding one, which
+ *   is replaced
+ * - dropped: Queries dropped because the table was full
+ * - ignored: Messages that could not be joined, such as without a type,
+ *   time or DNS message
+ */
+struct dnswire_join {
+    struct dnswire_join_entry* table;
+    size_t                     size, used, max_used;
+    uint64_t                   timeout, now;
+    size_t                     sweep;
+
+    void (*callback)(const struct dnswire_join_match*, void*);
+    void* ctx;
+
+    struct dnswire_join_histogram histogram;
+
+    size_t queries, responses, matched, expired, unmatched, duplicates, dropped, ignored;
+};
+
+#define DNSWIRE_JOIN_DEFAULT_TIMEOUT 5000000000ULL
+
+/*
+ * Initialize with room for `capacity` outstanding queries and a timeout
+ * in nanoseconds.
+ */
+enum dnswire_result dnswire_join_init(struct dnswire_join*, size_t, uint64_t);
+void                dnswire_join_destroy(struct dnswire_join*);
+
+#define dnswire_join_set_callback(j, f, c) \
+    (j).callback = f;                      \
+    (j).ctx      = c
+
+#define dnswire_join_histogram(j) (&(j).histogram)
+#define dnswire_join_outstanding(j) (j).used
+#define dnswire_join_queries(j) (j).queries
+#define dnswire_join_responses(j) (j).responses
+#define dnswire_join_matched(j) (j).matched
+#define dnswire_join_expired(j) (j).expired
+#define dnswire_join_unmatched(j) (j).unmatched
+#define dnswire_join_duplicates(j) (j).duplicates
+#define dnswire_join_dropped(j) (j).dropped
+#define dnswire_join_ignored(j) (j).ignored
+
+/*
+ * Add a decoded message, a query is stored and a response is matched
+ * against the stored queries. Returns `dnswire_ok` if the message was
+ * joined (or counted as unmatched, duplicate or dropped) and
+ * `dnswire_again` if it was ignored.
+ */
+enum dnswire_result dnswire_join_add(struct dnswire_join*, const struct dnstap*);
+
+/*
+ * Expire all queries older than the timeout at the given time in
+ * nanoseconds, or with 0 at the latest time seen. Use UINT64_MAX to
+ * expire all outstanding queries at the end of a stream.
+ */
+void dnswire_join_expire(struct dnswire_join*, uint64_t);
+
+#endif
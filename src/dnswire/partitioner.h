@@ -0,0 +1,105 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/decoder.h>
+#include <dnswire/dnstap.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_partitioner
+#define __dnswire_h_partitioner 1
+
+/*
+ * A frame aligned range of a file with only DATA frames.
+ *
+ * Attributes:
+ * - offset, length: The range in the file
+ * - frames: The number of frames in the range, found by the scan
+ * - dnstaps: DNSTAP messages decoded from the range
+ * - errors: Frames that could not be decoded
+ * - frame_offset, frame_length: The frame given to the callback
+ * - result: The result of processing the range
+ */
+struct dnswire_partition {
+    size_t              offset, length, frames;
+    size_t              dnstaps, errors;
+    size_t              frame_offset, frame_length;
+    enum dnswire_result result;
+};
+
+/*
+ * Parallel processing of a (unidirectional) DNSTAP file.
+ *
+ * `dnswire_partitioner_scan()` validates the START control frame with a
+ * `dnswire_decoder` and then walks only the frame length headers to split
+ * the DATA frames into frame aligned ranges of about equal size, it stops
+ * at the STOP control frame (or at a truncated last frame).
+ *
+ * Each range can then be decoded in its own thread, either with
+ * `dnswire_partitioner_run()` which runs one thread per range or by
+ * calling `dnswire_partitioner_process()` from the caller's own threads.
+ * The file is read through a read-only mapping if possible, otherwise
+ * with `pread()` in chunks.
+ *
+ * The callback is called with the index of the range so the caller can
+ * keep its results per range and combine them once all are done, messages
+ * of a range are given in the order of the file.
+ *
+ * Attributes:
+ * - map: The file mapped read-only, or NULL if `pread()` is used
+ * - decoder: The decoder state after the START control frame, copied to
+ *   each range
+ * - stopped: If the scan found the STOP control frame
+ */
+struct dnswire_partitioner {
+    int            fd;
+    const uint8_t* map;
+    size_t         size;
+
+    struct dnswire_decoder    decoder;
+    struct dnswire_partition* partitions;
+    size_t                    num_partitions;
+    bool                      stopped;
+
+    void (*callback)(size_t, const struct dnstap*, void*);
+    void* ctx;
+};
+
+#define DNSWIRE_PARTITIONER_CHUNK_SIZE (1024 * 1024)
+
+enum dnswire_result dnswire_partitioner_init(struct dnswire_partitioner*, int, bool);
+void                dnswire_partitioner_destroy(struct dnswire_partitioner*);
+
+#define dnswire_partitioner_set_callback(p, f, c) \
+    (p).callback = f;                             \
+    (p).ctx      = c
+#define dnswire_partitioner_partitions(p) (p).num_partitions
+#define dnswire_partitioner_partition(p, i) (&(p).partitions[i])
+#define dnswire_partitioner_is_mapped(p) ((p).map != 0)
+
+enum dnswire_result dnswire_partitioner_scan(struct dnswire_partitioner*, size_t);
+enum dnswire_result dnswire_partitioner_process(struct dnswire_partitioner*, size_t);
+enum dnswire_result dnswire_partitioner_run(struct dnswire_partitioner*);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/reader.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_pipeline
+#define __dnswire_h_pipeline 1
+
+enum dnswire_pipeline_slot_state {
+    dnswire_pipeline_slot_empty    = 0,
+    dnswire_pipeline_slot_framed   = 1,
+    dnswire_pipeline_slot_decoding = 2,
+    dnswire_pipeline_slot_decoded  = 3,
+    dnswire_pipeline_slot_failed   = 4,
+};
+extern const char* const dnswire_pipeline_slot_state_string[];
+
+/*
+ * A slot in the reorder window holding a copy of a frame and, once
+ * decoded, the DNSTAP message.
+ */
+struct dnswire_pipeline_slot {
+    enum dnswire_pipeline_slot_state state;
+    uint8_t*                         data;
+    size_t                           len, size;
+    struct dnstap                    dnstap;
+};
+
+/*
+ * Attributes:
+ * - frames: Frames read by the framing stage
+ * - dnstaps: DNSTAP messages given to the consumer
+ * - errors: Frames that could not be decoded
+ * - waits: Times the framing stage waited for room in the window
+ */
+struct dnswire_pipeline_stats {
+    size_t frames, dnstaps, errors, waits;
+};
+
+/*
+ * A pipeline decoding a single stream on multiple cores while keeping the
+ * order of the messages.
+ *
+ * A framing thread reads the stream using a `dnswire_reader` in raw mode,
+ * which handles the control frames and the Frame Streams framing, and
+ * copies each frame into the next slot of the window. The decoder threads
+ * decode the slots in parallel and the consumer takes the decoded messages
+ * in the original order with `dnswire_pipeline_next()`.
+ *
+ * The window bounds the memory used, the framing stage waits if all slots
+ * are in use and the decoders wait for the framing stage, so a slow
+ * consumer slows down the reading of the stream.
+ *
+ * The file descriptor should be blocking. Frames that can not be decoded
+ * are skipped and counted, `dnswire_pipeline_next()` returns
+ * `dnswire_endofdata` once the stream has been stopped and all messages
+ * have been consumed, or `dnswire_error` if reading the stream failed.
+ * The message is valid until the next call.
+ *
+ * Stopping the pipeline before the end of the stream waits for the framing
+ * thread, if it is blocked reading then the caller must make the read
+ * return, for example by shutting down the socket.
+ *
+ * Attributes:
+ * - slots, window: The reorder window, slot for sequence `n` is at
+ *   `n % window`
+ * - head: Sequence of the next message to give to the consumer
+ * - decode: Sequence of the next frame to decode
+ * - tail: Sequence of the next frame to read
+ * - current: If the consumer holds the slot at `head`
+ * - eof, result: If the framing stage has ended and its result
+ */
+struct dnswire_pipeline {
+    struct dnswire_reader reader;
+    int                   fd;
+
+    struct dnswire_pipeline_slot* slots;
+    size_t                        window, head, decode, tail;
+    bool                          current;
+
+    pthread_t *threads, framer;
+    size_t     num_threads;
+    bool       started, framing;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  framed, decoded, space;
+    bool            eof, stop;
+
+    enum dnswire_result           result;
+    struct dnswire_pipeline_stats stats;
+};
+
+#define DNSWIRE_PIPELINE_DEFAULT_WINDOW 1024
+
+enum dnswire_result dnswire_pipeline_init(struct dnswire_pipeline*, size_t, size_t);
+void                dnswire_pipeline_destroy(struct dnswire_pipeline*);
+
+#define dnswire_pipeline_threads(p) (p).num_threads
+#define dnswire_pipeline_window(p) (p).window
+#define dnswire_pipeline_dnstap(p) (&(p).slots[(p).head % (p).window].dnstap)
+
+enum dnswire_result dnswire_pipeline_allow_bidirectional(struct dnswire_pipeline*, bool);
+enum dnswire_result dnswire_pipeline_start(struct dnswire_pipeline*, int);
+enum dnswire_result dnswire_pipeline_next(struct dnswire_pipeline*);
+enum dnswire_result dnswire_pipeline_stop(struct dnswire_pipeline*);
+void                dnswire_pipeline_stats(struct dnswire_pipeline*, struct dnswire_pipeline_stats*);
+
+#endif
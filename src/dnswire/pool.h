@@ -0,0 +1,156 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_pool
+#define __dnswire_h_pool 1
+
+/*
+ * Where batches come from, normally a connection, used to keep the order
+ * of its batches if the pool is ordered.
+ *
+ * Attributes:
+ * - ctx: User data given to the callback
+ * - refs: Held by the creator and each batch in the pool
+ * - busy: If a batch of the source is queued or being decoded, following
+ *   batches then waits in the source's list (ordered pools only)
+ */
+struct dnswire_pool_batch;
+struct dnswire_pool_source {
+    void*                      ctx;
+    size_t                     refs;
+    bool                       busy;
+    struct dnswire_pool_batch *head, *tail;
+};
+
+struct dnswire_pool_source* dnswire_pool_source_new(void*);
+void                        dnswire_pool_source_unref(struct dnswire_pool_source*);
+
+#define DNSWIRE_POOL_BATCH_FRAMES 256
+#define DNSWIRE_POOL_BATCH_SIZE (64 * 1024)
+
+/*
+ * A batch of raw frame payloads copied back to back into `data`.
+ */
+struct dnswire_pool_batch {
+    struct dnswire_pool_batch*  next;
+    struct dnswire_pool_source* source;
+    size_t                      frames, used, size;
+    struct {
+        size_t offset, length;
+    } frame[DNSWIRE_POOL_BATCH_FRAMES];
+    uint8_t data[];
+};
+
+struct dnswire_pool_batch* dnswire_pool_batch_new(struct dnswire_pool_source*, size_t);
+enum dnswire_result        dnswire_pool_batch_add(struct dnswire_pool_batch*, const uint8_t*, size_t);
+void                       dnswire_pool_batch_free(struct dnswire_pool_batch*);
+
+/*
+ * A worker's deque, the owner takes batches from the front and other
+ * workers steal from the back.
+ */
+struct dnswire_pool_deque {
+    pthread_mutex_t             lock;
+    struct dnswire_pool_batch** batches;
+    size_t                      size, at, len;
+};
+
+/*
+ * Attributes:
+ * - batches, dnstaps: Counters of batches and DNSTAP messages decoded
+ * - stolen: Batches stolen from other workers' deques
+ * - errors: Frames that could not be decoded
+ */
+struct dnswire_pool_stats {
+    size_t batches, dnstaps, stolen, errors;
+};
+
+struct dnswire_pool;
+struct dnswire_pool_worker {
+    struct dnswire_pool*      pool;
+    size_t                    id;
+    pthread_t                 thread;
+    bool                      started;
+    struct dnswire_pool_deque deque;
+    struct dnswire_pool_stats stats;
+};
+
+/*
+ * A work-stealing pool of decoder threads, I/O threads only do the
+ * framing and submit batches of raw frames which are decoded and given to
+ * the callback by the workers. Idle workers steal batches from the other
+ * workers' deques so that the decoding is balanced over all workers
+ * regardless of how busy each source is.
+ *
+ * If ordered, the batches of a source are decoded one at a time in the
+ * order they were submitted, otherwise in any order and in parallel.
+ *
+ * Attributes:
+ * - queued: Batches submitted but not yet decoded, submitting blocks if
+ *   this reaches the total size of the deques
+ * - ready: Batches in the deques
+ */
+struct dnswire_pool {
+    struct dnswire_pool_worker* workers;
+    size_t                      num_workers, next;
+    bool                        ordered;
+
+    void (*callback)(size_t, void*, const struct dnstap*, void*);
+    void* ctx;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  work, space, drained;
+    size_t          queued, max_queued, ready;
+    bool            stop;
+};
+
+#define DNSWIRE_POOL_DEFAULT_DEQUE_SIZE 64
+
+enum dnswire_result dnswire_pool_init(struct dnswire_pool*, size_t, size_t, bool);
+void                dnswire_pool_destroy(struct dnswire_pool*);
+
+#define dnswire_pool_set_callback(p, f, c) \
+    (p).callback = f;                      \
+    (p).ctx      = c
+#define dnswire_pool_workers(p) (p).num_workers
+
+enum dnswire_result dnswire_pool_start(struct dnswire_pool*);
+enum dnswire_result dnswire_pool_submit(struct dnswire_pool*, struct dnswire_pool_batch*);
+enum dnswire_result dnswire_pool_drain(struct dnswire_pool*);
+enum dnswire_result dnswire_pool_stop(struct dnswire_pool*);
+void                dnswire_pool_stats(struct dnswire_pool*, size_t, struct dnswire_pool_stats*);
+
+/*
+ * Helpers for I/O threads, add a frame to the batch (allocated as needed)
+ * and submit it once full, and submit what is in the batch.
+ */
+enum dnswire_result dnswire_pool_add(struct dnswire_pool*, struct dnswire_pool_batch**, struct dnswire_pool_source*, const uint8_t*, size_t);
+enum dnswire_result dnswire_pool_flush(struct dnswire_pool*, struct dnswire_pool_batch**);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/frame.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_publisher
+#define __dnswire_h_publisher 1
+
+enum dnswire_publisher_client_state {
+    dnswire_publisher_client_publishing = 0,
+    dnswire_publisher_client_stopping   = 1,
+    dnswire_publisher_client_done       = 2,
+    dnswire_publisher_client_evicted    = 3,
+};
+extern const char* const dnswire_publisher_client_state_string[];
+
+/*
+ * Attributes:
+ * - fd: The file descriptor used by `dnswire_publisher_write()`, not used if
+ *   frames are popped from the queue and written by other means
+ * - ctx: User data
+ * - queue: The client's own queue of frames, the control START is queued
+ *   when the client is added
+ * - drops: Frames dropped since the client last had room in its queue
+ * - stop: If the client should be stopped once its queue is empty, the
+ *   control STOP is then written (state stopping) before the client is done
+ */
+struct dnswire_publisher_client;
+struct dnswire_publisher_client {
+    struct dnswire_publisher_client *   next, *prev;
+    enum dnswire_publisher_client_state state;
+    int                                 fd;
+    void*                               ctx;
+    struct dnswire_frame_queue          queue;
+    size_t                              drops;
+    bool                                stop;
+};
+
+/*
+ * Publish frames, encoded once, to many clients (unidirectional mode) by
+ * reference.
+ *
+ * Attributes:
+ * - queue_size: The size of the queue for new clients
+ * - max_drops: How many frames a client may drop in a row, because its
+ *   queue is full, before it is evicted
+ * - published, evicted: Counters
+ */
+struct dnswire_publisher {
+    struct dnswire_publisher_client* clients;
+    size_t                           num_clients;
+
+    struct dnswire_frame *start, *stop;
+
+    size_t queue_size, max_drops;
+    size_t published, evicted;
+};
+
+enum dnswire_result dnswire_publisher_init(struct dnswire_publisher*);
+void                dnswire_publisher_destroy(struct dnswire_publisher*);
+
+#define dnswire_publisher_set_queue_size(p, s) (p).queue_size = s
+#define dnswire_publisher_set_max_drops(p, m) (p).max_drops = m
+#define dnswire_publisher_clients(p) (p).clients
+#define dnswire_publisher_num_clients(p) (p).num_clients
+
+struct dnswire_publisher_client* dnswire_publisher_add_client(struct dnswire_publisher*, int, void*);
+void                             dnswire_publisher_remove_client(struct dnswire_publisher*, struct dnswire_publisher_client*);
+
+/*
+ * Frames are either written with `dnswire_publisher_write()`, using the
+ * client's file descriptor, or popped one by one with
+ * `dnswire_publisher_pop()` which gives the caller the reference to the
+ * frame, to be released once it has been written.
+ */
+enum dnswire_result   dnswire_publisher_publish(struct dnswire_publisher*, struct dnswire_frame*);
+enum dnswire_result   dnswire_publisher_publish_dnstap(struct dnswire_publisher*, const struct dnstap*);
+enum dnswire_result   dnswire_publisher_write(struct dnswire_publisher*, struct dnswire_publisher_client*);
+struct dnswire_frame* dnswire_publisher_pop(struct dnswire_publisher*, struct dnswire_publisher_client*);
+enum dnswire_result   dnswire_publisher_stop(struct dnswire_publisher*);
+
+#endif
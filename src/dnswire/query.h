@@ -0,0 +1,145 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/columnar.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_query
+#define __dnswire_h_query 1
+
+/*
+ * Comparison of a column's value with the value of a filter, bytes
+ * columns can only be compared for (in)equality. Rows without a value in
+ * the column never match.
+ */
+enum dnswire_query_op {
+    dnswire_query_eq = 0,
+    dnswire_query_ne = 1,
+    dnswire_query_lt = 2,
+    dnswire_query_le = 3,
+    dnswire_query_gt = 4,
+    dnswire_query_ge = 5,
+};
+extern const char* const dnswire_query_op_string[];
+
+/*
+ * A filter on a column, the value is used for numeric columns and bytes,
+ * length for bytes columns (the bytes are copied).
+ */
+struct dnswire_query_filter {
+    enum dnswire_column   column;
+    enum dnswire_query_op op;
+    uint64_t              value;
+    uint8_t*              bytes;
+    size_t                length;
+};
+
+#define DNSWIRE_QUERY_MAX_FILTERS 16
+
+/*
+ * A distinct value of the group-by column and the number of matching rows
+ * that had it, `bytes` and `length` are used for bytes columns.
+ */
+struct dnswire_query_group {
+    uint64_t value;
+    uint8_t* bytes;
+    size_t   length, count;
+};
+
+/*
+ * A query over a columnar archive: the rows matching all filters are
+ * counted and then either grouped and counted by the value of a column,
+ * giving the top N values, or the projected columns of the first N rows
+ * are given to the callback.
+ *
+ * Filters are pushed down: a row group is skipped without reading it if
+ * the min and max of a filter's column show that no row can match, and
+ * only the columns of the filters are read until a row in the group
+ * matches, then the group-by or projected columns. Filtering on the query
+ * or response time gives time ranges.
+ *
+ * Row groups are processed in parallel, each thread with its own buffers
+ * and counts which are merged when it is done. The callback is called
+ * with the columns of a group and the row, it is never called by two
+ * threads at the same time but groups are given in any order.
+ *
+ * Attributes:
+ * - grouped, group_by: If and by which column matching rows are grouped
+ * - limit: The number of groups (top N by count) or rows to give, 0 for
+ *   all
+ * - groups, num_groups: The groups sorted by count after running
+ * - matched: The number of rows that matched the filters, when giving
+ *   rows with a limit it stops at the groups read until the limit
+ * - scanned, skipped: The number of row groups read and skipped
+ * - bytes_read: The number of bytes read from the archive
+ */
+struct dnswire_query {
+    struct dnswire_query_filter filters[DNSWIRE_QUERY_MAX_FILTERS];
+    size_t                      num_filters;
+    enum dnswire_column         project[DNSWIRE_COLUMNS];
+    size_t                      num_project;
+    bool                        grouped;
+    enum dnswire_column         group_by;
+    size_t                      limit;
+
+    void (*callback)(const struct dnswire_column_data*, size_t, void*);
+    void* ctx;
+
+    struct dnswire_query_group* groups;
+    size_t                      num_groups;
+
+    size_t matched, scanned, skipped, bytes_read;
+};
+
+enum dnswire_result dnswire_query_init(struct dnswire_query*);
+void                dnswire_query_destroy(struct dnswire_query*);
+
+enum dnswire_result dnswire_query_add_filter(struct dnswire_query*, enum dnswire_column, enum dnswire_query_op, uint64_t);
+enum dnswire_result dnswire_query_add_filter_bytes(struct dnswire_query*, enum dnswire_column, enum dnswire_query_op, const uint8_t*, size_t);
+enum dnswire_result dnswire_query_add_project(struct dnswire_query*, enum dnswire_column);
+
+#define dnswire_query_set_group_by(q, c) \
+    (q).grouped  = true;                 \
+    (q).group_by = c
+#define dnswire_query_set_limit(q, v) (q).limit = v
+#define dnswire_query_set_callback(q, f, c) \
+    (q).callback = f;                       \
+    (q).ctx      = c
+
+#define dnswire_query_matched(q) (q).matched
+#define dnswire_query_scanned(q) (q).scanned
+#define dnswire_query_skipped(q) (q).skipped
+#define dnswire_query_bytes_read(q) (q).bytes_read
+#define dnswire_query_groups(q) (q).num_groups
+#define dnswire_query_group(q, i) (&(q).groups[i])
+
+/*
+ * Run the query over all row groups of an opened columnar reader with a
+ * number of threads, the results of a previous run are cleared first.
+ */
+enum dnswire_result dnswire_query_run(struct dnswire_query*, const struct dnswire_columnar_reader*, size_t);
+
+#endif
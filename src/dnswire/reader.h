@@ -49,7 +49,13 @@ extern const char* const dnswire_reader_state_string[];
  * - at: Where in the buffer we are decoding (start of data)
  * - left: How much data that is still left in the buffer from `at`
  * - pushed: How much data that was pushed to the buffer by `dnswire_reader_push()`
+ * - decompressor: If set, input read from the file descriptor is
+ *   decompressed through it
+ * - rollup: If set, each decoded message is also counted in it, a failure
+ *   to do so does not fail the read but is counted in the rollup
  */
+struct dnswire_decompressor;
+struct dnswire_rollup;
 struct dnswire_reader {
     enum dnswire_reader_state state;
 
@@ -62,6 +68,9 @@ struct dnswire_reader {
     size_t                 write_size, write_inc, write_max, write_at, write_left;
 
     bool allow_bidirectional, is_bidirectional;
+
+    struct dnswire_decompressor* decompressor;
+    struct dnswire_rollup*       rollup;
 };
 
 enum dnswire_result dnswire_reader_init(struct dnswire_reader*);
@@ -75,6 +84,11 @@ enum dnswire_result dnswire_reader_init(struct dnswire_reader*);
     free((r).write_buf);          \
     dnswire_decoder_cleanup((r).decoder)
 #define dnswire_reader_is_bidirectional(r) (r).is_bidirectional
+#define dnswire_reader_set_raw(r, v) dnswire_decoder_set_raw((r).decoder, v)
+#define dnswire_reader_frame(r) dnswire_decoder_frame((r).decoder)
+#define dnswire_reader_frame_length(r) dnswire_decoder_frame_length((r).decoder)
+#define dnswire_reader_set_decompressor(r, d) (r).decompressor = d
+#define dnswire_reader_set_rollup(r, u) (r).rollup = u
 
 enum dnswire_result dnswire_reader_allow_bidirectional(struct dnswire_reader*, bool);
 enum dnswire_result dnswire_reader_set_bufsize(struct dnswire_reader*, size_t);
@@ -88,4 +102,14 @@ static inline enum dnswire_result dnswire_reader_fread(struct dnswire_reader* ha
     return dnswire_reader_read(handle, fileno(fp));
 }
 
+/*
+ * Seek in a (unidirectional) file to the frame at the given offset, or to
+ * the first block of the index that may have messages at or after the
+ * given time (`query_time_sec`/`response_time_sec`). If the handshake has
+ * not been done yet it is first read from the file.
+ */
+struct dnswire_index;
+enum dnswire_result dnswire_reader_seek(struct dnswire_reader*, int, uint64_t);
+enum dnswire_result dnswire_reader_seek_time(struct dnswire_reader*, int, const struct dnswire_index*, uint64_t);
+
 #endif
@@ -0,0 +1,95 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/frame.h>
+#include <dnswire/reader.h>
+#include <dnswire/writer.h>
+
+#include <stdlib.h>
+
+#ifndef __dnswire_h_relay
+#define __dnswire_h_relay 1
+
+enum dnswire_relay_destination_state {
+    dnswire_relay_destination_starting = 0,
+    dnswire_relay_destination_relaying = 1,
+    dnswire_relay_destination_stopping = 2,
+    dnswire_relay_destination_done     = 3,
+    dnswire_relay_destination_failed   = 4,
+};
+extern const char* const dnswire_relay_destination_state_string[];
+
+/*
+ * Attributes:
+ * - fd: The file descriptor frames are relayed to, should be non-blocking
+ *   if other destinations should not be stalled by it
+ * - writer: Used for the handshake and to stop the stream
+ * - queue: The destination's own backlog of frames, with drop policy and
+ *   counters
+ * - stop: Stop the stream once the queue has been written
+ */
+struct dnswire_relay_destination {
+    enum dnswire_relay_destination_state state;
+    int                                  fd;
+    struct dnswire_writer                writer;
+    struct dnswire_frame_queue           queue;
+    bool                                 stop;
+};
+
+/*
+ * A destination can also be used on its own, it is then fed by pushing
+ * frames to its queue.
+ */
+enum dnswire_result dnswire_relay_destination_init(struct dnswire_relay_destination*, int, bool, size_t, enum dnswire_frame_queue_policy);
+void                dnswire_relay_destination_destroy(struct dnswire_relay_destination*);
+enum dnswire_result dnswire_relay_destination_write(struct dnswire_relay_destination*);
+
+#define dnswire_relay_destination_is_active(d) (((d).state == dnswire_relay_destination_starting || (d).state == dnswire_relay_destination_relaying) && !(d).stop)
+
+/*
+ * Attributes:
+ * - reader: Reads the incoming stream in raw mode, frames are never decoded
+ * - received: The number of frames received
+ */
+struct dnswire_relay {
+    struct dnswire_reader             reader;
+    struct dnswire_relay_destination* destinations;
+    size_t                            num_destinations;
+    size_t                            received;
+};
+
+enum dnswire_result dnswire_relay_init(struct dnswire_relay*);
+void                dnswire_relay_destroy(struct dnswire_relay*);
+
+#define dnswire_relay_allow_bidirectional(r, b) dnswire_reader_allow_bidirectional(&(r).reader, b)
+#define dnswire_relay_received(r) (r).received
+#define dnswire_relay_destinations(r) (r).num_destinations
+#define dnswire_relay_destination(r, i) (&(r).destinations[i])
+
+enum dnswire_result dnswire_relay_add_destination(struct dnswire_relay*, int, bool, size_t, enum dnswire_frame_queue_policy);
+
+enum dnswire_result dnswire_relay_push(struct dnswire_relay*, const uint8_t*, size_t, uint8_t*, size_t*);
+enum dnswire_result dnswire_relay_read(struct dnswire_relay*, int);
+enum dnswire_result dnswire_relay_write(struct dnswire_relay*, size_t);
+enum dnswire_result dnswire_relay_stop(struct dnswire_relay*);
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_rollup
+#define __dnswire_h_rollup 1
+
+/*
+ * The dimensions messages can be grouped by, the DNS fields are from the
+ * query message (or the response message if there is none) except RCODE
+ * which is only taken from responses.
+ */
+enum dnswire_rollup_dimension {
+    dnswire_rollup_message_type    = 0,
+    dnswire_rollup_socket_family   = 1,
+    dnswire_rollup_socket_protocol = 2,
+    dnswire_rollup_qtype           = 3,
+    dnswire_rollup_rcode           = 4,
+    dnswire_rollup_opcode          = 5,
+    dnswire_rollup_identity        = 6,
+};
+#define DNSWIRE_ROLLUP_DIMENSIONS 7
+extern const char* const dnswire_rollup_dimension_string[];
+
+/*
+ * The value of a dimension the message does not have.
+ */
+#define DNSWIRE_ROLLUP_NONE 0xffff
+
+/*
+ * An aggregate of a bucket, the key holds the values of the dimensions,
+ * 16 bits each in the order they were added and the identity (if used)
+ * last.
+ *
+ * Attributes:
+ * - key, length: Offset and length of the key in the keys of the bucket
+ * - hash: The hash of the key
+ * - messages: The number of messages
+ * - bytes: The total length of the DNS messages
+ */
+struct dnswire_rollup_group {
+    uint32_t key, length, hash;
+    uint64_t messages, bytes;
+};
+
+/*
+ * The aggregates of one time interval.
+ *
+ * Attributes:
+ * - open: If the bucket is in use
+ * - start: The start of the interval in seconds
+ * - groups, num_groups: The aggregates
+ * - keys, keys_len: The keys of the groups
+ * - index, index_size: Open-addressing index of the groups, group
+ *   index + 1 or 0 if empty
+ */
+struct dnswire_rollup_bucket {
+    bool                         open;
+    uint64_t                     start;
+    struct dnswire_rollup_group* groups;
+    size_t                       num_groups, groups_size;
+    uint8_t*                     keys;
+    size_t                       keys_len, keys_size;
+    uint32_t*                    index;
+    size_t                       index_size;
+};
+
+#define DNSWIRE_ROLLUP_BUCKET_INITIALIZER { .open = false }
+void dnswire_rollup_bucket_destroy(struct dnswire_rollup_bucket*);
+
+/*
+ * Aggregates of messages per time interval (a minute by default), grouped
+ * by a set of dimensions, maintained while messages are read and written
+ * to a side file as each interval finishes.
+ *
+ * The time of a message is the query time, or the response time for
+ * responses. Two buckets are kept open so messages slightly out of order
+ * are still counted, a bucket is flushed when a message from two
+ * intervals later arrives. Older messages are counted as late and
+ * dropped.
+ *
+ * The number of groups per bucket is limited to bound memory, messages
+ * of new groups when full are dropped.
+ *
+ * The rollup can be fed by a reader with `dnswire_reader_set_rollup()`
+ * or by calling `dnswire_rollup_add()`, the reader still returns messages
+ * it failed to add and counts them in `failed` instead.
+ *
+ * Attributes:
+ * - interval: The length of a bucket in seconds
+ * - dimensions, num_dimensions: What the messages are grouped by
+ * - max_groups: Groups per bucket
+ * - fd: The side file, or -1 to only aggregate in memory
+ * - buckets, current: The open buckets
+ * - flushed: The number of buckets written
+ * - late, dropped, ignored: Messages older than the open buckets, in
+ *   new groups of a full bucket or without a time
+ * - failed: Messages a reader could not add because of an error, such
+ *   as failing to write the side file
+ */
+struct dnswire_rollup {
+    uint32_t                      interval;
+    enum dnswire_rollup_dimension dimensions[DNSWIRE_ROLLUP_DIMENSIONS];
+    size_t                        num_dimensions;
+    size_t                        max_groups;
+    int                           fd;
+    bool                          header_written;
+
+    struct dnswire_rollup_bucket buckets[2];
+    size_t                       current;
+
+    size_t flushed, late, dropped, ignored, failed;
+};
+
+#define DNSWIRE_ROLLUP_DEFAULT_INTERVAL 60
+#define DNSWIRE_ROLLUP_DEFAULT_MAX_GROUPS 65536
+#define DNSWIRE_ROLLUP_MAGIC "DNSWRLP1"
+
+enum dnswire_result dnswire_rollup_init(struct dnswire_rollup*, uint32_t);
+void                dnswire_rollup_destroy(struct dnswire_rollup*);
+
+/*
+ * Add a dimension to group by, before any message has been added.
+ * Without dimensions each interval has a single group with the totals.
+ */
+enum dnswire_result dnswire_rollup_add_dimension(struct dnswire_rollup*, enum dnswire_rollup_dimension);
+
+#define dnswire_rollup_set_fd(r, v) (r).fd = v
+#define dnswire_rollup_set_max_groups(r, v) (r).max_groups = v
+#define dnswire_rollup_flushed(r) (r).flushed
+#define dnswire_rollup_late(r) (r).late
+#define dnswire_rollup_dropped(r) (r).dropped
+#define dnswire_rollup_ignored(r) (r).ignored
+#define dnswire_rollup_failed(r) (r).failed
+
+/*
+ * Count a message, flushing buckets that are finished. Returns
+ * `dnswire_error` only if a bucket could not be written or memory could
+ * not be allocated.
+ */
+enum dnswire_result dnswire_rollup_add(struct dnswire_rollup*, const struct dnstap*);
+
+/*
+ * Flush all open buckets, such as at the end of the stream.
+ */
+enum dnswire_result dnswire_rollup_flush(struct dnswire_rollup*);
+
+/*
+ * Read the header of a side file into an initialized rollup, setting the
+ * interval and dimensions.
+ */
+enum dnswire_result dnswire_rollup_load(struct dnswire_rollup*, int);
+
+/*
+ * Read the next bucket of a side file, returns `dnswire_endofdata` at
+ * the end of the file.
+ */
+enum dnswire_result dnswire_rollup_read(const struct dnswire_rollup*, struct dnswire_rollup_bucket*, int);
+
+/*
+ * Return the value of a dimension of a group, or `DNSWIRE_ROLLUP_NONE`
+ * if the rollup does not have the dimension or the message did not have
+ * the value. For the identity use `dnswire_rollup_group_identity()`.
+ */
+uint16_t dnswire_rollup_group_value(const struct dnswire_rollup*, const struct dnswire_rollup_bucket*, size_t, enum dnswire_rollup_dimension);
+
+/*
+ * Return the identity of a group and set its length, NULL if the rollup
+ * is not grouped by identity.
+ */
+const uint8_t* dnswire_rollup_group_identity(const struct dnswire_rollup*, const struct dnswire_rollup_bucket*, size_t, size_t*);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/writer.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef __dnswire_h_rotator
+#define __dnswire_h_rotator 1
+
+/*
+ * A file writer that rotates to a new file once the current file has
+ * reached a size or number of frames, or at a wall-clock interval (aligned
+ * to multiples of the interval since the epoch). Each file is a complete
+ * DNSTAP file, it is ended with STOP before it is closed and the next
+ * starts with START.
+ *
+ * Files are named `<path>.<sequence>`, the sequence continues after the
+ * highest existing file and files are created exclusively so that files
+ * of a previous run are never overwritten. The next file is opened and
+ * preallocated by a background thread while the current is written, so a
+ * rotation only has to write STOP and swap file descriptors. Preallocated
+ * files are truncated to their real size when closed.
+ *
+ * Attributes:
+ * - path: The base path of the files
+ * - seq: The sequence of the current file
+ * - max_bytes, max_frames, interval: When to rotate, 0 disables each,
+ *   interval is in seconds
+ * - preallocate: How much to preallocate for each file, 0 for none
+ * - bytes, frames: Written to the current file
+ * - rotate_at: Wall-clock time (in seconds) of the next interval rotation
+ * - next_fd, next_seq: The preopened next file, -1 if not ready yet
+ * - files, rotations, stalls: Counters, stalls is rotations that had to
+ *   wait for the next file to be opened
+ */
+struct dnswire_rotator {
+    char*                 path;
+    char*                 file;
+    size_t                seq;
+    int                   fd;
+    struct dnswire_writer writer;
+    bool                  opened;
+
+    uint64_t max_bytes, max_frames, interval, preallocate;
+    uint64_t bytes, frames, rotate_at;
+
+    pthread_t       thread;
+    bool            started, stop;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             next_fd, next_errno;
+    size_t          next_seq;
+
+    size_t files, rotations, stalls;
+};
+
+enum dnswire_result dnswire_rotator_init(struct dnswire_rotator*, const char*);
+void                dnswire_rotator_destroy(struct dnswire_rotator*);
+
+#define dnswire_rotator_set_max_bytes(r, v) (r).max_bytes = v
+#define dnswire_rotator_set_max_frames(r, v) (r).max_frames = v
+#define dnswire_rotator_set_interval(r, v) (r).interval = v
+#define dnswire_rotator_set_preallocate(r, v) (r).preallocate = v
+#define dnswire_rotator_file(r) (r).file
+
+/*
+ * Open the first file and start preopening the next, write DNSTAP
+ * messages and call `dnswire_rotator_check()` regularly if rotating on
+ * interval so that files are rotated even if nothing is written. Closing
+ * ends the current file and removes the unused preopened file.
+ */
+enum dnswire_result dnswire_rotator_open(struct dnswire_rotator*);
+enum dnswire_result dnswire_rotator_write(struct dnswire_rotator*, const struct dnstap*);
+enum dnswire_result dnswire_rotator_check(struct dnswire_rotator*);
+enum dnswire_result dnswire_rotator_rotate(struct dnswire_rotator*);
+enum dnswire_result dnswire_rotator_close(struct dnswire_rotator*);
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/frame.h>
+#include <dnswire/writer.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef __dnswire_h_spool
+#define __dnswire_h_spool 1
+
+enum dnswire_spool_state {
+    dnswire_spool_disconnected = 0,
+    dnswire_spool_connecting   = 1,
+    dnswire_spool_connected    = 2,
+    dnswire_spool_stopping     = 3,
+    dnswire_spool_done         = 4,
+};
+extern const char* const dnswire_spool_state_string[];
+
+/*
+ * A reconnecting writer that spills frames to a local append-only spool file
+ * while the collector is unavailable or too slow, and replays the spool at a
+ * bounded rate once connected again.
+ *
+ * Frames are sent from a bounded in-memory queue while the spool is empty,
+ * once anything has been spooled all new frames are appended to the spool
+ * so that the order is kept. The spool is truncated once all of it has been
+ * replayed and sent. Frames that were queued directly but not fully written
+ * when the connection breaks are respooled, so delivery is at least once
+ * and those frames may be delivered after frames spooled during the outage,
+ * replayed frames are instead replayed again from the spool in order.
+ *
+ * The spool file contains only data frames, header and payload, and a
+ * partially written frame at the end (from a crash) is truncated when the
+ * spool is opened.
+ *
+ * Attributes:
+ * - connect: Callback to (re)connect to the collector, returns a file
+ *   descriptor (preferably non-blocking) or -1 on failure, the spool owns
+ *   the file descriptor and closes it on errors and when done
+ * - queue: Frames to send on the current connection
+ * - live: The queue's `queued` counter after the last frame that was queued
+ *   directly, frames up to it are not in the spool
+ * - spool_fd: The spool file
+ * - read_at, write_at: Where replay reads from and appends are written to
+ * - max_size: The maximum size of the spool file, 0 for unlimited, frames
+ *   that do not fit are dropped
+ * - sync_frames, sync_interval: Group commit, the spool file is synced after
+ *   this many appended frames or when this many milliseconds have passed
+ *   since the last sync (if something was appended), 0 disables each
+ * - reconnect_interval: Milliseconds between connection attempts
+ * - replay_rate: Bytes per second to replay from the spool, 0 for unlimited
+ * - connects, spooled, replayed, dropped, syncs: Counters
+ */
+struct dnswire_spool {
+    enum dnswire_spool_state state;
+
+    int (*connect)(void*);
+    void*                      ctx;
+    int                        fd;
+    struct dnswire_writer      writer;
+    bool                       bidirectional;
+    struct dnswire_frame_queue queue;
+    size_t                     live;
+
+    int   spool_fd;
+    off_t read_at, write_at, max_size;
+
+    size_t   sync_frames, unsynced;
+    uint64_t sync_interval, last_sync;
+    uint64_t reconnect_interval, next_connect;
+    size_t   replay_rate, tokens;
+    uint64_t last_refill;
+
+    bool stop;
+
+    size_t connects, spooled, replayed, dropped, syncs;
+};
+
+#define DNSWIRE_SPOOL_DEFAULT_SYNC_FRAMES 1024
+#define DNSWIRE_SPOOL_DEFAULT_SYNC_INTERVAL 1000
+#define DNSWIRE_SPOOL_DEFAULT_RECONNECT_INTERVAL 1000
+
+enum dnswire_result dnswire_spool_init(struct dnswire_spool*, const char*);
+void                dnswire_spool_destroy(struct dnswire_spool*);
+
+#define dnswire_spool_set_connect(s, f, c) \
+    (s).connect = f;                       \
+    (s).ctx     = c
+#define dnswire_spool_set_bidirectional(s, b) (s).bidirectional = b
+#define dnswire_spool_set_max_size(s, m) (s).max_size = m
+#define dnswire_spool_set_sync_frames(s, n) (s).sync_frames = n
+#define dnswire_spool_set_sync_interval(s, ms) (s).sync_interval = ms
+#define dnswire_spool_set_reconnect_interval(s, ms) (s).reconnect_interval = ms
+#define dnswire_spool_set_replay_rate(s, r) (s).replay_rate = r
+#define dnswire_spool_pending(s) ((s).write_at - (s).read_at)
+#define dnswire_spool_is_connected(s) ((s).state == dnswire_spool_connected)
+
+enum dnswire_result dnswire_spool_set_queue_size(struct dnswire_spool*, size_t);
+
+/*
+ * Frames are written to the queue or appended to the spool, and
+ * `dnswire_spool_run()` should be called whenever the connection can be
+ * written to (and regularly while disconnected or replaying) to connect,
+ * send, replay and sync.
+ *
+ * `dnswire_spool_run()` returns:
+ * - dnswire_ok: Everything has been sent
+ * - dnswire_again: There is more to send, or to replay once the rate allows,
+ *   or it is waiting to reconnect
+ * - dnswire_endofdata: Stopped, anything not sent is kept in the spool
+ * - dnswire_error: The spool file could not be written or read
+ */
+enum dnswire_result dnswire_spool_write_frame(struct dnswire_spool*, struct dnswire_frame*);
+enum dnswire_result dnswire_spool_write_dnstap(struct dnswire_spool*, const struct dnstap*);
+enum dnswire_result dnswire_spool_run(struct dnswire_spool*);
+enum dnswire_result dnswire_spool_sync(struct dnswire_spool*);
+enum dnswire_result dnswire_spool_stop(struct dnswire_spool*);
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/columnar.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __dnswire_h_topk
+#define __dnswire_h_topk 1
+
+/*
+ * What is counted:
+ * - qname: The QNAME of the query (or response) message, lowercased and
+ *   in wire format
+ * - client: The query address
+ * - client_rcode: The query address and the RCODE of responses, as the
+ *   address followed by one byte with the RCODE
+ */
+enum dnswire_topk_key {
+    dnswire_topk_qname        = 0,
+    dnswire_topk_client       = 1,
+    dnswire_topk_client_rcode = 2,
+};
+extern const char* const dnswire_topk_key_string[];
+
+/*
+ * Room for the longest key, a QNAME.
+ */
+#define DNSWIRE_TOPK_MAX_KEY 256
+
+/*
+ * A counter of the sketch, `count` overestimates the true count by at
+ * most `error`.
+ */
+struct dnswire_topk_counter {
+    uint8_t  key[DNSWIRE_TOPK_MAX_KEY];
+    size_t   length;
+    uint64_t count, error;
+    uint32_t hash, heap;
+};
+
+/*
+ * A Space-Saving sketch of the most frequent keys of a stream.
+ *
+ * A fixed number of counters is kept, a key that is not counted replaces
+ * the key with the lowest count and takes over its count (as error). Any
+ * key seen more often than the total divided by the number of counters
+ * is guaranteed to be counted. Memory is set by the number of counters
+ * at init and does not grow with the number of distinct keys.
+ *
+ * Counters are found by an open-addressing index and the lowest count by
+ * a min-heap, so adding is constant time in the common case of a key
+ * already counted.
+ *
+ * A sketch is not thread-safe, each worker thread should have its own
+ * and they are merged with `dnswire_topk_merge()` at the end of a window,
+ * so adding needs no locks or atomics.
+ *
+ * Attributes:
+ * - key: What is counted
+ * - counters, capacity, used: The counters
+ * - heap: Counter indexes as a min-heap by count
+ * - index, index_size: The open-addressing index, counter index + 1 or
+ *   0 if empty
+ * - total: The sum of all counts added
+ */
+struct dnswire_topk {
+    enum dnswire_topk_key        key;
+    struct dnswire_topk_counter* counters;
+    size_t                       capacity, used;
+    uint32_t*                    heap;
+    uint32_t*                    index;
+    size_t                       index_size;
+    uint64_t                     total;
+};
+
+/*
+ * Initialize with a number of counters, which sets the memory used.
+ */
+enum dnswire_result dnswire_topk_init(struct dnswire_topk*, enum dnswire_topk_key, size_t);
+void                dnswire_topk_destroy(struct dnswire_topk*);
+
+/*
+ * Reset all counters, such as at the start of a new window.
+ */
+void dnswire_topk_clear(struct dnswire_topk*);
+
+#define dnswire_topk_total(t) (t).total
+#define dnswire_topk_used(t) (t).used
+
+/*
+ * Count a key a number of times.
+ */
+enum dnswire_result dnswire_topk_add(struct dnswire_topk*, const uint8_t*, size_t, uint64_t);
+
+/*
+ * Count the key of a DNSTAP message, returns `dnswire_again` if the
+ * message does not have it (no QNAME, or not a response for
+ * client_rcode).
+ */
+enum dnswire_result dnswire_topk_add_dnstap(struct dnswire_topk*, const struct dnstap*);
+
+/*
+ * Count the keys of the rows of `DNSWIRE_COLUMNS` columns, such as the
+ * columns of a `dnswire_batch` or of a row group of a columnar archive.
+ */
+enum dnswire_result dnswire_topk_add_columns(struct dnswire_topk*, const struct dnswire_column_data*);
+
+/*
+ * Merge a sketch into another counting the same key, the result is as if
+ * both streams had been counted together with the counters of `handle`.
+ */
+enum dnswire_result dnswire_topk_merge(struct dnswire_topk*, const struct dnswire_topk*);
+
+/*
+ * Copy up to `n` counters with the highest counts, in order, and return
+ * how many were copied. Taken at the end of a window before clearing.
+ */
+size_t dnswire_topk_snapshot(const struct dnswire_topk*, struct dnswire_topk_counter*, size_t);
+
+#endif
@@ -51,7 +51,14 @@ extern const char* const dnswire_writer_state_string[];
  * - max: The maximum size the buffer is allowed to have
  * - at: Where in the buffer we are encoding to (end of data)
  * - left: How much data that is still left in the buffer before `at`
+ * - offset: How much of the stream that has been encoded, used as the
+ *   offset of the frames added to the index
+ * - index: If set, each DNSTAP frame is added to the index
+ * - compressor: If set, output is compressed through it instead of
+ *   written to the file descriptor directly
  */
+struct dnswire_index;
+struct dnswire_compressor;
 struct dnswire_writer {
     enum dnswire_writer_state state;
 
@@ -64,12 +71,25 @@ struct dnswire_writer {
     size_t                 read_size, read_inc, read_max, read_at, read_left, read_pushed;
 
     bool bidirectional;
+
+    size_t                offset;
+    struct dnswire_index* index;
+
+    struct dnswire_compressor* compressor;
 };
 
 enum dnswire_result dnswire_writer_init(struct dnswire_writer*);
 
 #define dnswire_writer_popped(w) (w).popped
 #define dnswire_writer_set_dnstap(w, d) (w).encoder.dnstap = d
+#define dnswire_writer_set_index(w, i) (w).index = i
+#define dnswire_writer_set_compressor(w, c) (w).compressor = c
+#define dnswire_writer_offset(w) (w).offset
+/*
+ * True once the handshake (READY/ACCEPT if bidirectional, and START) has been
+ * fully written and the writer is ready to encode frames.
+ */
+#define dnswire_writer_is_started(w) ((w).state == dnswire_writer_encoding && (w).encoder.state == dnswire_encoder_frames && !(w).left)
 #define dnswire_writer_destroy(w) \
     free((w).buf);                \
     free((w).read_buf)
@@ -0,0 +1,80 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dnswire/dnswire.h>
+#include <dnswire/dnstap.h>
+#include <dnswire/frame.h>
+#include <dnswire/relay.h>
+
+#include <stdlib.h>
+
+#ifndef __dnswire_h_writer_group
+#define __dnswire_h_writer_group 1
+
+enum dnswire_writer_group_distribution {
+    dnswire_writer_group_round_robin    = 0,
+    dnswire_writer_group_client_address = 1,
+};
+extern const char* const dnswire_writer_group_distribution_string[];
+
+/*
+ * A group of parallel Frame Streams connections, each with its own
+ * handshake and queue, that messages are distributed over so that a
+ * collector can decode them on multiple cores.
+ *
+ * Messages are distributed round-robin or by a hash of a key, normally the
+ * client address, so that the messages of a client stays in order on the
+ * same connection. If the selected connection has failed or is stopping
+ * the next active one is used.
+ *
+ * Attributes:
+ * - connections: The connections, see `struct dnswire_relay_destination`
+ * - next: The next connection for round-robin
+ * - unrouted: Messages that could not be sent since no connection was active
+ */
+struct dnswire_writer_group {
+    enum dnswire_writer_group_distribution distribution;
+    struct dnswire_relay_destination*      connections;
+    size_t                                 num_connections, next;
+    size_t                                 unrouted;
+};
+
+enum dnswire_result dnswire_writer_group_init(struct dnswire_writer_group*, enum dnswire_writer_group_distribution);
+void                dnswire_writer_group_destroy(struct dnswire_writer_group*);
+
+#define dnswire_writer_group_connections(g) (g).num_connections
+#define dnswire_writer_group_connection(g, i) (&(g).connections[i])
+
+enum dnswire_result dnswire_writer_group_add_connection(struct dnswire_writer_group*, int, bool, size_t, enum dnswire_frame_queue_policy);
+
+/*
+ * Queue a frame, using the key (if any) for distribution by client
+ * address, or a DNSTAP message keyed by its query address.
+ *
+ * Returns dnswire_ok if queued, dnswire_again if a frame was dropped by the
+ * connection's queue or dnswire_error if there was no active connection.
+ */
+enum dnswire_result dnswire_writer_group_write_frame(struct dnswire_writer_group*, struct dnswire_frame*, const uint8_t*, size_t);
+enum dnswire_result dnswire_writer_group_write_dnstap(struct dnswire_writer_group*, const struct dnstap*);
+enum dnswire_result dnswire_writer_group_write(struct dnswire_writer_group*, size_t);
+enum dnswire_result dnswire_writer_group_stop(struct dnswire_writer_group*);
+
+#endif
@@ -0,0 +1,229 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/frame.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+const char* const dnswire_frame_queue_policy_string[] = {
+    "drop_newest",
+    "drop_oldest",
+};
+
+struct dnswire_frame* dnswire_frame_new(size_t len)
+{
+    assert(len);
+    assert(len <= UINT32_MAX);
+
+    struct dnswire_frame* frame = malloc(sizeof(struct dnswire_frame) + tinyframe_frame_size(len));
+    if (!frame) {
+        return 0;
+    }
+
+    frame->refs   = 1;
+    frame->length = tinyframe_frame_size(len);
+    tinyframe_set_header(frame->data, len);
+
+    return frame;
+}
+
+struct dnswire_frame* dnswire_frame_copy(const uint8_t* data, size_t len)
+{
+    assert(data);
+
+    struct dnswire_frame* frame = dnswire_frame_new(len);
+    if (frame) {
+        memcpy(dnswire_frame_payload(frame), data, len);
+    }
+
+    return frame;
+}
+
+enum dnswire_result dnswire_frame_queue_init(struct dnswire_frame_queue* handle, size_t size, enum dnswire_frame_queue_policy policy)
+{
+    assert(handle);
+    assert(size);
+
+    memset(handle, 0, sizeof(struct dnswire_frame_queue));
+
+    switch (policy) {
+    case dnswire_frame_queue_drop_newest:
+    case dnswire_frame_queue_drop_oldest:
+        break;
+    default:
+        return dnswire_error;
+    }
+
+    if (!(handle->frames = calloc(size, sizeof(struct dnswire_frame*)))) {
+        return dnswire_error;
+    }
+    handle->size   = size;
+    handle->policy = policy;
+
+    return dnswire_ok;
+}
+
+void dnswire_frame_queue_clear(struct dnswire_frame_queue* handle)
+{
+    assert(handle);
+
+    while (handle->len) {
+        dnswire_frame_unref(handle->frames[handle->at]);
+        handle->frames[handle->at] = 0;
+        handle->at                 = (handle->at + 1) % handle->size;
+        handle->len--;
+    }
+    handle->at     = 0;
+    handle->offset = 0;
+}
+
+void dnswire_frame_queue_destroy(struct dnswire_frame_queue* handle)
+{
+    assert(handle);
+
+    if (handle->frames) {
+        dnswire_frame_queue_clear(handle);
+        free(handle->frames);
+        handle->frames = 0;
+    }
+}
+
+enum dnswire_result dnswire_frame_queue_push(struct dnswire_frame_queue* handle, struct dnswire_frame* frame)
+{
+    assert(handle);
+    assert(handle->frames);
+    assert(frame);
+
+    enum dnswire_result res = dnswire_ok;
+
+    if (handle->len >= handle->size) {
+        /*
+         * The oldest frame can not be dropped if it has been partially
+         * written, that would corrupt the stream, so drop the one after it.
+         */
+        if (handle->policy == dnswire_frame_queue_drop_newest || (handle->offset && handle->len < 2)) {
+            __trace("full, dropping newest");
+            handle->dropped++;
+            return dnswire_again;
+        }
+
+        size_t drop = handle->offset ? (handle->at + 1) % handle->size : handle->at;
+        __trace("full, dropping oldest at %zu", drop);
+        dnswire_frame_unref(handle->frames[drop]);
+        if (handle->offset) {
+            handle->frames[drop] = handle->frames[handle->at];
+        }
+        handle->frames[handle->at] = 0;
+        handle->at                 = (handle->at + 1) % handle->size;
+        handle->len--;
+        handle->dropped++;
+        res = dnswire_again;
+    }
+
+    handle->frames[(handle->at + handle->len) % handle->size] = dnswire_frame_ref(frame);
+    handle->len++;
+    handle->queued++;
+
+    return res;
+}
+
+enum dnswire_result dnswire_frame_queue_write(struct dnswire_frame_queue* handle, int fd)
+{
+    assert(handle);
+    assert(handle->frames);
+
+    if (!handle->len) {
+        return dnswire_ok;
+    }
+
+    struct iovec iov[DNSWIRE_FRAME_QUEUE_MAX_IOV];
+    size_t       n;
+
+    for (n = 0; n < handle->len && n < DNSWIRE_FRAME_QUEUE_MAX_IOV; n++) {
+        struct dnswire_frame* frame = handle->frames[(handle->at + n) % handle->size];
+        size_t                skip  = n ? 0 : handle->offset;
+
+        iov[n].iov_base = &frame->data[skip];
+        iov[n].iov_len  = frame->length - skip;
+    }
+
+    ssize_t nwrote = writev(fd, iov, (int)n);
+    __trace("wrote %zd", nwrote);
+    if (nwrote < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return dnswire_again;
+        }
+        return dnswire_error;
+    } else if (!nwrote) {
+        return dnswire_error;
+    }
+
+    handle->bytes += nwrote;
+
+    size_t left = nwrote;
+    while (left) {
+        struct dnswire_frame* frame = handle->frames[handle->at];
+        size_t                rest  = frame->length - handle->offset;
+
+        if (left < rest) {
+            handle->offset += left;
+            break;
+        }
+
+        left -= rest;
+        dnswire_frame_unref(frame);
+        handle->frames[handle->at] = 0;
+        handle->at                 = (handle->at + 1) % handle->size;
+        handle->offset             = 0;
+        handle->len--;
+        handle->written++;
+    }
+    __trace("left %zu", handle->len);
+
+    return handle->len ? dnswire_again : dnswire_ok;
+}
+
+struct dnswire_frame* dnswire_frame_queue_pop(struct dnswire_frame_queue* handle)
+{
+    assert(handle);
+    assert(handle->frames);
+    // can not pop a frame that has been partially written
+    assert(!handle->offset);
+
+    if (!handle->len) {
+        return 0;
+    }
+
+    struct dnswire_frame* frame = handle->frames[handle->at];
+    handle->frames[handle->at]  = 0;
+    handle->at                  = (handle->at + 1) % handle->size;
+    handle->len--;
+    handle->written++;
+    handle->bytes += frame->length;
+
+    return frame;
+}
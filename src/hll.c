@@ -0,0 +1,458 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/hll.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+/*
+ * Values hashed at a time when adding a batch.
+ */
+#define HASH_CHUNK 256
+
+static inline uint64_t _mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static inline uint64_t _hash(const uint8_t* value, size_t len)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL * (len + 1), w;
+
+    while (len >= 8) {
+        memcpy(&w, value, 8);
+        h = _mix(h ^ w);
+        value += 8;
+        len -= 8;
+    }
+    w = 0;
+    if (len) {
+        memcpy(&w, value, len);
+    }
+
+    return _mix(h ^ w);
+}
+
+enum dnswire_result dnswire_hll_init(struct dnswire_hll* handle, uint8_t precision)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_hll));
+
+    if (precision < DNSWIRE_HLL_MIN_PRECISION || precision > DNSWIRE_HLL_MAX_PRECISION) {
+        return dnswire_error;
+    }
+    if (!(handle->registers = calloc(1, (size_t)1 << precision))) {
+        return dnswire_error;
+    }
+    handle->precision = precision;
+    handle->size      = (size_t)1 << precision;
+
+    return dnswire_ok;
+}
+
+void dnswire_hll_destroy(struct dnswire_hll* handle)
+{
+    assert(handle);
+
+    free(handle->registers);
+    handle->registers = 0;
+}
+
+void dnswire_hll_clear(struct dnswire_hll* handle)
+{
+    assert(handle);
+    assert(handle->registers);
+
+    memset(handle->registers, 0, handle->size);
+}
+
+/*
+ * The top bits of the hash select the register, which keeps the position
+ * of the first set bit of the rest. The low bit set below the rest limits
+ * the rank to 64 - precision + 1.
+ */
+static inline void _update(struct dnswire_hll* handle, uint64_t hash)
+{
+    size_t  i    = hash >> (64 - handle->precision);
+    uint8_t rank = __builtin_clzll((hash << handle->precision) | ((uint64_t)1 << (handle->precision - 1))) + 1;
+
+    if (rank > handle->registers[i]) {
+        handle->registers[i] = rank;
+    }
+}
+
+void dnswire_hll_add(struct dnswire_hll* handle, const uint8_t* value, size_t len)
+{
+    assert(handle);
+    assert(handle->registers);
+    assert(value || !len);
+
+    _update(handle, _hash(value, len));
+}
+
+void dnswire_hll_add_batch(struct dnswire_hll* handle, const uint8_t* const* values, const size_t* lens, size_t n)
+{
+    assert(handle);
+    assert(handle->registers);
+    assert(values || !n);
+    assert(lens || !n);
+
+    uint64_t hashes[HASH_CHUNK];
+    size_t   i, j, m;
+
+    for (i = 0; i < n; i += m) {
+        m = n - i < HASH_CHUNK ? n - i : HASH_CHUNK;
+
+        for (j = 0; j < m; j++) {
+            hashes[j] = _hash(values[i + j], lens[i + j]);
+        }
+        for (j = 0; j < m; j++) {
+            _update(handle, hashes[j]);
+        }
+    }
+}
+
+void dnswire_hll_add_column(struct dnswire_hll* handle, const struct dnswire_column_data* column)
+{
+    assert(handle);
+    assert(handle->registers);
+    assert(column);
+
+    const uint8_t* values[HASH_CHUNK];
+    size_t         lens[HASH_CHUNK], i, m = 0;
+
+    for (i = 0; i < column->rows; i++) {
+        if (!dnswire_column_data_is_present(*column, i)) {
+            continue;
+        }
+        values[m] = dnswire_column_data_bytes(*column, i);
+        lens[m++] = dnswire_column_data_length(*column, i);
+        if (m == HASH_CHUNK) {
+            dnswire_hll_add_batch(handle, values, lens, m);
+            m = 0;
+        }
+    }
+    if (m) {
+        dnswire_hll_add_batch(handle, values, lens, m);
+    }
+}
+
+static inline void _merge(uint8_t* registers, const uint8_t* from, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        registers[i] = from[i] > registers[i] ? from[i] : registers[i];
+    }
+}
+
+enum dnswire_result dnswire_hll_merge(struct dnswire_hll* handle, const struct dnswire_hll* from)
+{
+    assert(handle);
+    assert(handle->registers);
+    assert(from);
+    assert(from->registers);
+
+    if (handle->precision != from->precision) {
+        return dnswire_error;
+    }
+    _merge(handle->registers, from->registers, handle->size);
+
+    return dnswire_ok;
+}
+
+/*
+ * The estimator from "New cardinality estimation algorithms for
+ * HyperLogLog sketches" (Otmar Ertl, 2017).
+ */
+
+static double _sigma(double x)
+{
+    double y = 1.0, z = x, prev;
+
+    do {
+        x *= x;
+        prev = z;
+        z += x * y;
+        y += y;
+    } while (z != prev);
+
+    return z;
+}
+
+static double _tau(double x)
+{
+    double y = 1.0, z = 1.0 - x, prev;
+
+    if (x == 0.0 || x == 1.0) {
+        return 0.0;
+    }
+    do {
+        x = sqrt(x);
+        prev = z;
+        y *= 0.5;
+        z -= (1.0 - x) * (1.0 - x) * y;
+    } while (z != prev);
+
+    return z / 3.0;
+}
+
+uint64_t dnswire_hll_estimate(const struct dnswire_hll* handle)
+{
+    assert(handle);
+    assert(handle->registers);
+
+    size_t q = 64 - handle->precision, counts[66] = { 0 }, i;
+    double m = handle->size, z;
+
+    for (i = 0; i < handle->size; i++) {
+        counts[handle->registers[i]]++;
+    }
+    if (counts[0] == handle->size) {
+        return 0;
+    }
+
+    z = m * _tau(1.0 - counts[q + 1] / m);
+    for (i = q; i > 0; i--) {
+        z = 0.5 * (z + counts[i]);
+    }
+    z += m * _sigma(counts[0] / m);
+
+    // alpha for an infinite number of registers, 1 / (2 ln 2)
+    return (uint64_t)(0.7213475204444817 * m * m / z + 0.5);
+}
+
+ssize_t dnswire_hll_serialize(const struct dnswire_hll* handle, uint8_t* out, size_t size)
+{
+    assert(handle);
+    assert(handle->registers);
+    assert(out);
+
+    if (size < dnswire_hll_serialized_size(*handle)) {
+        return -1;
+    }
+    out[0] = 'H';
+    out[1] = 'L';
+    out[2] = DNSWIRE_HLL_VERSION;
+    out[3] = handle->precision;
+    memcpy(out + DNSWIRE_HLL_HEADER_SIZE, handle->registers, handle->size);
+
+    return dnswire_hll_serialized_size(*handle);
+}
+
+/*
+ * Check a serialized sketch, returns the precision or 0 if invalid.
+ */
+static uint8_t _check(const uint8_t* in, size_t len)
+{
+    size_t i;
+
+    if (len < DNSWIRE_HLL_HEADER_SIZE
+        || in[0] != 'H' || in[1] != 'L' || in[2] != DNSWIRE_HLL_VERSION
+        || in[3] < DNSWIRE_HLL_MIN_PRECISION || in[3] > DNSWIRE_HLL_MAX_PRECISION
+        || len != DNSWIRE_HLL_HEADER_SIZE + ((size_t)1 << in[3])) {
+        return 0;
+    }
+    for (i = DNSWIRE_HLL_HEADER_SIZE; i < len; i++) {
+        if (in[i] > 64 - in[3] + 1) {
+            return 0;
+        }
+    }
+
+    return in[3];
+}
+
+enum dnswire_result dnswire_hll_deserialize(struct dnswire_hll* handle, const uint8_t* in, size_t len)
+{
+    assert(handle);
+    assert(in);
+
+    uint8_t precision = _check(in, len);
+
+    if (!precision) {
+        memset(handle, 0, sizeof(struct dnswire_hll));
+        return dnswire_error;
+    }
+    if (dnswire_hll_init(handle, precision) != dnswire_ok) {
+        return dnswire_error;
+    }
+    memcpy(handle->registers, in + DNSWIRE_HLL_HEADER_SIZE, handle->size);
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_hll_merge_serialized(struct dnswire_hll* handle, const uint8_t* in, size_t len)
+{
+    assert(handle);
+    assert(handle->registers);
+    assert(in);
+
+    if (_check(in, len) != handle->precision) {
+        return dnswire_error;
+    }
+    _merge(handle->registers, in + DNSWIRE_HLL_HEADER_SIZE, handle->size);
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_hll_group_init(struct dnswire_hll_group* handle, uint8_t precision, size_t max_entries)
+{
+    assert(handle);
+
+    size_t size = 16;
+
+    memset(handle, 0, sizeof(struct dnswire_hll_group));
+
+    if (precision < DNSWIRE_HLL_MIN_PRECISION || precision > DNSWIRE_HLL_MAX_PRECISION
+        || !max_entries || max_entries > UINT32_MAX / 2) {
+        return dnswire_error;
+    }
+    while (size < max_entries * 2) {
+        size *= 2;
+    }
+
+    if (!(handle->entries = calloc(max_entries, sizeof(struct dnswire_hll_group_entry)))
+        || !(handle->index = calloc(size, sizeof(uint32_t)))) {
+        dnswire_hll_group_destroy(handle);
+        return dnswire_error;
+    }
+    handle->precision   = precision;
+    handle->max_entries = max_entries;
+    handle->index_size  = size;
+
+    __trace("precision %u max entries %zu", precision, max_entries);
+
+    return dnswire_ok;
+}
+
+void dnswire_hll_group_destroy(struct dnswire_hll_group* handle)
+{
+    assert(handle);
+
+    if (handle->entries) {
+        dnswire_hll_group_clear(handle);
+    }
+    free(handle->entries);
+    free(handle->index);
+    handle->entries = 0;
+    handle->index   = 0;
+}
+
+void dnswire_hll_group_clear(struct dnswire_hll_group* handle)
+{
+    assert(handle);
+    assert(handle->entries);
+
+    size_t i;
+
+    for (i = 0; i < handle->num_entries; i++) {
+        free(handle->entries[i].key);
+        dnswire_hll_destroy(&handle->entries[i].hll);
+    }
+    memset(handle->entries, 0, handle->num_entries * sizeof(struct dnswire_hll_group_entry));
+    // not allocated if init failed
+    if (handle->index) {
+        memset(handle->index, 0, handle->index_size * sizeof(uint32_t));
+    }
+    handle->num_entries = 0;
+    handle->dropped     = 0;
+}
+
+static inline size_t _find(const struct dnswire_hll_group* handle, const uint8_t* key, size_t len, uint32_t hash)
+{
+    size_t mask = handle->index_size - 1, i;
+
+    for (i = hash & mask; handle->index[i]; i = (i + 1) & mask) {
+        const struct dnswire_hll_group_entry* e = &handle->entries[handle->index[i] - 1];
+
+        if (e->hash == hash && e->length == len && (!len || !memcmp(e->key, key, len))) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+enum dnswire_result dnswire_hll_group_add(struct dnswire_hll_group* handle, const uint8_t* key, size_t key_len, const uint8_t* value, size_t len)
+{
+    assert(handle);
+    assert(handle->entries);
+    assert(key || !key_len);
+    assert(value || !len);
+
+    uint32_t                        hash = (uint32_t)_hash(key, key_len);
+    size_t                          slot = _find(handle, key, key_len, hash);
+    struct dnswire_hll_group_entry* e;
+
+    if (handle->index[slot]) {
+        _update(&handle->entries[handle->index[slot] - 1].hll, _hash(value, len));
+        return dnswire_ok;
+    }
+
+    if (handle->num_entries == handle->max_entries) {
+        handle->dropped++;
+        return dnswire_again;
+    }
+
+    e = &handle->entries[handle->num_entries];
+    if (!(e->key = malloc(key_len ? key_len : 1))) {
+        return dnswire_error;
+    }
+    if (dnswire_hll_init(&e->hll, handle->precision) != dnswire_ok) {
+        free(e->key);
+        e->key = 0;
+        return dnswire_error;
+    }
+    if (key_len) {
+        memcpy(e->key, key, key_len);
+    }
+    e->length           = key_len;
+    e->hash             = hash;
+    handle->index[slot] = ++handle->num_entries;
+
+    _update(&e->hll, _hash(value, len));
+
+    return dnswire_ok;
+}
+
+struct dnswire_hll* dnswire_hll_group_get(struct dnswire_hll_group* handle, const uint8_t* key, size_t len)
+{
+    assert(handle);
+    assert(handle->entries);
+    assert(key || !len);
+
+    uint32_t hash = (uint32_t)_hash(key, len);
+    size_t   slot = _find(handle, key, len, hash);
+
+    return handle->index[slot] ? &handle->entries[handle->index[slot] - 1].hll : 0;
+}
@@ -0,0 +1,503 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/index.h"
+#include "dnswire/partitioner.h"
+#include "dnswire/trace.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define __HEADER_SIZE 32
+#define __BLOCK_SIZE 28
+
+enum dnswire_result dnswire_index_init(struct dnswire_index* handle, size_t block_frames)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_index));
+
+    if (!block_frames || block_frames > DNSWIRE_INDEX_MAX_BLOCK_FRAMES) {
+        return dnswire_error;
+    }
+    handle->block_frames = block_frames;
+
+    return dnswire_ok;
+}
+
+void dnswire_index_destroy(struct dnswire_index* handle)
+{
+    assert(handle);
+
+    free(handle->blocks);
+    handle->blocks     = 0;
+    handle->num_blocks = 0;
+    handle->size       = 0;
+    free(handle->blooms);
+    handle->blooms = 0;
+}
+
+enum dnswire_result dnswire_index_set_bloom_size(struct dnswire_index* handle, size_t bloom_size)
+{
+    assert(handle);
+
+    if (handle->num_blocks || bloom_size > DNSWIRE_INDEX_MAX_BLOOM_SIZE) {
+        return dnswire_error;
+    }
+    free(handle->blooms);
+    handle->blooms     = 0;
+    handle->bloom_size = bloom_size;
+    handle->size       = 0;
+    free(handle->blocks);
+    handle->blocks = 0;
+
+    return dnswire_ok;
+}
+
+static struct dnswire_index_block* _new_block(struct dnswire_index* handle)
+{
+    if (handle->num_blocks == handle->size) {
+        size_t                      size   = handle->size ? handle->size * 2 : 64;
+        struct dnswire_index_block* blocks = realloc(handle->blocks, size * sizeof(struct dnswire_index_block));
+        if (!blocks) {
+            return 0;
+        }
+        handle->blocks = blocks;
+        if (handle->bloom_size) {
+            uint8_t* blooms = realloc(handle->blooms, size * 2 * handle->bloom_size);
+            if (!blooms) {
+                return 0;
+            }
+            handle->blooms = blooms;
+        }
+        handle->size = size;
+    }
+    if (handle->bloom_size) {
+        memset(dnswire_index_address_bloom(*handle, handle->num_blocks), 0, 2 * handle->bloom_size);
+    }
+
+    struct dnswire_index_block* block = &handle->blocks[handle->num_blocks++];
+    block->frames                     = 0;
+    block->min                        = UINT64_MAX;
+    block->max                        = 0;
+    block->seek                       = handle->num_blocks > 1 ? block[-1].seek : 0;
+
+    return block;
+}
+
+static inline void _time(struct dnswire_index_block* block, uint64_t t)
+{
+    if (t < block->min) {
+        block->min = t;
+    }
+    if (t > block->max) {
+        block->max = t;
+    }
+    if (t > block->seek) {
+        block->seek = t;
+    }
+}
+
+/*
+ * The bits of a key are found by double hashing with the two halves of a
+ * 64 bit FNV-1a hash.
+ */
+static void _bloom_add(uint8_t* bloom, size_t size, const uint8_t* key, size_t len)
+{
+    uint64_t h  = _fnv1a64(key, len);
+    uint32_t h1 = h, h2 = (h >> 32) | 1;
+    size_t   i, bits = size * 8;
+
+    for (i = 0; i < DNSWIRE_INDEX_BLOOM_HASHES; i++) {
+        size_t bit = (h1 + i * h2) % bits;
+        bloom[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+static bool _bloom_test(const uint8_t* bloom, size_t size, const uint8_t* key, size_t len)
+{
+    uint64_t h  = _fnv1a64(key, len);
+    uint32_t h1 = h, h2 = (h >> 32) | 1;
+    size_t   i, bits = size * 8;
+
+    for (i = 0; i < DNSWIRE_INDEX_BLOOM_HASHES; i++) {
+        size_t bit = (h1 + i * h2) % bits;
+        if (!(bloom[bit / 8] & (1 << (bit % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Get the QNAME of a DNS message in lower case wire format, returns the
+ * length or 0 if it could not be found.
+ */
+static size_t _qname(const uint8_t* msg, size_t len, uint8_t name[255])
+{
+    size_t at = 12, n = 0;
+
+    if (len < at || !(msg[4] || msg[5])) {
+        return 0;
+    }
+    while (at < len) {
+        uint8_t l = msg[at++];
+        if (l & 0xc0 || n + 1 + l > 255 || at + l > len) {
+            // compression in the question is not expected
+            return 0;
+        }
+        name[n++] = l;
+        if (!l) {
+            return n;
+        }
+        for (; l; l--) {
+            uint8_t c = msg[at++];
+            name[n++] = c >= 'A' && c <= 'Z' ? c + 32 : c;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Convert a name as text to lower case wire format, returns the length or
+ * 0 if it is not a valid name.
+ */
+static size_t _qname_from_string(const char* str, uint8_t name[255])
+{
+    size_t n = 0;
+
+    if (!strcmp(str, ".")) {
+        str++;
+    }
+    while (*str) {
+        size_t l = strcspn(str, ".");
+        if (!l || l > 63 || n + 1 + l + 1 > 255) {
+            return 0;
+        }
+        name[n++] = l;
+        for (; l; l--, str++) {
+            name[n++] = *str >= 'A' && *str <= 'Z' ? *str + 32 : *str;
+        }
+        if (*str == '.') {
+            str++;
+        }
+    }
+    name[n++] = 0;
+    return n;
+}
+
+enum dnswire_result dnswire_index_add(struct dnswire_index* handle, uint64_t offset, size_t length, const struct dnstap* dnstap)
+{
+    assert(handle);
+    assert(dnstap);
+
+    struct dnswire_index_block* block = handle->num_blocks ? &handle->blocks[handle->num_blocks - 1] : 0;
+
+    if (!block || block->frames >= handle->block_frames) {
+        if (!(block = _new_block(handle))) {
+            return dnswire_error;
+        }
+        block->offset = offset;
+    }
+    block->frames++;
+    handle->end = offset + length;
+
+    if (!dnstap_has_message(*dnstap)) {
+        return dnswire_ok;
+    }
+    if (dnstap_message_has_query_time_sec(*dnstap)) {
+        _time(block, dnstap_message_query_time_sec(*dnstap));
+    }
+    if (dnstap_message_has_response_time_sec(*dnstap)) {
+        _time(block, dnstap_message_response_time_sec(*dnstap));
+    }
+
+    if (handle->bloom_size) {
+        size_t  n = handle->num_blocks - 1, len = 0;
+        uint8_t name[255];
+
+        if (dnstap_message_has_query_address(*dnstap)) {
+            _bloom_add(dnswire_index_address_bloom(*handle, n), handle->bloom_size, dnstap_message_query_address(*dnstap), dnstap_message_query_address_length(*dnstap));
+        }
+        if (dnstap_message_has_query_message(*dnstap)) {
+            len = _qname(dnstap_message_query_message(*dnstap), dnstap_message_query_message_length(*dnstap), name);
+        }
+        if (!len && dnstap_message_has_response_message(*dnstap)) {
+            len = _qname(dnstap_message_response_message(*dnstap), dnstap_message_response_message_length(*dnstap), name);
+        }
+        if (len) {
+            _bloom_add(dnswire_index_qname_bloom(*handle, n), handle->bloom_size, name, len);
+        }
+    }
+
+    return dnswire_ok;
+}
+
+/*
+ * Find the offset of the first block that may have messages at or after
+ * the given time, blocks before it only have earlier messages. Returns
+ * `dnswire_endofdata` with the end offset if there is no such block.
+ */
+enum dnswire_result dnswire_index_find(const struct dnswire_index* handle, uint64_t t, uint64_t* offset)
+{
+    assert(handle);
+    assert(offset);
+
+    size_t lo = 0, hi = handle->num_blocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (handle->blocks[mid].seek < t) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == handle->num_blocks) {
+        *offset = handle->end;
+        return dnswire_endofdata;
+    }
+    *offset = handle->blocks[lo].offset;
+    return dnswire_ok;
+}
+
+bool dnswire_index_may_have_address(const struct dnswire_index* handle, size_t block, const uint8_t* address, size_t len)
+{
+    assert(handle);
+    assert(block < handle->num_blocks);
+    assert(address);
+
+    if (!handle->bloom_size) {
+        return true;
+    }
+    return _bloom_test(dnswire_index_address_bloom(*handle, block), handle->bloom_size, address, len);
+}
+
+bool dnswire_index_may_have_qname(const struct dnswire_index* handle, size_t block, const char* qname)
+{
+    assert(handle);
+    assert(block < handle->num_blocks);
+    assert(qname);
+
+    uint8_t name[255];
+    size_t  len;
+
+    if (!handle->bloom_size) {
+        return true;
+    }
+    if (!(len = _qname_from_string(qname, name))) {
+        return false;
+    }
+    return _bloom_test(dnswire_index_qname_bloom(*handle, block), handle->bloom_size, name, len);
+}
+
+struct _build {
+    struct dnswire_index*       index;
+    struct dnswire_partitioner* partitioner;
+    enum dnswire_result         result;
+};
+
+static void _build(size_t idx, const struct dnstap* dnstap, void* ctx)
+{
+    struct _build*            b    = ctx;
+    struct dnswire_partition* part = dnswire_partitioner_partition(*b->partitioner, idx);
+
+    if (dnswire_index_add(b->index, part->frame_offset, part->frame_length, dnstap) != dnswire_ok) {
+        b->result = dnswire_error;
+    }
+}
+
+enum dnswire_result dnswire_index_build(struct dnswire_index* handle, int fd)
+{
+    assert(handle);
+
+    struct dnswire_partitioner p;
+    struct _build              b = { handle, &p, dnswire_ok };
+
+    handle->num_blocks = 0;
+    handle->end        = 0;
+
+    if (dnswire_partitioner_init(&p, fd, true) != dnswire_ok) {
+        return dnswire_error;
+    }
+    dnswire_partitioner_set_callback(p, _build, &b);
+    if (dnswire_partitioner_scan(&p, 1) != dnswire_ok
+        || (dnswire_partitioner_partitions(p) && dnswire_partitioner_process(&p, 0) != dnswire_ok)) {
+        b.result = dnswire_error;
+    }
+    dnswire_partitioner_destroy(&p);
+
+    return b.result;
+}
+
+static int _write(int fd, const uint8_t* data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int _read(int fd, uint8_t* data, size_t len)
+{
+    while (len) {
+        ssize_t n = read(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (!n) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * The index file is a header followed by the blocks, all big endian:
+ * - magic (8 bytes), block frames (32 bits), Bloom filter size (32 bits),
+ *   number of blocks (64 bits), end offset (64 bits)
+ * - per block: offset (64 bits), frames (32 bits), min (64 bits), max (64 bits)
+ *   and, if the Bloom filter size is not 0, the address and QNAME filters
+ */
+enum dnswire_result dnswire_index_save(const struct dnswire_index* handle, int fd)
+{
+    assert(handle);
+
+    uint8_t buf[__HEADER_SIZE + 128 * __BLOCK_SIZE], *p = buf;
+    size_t  i;
+
+    memcpy(p, DNSWIRE_INDEX_MAGIC, 8);
+    _put32(p + 8, handle->block_frames);
+    _put32(p + 12, handle->bloom_size);
+    _put64(p + 16, handle->num_blocks);
+    _put64(p + 24, handle->end);
+    p += __HEADER_SIZE;
+
+    for (i = 0; i < handle->num_blocks; i++) {
+        if (p + __BLOCK_SIZE > buf + sizeof(buf)) {
+            if (_write(fd, buf, p - buf)) {
+                return dnswire_error;
+            }
+            p = buf;
+        }
+        _put64(p, handle->blocks[i].offset);
+        _put32(p + 8, handle->blocks[i].frames);
+        _put64(p + 12, handle->blocks[i].min);
+        _put64(p + 20, handle->blocks[i].max);
+        p += __BLOCK_SIZE;
+
+        if (handle->bloom_size) {
+            if (_write(fd, buf, p - buf) || _write(fd, dnswire_index_address_bloom(*handle, i), 2 * handle->bloom_size)) {
+                return dnswire_error;
+            }
+            p = buf;
+        }
+    }
+
+    return _write(fd, buf, p - buf) ? dnswire_error : dnswire_ok;
+}
+
+enum dnswire_result dnswire_index_load(struct dnswire_index* handle, int fd)
+{
+    assert(handle);
+
+    uint8_t     buf[__HEADER_SIZE];
+    uint64_t    blocks, i;
+    uint32_t    block_frames, bloom_size;
+    struct stat st;
+    off_t       at;
+
+    if (_read(fd, buf, sizeof(buf)) || memcmp(buf, DNSWIRE_INDEX_MAGIC, 8)) {
+        return dnswire_error;
+    }
+    block_frames = _get32(buf + 8);
+    bloom_size   = _get32(buf + 12);
+    blocks       = _get64(buf + 16);
+    if (!block_frames || block_frames > DNSWIRE_INDEX_MAX_BLOCK_FRAMES
+        || bloom_size > DNSWIRE_INDEX_MAX_BLOOM_SIZE
+        || blocks > SIZE_MAX / sizeof(struct dnswire_index_block)) {
+        return dnswire_error;
+    }
+
+    /*
+     * Check that the blocks are in the file before allocating for them,
+     * so a corrupt header can not make it allocate more than the file.
+     */
+    if (fstat(fd, &st)) {
+        return dnswire_error;
+    }
+    if (S_ISREG(st.st_mode)) {
+        if ((at = lseek(fd, 0, SEEK_CUR)) < 0 || at > st.st_size
+            || blocks > (uint64_t)(st.st_size - at) / (__BLOCK_SIZE + 2 * (uint64_t)bloom_size)) {
+            return dnswire_error;
+        }
+    }
+
+    dnswire_index_destroy(handle);
+    handle->block_frames = block_frames;
+    handle->bloom_size   = bloom_size;
+    handle->end          = _get64(buf + 24);
+
+    for (i = 0; i < blocks; i++) {
+        struct dnswire_index_block* block;
+
+        if (_read(fd, buf, __BLOCK_SIZE) || !(block = _new_block(handle))) {
+            dnswire_index_destroy(handle);
+            return dnswire_error;
+        }
+        block->offset = _get64(buf);
+        block->frames = _get32(buf + 8);
+        if (block->frames > handle->block_frames) {
+            dnswire_index_destroy(handle);
+            return dnswire_error;
+        }
+        block->min    = _get64(buf + 12);
+        block->max    = _get64(buf + 20);
+        if (block->max > block->seek) {
+            block->seek = block->max;
+        }
+        if (handle->bloom_size && _read(fd, dnswire_index_address_bloom(*handle, i), 2 * handle->bloom_size)) {
+            dnswire_index_destroy(handle);
+            return dnswire_error;
+        }
+    }
+
+    return dnswire_ok;
+}
@@ -0,0 +1,407 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/join.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * Entries checked for expiry on each message added, and when a query is
+ * added to a full table.
+ */
+#define SWEEP 2
+#define SWEEP_FULL 64
+
+void dnswire_join_histogram_clear(struct dnswire_join_histogram* handle)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_join_histogram));
+}
+
+static inline size_t _bucket(uint64_t latency)
+{
+    uint64_t us = latency / 1000;
+
+    if (us < 16) {
+        return us;
+    }
+
+    size_t e = 63 - __builtin_clzll(us);
+    return 16 + (e - 4) * 8 + ((us >> (e - 3)) & 7);
+}
+
+static inline uint64_t _bucket_max(size_t bucket)
+{
+    if (bucket < 16) {
+        return bucket * 1000 + 999;
+    }
+
+    size_t   e   = (bucket - 16) / 8 + 4;
+    uint64_t sub = (bucket - 16) % 8;
+    uint64_t us  = ((8 + sub + 1) << (e - 3)) - 1;
+
+    return us > UINT64_MAX / 1000 ? UINT64_MAX : us * 1000 + 999;
+}
+
+void dnswire_join_histogram_add(struct dnswire_join_histogram* handle, uint64_t latency)
+{
+    assert(handle);
+
+    handle->buckets[_bucket(latency)]++;
+    if (!handle->count || latency < handle->min) {
+        handle->min = latency;
+    }
+    if (latency > handle->max) {
+        handle->max = latency;
+    }
+    handle->count++;
+    handle->sum += latency;
+}
+
+void dnswire_join_histogram_merge(struct dnswire_join_histogram* handle, const struct dnswire_join_histogram* from)
+{
+    assert(handle);
+    assert(from);
+
+    size_t i;
+
+    if (!from->count) {
+        return;
+    }
+    for (i = 0; i < DNSWIRE_JOIN_HISTOGRAM_BUCKETS; i++) {
+        handle->buckets[i] += from->buckets[i];
+    }
+    if (!handle->count || from->min < handle->min) {
+        handle->min = from->min;
+    }
+    if (from->max > handle->max) {
+        handle->max = from->max;
+    }
+    handle->count += from->count;
+    handle->sum += from->sum;
+}
+
+uint64_t dnswire_join_histogram_percentile(const struct dnswire_join_histogram* handle, double fraction)
+{
+    assert(handle);
+
+    size_t i, seen = 0, want;
+
+    if (!handle->count) {
+        return 0;
+    }
+    if (fraction <= 0.0) {
+        return handle->min;
+    }
+    if (fraction >= 1.0) {
+        return handle->max;
+    }
+
+    want = (size_t)(fraction * handle->count + 0.5);
+    if (!want) {
+        want = 1;
+    }
+    for (i = 0; i < DNSWIRE_JOIN_HISTOGRAM_BUCKETS; i++) {
+        seen += handle->buckets[i];
+        if (seen >= want) {
+            uint64_t max = _bucket_max(i);
+            return max > handle->max ? handle->max : max;
+        }
+    }
+
+    return handle->max;
+}
+
+enum dnswire_result dnswire_join_init(struct dnswire_join* handle, size_t capacity, uint64_t timeout)
+{
+    assert(handle);
+
+    size_t size = 16;
+
+    memset(handle, 0, sizeof(struct dnswire_join));
+
+    if (!capacity) {
+        return dnswire_error;
+    }
+
+    /*
+     * Keep the load factor at or below 3/4 so probes stay short.
+     */
+    while (size - size / 4 < capacity) {
+        if (size > SIZE_MAX / 2 / sizeof(struct dnswire_join_entry)) {
+            return dnswire_error;
+        }
+        size *= 2;
+    }
+
+    if (!(handle->table = calloc(size, sizeof(struct dnswire_join_entry)))) {
+        return dnswire_error;
+    }
+    handle->size     = size;
+    handle->max_used = capacity;
+    handle->timeout  = timeout ? timeout : DNSWIRE_JOIN_DEFAULT_TIMEOUT;
+
+    __trace("size %zu capacity %zu", size, capacity);
+
+    return dnswire_ok;
+}
+
+void dnswire_join_destroy(struct dnswire_join* handle)
+{
+    assert(handle);
+
+    free(handle->table);
+    handle->table = 0;
+    handle->size  = 0;
+    handle->used  = 0;
+}
+
+static inline uint32_t _hash(const uint8_t* key)
+{
+    uint64_t h = 0, w;
+    size_t   i;
+
+    for (i = 0; i < DNSWIRE_JOIN_KEY_SIZE; i += 8) {
+        memcpy(&w, key + i, 8);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+    }
+
+    return (uint32_t)h;
+}
+
+/*
+ * Build the key of a message, for both the query and response the query
+ * address and port are the initiator's. Returns false if the message can
+ * not be joined.
+ */
+static inline bool _key(uint8_t* key, const struct dnstap* d, const uint8_t* dns, size_t dns_len)
+{
+    enum dnstap_message_type type = dnstap_message_type(*d);
+
+    if (type == DNSTAP_MESSAGE_TYPE_UNKNOWN || !dns || dns_len < 2) {
+        return false;
+    }
+
+    memset(key, 0, DNSWIRE_JOIN_KEY_SIZE);
+    if (dnstap_message_has_query_address(*d)) {
+        size_t len = dnstap_message_query_address_length(*d);
+        memcpy(key, dnstap_message_query_address(*d), len > 16 ? 16 : len);
+    }
+    if (dnstap_message_has_response_address(*d)) {
+        size_t len = dnstap_message_response_address_length(*d);
+        memcpy(key + 16, dnstap_message_response_address(*d), len > 16 ? 16 : len);
+    }
+    if (dnstap_message_has_query_port(*d)) {
+        key[32] = dnstap_message_query_port(*d) >> 8;
+        key[33] = dnstap_message_query_port(*d);
+    }
+    if (dnstap_message_has_response_port(*d)) {
+        key[34] = dnstap_message_response_port(*d) >> 8;
+        key[35] = dnstap_message_response_port(*d);
+    }
+    key[36] = dns[0];
+    key[37] = dns[1];
+    if (dnstap_message_has_socket_protocol(*d)) {
+        key[38] = dnstap_message_socket_protocol(*d);
+    }
+    key[39] = (type + 1) / 2;
+
+    return true;
+}
+
+/*
+ * Remove an entry by shifting back the entries after it that are not
+ * at their home slot, until an empty slot.
+ */
+static void _remove(struct dnswire_join* handle, size_t i)
+{
+    size_t mask = handle->size - 1, k = i;
+
+    while (1) {
+        k = (k + 1) & mask;
+        if (!handle->table[k].used) {
+            break;
+        }
+
+        size_t home = handle->table[k].hash & mask;
+        if (k > i ? (home <= i || home > k) : (home <= i && home > k)) {
+            handle->table[i] = handle->table[k];
+            i                = k;
+        }
+    }
+
+    handle->table[i].used = false;
+    handle->used--;
+}
+
+static inline bool _is_expired(const struct dnswire_join* handle, const struct dnswire_join_entry* e, uint64_t now)
+{
+    return now > e->time && now - e->time > handle->timeout;
+}
+
+static void _sweep(struct dnswire_join* handle, size_t n)
+{
+    size_t mask = handle->size - 1;
+
+    while (n-- && handle->used) {
+        struct dnswire_join_entry* e = &handle->table[handle->sweep];
+
+        if (e->used && _is_expired(handle, e, handle->now)) {
+            /*
+             * An entry may be shifted back into this slot, check it again.
+             */
+            _remove(handle, handle->sweep);
+            handle->expired++;
+            continue;
+        }
+        handle->sweep = (handle->sweep + 1) & mask;
+    }
+}
+
+static inline uint64_t _time(uint64_t sec, uint32_t nsec)
+{
+    return sec * 1000000000ULL + nsec;
+}
+
+enum dnswire_result dnswire_join_add(struct dnswire_join* handle, const struct dnstap* d)
+{
+    assert(handle);
+    assert(handle->table);
+    assert(d);
+
+    uint8_t  key[DNSWIRE_JOIN_KEY_SIZE];
+    uint64_t time;
+    uint32_t hash;
+    size_t   mask = handle->size - 1, i;
+
+    if (!dnstap_has_message(*d)) {
+        handle->ignored++;
+        return dnswire_again;
+    }
+
+    if (dnstap_message_type(*d) & 1) {
+        if (!dnstap_message_has_query_time_sec(*d)
+            || !dnstap_message_has_query_message(*d)
+            || !_key(key, d, dnstap_message_query_message(*d), dnstap_message_query_message_length(*d))) {
+            handle->ignored++;
+            return dnswire_again;
+        }
+        time = _time(dnstap_message_query_time_sec(*d), dnstap_message_has_query_time_nsec(*d) ? dnstap_message_query_time_nsec(*d) : 0);
+        if (time > handle->now) {
+            handle->now = time;
+        }
+        _sweep(handle, SWEEP);
+
+        handle->queries++;
+        hash = _hash(key);
+        for (i = hash & mask; handle->table[i].used; i = (i + 1) & mask) {
+            if (handle->table[i].hash == hash && !memcmp(handle->table[i].key, key, DNSWIRE_JOIN_KEY_SIZE)) {
+                handle->table[i].time = time;
+                handle->duplicates++;
+                return dnswire_ok;
+            }
+        }
+
+        if (handle->used >= handle->max_used) {
+            _sweep(handle, SWEEP_FULL);
+            if (handle->used >= handle->max_used) {
+                handle->dropped++;
+                return dnswire_ok;
+            }
+            // the sweep may have shifted entries, find the slot again
+            for (i = hash & mask; handle->table[i].used; i = (i + 1) & mask)
+                ;
+        }
+
+        memcpy(handle->table[i].key, key, DNSWIRE_JOIN_KEY_SIZE);
+        handle->table[i].time = time;
+        handle->table[i].hash = hash;
+        handle->table[i].used = true;
+        handle->used++;
+
+        return dnswire_ok;
+    }
+
+    if (!dnstap_message_has_response_time_sec(*d)
+        || !dnstap_message_has_response_message(*d)
+        || !_key(key, d, dnstap_message_response_message(*d), dnstap_message_response_message_length(*d))) {
+        handle->ignored++;
+        return dnswire_again;
+    }
+    time = _time(dnstap_message_response_time_sec(*d), dnstap_message_has_response_time_nsec(*d) ? dnstap_message_response_time_nsec(*d) : 0);
+    if (time > handle->now) {
+        handle->now = time;
+    }
+    _sweep(handle, SWEEP);
+
+    handle->responses++;
+    hash = _hash(key);
+    for (i = hash & mask; handle->table[i].used; i = (i + 1) & mask) {
+        if (handle->table[i].hash == hash && !memcmp(handle->table[i].key, key, DNSWIRE_JOIN_KEY_SIZE)) {
+            struct dnswire_join_match m = {
+                .response      = d,
+                .query_time    = handle->table[i].time,
+                .response_time = time,
+                .latency       = time > handle->table[i].time ? time - handle->table[i].time : 0,
+            };
+
+            _remove(handle, i);
+            handle->matched++;
+            dnswire_join_histogram_add(&handle->histogram, m.latency);
+            if (handle->callback) {
+                handle->callback(&m, handle->ctx);
+            }
+            return dnswire_ok;
+        }
+    }
+
+    handle->unmatched++;
+    return dnswire_ok;
+}
+
+void dnswire_join_expire(struct dnswire_join* handle, uint64_t now)
+{
+    assert(handle);
+    assert(handle->table);
+
+    size_t i = 0;
+
+    if (!now) {
+        now = handle->now;
+    }
+
+    while (i < handle->size && handle->used) {
+        if (handle->table[i].used && _is_expired(handle, &handle->table[i], now)) {
+            _remove(handle, i);
+            handle->expired++;
+            continue;
+        }
+        i++;
+    }
+
+    __trace("expired %zu outstanding %zu", handle->expired, handle->used);
+}
@@ -0,0 +1,334 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/partitioner.h"
+#include "dnswire/trace.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * A chunk of the file read with `pread()` when it is not mapped.
+ */
+struct _chunk {
+    uint8_t* buf;
+    size_t   size, offset, len;
+};
+
+/*
+ * Get the data at `off` up to `end`, at least `want` bytes if available.
+ * Returns NULL on errors or if there is no more data.
+ */
+static const uint8_t* _data(const struct dnswire_partitioner* handle, struct _chunk* chunk, size_t off, size_t end, size_t want, size_t* len)
+{
+    *len = 0;
+    if (off >= end) {
+        return 0;
+    }
+    if (handle->map) {
+        *len = end - off;
+        return handle->map + off;
+    }
+
+    if (off >= chunk->offset && off < chunk->offset + chunk->len) {
+        size_t have = chunk->offset + chunk->len - off;
+        if (have >= want || chunk->offset + chunk->len >= end) {
+            *len = have;
+            return chunk->buf + (off - chunk->offset);
+        }
+    }
+
+    size_t n = want > DNSWIRE_PARTITIONER_CHUNK_SIZE ? want : DNSWIRE_PARTITIONER_CHUNK_SIZE;
+    if (n > end - off) {
+        n = end - off;
+    }
+    if (chunk->size < n) {
+        uint8_t* b = realloc(chunk->buf, n);
+        if (!b) {
+            return 0;
+        }
+        chunk->buf  = b;
+        chunk->size = n;
+    }
+
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = pread(handle->fd, chunk->buf + got, n - got, off + got);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            break;
+        }
+        got += r;
+    }
+    chunk->offset = off;
+    chunk->len    = got;
+    *len          = got;
+
+    return got ? chunk->buf : 0;
+}
+
+static inline uint32_t _be32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+enum dnswire_result dnswire_partitioner_init(struct dnswire_partitioner* handle, int fd, bool use_mmap)
+{
+    assert(handle);
+
+    struct stat st;
+
+    memset(handle, 0, sizeof(struct dnswire_partitioner));
+    handle->fd = fd;
+
+    if (fstat(fd, &st) || st.st_size < 0) {
+        return dnswire_error;
+    }
+    handle->size = st.st_size;
+
+    if (use_mmap && handle->size) {
+        void* map = mmap(0, handle->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            handle->map = map;
+        } else {
+            __trace("mmap() failed, using pread(): %s", strerror(errno));
+        }
+    }
+
+    return dnswire_ok;
+}
+
+void dnswire_partitioner_destroy(struct dnswire_partitioner* handle)
+{
+    assert(handle);
+
+    if (handle->map) {
+        munmap((void*)handle->map, handle->size);
+        handle->map = 0;
+    }
+    free(handle->partitions);
+    handle->partitions     = 0;
+    handle->num_partitions = 0;
+}
+
+enum dnswire_result dnswire_partitioner_scan(struct dnswire_partitioner* handle, size_t parts)
+{
+    assert(handle);
+    assert(parts);
+
+    struct _chunk          chunk   = { 0 };
+    struct dnswire_decoder decoder = DNSWIRE_DECODER_INITIALIZER;
+    const uint8_t*         p;
+    size_t                 off = 0, len, want = 64, start;
+
+    free(handle->partitions);
+    handle->num_partitions = 0;
+    handle->stopped        = false;
+    if (!(handle->partitions = calloc(parts, sizeof(struct dnswire_partition)))) {
+        return dnswire_error;
+    }
+
+    // let the decoder validate the control frames up to the first frame
+    while (decoder.state != dnswire_decoder_reading_frames) {
+        if (!(p = _data(handle, &chunk, off, handle->size, want, &len))) {
+            free(chunk.buf);
+            return dnswire_error;
+        }
+        switch (dnswire_decoder_decode(&decoder, p, len)) {
+        case dnswire_again:
+            off += dnswire_decoder_decoded(decoder);
+            break;
+        case dnswire_need_more:
+            if (len >= handle->size - off) {
+                free(chunk.buf);
+                return dnswire_error;
+            }
+            want = len * 2;
+            break;
+        default:
+            free(chunk.buf);
+            return dnswire_error;
+        }
+    }
+    handle->decoder = decoder;
+    start           = off;
+
+    // walk the frame headers only
+    while ((p = _data(handle, &chunk, off, handle->size, 3 * TINYFRAME_HEADER_SIZE, &len))) {
+        if (len < TINYFRAME_HEADER_SIZE) {
+            break;
+        }
+
+        uint32_t flen = _be32(p);
+        if (!flen) {
+            // control frame, escape + length + type
+            if (len < 3 * TINYFRAME_HEADER_SIZE) {
+                break;
+            }
+            if (_be32(p + 2 * TINYFRAME_HEADER_SIZE) != TINYFRAME_CONTROL_STOP) {
+                free(chunk.buf);
+                return dnswire_error;
+            }
+            handle->stopped = true;
+            break;
+        }
+        if (handle->size - off - TINYFRAME_HEADER_SIZE < flen) {
+            __trace("truncated frame at %zu", off);
+            break;
+        }
+
+        size_t n = handle->num_partitions;
+        if (!n || (n < parts && off >= start + (handle->size - start) / parts * n)) {
+            handle->partitions[n].offset = off;
+            handle->num_partitions++;
+            n++;
+        }
+        handle->partitions[n - 1].frames++;
+        off += TINYFRAME_HEADER_SIZE + flen;
+        handle->partitions[n - 1].length = off - handle->partitions[n - 1].offset;
+    }
+    free(chunk.buf);
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_partitioner_process(struct dnswire_partitioner* handle, size_t idx)
+{
+    assert(handle);
+    assert(idx < handle->num_partitions);
+
+    struct dnswire_partition* part    = &handle->partitions[idx];
+    struct dnswire_decoder    decoder = handle->decoder;
+    struct _chunk             chunk   = { 0 };
+    const uint8_t*            p;
+    size_t                    off = part->offset, end = part->offset + part->length, len, want = 1;
+    struct dnstap             dnstap = DNSTAP_INITIALIZER;
+
+    decoder.dnstap = dnstap;
+    part->dnstaps  = 0;
+    part->errors   = 0;
+    part->result   = dnswire_ok;
+
+    while (off < end) {
+        if (!(p = _data(handle, &chunk, off, end, want, &len))) {
+            part->result = dnswire_error;
+            break;
+        }
+
+        switch (dnswire_decoder_decode(&decoder, p, len)) {
+        case dnswire_have_dnstap:
+            part->dnstaps++;
+            part->frame_offset = off;
+            part->frame_length = dnswire_decoder_decoded(decoder);
+            if (handle->callback) {
+                handle->callback(idx, dnswire_decoder_dnstap(decoder), handle->ctx);
+            }
+            off += dnswire_decoder_decoded(decoder);
+            want = 1;
+            continue;
+
+        case dnswire_need_more:
+            if (len >= end - off) {
+                part->result = dnswire_error;
+                break;
+            }
+            want = len * 2;
+            continue;
+
+        case dnswire_error:
+            if (len >= TINYFRAME_HEADER_SIZE && _be32(p) && end - off - TINYFRAME_HEADER_SIZE >= _be32(p)) {
+                // the frame is there but not a DNSTAP message, skip it
+                part->errors++;
+                off += TINYFRAME_HEADER_SIZE + _be32(p);
+                want = 1;
+                continue;
+            }
+            part->result = dnswire_error;
+            break;
+
+        default:
+            part->result = dnswire_error;
+            break;
+        }
+        break;
+    }
+    dnswire_decoder_cleanup(decoder);
+    free(chunk.buf);
+
+    return part->result;
+}
+
+struct _thread {
+    struct dnswire_partitioner* handle;
+    size_t                      idx;
+    pthread_t                   thread;
+};
+
+static void* _process(void* arg)
+{
+    struct _thread* t = arg;
+
+    dnswire_partitioner_process(t->handle, t->idx);
+
+    return 0;
+}
+
+enum dnswire_result dnswire_partitioner_run(struct dnswire_partitioner* handle)
+{
+    assert(handle);
+
+    struct _thread*     threads;
+    enum dnswire_result res = dnswire_ok;
+    size_t              i, started;
+
+    if (!(threads = calloc(handle->num_partitions, sizeof(struct _thread)))) {
+        return dnswire_error;
+    }
+
+    for (started = 0; started < handle->num_partitions; started++) {
+        threads[started].handle = handle;
+        threads[started].idx    = started;
+        if (pthread_create(&threads[started].thread, 0, _process, &threads[started])) {
+            res = dnswire_error;
+            break;
+        }
+    }
+    for (i = 0; i < started; i++) {
+        if (pthread_join(threads[i].thread, 0) || handle->partitions[i].result != dnswire_ok) {
+            res = dnswire_error;
+        }
+    }
+    free(threads);
+
+    return res;
+}
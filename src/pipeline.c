@@ -0,0 +1,337 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/pipeline.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <string.h>
+
+const char* const dnswire_pipeline_slot_state_string[] = {
+    "empty",
+    "framed",
+    "decoding",
+    "decoded",
+    "failed",
+};
+
+#define __slot(h, n) (&(h)->slots[(n) % (h)->window])
+
+enum dnswire_result dnswire_pipeline_init(struct dnswire_pipeline* handle, size_t threads, size_t window)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_pipeline));
+
+    if (!threads || !window) {
+        return dnswire_error;
+    }
+    if (dnswire_reader_init(&handle->reader) != dnswire_ok) {
+        return dnswire_error;
+    }
+    dnswire_reader_set_raw(handle->reader, true);
+
+    if (!(handle->slots = calloc(window, sizeof(struct dnswire_pipeline_slot)))
+        || !(handle->threads = calloc(threads, sizeof(pthread_t)))) {
+        free(handle->slots);
+        dnswire_reader_destroy(handle->reader);
+        return dnswire_error;
+    }
+    handle->window      = window;
+    handle->num_threads = threads;
+    handle->fd          = -1;
+
+    struct dnstap dnstap = DNSTAP_INITIALIZER;
+    size_t        i;
+    for (i = 0; i < window; i++) {
+        handle->slots[i].dnstap = dnstap;
+    }
+
+    pthread_mutex_init(&handle->lock, 0);
+    pthread_cond_init(&handle->framed, 0);
+    pthread_cond_init(&handle->decoded, 0);
+    pthread_cond_init(&handle->space, 0);
+
+    return dnswire_ok;
+}
+
+void dnswire_pipeline_destroy(struct dnswire_pipeline* handle)
+{
+    assert(handle);
+    assert(!handle->started);
+
+    if (!handle->slots) {
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i < handle->window; i++) {
+        dnstap_cleanup(&handle->slots[i].dnstap);
+        free(handle->slots[i].data);
+    }
+    free(handle->slots);
+    handle->slots = 0;
+    free(handle->threads);
+    handle->threads = 0;
+    dnswire_reader_destroy(handle->reader);
+
+    pthread_mutex_destroy(&handle->lock);
+    pthread_cond_destroy(&handle->framed);
+    pthread_cond_destroy(&handle->decoded);
+    pthread_cond_destroy(&handle->space);
+}
+
+enum dnswire_result dnswire_pipeline_allow_bidirectional(struct dnswire_pipeline* handle, bool allow_bidirectional)
+{
+    assert(handle);
+
+    return dnswire_reader_allow_bidirectional(&handle->reader, allow_bidirectional);
+}
+
+/*
+ * Put a frame in the slot at the tail, waits for the consumer if the
+ * window is full. Only the framing thread touches the slot at the tail so
+ * the copy is done without holding the lock.
+ */
+static bool _frame(struct dnswire_pipeline* handle, const uint8_t* data, size_t len)
+{
+    struct dnswire_pipeline_slot* slot;
+
+    pthread_mutex_lock(&handle->lock);
+    if (handle->tail - handle->head >= handle->window && !handle->stop) {
+        handle->stats.waits++;
+        while (handle->tail - handle->head >= handle->window && !handle->stop) {
+            pthread_cond_wait(&handle->space, &handle->lock);
+        }
+    }
+    if (handle->stop) {
+        pthread_mutex_unlock(&handle->lock);
+        return false;
+    }
+    slot = __slot(handle, handle->tail);
+    pthread_mutex_unlock(&handle->lock);
+
+    assert(slot->state == dnswire_pipeline_slot_empty);
+    if (slot->size < len) {
+        uint8_t* d = realloc(slot->data, len);
+        if (!d) {
+            return false;
+        }
+        slot->data = d;
+        slot->size = len;
+    }
+    memcpy(slot->data, data, len);
+    slot->len = len;
+
+    pthread_mutex_lock(&handle->lock);
+    slot->state = dnswire_pipeline_slot_framed;
+    handle->tail++;
+    handle->stats.frames++;
+    pthread_cond_signal(&handle->framed);
+    pthread_mutex_unlock(&handle->lock);
+
+    return true;
+}
+
+static void* _framer(void* arg)
+{
+    struct dnswire_pipeline* handle = arg;
+    enum dnswire_result      res;
+
+    while (1) {
+        res = dnswire_reader_read(&handle->reader, handle->fd);
+        if (res == dnswire_have_frame) {
+            if (!_frame(handle, dnswire_reader_frame(handle->reader), dnswire_reader_frame_length(handle->reader))) {
+                res = dnswire_error;
+                break;
+            }
+            continue;
+        }
+        if (res != dnswire_again && res != dnswire_need_more) {
+            break;
+        }
+    }
+    __trace("framing ended with %d", res);
+
+    pthread_mutex_lock(&handle->lock);
+    handle->result = res == dnswire_endofdata ? dnswire_endofdata : dnswire_error;
+    handle->eof    = true;
+    pthread_cond_broadcast(&handle->framed);
+    pthread_cond_signal(&handle->decoded);
+    pthread_mutex_unlock(&handle->lock);
+
+    return 0;
+}
+
+static void* _decoder(void* arg)
+{
+    struct dnswire_pipeline* handle = arg;
+
+    pthread_mutex_lock(&handle->lock);
+    while (1) {
+        while (handle->decode == handle->tail && !handle->eof && !handle->stop) {
+            pthread_cond_wait(&handle->framed, &handle->lock);
+        }
+        if (handle->stop || handle->decode == handle->tail) {
+            break;
+        }
+
+        size_t                        seq  = handle->decode++;
+        struct dnswire_pipeline_slot* slot = __slot(handle, seq);
+
+        slot->state = dnswire_pipeline_slot_decoding;
+        pthread_mutex_unlock(&handle->lock);
+
+        int failed = dnstap_decode_protobuf(&slot->dnstap, slot->data, slot->len);
+
+        pthread_mutex_lock(&handle->lock);
+        slot->state = failed ? dnswire_pipeline_slot_failed : dnswire_pipeline_slot_decoded;
+        if (seq == handle->head) {
+            pthread_cond_signal(&handle->decoded);
+        }
+    }
+    pthread_mutex_unlock(&handle->lock);
+
+    return 0;
+}
+
+enum dnswire_result dnswire_pipeline_start(struct dnswire_pipeline* handle, int fd)
+{
+    assert(handle);
+    assert(!handle->started);
+
+    handle->fd      = fd;
+    handle->started = true;
+
+    size_t i;
+    for (i = 0; i < handle->num_threads; i++) {
+        if (pthread_create(&handle->threads[i], 0, _decoder, handle)) {
+            handle->num_threads = i;
+            dnswire_pipeline_stop(handle);
+            return dnswire_error;
+        }
+    }
+    if (pthread_create(&handle->framer, 0, _framer, handle)) {
+        dnswire_pipeline_stop(handle);
+        return dnswire_error;
+    }
+    handle->framing = true;
+
+    return dnswire_ok;
+}
+
+/*
+ * Release the slot at the head, must be called with the lock held.
+ */
+static void _release(struct dnswire_pipeline* handle)
+{
+    struct dnswire_pipeline_slot* slot = __slot(handle, handle->head);
+
+    dnstap_cleanup(&slot->dnstap);
+    slot->state = dnswire_pipeline_slot_empty;
+    handle->head++;
+    pthread_cond_signal(&handle->space);
+}
+
+enum dnswire_result dnswire_pipeline_next(struct dnswire_pipeline* handle)
+{
+    assert(handle);
+
+    pthread_mutex_lock(&handle->lock);
+    if (handle->current) {
+        _release(handle);
+        handle->current = false;
+    }
+
+    while (!handle->stop) {
+        if (handle->head == handle->tail) {
+            if (handle->eof) {
+                enum dnswire_result res = handle->result;
+                pthread_mutex_unlock(&handle->lock);
+                return res;
+            }
+        } else {
+            switch (__slot(handle, handle->head)->state) {
+            case dnswire_pipeline_slot_decoded:
+                handle->current = true;
+                handle->stats.dnstaps++;
+                pthread_mutex_unlock(&handle->lock);
+                return dnswire_have_dnstap;
+
+            case dnswire_pipeline_slot_failed:
+                handle->stats.errors++;
+                _release(handle);
+                continue;
+
+            default:
+                break;
+            }
+        }
+        pthread_cond_wait(&handle->decoded, &handle->lock);
+    }
+    pthread_mutex_unlock(&handle->lock);
+
+    return dnswire_error;
+}
+
+enum dnswire_result dnswire_pipeline_stop(struct dnswire_pipeline* handle)
+{
+    assert(handle);
+
+    enum dnswire_result res = dnswire_ok;
+
+    if (!handle->started) {
+        return dnswire_ok;
+    }
+
+    pthread_mutex_lock(&handle->lock);
+    handle->stop = true;
+    pthread_cond_broadcast(&handle->framed);
+    pthread_cond_broadcast(&handle->space);
+    pthread_cond_broadcast(&handle->decoded);
+    pthread_mutex_unlock(&handle->lock);
+
+    size_t i;
+    for (i = 0; i < handle->num_threads; i++) {
+        if (pthread_join(handle->threads[i], 0)) {
+            res = dnswire_error;
+        }
+    }
+    if (handle->framing && pthread_join(handle->framer, 0)) {
+        res = dnswire_error;
+    }
+    handle->started = false;
+    handle->framing = false;
+
+    return res;
+}
+
+void dnswire_pipeline_stats(struct dnswire_pipeline* handle, struct dnswire_pipeline_stats* stats)
+{
+    assert(handle);
+    assert(stats);
+
+    pthread_mutex_lock(&handle->lock);
+    *stats = handle->stats;
+    pthread_mutex_unlock(&handle->lock);
+}
@@ -0,0 +1,469 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/pool.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define __stat_inc(s, f, n) __atomic_add_fetch(&(s).f, n, __ATOMIC_RELAXED)
+
+struct dnswire_pool_source* dnswire_pool_source_new(void* ctx)
+{
+    struct dnswire_pool_source* source = calloc(1, sizeof(struct dnswire_pool_source));
+    if (source) {
+        source->ctx  = ctx;
+        source->refs = 1;
+    }
+    return source;
+}
+
+void dnswire_pool_source_unref(struct dnswire_pool_source* source)
+{
+    assert(source);
+
+    if (!__atomic_sub_fetch(&source->refs, 1, __ATOMIC_ACQ_REL)) {
+        free(source);
+    }
+}
+
+struct dnswire_pool_batch* dnswire_pool_batch_new(struct dnswire_pool_source* source, size_t size)
+{
+    if (size < DNSWIRE_POOL_BATCH_SIZE) {
+        size = DNSWIRE_POOL_BATCH_SIZE;
+    }
+
+    struct dnswire_pool_batch* batch = malloc(sizeof(struct dnswire_pool_batch) + size);
+    if (!batch) {
+        return 0;
+    }
+    batch->next   = 0;
+    batch->source = source;
+    batch->frames = 0;
+    batch->used   = 0;
+    batch->size   = size;
+    if (source) {
+        __atomic_add_fetch(&source->refs, 1, __ATOMIC_RELAXED);
+    }
+
+    return batch;
+}
+
+enum dnswire_result dnswire_pool_batch_add(struct dnswire_pool_batch* batch, const uint8_t* data, size_t len)
+{
+    assert(batch);
+    assert(data);
+
+    if (batch->frames >= DNSWIRE_POOL_BATCH_FRAMES || batch->used + len > batch->size) {
+        return dnswire_again;
+    }
+
+    memcpy(&batch->data[batch->used], data, len);
+    batch->frame[batch->frames].offset = batch->used;
+    batch->frame[batch->frames].length = len;
+    batch->frames++;
+    batch->used += len;
+
+    return dnswire_ok;
+}
+
+void dnswire_pool_batch_free(struct dnswire_pool_batch* batch)
+{
+    assert(batch);
+
+    if (batch->source) {
+        dnswire_pool_source_unref(batch->source);
+    }
+    free(batch);
+}
+
+enum dnswire_result dnswire_pool_init(struct dnswire_pool* handle, size_t workers, size_t deque_size, bool ordered)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_pool));
+
+    if (!workers || !deque_size) {
+        return dnswire_error;
+    }
+    if (!(handle->workers = calloc(workers, sizeof(struct dnswire_pool_worker)))) {
+        return dnswire_error;
+    }
+
+    size_t i;
+    for (i = 0; i < workers; i++) {
+        struct dnswire_pool_worker* w = &handle->workers[i];
+
+        w->pool = handle;
+        w->id   = i;
+        if (!(w->deque.batches = calloc(deque_size, sizeof(struct dnswire_pool_batch*)))) {
+            dnswire_pool_destroy(handle);
+            return dnswire_error;
+        }
+        w->deque.size = deque_size;
+        pthread_mutex_init(&w->deque.lock, 0);
+        handle->num_workers++;
+    }
+
+    handle->max_queued = workers * deque_size;
+    handle->ordered    = ordered;
+    pthread_mutex_init(&handle->lock, 0);
+    pthread_cond_init(&handle->work, 0);
+    pthread_cond_init(&handle->space, 0);
+    pthread_cond_init(&handle->drained, 0);
+
+    return dnswire_ok;
+}
+
+void dnswire_pool_destroy(struct dnswire_pool* handle)
+{
+    assert(handle);
+
+    if (!handle->workers) {
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i < handle->num_workers; i++) {
+        struct dnswire_pool_worker* w = &handle->workers[i];
+
+        assert(!w->started);
+        while (w->deque.len) {
+            struct dnswire_pool_batch* batch = w->deque.batches[w->deque.at];
+            struct dnswire_pool_source* source = batch->source;
+
+            w->deque.at = (w->deque.at + 1) % w->deque.size;
+            w->deque.len--;
+
+            // batches waiting in the source are only reachable from here
+            while (handle->ordered && source && source->head) {
+                struct dnswire_pool_batch* next = source->head;
+                source->head                    = next->next;
+                dnswire_pool_batch_free(next);
+            }
+            dnswire_pool_batch_free(batch);
+        }
+        free(w->deque.batches);
+        pthread_mutex_destroy(&w->deque.lock);
+    }
+    free(handle->workers);
+    handle->workers     = 0;
+    handle->num_workers = 0;
+
+    pthread_mutex_destroy(&handle->lock);
+    pthread_cond_destroy(&handle->work);
+    pthread_cond_destroy(&handle->space);
+    pthread_cond_destroy(&handle->drained);
+}
+
+/*
+ * Put a batch in a deque, starting with the preferred one, must be called
+ * with the pool locked and there is always room since batches are counted
+ * in `queued` before being scheduled.
+ */
+static void _schedule(struct dnswire_pool* handle, struct dnswire_pool_batch* batch, size_t prefer)
+{
+    size_t i;
+    for (i = 0; i < handle->num_workers; i++) {
+        struct dnswire_pool_deque* q = &handle->workers[(prefer + i) % handle->num_workers].deque;
+
+        pthread_mutex_lock(&q->lock);
+        if (q->len < q->size) {
+            q->batches[(q->at + q->len) % q->size] = batch;
+            q->len++;
+            pthread_mutex_unlock(&q->lock);
+
+            __atomic_add_fetch(&handle->ready, 1, __ATOMIC_RELEASE);
+            pthread_cond_signal(&handle->work);
+            return;
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    assert(0);
+}
+
+enum dnswire_result dnswire_pool_submit(struct dnswire_pool* handle, struct dnswire_pool_batch* batch)
+{
+    assert(handle);
+    assert(batch);
+
+    if (!batch->frames) {
+        dnswire_pool_batch_free(batch);
+        return dnswire_ok;
+    }
+
+    pthread_mutex_lock(&handle->lock);
+    while (handle->queued >= handle->max_queued && !handle->stop) {
+        pthread_cond_wait(&handle->space, &handle->lock);
+    }
+    if (handle->stop) {
+        pthread_mutex_unlock(&handle->lock);
+        dnswire_pool_batch_free(batch);
+        return dnswire_error;
+    }
+    handle->queued++;
+
+    if (handle->ordered && batch->source) {
+        struct dnswire_pool_source* source = batch->source;
+
+        if (source->busy) {
+            if (source->tail) {
+                source->tail->next = batch;
+            } else {
+                source->head = batch;
+            }
+            source->tail = batch;
+            pthread_mutex_unlock(&handle->lock);
+            return dnswire_ok;
+        }
+        source->busy = true;
+    }
+
+    _schedule(handle, batch, handle->next);
+    handle->next = (handle->next + 1) % handle->num_workers;
+    pthread_mutex_unlock(&handle->lock);
+
+    return dnswire_ok;
+}
+
+static struct dnswire_pool_batch* _take(struct dnswire_pool_worker* worker)
+{
+    struct dnswire_pool*       pool  = worker->pool;
+    struct dnswire_pool_batch* batch = 0;
+    struct dnswire_pool_deque* q     = &worker->deque;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->len) {
+        batch = q->batches[q->at];
+        q->at = (q->at + 1) % q->size;
+        q->len--;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    size_t i;
+    for (i = 1; !batch && i < pool->num_workers; i++) {
+        q = &pool->workers[(worker->id + i) % pool->num_workers].deque;
+
+        pthread_mutex_lock(&q->lock);
+        if (q->len) {
+            q->len--;
+            batch = q->batches[(q->at + q->len) % q->size];
+            __stat_inc(worker->stats, stolen, 1);
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    if (batch) {
+        __atomic_sub_fetch(&pool->ready, 1, __ATOMIC_RELAXED);
+    }
+
+    return batch;
+}
+
+static void _decode(struct dnswire_pool_worker* worker, struct dnswire_pool_batch* batch)
+{
+    struct dnswire_pool* pool   = worker->pool;
+    struct dnstap        dnstap = DNSTAP_INITIALIZER;
+    size_t               i, dnstaps = 0, errors = 0;
+
+    for (i = 0; i < batch->frames; i++) {
+        if (dnstap_decode_protobuf(&dnstap, &batch->data[batch->frame[i].offset], batch->frame[i].length)) {
+            errors++;
+            continue;
+        }
+        if (pool->callback) {
+            pool->callback(worker->id, batch->source ? batch->source->ctx : 0, &dnstap, pool->ctx);
+        }
+        dnstap_cleanup(&dnstap);
+        dnstaps++;
+    }
+
+    __stat_inc(worker->stats, batches, 1);
+    __stat_inc(worker->stats, dnstaps, dnstaps);
+    __stat_inc(worker->stats, errors, errors);
+}
+
+static void* _worker(void* arg)
+{
+    struct dnswire_pool_worker* worker = arg;
+    struct dnswire_pool*        pool   = worker->pool;
+
+    while (1) {
+        struct dnswire_pool_batch* batch = _take(worker);
+
+        if (!batch) {
+            pthread_mutex_lock(&pool->lock);
+            while (!__atomic_load_n(&pool->ready, __ATOMIC_ACQUIRE) && !pool->stop) {
+                pthread_cond_wait(&pool->work, &pool->lock);
+            }
+            bool done = pool->stop && !__atomic_load_n(&pool->ready, __ATOMIC_ACQUIRE);
+            pthread_mutex_unlock(&pool->lock);
+            if (done) {
+                break;
+            }
+            continue;
+        }
+
+        _decode(worker, batch);
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->ordered && batch->source) {
+            struct dnswire_pool_source* source = batch->source;
+            struct dnswire_pool_batch*  next   = source->head;
+
+            if (next) {
+                source->head = next->next;
+                if (!source->head) {
+                    source->tail = 0;
+                }
+                next->next = 0;
+                _schedule(pool, next, worker->id);
+            } else {
+                source->busy = false;
+            }
+        }
+        pool->queued--;
+        pthread_cond_signal(&pool->space);
+        if (!pool->queued) {
+            pthread_cond_broadcast(&pool->drained);
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        dnswire_pool_batch_free(batch);
+    }
+
+    return 0;
+}
+
+enum dnswire_result dnswire_pool_start(struct dnswire_pool* handle)
+{
+    assert(handle);
+
+    size_t i;
+    for (i = 0; i < handle->num_workers; i++) {
+        struct dnswire_pool_worker* w = &handle->workers[i];
+
+        if (pthread_create(&w->thread, 0, _worker, w)) {
+            dnswire_pool_stop(handle);
+            return dnswire_error;
+        }
+        w->started = true;
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_pool_drain(struct dnswire_pool* handle)
+{
+    assert(handle);
+
+    pthread_mutex_lock(&handle->lock);
+    while (handle->queued) {
+        pthread_cond_wait(&handle->drained, &handle->lock);
+    }
+    pthread_mutex_unlock(&handle->lock);
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_pool_stop(struct dnswire_pool* handle)
+{
+    assert(handle);
+
+    enum dnswire_result res = dnswire_ok;
+
+    pthread_mutex_lock(&handle->lock);
+    handle->stop = true;
+    pthread_cond_broadcast(&handle->work);
+    pthread_cond_broadcast(&handle->space);
+    pthread_mutex_unlock(&handle->lock);
+
+    size_t i;
+    for (i = 0; i < handle->num_workers; i++) {
+        struct dnswire_pool_worker* w = &handle->workers[i];
+
+        if (w->started) {
+            if (pthread_join(w->thread, 0)) {
+                res = dnswire_error;
+            }
+            w->started = false;
+        }
+    }
+
+    return res;
+}
+
+void dnswire_pool_stats(struct dnswire_pool* handle, size_t worker, struct dnswire_pool_stats* stats)
+{
+    assert(handle);
+    assert(worker < handle->num_workers);
+    assert(stats);
+
+    struct dnswire_pool_stats* s = &handle->workers[worker].stats;
+
+    stats->batches = __atomic_load_n(&s->batches, __ATOMIC_RELAXED);
+    stats->dnstaps = __atomic_load_n(&s->dnstaps, __ATOMIC_RELAXED);
+    stats->stolen  = __atomic_load_n(&s->stolen, __ATOMIC_RELAXED);
+    stats->errors  = __atomic_load_n(&s->errors, __ATOMIC_RELAXED);
+}
+
+enum dnswire_result dnswire_pool_add(struct dnswire_pool* handle, struct dnswire_pool_batch** batch, struct dnswire_pool_source* source, const uint8_t* data, size_t len)
+{
+    assert(handle);
+    assert(batch);
+
+    if (*batch && (*batch)->source != source && dnswire_pool_flush(handle, batch) != dnswire_ok) {
+        return dnswire_error;
+    }
+    if (!*batch && !(*batch = dnswire_pool_batch_new(source, len))) {
+        return dnswire_error;
+    }
+    if (dnswire_pool_batch_add(*batch, data, len) == dnswire_ok) {
+        return dnswire_ok;
+    }
+
+    // full, submit it and start a new one
+    if (dnswire_pool_flush(handle, batch) != dnswire_ok
+        || !(*batch = dnswire_pool_batch_new(source, len))) {
+        return dnswire_error;
+    }
+
+    return dnswire_pool_batch_add(*batch, data, len);
+}
+
+enum dnswire_result dnswire_pool_flush(struct dnswire_pool* handle, struct dnswire_pool_batch** batch)
+{
+    assert(handle);
+    assert(batch);
+
+    if (!*batch) {
+        return dnswire_ok;
+    }
+
+    enum dnswire_result res = dnswire_pool_submit(handle, *batch);
+    *batch                  = 0;
+
+    return res;
+}
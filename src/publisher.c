@@ -0,0 +1,297 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/publisher.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <string.h>
+
+const char* const dnswire_publisher_client_state_string[] = {
+    "publishing",
+    "stopping",
+    "done",
+    "evicted",
+};
+
+#define __state(h, s)                                                                                                     \
+    __trace("state %s => %s", dnswire_publisher_client_state_string[(h)->state], dnswire_publisher_client_state_string[s]); \
+    (h)->state = s;
+
+/*
+ * Control frames are small, START with the content type is 42 bytes and
+ * STOP is 12 bytes.
+ */
+#define __control_size 64
+
+static struct dnswire_frame* _control(bool start)
+{
+    struct dnswire_frame*   frame  = malloc(sizeof(struct dnswire_frame) + __control_size);
+    struct tinyframe_writer writer = TINYFRAME_WRITER_INITIALIZER;
+    enum tinyframe_result   res;
+
+    if (!frame) {
+        return 0;
+    }
+
+    if (start) {
+        res = tinyframe_write_control_start(&writer, frame->data, __control_size, DNSTAP_PROTOBUF_CONTENT_TYPE, DNSTAP_PROTOBUF_CONTENT_TYPE_LENGTH);
+    } else {
+        res = tinyframe_write_control_stop(&writer, frame->data, __control_size);
+    }
+    if (res != tinyframe_ok) {
+        free(frame);
+        return 0;
+    }
+
+    frame->refs   = 1;
+    frame->length = writer.bytes_wrote;
+
+    return frame;
+}
+
+enum dnswire_result dnswire_publisher_init(struct dnswire_publisher* handle)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_publisher));
+
+    if (!(handle->start = _control(true))) {
+        return dnswire_error;
+    }
+    if (!(handle->stop = _control(false))) {
+        dnswire_frame_unref(handle->start);
+        handle->start = 0;
+        return dnswire_error;
+    }
+
+    handle->queue_size = DNSWIRE_FRAME_QUEUE_DEFAULT_SIZE;
+    handle->max_drops  = DNSWIRE_FRAME_QUEUE_DEFAULT_SIZE;
+
+    return dnswire_ok;
+}
+
+void dnswire_publisher_destroy(struct dnswire_publisher* handle)
+{
+    assert(handle);
+
+    while (handle->clients) {
+        dnswire_publisher_remove_client(handle, handle->clients);
+    }
+    if (handle->start) {
+        dnswire_frame_unref(handle->start);
+        handle->start = 0;
+    }
+    if (handle->stop) {
+        dnswire_frame_unref(handle->stop);
+        handle->stop = 0;
+    }
+}
+
+struct dnswire_publisher_client* dnswire_publisher_add_client(struct dnswire_publisher* handle, int fd, void* ctx)
+{
+    assert(handle);
+    assert(handle->start);
+
+    struct dnswire_publisher_client* client = calloc(1, sizeof(struct dnswire_publisher_client));
+    if (!client) {
+        return 0;
+    }
+
+    // new frames are dropped for a slow client so what it has queued stays in order
+    if (dnswire_frame_queue_init(&client->queue, handle->queue_size, dnswire_frame_queue_drop_newest) != dnswire_ok) {
+        free(client);
+        return 0;
+    }
+    dnswire_frame_queue_push(&client->queue, handle->start);
+
+    client->state = dnswire_publisher_client_publishing;
+    client->fd    = fd;
+    client->ctx   = ctx;
+
+    client->next = handle->clients;
+    if (client->next) {
+        client->next->prev = client;
+    }
+    handle->clients = client;
+    handle->num_clients++;
+
+    return client;
+}
+
+void dnswire_publisher_remove_client(struct dnswire_publisher* handle, struct dnswire_publisher_client* client)
+{
+    assert(handle);
+    assert(client);
+
+    if (client->prev) {
+        client->prev->next = client->next;
+    } else {
+        handle->clients = client->next;
+    }
+    if (client->next) {
+        client->next->prev = client->prev;
+    }
+    handle->num_clients--;
+
+    dnswire_frame_queue_destroy(&client->queue);
+    free(client);
+}
+
+enum dnswire_result dnswire_publisher_publish(struct dnswire_publisher* handle, struct dnswire_frame* frame)
+{
+    assert(handle);
+    assert(frame);
+
+    struct dnswire_publisher_client* client;
+
+    for (client = handle->clients; client; client = client->next) {
+        if (client->state != dnswire_publisher_client_publishing || client->stop) {
+            continue;
+        }
+
+        if (dnswire_frame_queue_push(&client->queue, frame) == dnswire_ok) {
+            client->drops = 0;
+            continue;
+        }
+
+        client->drops++;
+        if (handle->max_drops && client->drops > handle->max_drops) {
+            __trace("client %p evicted after %zu drops", client, client->drops);
+            __state(client, dnswire_publisher_client_evicted);
+            dnswire_frame_queue_clear(&client->queue);
+            handle->evicted++;
+        }
+    }
+    handle->published++;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_publisher_publish_dnstap(struct dnswire_publisher* handle, const struct dnstap* dnstap)
+{
+    assert(handle);
+    assert(dnstap);
+
+    size_t len = dnstap_encode_protobuf_size(dnstap);
+    if (!len) {
+        return dnswire_error;
+    }
+
+    struct dnswire_frame* frame = dnswire_frame_new(len);
+    if (!frame) {
+        return dnswire_error;
+    }
+    dnstap_encode_protobuf(dnstap, dnswire_frame_payload(frame));
+
+    enum dnswire_result res = dnswire_publisher_publish(handle, frame);
+    dnswire_frame_unref(frame);
+
+    return res;
+}
+
+enum dnswire_result dnswire_publisher_write(struct dnswire_publisher* handle, struct dnswire_publisher_client* client)
+{
+    assert(handle);
+    assert(client);
+
+    __trace("state %s", dnswire_publisher_client_state_string[client->state]);
+
+    switch (client->state) {
+    case dnswire_publisher_client_publishing:
+    case dnswire_publisher_client_stopping:
+        switch (dnswire_frame_queue_write(&client->queue, client->fd)) {
+        case dnswire_ok:
+            break;
+
+        case dnswire_again:
+            return dnswire_again;
+
+        default:
+            __state(client, dnswire_publisher_client_evicted);
+            dnswire_frame_queue_clear(&client->queue);
+            handle->evicted++;
+            return dnswire_error;
+        }
+        if (client->state == dnswire_publisher_client_stopping) {
+            __state(client, dnswire_publisher_client_done);
+            return dnswire_endofdata;
+        }
+        if (!client->stop) {
+            return dnswire_ok;
+        }
+        // the queue is empty so STOP will always fit
+        dnswire_frame_queue_push(&client->queue, handle->stop);
+        __state(client, dnswire_publisher_client_stopping);
+        return dnswire_publisher_write(handle, client);
+
+    case dnswire_publisher_client_done:
+        return dnswire_endofdata;
+
+    case dnswire_publisher_client_evicted:
+        break;
+    }
+
+    return dnswire_error;
+}
+
+struct dnswire_frame* dnswire_publisher_pop(struct dnswire_publisher* handle, struct dnswire_publisher_client* client)
+{
+    assert(handle);
+    assert(client);
+
+    switch (client->state) {
+    case dnswire_publisher_client_publishing:
+    case dnswire_publisher_client_stopping:
+        if (!dnswire_frame_queue_is_empty(client->queue)) {
+            return dnswire_frame_queue_pop(&client->queue);
+        }
+        if (client->state == dnswire_publisher_client_stopping) {
+            __state(client, dnswire_publisher_client_done);
+            break;
+        }
+        if (!client->stop) {
+            break;
+        }
+        __state(client, dnswire_publisher_client_stopping);
+        return dnswire_frame_ref(handle->stop);
+
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+enum dnswire_result dnswire_publisher_stop(struct dnswire_publisher* handle)
+{
+    assert(handle);
+
+    struct dnswire_publisher_client* client;
+
+    for (client = handle->clients; client; client = client->next) {
+        client->stop = true;
+    }
+
+    return dnswire_ok;
+}
@@ -0,0 +1,560 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/query.h"
+#include "dnswire/trace.h"
+#include "util.h"
+
+#include <assert.h>
+#include <string.h>
+
+const char* const dnswire_query_op_string[] = {
+    "==",
+    "!=",
+    "<",
+    "<=",
+    ">",
+    ">=",
+};
+
+enum dnswire_result dnswire_query_init(struct dnswire_query* handle)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_query));
+
+    return dnswire_ok;
+}
+
+static void _clear_groups(struct dnswire_query* handle)
+{
+    size_t i;
+
+    for (i = 0; i < handle->num_groups; i++) {
+        free(handle->groups[i].bytes);
+    }
+    free(handle->groups);
+    handle->groups     = 0;
+    handle->num_groups = 0;
+}
+
+void dnswire_query_destroy(struct dnswire_query* handle)
+{
+    assert(handle);
+
+    size_t i;
+
+    for (i = 0; i < handle->num_filters; i++) {
+        free(handle->filters[i].bytes);
+    }
+    handle->num_filters = 0;
+    _clear_groups(handle);
+}
+
+enum dnswire_result dnswire_query_add_filter(struct dnswire_query* handle, enum dnswire_column column, enum dnswire_query_op op, uint64_t value)
+{
+    assert(handle);
+
+    if (column >= DNSWIRE_COLUMNS || dnswire_column_is_bytes(column) || op > dnswire_query_ge || handle->num_filters >= DNSWIRE_QUERY_MAX_FILTERS) {
+        return dnswire_error;
+    }
+    handle->filters[handle->num_filters++] = (struct dnswire_query_filter) {
+        .column = column,
+        .op     = op,
+        .value  = value,
+    };
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_query_add_filter_bytes(struct dnswire_query* handle, enum dnswire_column column, enum dnswire_query_op op, const uint8_t* bytes, size_t length)
+{
+    assert(handle);
+    assert(bytes || !length);
+
+    uint8_t* copy;
+
+    if (column >= DNSWIRE_COLUMNS || !dnswire_column_is_bytes(column) || (op != dnswire_query_eq && op != dnswire_query_ne) || handle->num_filters >= DNSWIRE_QUERY_MAX_FILTERS) {
+        return dnswire_error;
+    }
+    if (!(copy = malloc(length ? length : 1))) {
+        return dnswire_error;
+    }
+    if (length) {
+        memcpy(copy, bytes, length);
+    }
+    handle->filters[handle->num_filters++] = (struct dnswire_query_filter) {
+        .column = column,
+        .op     = op,
+        .bytes  = copy,
+        .length = length,
+    };
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_query_add_project(struct dnswire_query* handle, enum dnswire_column column)
+{
+    assert(handle);
+
+    if (column >= DNSWIRE_COLUMNS || handle->num_project >= DNSWIRE_COLUMNS) {
+        return dnswire_error;
+    }
+    handle->project[handle->num_project++] = column;
+
+    return dnswire_ok;
+}
+
+/*
+ * Open addressing hash table of groups, a slot is empty if its count is
+ * zero.
+ */
+
+struct _table {
+    struct dnswire_query_group* slots;
+    size_t                      size, used;
+};
+
+static inline uint64_t _hash(bool bytes, uint64_t value, const uint8_t* data, size_t length)
+{
+    if (!bytes) {
+        return _fnv1a64((const uint8_t*)&value, sizeof(value));
+    }
+    return _fnv1a64(data, length);
+}
+
+static struct dnswire_query_group* _lookup(struct _table* t, bool bytes, uint64_t value, const uint8_t* data, size_t length)
+{
+    size_t mask = t->size - 1, s = _hash(bytes, value, data, length) & mask;
+
+    while (t->slots[s].count) {
+        struct dnswire_query_group* g = &t->slots[s];
+
+        if (bytes ? g->length == length && !memcmp(g->bytes, data, length) : g->value == value) {
+            break;
+        }
+        s = (s + 1) & mask;
+    }
+    return &t->slots[s];
+}
+
+static int _insert(struct _table* t, bool bytes, uint64_t value, const uint8_t* data, size_t length, size_t count)
+{
+    struct dnswire_query_group* g;
+    size_t                      i;
+
+    if ((t->used + 1) * 2 > t->size) {
+        struct _table n = { .size = t->size ? t->size * 2 : 1024 };
+
+        if (!(n.slots = calloc(n.size, sizeof(struct dnswire_query_group)))) {
+            return -1;
+        }
+        for (i = 0; i < t->size; i++) {
+            if (t->slots[i].count) {
+                *_lookup(&n, bytes, t->slots[i].value, t->slots[i].bytes, t->slots[i].length) = t->slots[i];
+            }
+        }
+        free(t->slots);
+        t->slots = n.slots;
+        t->size  = n.size;
+    }
+
+    g = _lookup(t, bytes, value, data, length);
+    if (!g->count) {
+        g->value = value;
+        if (bytes) {
+            if (!(g->bytes = malloc(length ? length : 1))) {
+                return -1;
+            }
+            if (length) {
+                memcpy(g->bytes, data, length);
+            }
+            g->length = length;
+        }
+        t->used++;
+    }
+    g->count += count;
+    return 0;
+}
+
+static void _free(struct _table* t)
+{
+    size_t i;
+
+    for (i = 0; i < t->size; i++) {
+        free(t->slots[i].bytes);
+    }
+    free(t->slots);
+    memset(t, 0, sizeof(struct _table));
+}
+
+/*
+ * Running the query.
+ */
+
+struct _run {
+    struct dnswire_query*                 handle;
+    const struct dnswire_columnar_reader* reader;
+    pthread_mutex_t                       lock;
+    size_t                                next, given;
+    bool                                  done;
+    enum dnswire_result                   result;
+    struct _table                         table;
+};
+
+struct _worker {
+    struct dnswire_columnar_reader reader;
+    struct dnswire_column_data     columns[DNSWIRE_COLUMNS];
+    uint32_t                       loaded;
+    uint8_t*                       sel;
+    size_t                         sel_size;
+    struct _table                  table;
+    size_t                         matched, scanned, skipped;
+};
+
+/*
+ * If no row of the group can match a filter, from the min and max of the
+ * filter's column.
+ */
+static bool _skip(const struct dnswire_query* handle, const struct dnswire_columnar_group* group)
+{
+    size_t i;
+
+    for (i = 0; i < handle->num_filters; i++) {
+        const struct dnswire_query_filter*   f = &handle->filters[i];
+        const struct dnswire_columnar_chunk* c = &group->chunks[f->column];
+
+        if (c->min > c->max) {
+            // no row has a value
+            return true;
+        }
+        if (dnswire_column_is_bytes(f->column)) {
+            continue;
+        }
+        switch (f->op) {
+        case dnswire_query_eq:
+            if (f->value < c->min || f->value > c->max) {
+                return true;
+            }
+            break;
+        case dnswire_query_ne:
+            if (c->min == f->value && c->max == f->value) {
+                return true;
+            }
+            break;
+        case dnswire_query_lt:
+            if (c->min >= f->value) {
+                return true;
+            }
+            break;
+        case dnswire_query_le:
+            if (c->min > f->value) {
+                return true;
+            }
+            break;
+        case dnswire_query_gt:
+            if (c->max <= f->value) {
+                return true;
+            }
+            break;
+        case dnswire_query_ge:
+            if (c->max < f->value) {
+                return true;
+            }
+            break;
+        }
+    }
+    return false;
+}
+
+static inline bool _match(const struct dnswire_query_filter* f, const struct dnswire_column_data* c, size_t row)
+{
+    if (!dnswire_column_data_is_present(*c, row)) {
+        return false;
+    }
+    if (f->bytes) {
+        bool eq = dnswire_column_data_length(*c, row) == f->length && !memcmp(dnswire_column_data_bytes(*c, row), f->bytes, f->length);
+        return f->op == dnswire_query_eq ? eq : !eq;
+    }
+
+    uint64_t v = dnswire_column_data_value(*c, row);
+    switch (f->op) {
+    case dnswire_query_eq:
+        return v == f->value;
+    case dnswire_query_ne:
+        return v != f->value;
+    case dnswire_query_lt:
+        return v < f->value;
+    case dnswire_query_le:
+        return v <= f->value;
+    case dnswire_query_gt:
+        return v > f->value;
+    case dnswire_query_ge:
+        return v >= f->value;
+    }
+    return false;
+}
+
+static enum dnswire_result _load(struct _worker* w, size_t group, enum dnswire_column column)
+{
+    if (w->loaded & (1 << column)) {
+        return dnswire_ok;
+    }
+    if (dnswire_columnar_reader_read(&w->reader, group, column, &w->columns[column]) != dnswire_ok) {
+        return dnswire_error;
+    }
+    w->loaded |= 1 << column;
+    return dnswire_ok;
+}
+
+static enum dnswire_result _process(struct _run* run, struct _worker* w, size_t group)
+{
+    const struct dnswire_query* handle = run->handle;
+    size_t                      rows   = w->reader.groups[group].rows, n = rows, i, j;
+
+    if (_skip(handle, &w->reader.groups[group])) {
+        w->skipped++;
+        return dnswire_ok;
+    }
+    w->scanned++;
+    w->loaded = 0;
+
+    if (rows > w->sel_size) {
+        uint8_t* sel = realloc(w->sel, rows);
+        if (!sel) {
+            return dnswire_error;
+        }
+        w->sel      = sel;
+        w->sel_size = rows;
+    }
+    memset(w->sel, 1, rows);
+
+    /*
+     * Only read the columns of the filters until no rows are left.
+     */
+    for (i = 0; i < handle->num_filters && n; i++) {
+        const struct dnswire_query_filter* f = &handle->filters[i];
+
+        if (_load(w, group, f->column) != dnswire_ok) {
+            return dnswire_error;
+        }
+        for (j = 0, n = 0; j < rows; j++) {
+            if (w->sel[j]) {
+                n += (w->sel[j] = _match(f, &w->columns[f->column], j));
+            }
+        }
+    }
+    if (!n) {
+        return dnswire_ok;
+    }
+    w->matched += n;
+
+    if (handle->grouped) {
+        const struct dnswire_column_data* c     = &w->columns[handle->group_by];
+        bool                              bytes = dnswire_column_is_bytes(handle->group_by);
+
+        if (_load(w, group, handle->group_by) != dnswire_ok) {
+            return dnswire_error;
+        }
+        for (j = 0; j < rows; j++) {
+            if (!w->sel[j] || !dnswire_column_data_is_present(*c, j)) {
+                continue;
+            }
+            if (bytes ? _insert(&w->table, true, 0, dnswire_column_data_bytes(*c, j), dnswire_column_data_length(*c, j), 1)
+                      : _insert(&w->table, false, dnswire_column_data_value(*c, j), 0, 0, 1)) {
+                return dnswire_error;
+            }
+        }
+        return dnswire_ok;
+    }
+
+    if (!handle->num_project) {
+        return dnswire_ok;
+    }
+    for (i = 0; i < handle->num_project; i++) {
+        if (_load(w, group, handle->project[i]) != dnswire_ok) {
+            return dnswire_error;
+        }
+    }
+    pthread_mutex_lock(&run->lock);
+    for (j = 0; j < rows && !run->done; j++) {
+        if (!w->sel[j]) {
+            continue;
+        }
+        if (handle->callback) {
+            handle->callback(w->columns, j, handle->ctx);
+        }
+        if (handle->limit && ++run->given >= handle->limit) {
+            run->done = true;
+        }
+    }
+    pthread_mutex_unlock(&run->lock);
+
+    return dnswire_ok;
+}
+
+static void* _worker(void* arg)
+{
+    struct _run*   run = arg;
+    struct _worker w;
+    size_t         i;
+
+    memset(&w, 0, sizeof(w));
+    // share the footer but not the buffers of the reader
+    w.reader            = *run->reader;
+    w.reader.in         = 0;
+    w.reader.in_size    = 0;
+    w.reader.raw        = 0;
+    w.reader.raw_size   = 0;
+    w.reader.bytes_read = 0;
+
+    while (1) {
+        pthread_mutex_lock(&run->lock);
+        size_t idx = run->next++;
+        bool   ok  = run->result == dnswire_ok && !run->done;
+        pthread_mutex_unlock(&run->lock);
+
+        if (!ok || idx >= w.reader.num_groups) {
+            break;
+        }
+        if (_process(run, &w, idx) != dnswire_ok) {
+            pthread_mutex_lock(&run->lock);
+            run->result = dnswire_error;
+            pthread_mutex_unlock(&run->lock);
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&run->lock);
+    for (i = 0; i < w.table.size && run->result == dnswire_ok; i++) {
+        struct dnswire_query_group* g = &w.table.slots[i];
+
+        if (g->count && _insert(&run->table, run->handle->grouped && dnswire_column_is_bytes(run->handle->group_by), g->value, g->bytes, g->length, g->count)) {
+            run->result = dnswire_error;
+        }
+    }
+    run->handle->matched += w.matched;
+    run->handle->scanned += w.scanned;
+    run->handle->skipped += w.skipped;
+    run->handle->bytes_read += w.reader.bytes_read;
+    pthread_mutex_unlock(&run->lock);
+
+    _free(&w.table);
+    for (i = 0; i < DNSWIRE_COLUMNS; i++) {
+        dnswire_column_data_destroy(&w.columns[i]);
+    }
+    free(w.sel);
+    free(w.reader.in);
+    free(w.reader.raw);
+
+    return 0;
+}
+
+static int _cmp(const void* a, const void* b)
+{
+    const struct dnswire_query_group* x = a;
+    const struct dnswire_query_group* y = b;
+
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+    if (x->bytes) {
+        size_t l = x->length < y->length ? x->length : y->length;
+        int    r = memcmp(x->bytes, y->bytes, l);
+        return r ? r : (x->length > y->length) - (x->length < y->length);
+    }
+    return (x->value > y->value) - (x->value < y->value);
+}
+
+enum dnswire_result dnswire_query_run(struct dnswire_query* handle, const struct dnswire_columnar_reader* reader, size_t threads)
+{
+    assert(handle);
+    assert(reader);
+    assert(threads);
+
+    struct _run run = {
+        .handle = handle,
+        .reader = reader,
+        .result = dnswire_ok,
+    };
+    pthread_t* tids;
+    size_t     i, started;
+
+    if (handle->grouped && handle->group_by >= DNSWIRE_COLUMNS) {
+        return dnswire_error;
+    }
+    _clear_groups(handle);
+    handle->matched    = 0;
+    handle->scanned    = 0;
+    handle->skipped    = 0;
+    handle->bytes_read = 0;
+
+    if (threads > reader->num_groups) {
+        threads = reader->num_groups;
+    }
+    if (!threads) {
+        return dnswire_ok;
+    }
+    if (!(tids = calloc(threads, sizeof(pthread_t)))) {
+        return dnswire_error;
+    }
+    pthread_mutex_init(&run.lock, 0);
+
+    for (started = 0; started < threads; started++) {
+        if (pthread_create(&tids[started], 0, _worker, &run)) {
+            pthread_mutex_lock(&run.lock);
+            run.result = dnswire_error;
+            pthread_mutex_unlock(&run.lock);
+            break;
+        }
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(tids[i], 0);
+    }
+    pthread_mutex_destroy(&run.lock);
+    free(tids);
+
+    /*
+     * Sort the groups by count and keep the top N.
+     */
+    if (run.result == dnswire_ok && run.table.used) {
+        if (!(handle->groups = malloc(run.table.used * sizeof(struct dnswire_query_group)))) {
+            run.result = dnswire_error;
+        } else {
+            for (i = 0; i < run.table.size; i++) {
+                if (run.table.slots[i].count) {
+                    handle->groups[handle->num_groups++] = run.table.slots[i];
+                    run.table.slots[i].bytes             = 0;
+                }
+            }
+            qsort(handle->groups, handle->num_groups, sizeof(struct dnswire_query_group), _cmp);
+            while (handle->limit && handle->num_groups > handle->limit) {
+                free(handle->groups[--handle->num_groups].bytes);
+            }
+        }
+    }
+    _free(&run.table);
+    __trace("matched %zu scanned %zu skipped %zu read %zu", handle->matched, handle->scanned, handle->skipped, handle->bytes_read);
+
+    return run.result;
+}
@@ -22,10 +22,15 @@
 #include "config.h"
 
 #include "dnswire/reader.h"
+#include "dnswire/index.h"
+#include "dnswire/compression.h"
+#include "dnswire/rollup.h"
 #include "dnswire/trace.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 const char* const dnswire_reader_state_string[] = {
     "reading_control",
@@ -65,6 +70,9 @@ static struct dnswire_reader _defaults = {
 
     .allow_bidirectional = false,
     .is_bidirectional    = false,
+
+    .decompressor = 0,
+    .rollup       = 0,
 };
 
 enum dnswire_result dnswire_reader_init(struct dnswire_reader* handle)
@@ -159,6 +167,14 @@ enum dnswire_result dnswire_reader_set_bufmax(struct dnswire_reader* handle, siz
     return dnswire_ok;
 }
 
+static ssize_t _read(struct dnswire_reader* handle, int fd, uint8_t* data, size_t len)
+{
+    if (handle->decompressor) {
+        return dnswire_decompressor_read(handle->decompressor, fd, data, len);
+    }
+    return read(fd, data, len);
+}
+
 static enum dnswire_result _encoding(struct dnswire_reader* handle)
 {
     enum dnswire_result res;
@@ -301,8 +317,22 @@ enum dnswire_result dnswire_reader_push(struct dnswire_reader* handle, const uin
                 handle->at = 0;
                 __state(handle, dnswire_reader_reading);
             }
+            if (handle->rollup && dnswire_rollup_add(handle->rollup, &handle->decoder.dnstap) != dnswire_ok) {
+                handle->rollup->failed++;
+            }
             return dnswire_have_dnstap;
 
+        case dnswire_have_frame:
+            handle->at += dnswire_decoder_decoded(handle->decoder);
+            handle->left -= dnswire_decoder_decoded(handle->decoder);
+            if (handle->left) {
+                __state(handle, dnswire_reader_decoding);
+            } else {
+                handle->at = 0;
+                __state(handle, dnswire_reader_reading);
+            }
+            return dnswire_have_frame;
+
         case dnswire_endofdata:
             if (handle->is_bidirectional) {
                 __state(handle, dnswire_reader_encoding_finish);
@@ -404,8 +434,20 @@ enum dnswire_result dnswire_reader_push(struct dnswire_reader* handle, const uin
                 handle->at = 0;
                 __state(handle, dnswire_reader_reading);
             }
+            if (handle->rollup && dnswire_rollup_add(handle->rollup, &handle->decoder.dnstap) != dnswire_ok) {
+                handle->rollup->failed++;
+            }
             return dnswire_have_dnstap;
 
+        case dnswire_have_frame:
+            handle->at += dnswire_decoder_decoded(handle->decoder);
+            handle->left -= dnswire_decoder_decoded(handle->decoder);
+            if (!handle->left) {
+                handle->at = 0;
+                __state(handle, dnswire_reader_reading);
+            }
+            return dnswire_have_frame;
+
         case dnswire_endofdata:
             if (handle->is_bidirectional) {
                 __state(handle, dnswire_reader_encoding_finish);
@@ -459,9 +501,11 @@ enum dnswire_result dnswire_reader_read(struct dnswire_reader* handle, int fd)
 
     switch (handle->state) {
     case dnswire_reader_reading_control: {
-        ssize_t nread = read(fd, &handle->buf[handle->at + handle->left], handle->size - handle->at - handle->left);
+        ssize_t nread = _read(handle, fd, &handle->buf[handle->at + handle->left], handle->size - handle->at - handle->left);
         if (nread < 0) {
-            // TODO
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return dnswire_again;
+            }
             return dnswire_error;
         } else if (!nread) {
             // TODO
@@ -540,8 +584,22 @@ enum dnswire_result dnswire_reader_read(struct dnswire_reader* handle, int fd)
                 handle->at = 0;
                 __state(handle, dnswire_reader_reading);
             }
+            if (handle->rollup && dnswire_rollup_add(handle->rollup, &handle->decoder.dnstap) != dnswire_ok) {
+                handle->rollup->failed++;
+            }
             return dnswire_have_dnstap;
 
+        case dnswire_have_frame:
+            handle->at += dnswire_decoder_decoded(handle->decoder);
+            handle->left -= dnswire_decoder_decoded(handle->decoder);
+            if (handle->left) {
+                __state(handle, dnswire_reader_decoding);
+            } else {
+                handle->at = 0;
+                __state(handle, dnswire_reader_reading);
+            }
+            return dnswire_have_frame;
+
         case dnswire_endofdata:
             if (handle->is_bidirectional) {
                 __state(handle, dnswire_reader_encoding_finish);
@@ -570,7 +628,9 @@ enum dnswire_result dnswire_reader_read(struct dnswire_reader* handle, int fd)
         ssize_t nwrote = write(fd, &handle->write_buf[handle->write_at - handle->write_left], handle->write_left);
         __trace("wrote %zd", nwrote);
         if (nwrote < 0) {
-            // TODO
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return dnswire_again;
+            }
             return dnswire_error;
         } else if (!nwrote) {
             // TODO
@@ -587,9 +647,11 @@ enum dnswire_result dnswire_reader_read(struct dnswire_reader* handle, int fd)
     }
 
     case dnswire_reader_reading: {
-        ssize_t nread = read(fd, &handle->buf[handle->at + handle->left], handle->size - handle->at - handle->left);
+        ssize_t nread = _read(handle, fd, &handle->buf[handle->at + handle->left], handle->size - handle->at - handle->left);
         if (nread < 0) {
-            // TODO
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return dnswire_again;
+            }
             return dnswire_error;
         } else if (!nread) {
             // TODO
@@ -645,8 +707,20 @@ enum dnswire_result dnswire_reader_read(struct dnswire_reader* handle, int fd)
                 handle->at = 0;
                 __state(handle, dnswire_reader_reading);
             }
+            if (handle->rollup && dnswire_rollup_add(handle->rollup, &handle->decoder.dnstap) != dnswire_ok) {
+                handle->rollup->failed++;
+            }
             return dnswire_have_dnstap;
 
+        case dnswire_have_frame:
+            handle->at += dnswire_decoder_decoded(handle->decoder);
+            handle->left -= dnswire_decoder_decoded(handle->decoder);
+            if (!handle->left) {
+                handle->at = 0;
+                __state(handle, dnswire_reader_reading);
+            }
+            return dnswire_have_frame;
+
         case dnswire_endofdata:
             if (handle->is_bidirectional) {
                 __state(handle, dnswire_reader_encoding_finish);
@@ -675,7 +749,9 @@ enum dnswire_result dnswire_reader_read(struct dnswire_reader* handle, int fd)
         ssize_t nwrote = write(fd, &handle->write_buf[handle->write_at - handle->write_left], handle->write_left);
         __trace("wrote %zd", nwrote);
         if (nwrote < 0) {
-            // TODO
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return dnswire_again;
+            }
             return dnswire_error;
         } else if (!nwrote) {
             // TODO
@@ -698,3 +774,63 @@ enum dnswire_result dnswire_reader_read(struct dnswire_reader* handle, int fd)
 
     return dnswire_error;
 }
+
+static enum dnswire_result _handshake(struct dnswire_reader* handle, int fd)
+{
+    while (handle->decoder.state != dnswire_decoder_reading_frames) {
+        switch (handle->state) {
+        case dnswire_reader_reading_control:
+        case dnswire_reader_decoding_control:
+            break;
+        default:
+            return dnswire_error;
+        }
+
+        switch (dnswire_reader_read(handle, fd)) {
+        case dnswire_again:
+        case dnswire_need_more:
+            break;
+        default:
+            return dnswire_error;
+        }
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_reader_seek(struct dnswire_reader* handle, int fd, uint64_t offset)
+{
+    assert(handle);
+    assert(handle->buf);
+
+    if (handle->decompressor || _handshake(handle, fd) != dnswire_ok || handle->is_bidirectional) {
+        return dnswire_error;
+    }
+    if (lseek(fd, (off_t)offset, SEEK_SET) < 0) {
+        return dnswire_error;
+    }
+
+    // drop what was buffered from the old position
+    handle->at   = 0;
+    handle->left = 0;
+    __state(handle, dnswire_reader_reading);
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_reader_seek_time(struct dnswire_reader* handle, int fd, const struct dnswire_index* index, uint64_t t)
+{
+    assert(handle);
+    assert(index);
+
+    uint64_t offset;
+
+    if (!dnswire_index_blocks(*index)) {
+        // nothing to seek to, just do the handshake
+        return _handshake(handle, fd);
+    }
+    // if nothing is at or after `t` this seeks to the end of the data
+    dnswire_index_find(index, t, &offset);
+
+    return dnswire_reader_seek(handle, fd, offset);
+}
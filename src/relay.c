@@ -0,0 +1,278 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/relay.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <string.h>
+
+const char* const dnswire_relay_destination_state_string[] = {
+    "starting",
+    "relaying",
+    "stopping",
+    "done",
+    "failed",
+};
+
+#define __state(h, s)                                                                                                       \
+    __trace("state %s => %s", dnswire_relay_destination_state_string[(h)->state], dnswire_relay_destination_state_string[s]); \
+    (h)->state = s;
+
+enum dnswire_result dnswire_relay_init(struct dnswire_relay* handle)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_relay));
+
+    if (dnswire_reader_init(&handle->reader) != dnswire_ok) {
+        return dnswire_error;
+    }
+    dnswire_reader_set_raw(handle->reader, true);
+
+    return dnswire_ok;
+}
+
+void dnswire_relay_destroy(struct dnswire_relay* handle)
+{
+    assert(handle);
+
+    size_t i;
+    for (i = 0; i < handle->num_destinations; i++) {
+        dnswire_relay_destination_destroy(&handle->destinations[i]);
+    }
+    free(handle->destinations);
+    handle->destinations     = 0;
+    handle->num_destinations = 0;
+
+    dnswire_reader_destroy(handle->reader);
+}
+
+enum dnswire_result dnswire_relay_destination_init(struct dnswire_relay_destination* handle, int fd, bool bidirectional, size_t queue_size, enum dnswire_frame_queue_policy policy)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_relay_destination));
+    handle->state = dnswire_relay_destination_starting;
+    handle->fd    = fd;
+
+    if (dnswire_frame_queue_init(&handle->queue, queue_size, policy) != dnswire_ok) {
+        return dnswire_error;
+    }
+    if (dnswire_writer_init(&handle->writer) != dnswire_ok) {
+        dnswire_frame_queue_destroy(&handle->queue);
+        return dnswire_error;
+    }
+    if (dnswire_writer_set_bidirectional(&handle->writer, bidirectional) != dnswire_ok) {
+        dnswire_relay_destination_destroy(handle);
+        return dnswire_error;
+    }
+
+    return dnswire_ok;
+}
+
+void dnswire_relay_destination_destroy(struct dnswire_relay_destination* handle)
+{
+    assert(handle);
+
+    dnswire_writer_destroy(handle->writer);
+    dnswire_frame_queue_destroy(&handle->queue);
+}
+
+enum dnswire_result dnswire_relay_add_destination(struct dnswire_relay* handle, int fd, bool bidirectional, size_t queue_size, enum dnswire_frame_queue_policy policy)
+{
+    assert(handle);
+
+    struct dnswire_relay_destination* destinations = realloc(handle->destinations, sizeof(struct dnswire_relay_destination) * (handle->num_destinations + 1));
+    if (!destinations) {
+        return dnswire_error;
+    }
+    handle->destinations = destinations;
+
+    if (dnswire_relay_destination_init(&handle->destinations[handle->num_destinations], fd, bidirectional, queue_size, policy) != dnswire_ok) {
+        return dnswire_error;
+    }
+    handle->num_destinations++;
+
+    return dnswire_ok;
+}
+
+static enum dnswire_result _fanout(struct dnswire_relay* handle)
+{
+    /*
+     * The frame is copied once out of the reader's buffer and then shared
+     * by reference with all destinations' queues.
+     */
+    struct dnswire_frame* frame = dnswire_frame_copy(dnswire_reader_frame(handle->reader), dnswire_reader_frame_length(handle->reader));
+    if (!frame) {
+        return dnswire_error;
+    }
+    handle->received++;
+
+    size_t i;
+    for (i = 0; i < handle->num_destinations; i++) {
+        struct dnswire_relay_destination* d = &handle->destinations[i];
+
+        if (dnswire_relay_destination_is_active(*d)) {
+            // dropped frames are counted by the queue
+            dnswire_frame_queue_push(&d->queue, frame);
+        }
+    }
+
+    dnswire_frame_unref(frame);
+
+    return dnswire_have_frame;
+}
+
+enum dnswire_result dnswire_relay_push(struct dnswire_relay* handle, const uint8_t* data, size_t len, uint8_t* out_data, size_t* out_len)
+{
+    assert(handle);
+
+    enum dnswire_result res = dnswire_reader_push(&handle->reader, data, len, out_data, out_len);
+
+    switch (res) {
+    case dnswire_have_frame:
+        return _fanout(handle);
+
+    case dnswire_endofdata:
+        dnswire_relay_stop(handle);
+        break;
+
+    default:
+        break;
+    }
+
+    return res;
+}
+
+enum dnswire_result dnswire_relay_read(struct dnswire_relay* handle, int fd)
+{
+    assert(handle);
+
+    enum dnswire_result res = dnswire_reader_read(&handle->reader, fd);
+
+    switch (res) {
+    case dnswire_have_frame:
+        return _fanout(handle);
+
+    case dnswire_endofdata:
+        dnswire_relay_stop(handle);
+        break;
+
+    default:
+        break;
+    }
+
+    return res;
+}
+
+static enum dnswire_result _failed(struct dnswire_relay_destination* d)
+{
+    __state(d, dnswire_relay_destination_failed);
+    dnswire_frame_queue_clear(&d->queue);
+    return dnswire_error;
+}
+
+enum dnswire_result dnswire_relay_destination_write(struct dnswire_relay_destination* handle)
+{
+    assert(handle);
+
+    enum dnswire_result res;
+
+    __trace("state %s", dnswire_relay_destination_state_string[handle->state]);
+
+    switch (handle->state) {
+    case dnswire_relay_destination_starting:
+        res = dnswire_writer_write(&handle->writer, handle->fd);
+        if (res == dnswire_error) {
+            return _failed(handle);
+        }
+        if (!dnswire_writer_is_started(handle->writer)) {
+            return dnswire_again;
+        }
+        __state(handle, dnswire_relay_destination_relaying);
+        // fallthrough
+
+    case dnswire_relay_destination_relaying:
+        switch (dnswire_frame_queue_write(&handle->queue, handle->fd)) {
+        case dnswire_ok:
+            break;
+
+        case dnswire_again:
+            return dnswire_again;
+
+        default:
+            return _failed(handle);
+        }
+        if (!handle->stop) {
+            return dnswire_ok;
+        }
+        if (dnswire_writer_stop(&handle->writer) != dnswire_ok) {
+            return _failed(handle);
+        }
+        __state(handle, dnswire_relay_destination_stopping);
+        // fallthrough
+
+    case dnswire_relay_destination_stopping:
+        switch (dnswire_writer_write(&handle->writer, handle->fd)) {
+        case dnswire_endofdata:
+            __state(handle, dnswire_relay_destination_done);
+            return dnswire_endofdata;
+
+        case dnswire_error:
+            return _failed(handle);
+
+        default:
+            break;
+        }
+        return dnswire_again;
+
+    case dnswire_relay_destination_done:
+        return dnswire_endofdata;
+
+    case dnswire_relay_destination_failed:
+        break;
+    }
+
+    return dnswire_error;
+}
+
+enum dnswire_result dnswire_relay_write(struct dnswire_relay* handle, size_t destination)
+{
+    assert(handle);
+    assert(destination < handle->num_destinations);
+
+    return dnswire_relay_destination_write(&handle->destinations[destination]);
+}
+
+enum dnswire_result dnswire_relay_stop(struct dnswire_relay* handle)
+{
+    assert(handle);
+
+    size_t i;
+    for (i = 0; i < handle->num_destinations; i++) {
+        handle->destinations[i].stop = true;
+    }
+
+    return dnswire_ok;
+}
@@ -0,0 +1,655 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/rollup.h"
+#include "dnswire/dns.h"
+#include "dnswire/trace.h"
+#include "util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+const char* const dnswire_rollup_dimension_string[] = {
+    "message_type",
+    "socket_family",
+    "socket_protocol",
+    "qtype",
+    "rcode",
+    "opcode",
+    "identity",
+};
+
+/*
+ * Longest identity kept in a key, and the largest key.
+ */
+#define MAX_IDENTITY 255
+#define MAX_KEY (2 * (DNSWIRE_ROLLUP_DIMENSIONS - 1) + MAX_IDENTITY)
+
+#define __HEADER_SIZE 16
+#define __BUCKET_SIZE 16
+
+/*
+ * Largest bucket read from a file.
+ */
+#define MAX_BUCKET (256 * 1024 * 1024)
+
+void dnswire_rollup_bucket_destroy(struct dnswire_rollup_bucket* handle)
+{
+    assert(handle);
+
+    free(handle->groups);
+    free(handle->keys);
+    free(handle->index);
+    memset(handle, 0, sizeof(struct dnswire_rollup_bucket));
+}
+
+static void _reset(struct dnswire_rollup_bucket* handle, uint64_t start)
+{
+    handle->open       = true;
+    handle->start      = start;
+    handle->num_groups = 0;
+    handle->keys_len   = 0;
+    if (handle->index) {
+        memset(handle->index, 0, handle->index_size * sizeof(uint32_t));
+    }
+}
+
+static inline size_t _find(const struct dnswire_rollup_bucket* handle, const uint8_t* key, size_t len, uint32_t hash)
+{
+    size_t mask = handle->index_size - 1, i;
+
+    for (i = hash & mask; handle->index[i]; i = (i + 1) & mask) {
+        const struct dnswire_rollup_group* g = &handle->groups[handle->index[i] - 1];
+
+        if (g->hash == hash && g->length == len && (!len || !memcmp(&handle->keys[g->key], key, len))) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/*
+ * Make room for one more group, keeping the index at most half full.
+ */
+static int _grow(struct dnswire_rollup_bucket* handle, size_t len)
+{
+    if (handle->num_groups == handle->groups_size) {
+        size_t                       size   = handle->groups_size ? handle->groups_size * 2 : 64;
+        struct dnswire_rollup_group* groups = realloc(handle->groups, size * sizeof(struct dnswire_rollup_group));
+
+        if (!groups) {
+            return -1;
+        }
+        handle->groups      = groups;
+        handle->groups_size = size;
+    }
+
+    // allocated even for empty keys (no dimensions) so keys is never NULL
+    if (!handle->keys || handle->keys_len + len > handle->keys_size) {
+        size_t   size = handle->keys_size ? handle->keys_size : 4096;
+        uint8_t* keys;
+
+        while (size < handle->keys_len + len) {
+            size *= 2;
+        }
+        if (!(keys = realloc(handle->keys, size))) {
+            return -1;
+        }
+        handle->keys      = keys;
+        handle->keys_size = size;
+    }
+
+    if ((handle->num_groups + 1) * 2 > handle->index_size) {
+        size_t    size = handle->index_size ? handle->index_size * 2 : 128, i;
+        uint32_t* index;
+
+        if (!(index = calloc(size, sizeof(uint32_t)))) {
+            return -1;
+        }
+        free(handle->index);
+        handle->index      = index;
+        handle->index_size = size;
+
+        for (i = 0; i < handle->num_groups; i++) {
+            const struct dnswire_rollup_group* g = &handle->groups[i];
+
+            handle->index[_find(handle, &handle->keys[g->key], g->length, g->hash)] = i + 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Add to the group of a key, returns 1 if the bucket is full.
+ */
+static int _add(struct dnswire_rollup_bucket* handle, const uint8_t* key, size_t len, uint64_t messages, uint64_t bytes, size_t max_groups)
+{
+    uint32_t                     hash = _fnv1a32(key, len);
+    size_t                       slot;
+    struct dnswire_rollup_group* g;
+
+    if (handle->index_size) {
+        slot = _find(handle, key, len, hash);
+        if (handle->index[slot]) {
+            g = &handle->groups[handle->index[slot] - 1];
+            g->messages += messages;
+            g->bytes += bytes;
+            return 0;
+        }
+    }
+
+    if (handle->num_groups >= max_groups) {
+        return 1;
+    }
+    if (_grow(handle, len)) {
+        return -1;
+    }
+
+    g           = &handle->groups[handle->num_groups];
+    g->key      = handle->keys_len;
+    g->length   = len;
+    g->hash     = hash;
+    g->messages = messages;
+    g->bytes    = bytes;
+    if (len) {
+        memcpy(&handle->keys[handle->keys_len], key, len);
+    }
+    handle->keys_len += len;
+
+    handle->index[_find(handle, key, len, hash)] = ++handle->num_groups;
+
+    return 0;
+}
+
+enum dnswire_result dnswire_rollup_init(struct dnswire_rollup* handle, uint32_t interval)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_rollup));
+    handle->interval   = interval ? interval : DNSWIRE_ROLLUP_DEFAULT_INTERVAL;
+    handle->max_groups = DNSWIRE_ROLLUP_DEFAULT_MAX_GROUPS;
+    handle->fd         = -1;
+
+    return dnswire_ok;
+}
+
+void dnswire_rollup_destroy(struct dnswire_rollup* handle)
+{
+    assert(handle);
+
+    dnswire_rollup_bucket_destroy(&handle->buckets[0]);
+    dnswire_rollup_bucket_destroy(&handle->buckets[1]);
+}
+
+enum dnswire_result dnswire_rollup_add_dimension(struct dnswire_rollup* handle, enum dnswire_rollup_dimension dimension)
+{
+    assert(handle);
+
+    size_t i;
+
+    if (dimension >= DNSWIRE_ROLLUP_DIMENSIONS || handle->buckets[0].open || handle->buckets[1].open) {
+        return dnswire_error;
+    }
+    for (i = 0; i < handle->num_dimensions; i++) {
+        if (handle->dimensions[i] == dimension) {
+            return dnswire_error;
+        }
+    }
+    handle->dimensions[handle->num_dimensions++] = dimension;
+
+    return dnswire_ok;
+}
+
+static inline size_t _put_varint(uint8_t* p, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+
+    return n;
+}
+
+static inline int _get_varint(const uint8_t** p, const uint8_t* end, uint64_t* v)
+{
+    unsigned shift = 0;
+
+    *v = 0;
+    while (*p < end && shift < 64) {
+        uint8_t b = *(*p)++;
+
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return 0;
+        }
+        shift += 7;
+    }
+
+    return -1;
+}
+
+static int _write(int fd, const uint8_t* data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Returns 1 if at the end of the file before anything was read.
+ */
+static int _read(int fd, uint8_t* data, size_t len)
+{
+    size_t left = len;
+
+    while (left) {
+        ssize_t n = read(fd, data, left);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (!n) {
+            return left == len ? 1 : -1;
+        }
+        data += n;
+        left -= n;
+    }
+    return 0;
+}
+
+/*
+ * The side file is a header followed by the buckets, all big endian:
+ * - magic (8 bytes), interval (32 bits), number of dimensions (32 bits)
+ *   and then one byte per dimension
+ * - per bucket: start (64 bits), number of groups (32 bits), length of
+ *   the groups (32 bits) so a bucket can be skipped without parsing it
+ * - per group: key length (16 bits), key, messages and bytes as varints
+ */
+static int _write_header(struct dnswire_rollup* handle)
+{
+    uint8_t buf[__HEADER_SIZE + DNSWIRE_ROLLUP_DIMENSIONS];
+    size_t  i;
+
+    memcpy(buf, DNSWIRE_ROLLUP_MAGIC, 8);
+    _put32(buf + 8, handle->interval);
+    _put32(buf + 12, handle->num_dimensions);
+    for (i = 0; i < handle->num_dimensions; i++) {
+        buf[__HEADER_SIZE + i] = handle->dimensions[i];
+    }
+
+    return _write(handle->fd, buf, __HEADER_SIZE + handle->num_dimensions);
+}
+
+static enum dnswire_result _flush(struct dnswire_rollup* handle, struct dnswire_rollup_bucket* bucket)
+{
+    uint8_t *buf, *p;
+    size_t   i;
+    int      err;
+
+    if (!bucket->open) {
+        return dnswire_ok;
+    }
+    bucket->open = false;
+    handle->flushed++;
+
+    __trace("flush %lu groups %zu", (unsigned long)bucket->start, bucket->num_groups);
+
+    if (handle->fd < 0) {
+        return dnswire_ok;
+    }
+    if (!handle->header_written) {
+        if (_write_header(handle)) {
+            return dnswire_error;
+        }
+        handle->header_written = true;
+    }
+
+    if (!(buf = malloc(__BUCKET_SIZE + bucket->num_groups * (2 + 20) + bucket->keys_len))) {
+        return dnswire_error;
+    }
+    p = buf + __BUCKET_SIZE;
+    for (i = 0; i < bucket->num_groups; i++) {
+        const struct dnswire_rollup_group* g = &bucket->groups[i];
+
+        _put16(p, g->length);
+        memcpy(p + 2, &bucket->keys[g->key], g->length);
+        p += 2 + g->length;
+        p += _put_varint(p, g->messages);
+        p += _put_varint(p, g->bytes);
+    }
+    _put64(buf, bucket->start);
+    _put32(buf + 8, bucket->num_groups);
+    _put32(buf + 12, p - buf - __BUCKET_SIZE);
+
+    err = _write(handle->fd, buf, p - buf);
+    free(buf);
+
+    return err ? dnswire_error : dnswire_ok;
+}
+
+enum dnswire_result dnswire_rollup_flush(struct dnswire_rollup* handle)
+{
+    assert(handle);
+
+    struct dnswire_rollup_bucket* cur  = &handle->buckets[handle->current];
+    struct dnswire_rollup_bucket* prev = &handle->buckets[handle->current ^ 1];
+
+    if (_flush(handle, prev) != dnswire_ok || _flush(handle, cur) != dnswire_ok) {
+        return dnswire_error;
+    }
+
+    return dnswire_ok;
+}
+
+/*
+ * Find the bucket for a time, flushing and opening buckets as needed.
+ */
+static struct dnswire_rollup_bucket* _bucket(struct dnswire_rollup* handle, uint64_t start, enum dnswire_result* res)
+{
+    struct dnswire_rollup_bucket* cur  = &handle->buckets[handle->current];
+    struct dnswire_rollup_bucket* prev = &handle->buckets[handle->current ^ 1];
+
+    *res = dnswire_ok;
+
+    if (!cur->open) {
+        _reset(cur, start);
+        return cur;
+    }
+    if (start == cur->start) {
+        return cur;
+    }
+
+    if (start > cur->start) {
+        if ((*res = _flush(handle, prev)) != dnswire_ok) {
+            return 0;
+        }
+        if (start - cur->start > handle->interval) {
+            if ((*res = _flush(handle, cur)) != dnswire_ok) {
+                return 0;
+            }
+            _reset(cur, start);
+            return cur;
+        }
+        handle->current ^= 1;
+        _reset(prev, start);
+        return prev;
+    }
+
+    if (prev->open) {
+        return prev->start == start ? prev : 0;
+    }
+    if (cur->start - start == handle->interval) {
+        _reset(prev, start);
+        return prev;
+    }
+
+    return 0;
+}
+
+enum dnswire_result dnswire_rollup_add(struct dnswire_rollup* handle, const struct dnstap* d)
+{
+    assert(handle);
+    assert(d);
+
+    uint8_t                       key[MAX_KEY];
+    size_t                        len = 0, i, dns_len = 0, bytes = 0;
+    const uint8_t*                dns = 0;
+    bool                          response;
+    uint64_t                      sec;
+    enum dnswire_result           res;
+    struct dnswire_rollup_bucket* bucket;
+
+    if (!dnstap_has_message(*d)) {
+        handle->ignored++;
+        return dnswire_ok;
+    }
+
+    response = dnstap_message_type(*d) && !(dnstap_message_type(*d) & 1);
+    if (response && dnstap_message_has_response_time_sec(*d)) {
+        sec = dnstap_message_response_time_sec(*d);
+    } else if (dnstap_message_has_query_time_sec(*d)) {
+        sec = dnstap_message_query_time_sec(*d);
+    } else {
+        handle->ignored++;
+        return dnswire_ok;
+    }
+
+    if (dnstap_message_has_query_message(*d)) {
+        dns     = dnstap_message_query_message(*d);
+        dns_len = dnstap_message_query_message_length(*d);
+        bytes   = dns_len;
+    }
+    if (dnstap_message_has_response_message(*d)) {
+        if (!dns) {
+            dns     = dnstap_message_response_message(*d);
+            dns_len = dnstap_message_response_message_length(*d);
+        }
+        if (response || !bytes) {
+            bytes = dnstap_message_response_message_length(*d);
+        }
+    }
+
+    for (i = 0; i < handle->num_dimensions; i++) {
+        uint16_t           v = DNSWIRE_ROLLUP_NONE;
+        struct dnswire_dns parsed;
+
+        switch (handle->dimensions[i]) {
+        case dnswire_rollup_message_type:
+            v = dnstap_message_type(*d);
+            break;
+        case dnswire_rollup_socket_family:
+            if (dnstap_message_has_socket_family(*d)) {
+                v = dnstap_message_socket_family(*d);
+            }
+            break;
+        case dnswire_rollup_socket_protocol:
+            if (dnstap_message_has_socket_protocol(*d)) {
+                v = dnstap_message_socket_protocol(*d);
+            }
+            break;
+        case dnswire_rollup_qtype:
+            if (dns && dnswire_dns_parse(&parsed, dns, dns_len) == dnswire_ok && parsed.has_question) {
+                v = parsed.qtype;
+            }
+            break;
+        case dnswire_rollup_rcode:
+            if (response && dnstap_message_has_response_message(*d) && dnstap_message_response_message_length(*d) >= DNSWIRE_DNS_HEADER_SIZE) {
+                v = (dnstap_message_response_message(*d))[3] & 0xf;
+            }
+            break;
+        case dnswire_rollup_opcode:
+            if (dns && dns_len >= DNSWIRE_DNS_HEADER_SIZE) {
+                v = (dns[2] >> 3) & 0xf;
+            }
+            break;
+        case dnswire_rollup_identity:
+            continue;
+        }
+        _put16(&key[len], v);
+        len += 2;
+    }
+    for (i = 0; i < handle->num_dimensions; i++) {
+        if (handle->dimensions[i] == dnswire_rollup_identity && dnstap_has_identity(*d)) {
+            size_t n = dnstap_identity_length(*d) > MAX_IDENTITY ? MAX_IDENTITY : dnstap_identity_length(*d);
+
+            memcpy(&key[len], dnstap_identity(*d), n);
+            len += n;
+        }
+    }
+
+    if (!(bucket = _bucket(handle, sec - sec % handle->interval, &res))) {
+        if (res != dnswire_ok) {
+            return res;
+        }
+        handle->late++;
+        return dnswire_ok;
+    }
+
+    switch (_add(bucket, key, len, 1, bytes, handle->max_groups)) {
+    case 0:
+        break;
+    case 1:
+        handle->dropped++;
+        break;
+    default:
+        return dnswire_error;
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_rollup_load(struct dnswire_rollup* handle, int fd)
+{
+    assert(handle);
+
+    uint8_t  buf[__HEADER_SIZE + DNSWIRE_ROLLUP_DIMENSIONS];
+    uint32_t num, i;
+
+    if (_read(fd, buf, __HEADER_SIZE) || memcmp(buf, DNSWIRE_ROLLUP_MAGIC, 8) || !_get32(buf + 8)) {
+        return dnswire_error;
+    }
+    if ((num = _get32(buf + 12)) > DNSWIRE_ROLLUP_DIMENSIONS || _read(fd, buf + __HEADER_SIZE, num)) {
+        return dnswire_error;
+    }
+
+    dnswire_rollup_destroy(handle);
+    dnswire_rollup_init(handle, _get32(buf + 8));
+    for (i = 0; i < num; i++) {
+        if (dnswire_rollup_add_dimension(handle, buf[__HEADER_SIZE + i]) != dnswire_ok) {
+            return dnswire_error;
+        }
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_rollup_read(const struct dnswire_rollup* handle, struct dnswire_rollup_bucket* bucket, int fd)
+{
+    assert(handle);
+    assert(bucket);
+
+    uint8_t        head[__BUCKET_SIZE], *buf;
+    const uint8_t *p, *end;
+    uint32_t       groups, length, i;
+    int            err;
+
+    if ((err = _read(fd, head, __BUCKET_SIZE))) {
+        return err > 0 ? dnswire_endofdata : dnswire_error;
+    }
+    groups = _get32(head + 8);
+    length = _get32(head + 12);
+    if (length > MAX_BUCKET || !(buf = malloc(length ? length : 1))) {
+        return dnswire_error;
+    }
+    if (_read(fd, buf, length)) {
+        free(buf);
+        return dnswire_error;
+    }
+
+    _reset(bucket, _get64(head));
+    for (p = buf, end = buf + length, i = 0; i < groups; i++) {
+        const uint8_t* key;
+        uint64_t       messages, bytes;
+        size_t         len;
+
+        if (end - p < 2 || (len = _get16(p)) > MAX_KEY || (size_t)(end - p - 2) < len) {
+            break;
+        }
+        key = p + 2;
+        p += 2 + len;
+        if (_get_varint(&p, end, &messages) || _get_varint(&p, end, &bytes)
+            || _add(bucket, key, len, messages, bytes, SIZE_MAX)) {
+            break;
+        }
+    }
+    free(buf);
+
+    return i == groups ? dnswire_ok : dnswire_error;
+}
+
+uint16_t dnswire_rollup_group_value(const struct dnswire_rollup* handle, const struct dnswire_rollup_bucket* bucket, size_t group, enum dnswire_rollup_dimension dimension)
+{
+    assert(handle);
+    assert(bucket);
+    assert(group < bucket->num_groups);
+
+    const struct dnswire_rollup_group* g   = &bucket->groups[group];
+    size_t                             off = 0, i;
+
+    for (i = 0; i < handle->num_dimensions; i++) {
+        if (handle->dimensions[i] == dnswire_rollup_identity) {
+            continue;
+        }
+        if (handle->dimensions[i] == dimension) {
+            return off + 2 <= g->length ? _get16(&bucket->keys[g->key + off]) : DNSWIRE_ROLLUP_NONE;
+        }
+        off += 2;
+    }
+
+    return DNSWIRE_ROLLUP_NONE;
+}
+
+const uint8_t* dnswire_rollup_group_identity(const struct dnswire_rollup* handle, const struct dnswire_rollup_bucket* bucket, size_t group, size_t* len)
+{
+    assert(handle);
+    assert(bucket);
+    assert(group < bucket->num_groups);
+    assert(len);
+
+    const struct dnswire_rollup_group* g     = &bucket->groups[group];
+    size_t                             off   = 0, i;
+    bool                               found = false;
+
+    for (i = 0; i < handle->num_dimensions; i++) {
+        if (handle->dimensions[i] == dnswire_rollup_identity) {
+            found = true;
+        } else {
+            off += 2;
+        }
+    }
+    if (!found || off > g->length) {
+        *len = 0;
+        return 0;
+    }
+
+    *len = g->length - off;
+    return &bucket->keys[g->key + off];
+}
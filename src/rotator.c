@@ -0,0 +1,410 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/rotator.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static char* _name(const char* path, size_t seq)
+{
+    size_t len  = strlen(path) + 24;
+    char*  name = malloc(len);
+
+    if (name) {
+        snprintf(name, len, "%s.%zu", path, seq);
+    }
+    return name;
+}
+
+/*
+ * Open the file with the given sequence, or the next that does not exist,
+ * and set the sequence used. Files are never truncated so existing files
+ * are never overwritten.
+ */
+static int _open(const struct dnswire_rotator* handle, size_t* seq)
+{
+    int fd;
+
+    while (1) {
+        char* name = _name(handle->path, *seq);
+
+        if (!name) {
+            return -1;
+        }
+        fd = open(name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        free(name);
+        if (fd > -1 || errno != EEXIST) {
+            break;
+        }
+        (*seq)++;
+    }
+
+#if HAVE_POSIX_FALLOCATE
+    if (fd > -1 && handle->preallocate) {
+        // not fatal, the file system may not support it
+        int err = posix_fallocate(fd, 0, (off_t)handle->preallocate);
+        if (err) {
+            __trace("posix_fallocate() failed: %s", strerror(err));
+        }
+    }
+#endif
+
+    return fd;
+}
+
+/*
+ * Find the sequence after the highest existing `<path>.<sequence>` so a
+ * new run continues after the files of a previous one, 0 if there are
+ * none.
+ */
+static size_t _first_seq(const char* path)
+{
+    const char*    slash = strrchr(path, '/');
+    const char*    base  = slash ? slash + 1 : path;
+    size_t         len   = strlen(base), seq = 0;
+    char*          dir;
+    DIR*           d;
+    struct dirent* e;
+
+    if (!(dir = slash ? strndup(path, slash - path + 1) : strdup("."))) {
+        return 0;
+    }
+    if ((d = opendir(dir))) {
+        while ((e = readdir(d))) {
+            const char*        p;
+            char*              end;
+            unsigned long long n;
+
+            if (strncmp(e->d_name, base, len) || e->d_name[len] != '.') {
+                continue;
+            }
+            p = e->d_name + len + 1;
+            if (*p < '0' || *p > '9') {
+                continue;
+            }
+            errno = 0;
+            n     = strtoull(p, &end, 10);
+            if (*end || errno || n >= SIZE_MAX) {
+                continue;
+            }
+            if (n + 1 > seq) {
+                seq = n + 1;
+            }
+        }
+        closedir(d);
+    }
+    free(dir);
+
+    return seq;
+}
+
+static uint64_t _rotate_at(const struct dnswire_rotator* handle)
+{
+    if (!handle->interval) {
+        return 0;
+    }
+    return ((uint64_t)time(0) / handle->interval + 1) * handle->interval;
+}
+
+enum dnswire_result dnswire_rotator_init(struct dnswire_rotator* handle, const char* path)
+{
+    assert(handle);
+    assert(path);
+
+    memset(handle, 0, sizeof(struct dnswire_rotator));
+
+    if (!(handle->path = strdup(path))) {
+        return dnswire_error;
+    }
+    handle->fd      = -1;
+    handle->next_fd = -1;
+    pthread_mutex_init(&handle->lock, 0);
+    pthread_cond_init(&handle->cond, 0);
+
+    return dnswire_ok;
+}
+
+void dnswire_rotator_destroy(struct dnswire_rotator* handle)
+{
+    assert(handle);
+
+    if (handle->opened) {
+        dnswire_rotator_close(handle);
+    }
+    free(handle->path);
+    handle->path = 0;
+    free(handle->file);
+    handle->file = 0;
+    pthread_mutex_destroy(&handle->lock);
+    pthread_cond_destroy(&handle->cond);
+}
+
+/*
+ * Opens the next file whenever the preopened one has been taken.
+ */
+static void* _preopen(void* arg)
+{
+    struct dnswire_rotator* handle = arg;
+
+    pthread_mutex_lock(&handle->lock);
+    while (1) {
+        while (!handle->stop && (handle->next_fd > -1 || handle->next_errno)) {
+            pthread_cond_wait(&handle->cond, &handle->lock);
+        }
+        if (handle->stop) {
+            break;
+        }
+        size_t seq = handle->next_seq;
+        pthread_mutex_unlock(&handle->lock);
+
+        int fd  = _open(handle, &seq);
+        int err = errno;
+
+        pthread_mutex_lock(&handle->lock);
+        if (fd < 0) {
+            handle->next_errno = err ? err : EIO;
+        } else {
+            handle->next_fd  = fd;
+            handle->next_seq = seq;
+        }
+        pthread_cond_broadcast(&handle->cond);
+    }
+    pthread_mutex_unlock(&handle->lock);
+
+    return 0;
+}
+
+/*
+ * Start a file by writing START so that it is complete even if nothing
+ * else is written to it.
+ */
+static enum dnswire_result _start_file(struct dnswire_rotator* handle, int fd, size_t seq)
+{
+    char* file = _name(handle->path, seq);
+
+    if (!file) {
+        close(fd);
+        return dnswire_error;
+    }
+    free(handle->file);
+    handle->file   = file;
+    handle->fd     = fd;
+    handle->seq    = seq;
+    handle->bytes  = 0;
+    handle->frames = 0;
+
+    if (dnswire_writer_init(&handle->writer) != dnswire_ok) {
+        close(fd);
+        handle->fd = -1;
+        return dnswire_error;
+    }
+    while (!dnswire_writer_is_started(handle->writer)) {
+        if (dnswire_writer_write(&handle->writer, fd) == dnswire_error) {
+            return dnswire_error;
+        }
+    }
+    handle->bytes = dnswire_writer_offset(handle->writer);
+    handle->files++;
+
+    return dnswire_ok;
+}
+
+static enum dnswire_result _end_file(struct dnswire_rotator* handle)
+{
+    enum dnswire_result res = dnswire_ok;
+
+    if (handle->fd < 0) {
+        return dnswire_ok;
+    }
+
+    if (dnswire_writer_stop(&handle->writer) != dnswire_ok) {
+        res = dnswire_error;
+    }
+    while (res == dnswire_ok) {
+        enum dnswire_result r = dnswire_writer_write(&handle->writer, handle->fd);
+        if (r == dnswire_endofdata) {
+            break;
+        }
+        if (r == dnswire_error) {
+            res = dnswire_error;
+        }
+    }
+    if (handle->preallocate && ftruncate(handle->fd, (off_t)dnswire_writer_offset(handle->writer))) {
+        res = dnswire_error;
+    }
+    if (close(handle->fd)) {
+        res = dnswire_error;
+    }
+    handle->fd = -1;
+    dnswire_writer_destroy(handle->writer);
+
+    return res;
+}
+
+enum dnswire_result dnswire_rotator_open(struct dnswire_rotator* handle)
+{
+    assert(handle);
+    assert(!handle->opened);
+
+    size_t seq = _first_seq(handle->path);
+    int    fd  = _open(handle, &seq);
+    if (fd < 0) {
+        return dnswire_error;
+    }
+    if (_start_file(handle, fd, seq) != dnswire_ok) {
+        _end_file(handle);
+        return dnswire_error;
+    }
+    handle->rotate_at  = _rotate_at(handle);
+    handle->next_seq   = seq + 1;
+    handle->next_errno = 0;
+    handle->stop       = false;
+    handle->opened     = true;
+
+    if (pthread_create(&handle->thread, 0, _preopen, handle)) {
+        // rotations will open the files themselves
+        __trace("unable to start preopen thread");
+    } else {
+        handle->started = true;
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_rotator_rotate(struct dnswire_rotator* handle)
+{
+    assert(handle);
+
+    if (!handle->opened) {
+        return dnswire_error;
+    }
+
+    enum dnswire_result res = _end_file(handle);
+    int                 fd  = -1;
+    size_t              seq;
+
+    pthread_mutex_lock(&handle->lock);
+    if (handle->started && handle->next_fd < 0 && !handle->next_errno) {
+        handle->stalls++;
+        while (handle->next_fd < 0 && !handle->next_errno) {
+            pthread_cond_wait(&handle->cond, &handle->lock);
+        }
+    }
+    seq                = handle->next_seq++;
+    fd                 = handle->next_fd;
+    handle->next_fd    = -1;
+    handle->next_errno = 0;
+    pthread_cond_broadcast(&handle->cond);
+    pthread_mutex_unlock(&handle->lock);
+
+    if (fd < 0 && (fd = _open(handle, &seq)) < 0) {
+        return dnswire_error;
+    }
+    if (_start_file(handle, fd, seq) != dnswire_ok) {
+        return dnswire_error;
+    }
+    handle->rotate_at = _rotate_at(handle);
+    handle->rotations++;
+
+    return res;
+}
+
+enum dnswire_result dnswire_rotator_check(struct dnswire_rotator* handle)
+{
+    assert(handle);
+
+    if ((handle->max_bytes && handle->bytes >= handle->max_bytes)
+        || (handle->max_frames && handle->frames >= handle->max_frames)
+        || (handle->interval && (uint64_t)time(0) >= handle->rotate_at)) {
+        return dnswire_rotator_rotate(handle);
+    }
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_rotator_write(struct dnswire_rotator* handle, const struct dnstap* dnstap)
+{
+    assert(handle);
+    assert(dnstap);
+
+    if (!handle->opened || handle->fd < 0) {
+        return dnswire_error;
+    }
+
+    dnswire_writer_set_dnstap(handle->writer, dnstap);
+    while (1) {
+        enum dnswire_result res = dnswire_writer_write(&handle->writer, handle->fd);
+        if (res == dnswire_ok) {
+            break;
+        }
+        if (res != dnswire_again) {
+            return dnswire_error;
+        }
+    }
+    handle->bytes = dnswire_writer_offset(handle->writer);
+    handle->frames++;
+
+    return dnswire_rotator_check(handle);
+}
+
+enum dnswire_result dnswire_rotator_close(struct dnswire_rotator* handle)
+{
+    assert(handle);
+
+    if (!handle->opened) {
+        return dnswire_ok;
+    }
+
+    enum dnswire_result res = _end_file(handle);
+
+    if (handle->started) {
+        pthread_mutex_lock(&handle->lock);
+        handle->stop = true;
+        pthread_cond_broadcast(&handle->cond);
+        pthread_mutex_unlock(&handle->lock);
+        pthread_join(handle->thread, 0);
+        handle->started = false;
+    }
+    if (handle->next_fd > -1) {
+        char* name = _name(handle->path, handle->next_seq);
+
+        close(handle->next_fd);
+        handle->next_fd = -1;
+        if (name) {
+            unlink(name);
+            free(name);
+        }
+    }
+    handle->opened = false;
+
+    return res;
+}
@@ -0,0 +1,514 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/spool.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+const char* const dnswire_spool_state_string[] = {
+    "disconnected",
+    "connecting",
+    "connected",
+    "stopping",
+    "done",
+};
+
+#define __state(h, s)                                                                                 \
+    __trace("state %s => %s", dnswire_spool_state_string[(h)->state], dnswire_spool_state_string[s]); \
+    (h)->state = s;
+
+static uint64_t _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline uint32_t _frame_length(const uint8_t* header)
+{
+    return ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) | ((uint32_t)header[2] << 8) | header[3];
+}
+
+/*
+ * Find the end of the last complete frame in the spool and truncate
+ * anything after it.
+ */
+static enum dnswire_result _recover(struct dnswire_spool* handle)
+{
+    struct stat st;
+    off_t       at = 0;
+    uint8_t     header[TINYFRAME_HEADER_SIZE];
+
+    if (fstat(handle->spool_fd, &st) || st.st_size < 0) {
+        return dnswire_error;
+    }
+
+    while ((uint64_t)at + TINYFRAME_HEADER_SIZE <= (uint64_t)st.st_size) {
+        if (pread(handle->spool_fd, header, sizeof(header), at) != sizeof(header)) {
+            return dnswire_error;
+        }
+        uint32_t len = _frame_length(header);
+        if (!len || (uint64_t)at + TINYFRAME_HEADER_SIZE + len > (uint64_t)st.st_size) {
+            break;
+        }
+        at += TINYFRAME_HEADER_SIZE + len;
+    }
+
+    if (at < st.st_size) {
+        __trace("truncating spool from %jd to %jd", (intmax_t)st.st_size, (intmax_t)at);
+        if (ftruncate(handle->spool_fd, at)) {
+            return dnswire_error;
+        }
+    }
+    handle->write_at = at;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_spool_init(struct dnswire_spool* handle, const char* path)
+{
+    assert(handle);
+    assert(path);
+
+    memset(handle, 0, sizeof(struct dnswire_spool));
+
+    handle->state              = dnswire_spool_disconnected;
+    handle->fd                 = -1;
+    handle->spool_fd           = -1;
+    handle->sync_frames        = DNSWIRE_SPOOL_DEFAULT_SYNC_FRAMES;
+    handle->sync_interval      = DNSWIRE_SPOOL_DEFAULT_SYNC_INTERVAL;
+    handle->reconnect_interval = DNSWIRE_SPOOL_DEFAULT_RECONNECT_INTERVAL;
+    handle->last_sync          = _now();
+    handle->last_refill        = handle->last_sync;
+
+    if (dnswire_frame_queue_init(&handle->queue, DNSWIRE_FRAME_QUEUE_DEFAULT_SIZE, dnswire_frame_queue_drop_newest) != dnswire_ok) {
+        return dnswire_error;
+    }
+    if ((handle->spool_fd = open(path, O_RDWR | O_CREAT, 0644)) < 0
+        || _recover(handle) != dnswire_ok) {
+        dnswire_spool_destroy(handle);
+        return dnswire_error;
+    }
+
+    return dnswire_ok;
+}
+
+static void _close(struct dnswire_spool* handle)
+{
+    if (handle->fd > -1) {
+        close(handle->fd);
+        handle->fd = -1;
+        dnswire_writer_destroy(handle->writer);
+    }
+}
+
+void dnswire_spool_destroy(struct dnswire_spool* handle)
+{
+    assert(handle);
+
+    _close(handle);
+    if (handle->spool_fd > -1) {
+        dnswire_spool_sync(handle);
+        close(handle->spool_fd);
+        handle->spool_fd = -1;
+    }
+    dnswire_frame_queue_destroy(&handle->queue);
+}
+
+enum dnswire_result dnswire_spool_set_queue_size(struct dnswire_spool* handle, size_t size)
+{
+    assert(handle);
+
+    if (!size || !dnswire_frame_queue_is_empty(handle->queue)) {
+        return dnswire_error;
+    }
+
+    struct dnswire_frame_queue queue;
+    if (dnswire_frame_queue_init(&queue, size, dnswire_frame_queue_drop_newest) != dnswire_ok) {
+        return dnswire_error;
+    }
+    dnswire_frame_queue_destroy(&handle->queue);
+    handle->queue = queue;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_spool_sync(struct dnswire_spool* handle)
+{
+    assert(handle);
+
+    if (!handle->unsynced) {
+        return dnswire_ok;
+    }
+
+#if HAVE_FDATASYNC
+    if (fdatasync(handle->spool_fd)) {
+#else
+    if (fsync(handle->spool_fd)) {
+#endif
+        return dnswire_error;
+    }
+    __trace("synced %zu frames", handle->unsynced);
+    handle->unsynced  = 0;
+    handle->last_sync = _now();
+    handle->syncs++;
+
+    return dnswire_ok;
+}
+
+static enum dnswire_result _append(struct dnswire_spool* handle, struct dnswire_frame* frame)
+{
+    if (handle->max_size && handle->write_at + (off_t)frame->length > handle->max_size) {
+        handle->dropped++;
+        return dnswire_again;
+    }
+
+    size_t left = frame->length;
+    while (left) {
+        ssize_t nwrote = pwrite(handle->spool_fd, &frame->data[frame->length - left], left, handle->write_at + (frame->length - left));
+        if (nwrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return dnswire_error;
+        }
+        left -= nwrote;
+    }
+
+    handle->write_at += frame->length;
+    handle->spooled++;
+    handle->unsynced++;
+
+    /*
+     * Group commit, many appended frames share one sync.
+     */
+    if (handle->sync_frames && handle->unsynced >= handle->sync_frames) {
+        return dnswire_spool_sync(handle);
+    }
+
+    return dnswire_ok;
+}
+
+static enum dnswire_result _disconnect(struct dnswire_spool* handle)
+{
+    size_t live   = handle->live > handle->queue.written ? handle->live - handle->queue.written : 0;
+    off_t  rewind = 0;
+
+    _close(handle);
+    __state(handle, dnswire_spool_disconnected);
+    handle->next_connect = _now() + handle->reconnect_interval;
+
+    /*
+     * A partially written frame is sent again in full on the next
+     * connection, as it will be a new stream.
+     *
+     * Frames that were queued directly are not in the spool and are
+     * appended to it, the rest were replayed from just before `read_at`
+     * and are still in the spool so replay is rewound to them instead,
+     * keeping their order.
+     */
+    handle->queue.offset = 0;
+    while (!dnswire_frame_queue_is_empty(handle->queue)) {
+        struct dnswire_frame* frame = dnswire_frame_queue_pop(&handle->queue);
+        enum dnswire_result   res   = dnswire_ok;
+
+        if (live) {
+            res = _append(handle, frame);
+            live--;
+        } else {
+            rewind += frame->length;
+        }
+        dnswire_frame_unref(frame);
+        if (res == dnswire_error) {
+            dnswire_frame_queue_clear(&handle->queue);
+            return dnswire_error;
+        }
+    }
+    assert(rewind <= handle->read_at);
+    handle->read_at -= rewind;
+
+    return dnswire_again;
+}
+
+enum dnswire_result dnswire_spool_write_frame(struct dnswire_spool* handle, struct dnswire_frame* frame)
+{
+    assert(handle);
+    assert(frame);
+
+    switch (handle->state) {
+    case dnswire_spool_connecting:
+    case dnswire_spool_connected:
+        if (!handle->stop && !handle->write_at && !dnswire_frame_queue_is_full(handle->queue)) {
+            dnswire_frame_queue_push(&handle->queue, frame);
+            handle->live = handle->queue.queued;
+            return dnswire_ok;
+        }
+        break;
+
+    case dnswire_spool_disconnected:
+        break;
+
+    default:
+        return dnswire_error;
+    }
+
+    return _append(handle, frame);
+}
+
+enum dnswire_result dnswire_spool_write_dnstap(struct dnswire_spool* handle, const struct dnstap* dnstap)
+{
+    assert(handle);
+    assert(dnstap);
+
+    size_t len = dnstap_encode_protobuf_size(dnstap);
+    if (!len) {
+        return dnswire_error;
+    }
+
+    struct dnswire_frame* frame = dnswire_frame_new(len);
+    if (!frame) {
+        return dnswire_error;
+    }
+    dnstap_encode_protobuf(dnstap, dnswire_frame_payload(frame));
+
+    enum dnswire_result res = dnswire_spool_write_frame(handle, frame);
+    dnswire_frame_unref(frame);
+
+    return res;
+}
+
+/*
+ * Truncate the spool once everything has been replayed and sent, until then
+ * the replayed frames still in the queue are kept so they can be replayed
+ * again if the connection breaks.
+ */
+static enum dnswire_result _truncate(struct dnswire_spool* handle)
+{
+    if (!handle->read_at || dnswire_spool_pending(*handle) || !dnswire_frame_queue_is_empty(handle->queue)) {
+        return dnswire_ok;
+    }
+
+    __trace("spool replayed, truncating");
+    if (ftruncate(handle->spool_fd, 0)) {
+        return dnswire_error;
+    }
+    handle->read_at  = 0;
+    handle->write_at = 0;
+
+    return dnswire_ok;
+}
+
+/*
+ * Move frames from the spool to the queue, as many as fits in the queue
+ * and the replay rate allows, returns dnswire_again if limited by the rate.
+ *
+ * Tokens are capped at the replay rate, or at the size of the next frame
+ * if it is larger, so that any frame can eventually be replayed.
+ */
+static enum dnswire_result _replay(struct dnswire_spool* handle)
+{
+    while (dnswire_spool_pending(*handle) && !dnswire_frame_queue_is_full(handle->queue)) {
+        uint8_t header[TINYFRAME_HEADER_SIZE];
+
+        if (pread(handle->spool_fd, header, sizeof(header), handle->read_at) != sizeof(header)) {
+            return dnswire_error;
+        }
+        size_t len  = _frame_length(header);
+        size_t need = TINYFRAME_HEADER_SIZE + len;
+
+        if (handle->replay_rate) {
+            uint64_t now = _now();
+            if (now > handle->last_refill) {
+                size_t burst = need > handle->replay_rate ? need : handle->replay_rate;
+
+                handle->tokens += handle->replay_rate * (now - handle->last_refill) / 1000;
+                if (handle->tokens > burst) {
+                    handle->tokens = burst;
+                }
+                handle->last_refill = now;
+            }
+            if (handle->tokens < need) {
+                return dnswire_again;
+            }
+        }
+
+        struct dnswire_frame* frame = dnswire_frame_new(len);
+        if (!frame) {
+            return dnswire_error;
+        }
+        if (pread(handle->spool_fd, dnswire_frame_payload(frame), len, handle->read_at + TINYFRAME_HEADER_SIZE) != (ssize_t)len) {
+            dnswire_frame_unref(frame);
+            return dnswire_error;
+        }
+        dnswire_frame_queue_push(&handle->queue, frame);
+        dnswire_frame_unref(frame);
+
+        handle->read_at += need;
+        handle->replayed++;
+        if (handle->replay_rate) {
+            handle->tokens -= need;
+        }
+    }
+
+    return _truncate(handle);
+}
+
+enum dnswire_result dnswire_spool_run(struct dnswire_spool* handle)
+{
+    assert(handle);
+
+    __trace("state %s", dnswire_spool_state_string[handle->state]);
+
+    if (handle->unsynced && handle->sync_interval && _now() - handle->last_sync >= handle->sync_interval) {
+        if (dnswire_spool_sync(handle) != dnswire_ok) {
+            return dnswire_error;
+        }
+    }
+
+    switch (handle->state) {
+    case dnswire_spool_disconnected:
+        if (handle->stop) {
+            if (dnswire_spool_sync(handle) != dnswire_ok) {
+                return dnswire_error;
+            }
+            __state(handle, dnswire_spool_done);
+            return dnswire_endofdata;
+        }
+        if (!handle->connect || _now() < handle->next_connect) {
+            return dnswire_again;
+        }
+        if ((handle->fd = handle->connect(handle->ctx)) < 0) {
+            handle->fd           = -1;
+            handle->next_connect = _now() + handle->reconnect_interval;
+            return dnswire_again;
+        }
+        if (dnswire_writer_init(&handle->writer) != dnswire_ok) {
+            close(handle->fd);
+            handle->fd = -1;
+            return dnswire_error;
+        }
+        if (dnswire_writer_set_bidirectional(&handle->writer, handle->bidirectional) != dnswire_ok) {
+            _close(handle);
+            return dnswire_error;
+        }
+        handle->connects++;
+        __state(handle, dnswire_spool_connecting);
+        // fallthrough
+
+    case dnswire_spool_connecting:
+        if (dnswire_writer_write(&handle->writer, handle->fd) == dnswire_error) {
+            return _disconnect(handle);
+        }
+        if (!dnswire_writer_is_started(handle->writer)) {
+            return dnswire_again;
+        }
+        __state(handle, dnswire_spool_connected);
+        // fallthrough
+
+    case dnswire_spool_connected:
+        while (1) {
+            switch (dnswire_frame_queue_write(&handle->queue, handle->fd)) {
+            case dnswire_ok:
+                break;
+
+            case dnswire_again:
+                return dnswire_again;
+
+            default:
+                return _disconnect(handle);
+            }
+
+            if (!dnswire_spool_pending(*handle)) {
+                if (!dnswire_frame_queue_is_empty(handle->queue)) {
+                    continue;
+                }
+                if (_truncate(handle) != dnswire_ok) {
+                    return dnswire_error;
+                }
+                break;
+            }
+            switch (_replay(handle)) {
+            case dnswire_ok:
+                continue;
+
+            case dnswire_again:
+                if (dnswire_frame_queue_is_empty(handle->queue)) {
+                    return dnswire_again;
+                }
+                continue;
+
+            default:
+                return dnswire_error;
+            }
+        }
+        if (!handle->stop) {
+            return dnswire_ok;
+        }
+        if (dnswire_writer_stop(&handle->writer) != dnswire_ok) {
+            return _disconnect(handle);
+        }
+        __state(handle, dnswire_spool_stopping);
+        // fallthrough
+
+    case dnswire_spool_stopping:
+        switch (dnswire_writer_write(&handle->writer, handle->fd)) {
+        case dnswire_endofdata:
+            _close(handle);
+            if (dnswire_spool_sync(handle) != dnswire_ok) {
+                return dnswire_error;
+            }
+            __state(handle, dnswire_spool_done);
+            return dnswire_endofdata;
+
+        case dnswire_error:
+            _disconnect(handle);
+            __state(handle, dnswire_spool_done);
+            return dnswire_endofdata;
+
+        default:
+            break;
+        }
+        return dnswire_again;
+
+    case dnswire_spool_done:
+        return dnswire_endofdata;
+    }
+
+    return dnswire_error;
+}
+
+enum dnswire_result dnswire_spool_stop(struct dnswire_spool* handle)
+{
+    assert(handle);
+
+    handle->stop = true;
+
+    return dnswire_ok;
+}
@@ -0,0 +1,29 @@
+#include <dnswire/reader.h>
+
+#include <assert.h>
+#include <stdio.h>
+
+static size_t count_dnstap(const char* file)
+{
+    FILE* fp = fopen(file, "r");
+    assert(fp);
+
+    struct dnswire_reader r;
+    assert(dnswire_reader_init(&r) == dnswire_ok);
+
+    size_t n = 0;
+    while (1) {
+        enum dnswire_result res = dnswire_reader_fread(&r, fp);
+        if (res == dnswire_have_dnstap) {
+            n++;
+        } else if (res == dnswire_endofdata) {
+            break;
+        } else {
+            assert(res == dnswire_again || res == dnswire_need_more);
+        }
+    }
+
+    dnswire_reader_destroy(r);
+    fclose(fp);
+    return n;
+}
@@ -5,3 +5,25 @@
 ./test_decoder
 ./test_reader
 ./test_writer
+./test_relay "$srcdir/test.dnstap"
+./test_publisher "$srcdir/test.dnstap"
+./test_spool "$srcdir/test.dnstap"
+./test_writer_group
+./test_balancer
+./test_collector
+./test_pool
+./test_pipeline
+./test_partitioner
+./test_index
+./test_rotator
+./test_archiver
+./test_compression
+./test_blockfile
+./test_columnar
+./test_batch
+./test_query
+./test_dns
+./test_join
+./test_topk
+./test_hll
+./test_rollup
@@ -0,0 +1,93 @@
+#include <dnswire/archiver.h>
+#include <dnswire/reader.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+/*
+ * Read the archived file and return the number of messages, the file must
+ * be complete with START and STOP.
+ */
+static size_t messages(const char* path)
+{
+    struct dnswire_reader r;
+    enum dnswire_result   res;
+    size_t                n = 0;
+    int                   fd;
+
+    assert((fd = open(path, O_RDONLY)) > -1);
+    assert(dnswire_reader_init(&r) == dnswire_ok);
+    while ((res = dnswire_reader_read(&r, fd)) != dnswire_endofdata) {
+        if (res == dnswire_have_dnstap) {
+            n++;
+            continue;
+        }
+        assert(res == dnswire_again || res == dnswire_need_more);
+    }
+    dnswire_reader_destroy(r);
+    close(fd);
+
+    return n;
+}
+
+static off_t archive(const char* path, bool direct, size_t num)
+{
+    struct dnswire_archiver a;
+    struct dnstap           d = DNSTAP_INITIALIZER;
+    size_t                  n;
+
+    create_dnstap(&d, "test_archiver");
+
+    assert(dnswire_archiver_init(&a) == dnswire_ok);
+    dnswire_archiver_set_buf_size(a, 3 * 1024);
+    assert(dnswire_archiver_open(&a, path) == dnswire_error);
+    dnswire_archiver_set_buf_size(a, 2 * DNSWIRE_ARCHIVER_ALIGNMENT);
+    dnswire_archiver_set_direct(a, direct);
+    assert(dnswire_archiver_open(&a, path) == dnswire_ok);
+    if (!direct) {
+        assert(!dnswire_archiver_is_direct(a));
+    }
+    printf("%s: direct %d\n", path, dnswire_archiver_is_direct(a));
+
+    for (n = 0; n < num; n++) {
+        assert(dnswire_archiver_write(&a, &d) == dnswire_ok);
+    }
+    assert(dnswire_archiver_close(&a) == dnswire_ok);
+    printf("%s: blocks %zu stalls %zu\n", path, a.blocks, a.stalls);
+    assert(a.blocks > 1);
+    dnswire_archiver_destroy(&a);
+
+    struct stat st;
+    assert(!stat(path, &st));
+    assert(messages(path) == num);
+    unlink(path);
+
+    return st.st_size;
+}
+
+int main(void)
+{
+    /*
+     * O_DIRECT may not be supported here in which case it falls back to
+     * buffered, either way the padding must have been truncated.
+     */
+    assert(archive("test_archiver.dnstap", true, 1000) == archive("test_archiver_buffered.dnstap", false, 1000));
+
+    /*
+     * A file with nothing written to it is still complete.
+     */
+    struct dnswire_archiver a;
+
+    assert(dnswire_archiver_init(&a) == dnswire_ok);
+    assert(dnswire_archiver_open(&a, "test_archiver.dnstap") == dnswire_ok);
+    dnswire_archiver_destroy(&a);
+    assert(messages("test_archiver.dnstap") == 0);
+    unlink("test_archiver.dnstap");
+
+    return 0;
+}
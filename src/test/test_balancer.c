@@ -0,0 +1,150 @@
+#include <dnswire/balancer.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define KEYS 300
+
+static struct dnswire_balancer b;
+
+static size_t route(size_t n)
+{
+    uint8_t key[4] = { 10, 0, n >> 8, n };
+
+    struct dnswire_balancer_endpoint* e = dnswire_balancer_route(&b, key, sizeof(key));
+    assert(e);
+    return e - b.endpoints;
+}
+
+static enum dnswire_result write_key(struct dnswire_frame* f, size_t n)
+{
+    uint8_t key[4] = { 10, 0, n >> 8, n };
+
+    return dnswire_balancer_write_frame(&b, f, key, sizeof(key));
+}
+
+static size_t key_for(size_t endpoint, size_t* map)
+{
+    size_t n;
+    for (n = 0; n < KEYS; n++) {
+        if (map[n] == endpoint) {
+            return n;
+        }
+    }
+    assert(0);
+    return 0;
+}
+
+int main(void)
+{
+    struct dnswire_frame* f;
+    int                   fds[3][2], fd[2];
+    size_t                map[KEYS], per[3] = { 0, 0, 0 }, i, n;
+    char                  buf[4096];
+
+    signal(SIGPIPE, SIG_IGN);
+    assert((f = dnswire_frame_new(8)));
+
+    assert(dnswire_balancer_init(&b) == dnswire_ok);
+    assert(dnswire_balancer_write_frame(&b, f, 0, 0) == dnswire_error);
+    assert(b.unrouted == 1);
+    dnswire_balancer_set_stall_fill(b, 50);
+    dnswire_balancer_set_stall_timeout(b, 0);
+
+    for (i = 0; i < 3; i++) {
+        assert(pipe(fds[i]) == 0);
+        fcntl(fds[i][1], F_SETFL, fcntl(fds[i][1], F_GETFL) | O_NONBLOCK);
+        assert(dnswire_balancer_add_endpoint(&b, fds[i][1], false, 8, dnswire_frame_queue_drop_newest) == dnswire_ok);
+        assert(dnswire_balancer_write(&b, i) == dnswire_ok);
+    }
+    assert(dnswire_balancer_endpoints(b) == 3);
+    assert(b.ring_size == 3 * DNSWIRE_BALANCER_DEFAULT_VNODES);
+
+    for (n = 0; n < KEYS; n++) {
+        map[n] = route(n);
+        per[map[n]]++;
+    }
+    assert(per[0] && per[1] && per[2]);
+
+    // stall by queue fill, only the stalled endpoint's keys move
+    for (i = 0; i < 4; i++) {
+        assert(write_key(f, key_for(1, map)) == dnswire_ok);
+    }
+    assert(b.routed == 4);
+    assert(write_key(f, key_for(1, map)) == dnswire_ok);
+    assert(b.rerouted == 1);
+    assert(dnswire_balancer_endpoint(b, 1)->health == dnswire_balancer_endpoint_stalled);
+    for (n = 0; n < KEYS; n++) {
+        if (map[n] == 1) {
+            assert(route(n) != 1);
+        } else {
+            assert(route(n) == map[n]);
+        }
+    }
+
+    // recovers once drained, and all keys move back
+    assert(dnswire_balancer_write(&b, 1) == dnswire_ok);
+    assert(dnswire_balancer_endpoint(b, 1)->health == dnswire_balancer_endpoint_healthy);
+    for (n = 0; n < KEYS; n++) {
+        assert(route(n) == map[n]);
+    }
+
+    // stall by no progress
+    for (i = 0; i < 3; i++) {
+        assert(dnswire_balancer_write(&b, i) == dnswire_ok);
+    }
+    dnswire_balancer_set_stall_timeout(b, 1);
+    assert(write_key(f, key_for(2, map)) == dnswire_ok);
+    usleep(5000);
+    dnswire_balancer_check(&b);
+    assert(dnswire_balancer_endpoint(b, 0)->health == dnswire_balancer_endpoint_healthy);
+    assert(dnswire_balancer_endpoint(b, 2)->health == dnswire_balancer_endpoint_stalled);
+    assert(route(key_for(2, map)) != 2);
+    assert(dnswire_balancer_write(&b, 2) == dnswire_ok);
+    assert(dnswire_balancer_endpoint(b, 2)->health == dnswire_balancer_endpoint_healthy);
+
+    // down when the connection fails, back after reconnecting
+    close(fds[0][0]);
+    assert(write_key(f, key_for(0, map)) == dnswire_ok);
+    assert(dnswire_balancer_write(&b, 0) == dnswire_error);
+    assert(dnswire_balancer_endpoint(b, 0)->health == dnswire_balancer_endpoint_down);
+    assert(route(key_for(0, map)) != 0);
+    dnswire_balancer_check(&b);
+    assert(dnswire_balancer_endpoint(b, 0)->health == dnswire_balancer_endpoint_down);
+    close(fds[0][1]);
+    assert(pipe(fd) == 0);
+    assert(dnswire_balancer_reconnect(&b, 0, fd[1]) == dnswire_ok);
+    assert(dnswire_balancer_write(&b, 0) == dnswire_ok);
+    for (n = 0; n < KEYS; n++) {
+        assert(route(n) == map[n]);
+    }
+
+    // round-robin without a key
+    for (i = 0; i < 3; i++) {
+        assert(dnswire_balancer_write_frame(&b, f, 0, 0) == dnswire_ok);
+    }
+    for (i = 0; i < 3; i++) {
+        assert(dnswire_frame_queue_length(dnswire_balancer_endpoint(b, i)->destination.queue) == 1);
+    }
+
+    assert(dnswire_balancer_stop(&b) == dnswire_ok);
+    for (i = 0; i < 3; i++) {
+        assert(dnswire_balancer_write(&b, i) == dnswire_endofdata);
+    }
+    assert(write_key(f, 0) == dnswire_error);
+    dnswire_balancer_destroy(&b);
+    dnswire_frame_unref(f);
+
+    assert(read(fds[1][0], buf, sizeof(buf)) > 0);
+    assert(read(fd[0], buf, sizeof(buf)) > 0);
+    for (i = 1; i < 3; i++) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+    close(fd[0]);
+    close(fd[1]);
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+#include <dnswire/batch.h>
+#include <dnswire/writer.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+#define FILE_NAME "test_batch.dnstap"
+#define MESSAGES 1000
+#define CAPACITY 300
+
+static void set_message(struct dnstap* d, size_t n, char* id, size_t len)
+{
+    snprintf(id, len, "%zu", n);
+    dnstap_set_identity_string(*d, id);
+    dnstap_message_set_query_port(*d, 1000 + n);
+    dnstap_message_set_query_time_sec(*d, 1600000000 + n);
+    d->message.has_response_port = n % 4 ? true : false;
+}
+
+static void create_file(void)
+{
+    struct dnswire_writer w;
+    struct dnstap         d = DNSTAP_INITIALIZER;
+    char                  id[32];
+    size_t                n = 0;
+    int                   fd;
+
+    assert((fd = open(FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_writer_init(&w) == dnswire_ok);
+    create_dnstap(&d, "");
+    set_message(&d, n, id, sizeof(id));
+    dnswire_writer_set_dnstap(w, &d);
+
+    while (1) {
+        enum dnswire_result res = dnswire_writer_write(&w, fd);
+        if (res == dnswire_ok) {
+            if (++n == MESSAGES) {
+                assert(dnswire_writer_stop(&w) == dnswire_ok);
+                continue;
+            }
+            set_message(&d, n, id, sizeof(id));
+            dnswire_writer_set_dnstap(w, &d);
+        } else if (res == dnswire_endofdata) {
+            break;
+        } else {
+            assert(res == dnswire_again);
+        }
+    }
+
+    dnswire_writer_destroy(w);
+    close(fd);
+}
+
+static struct ArrowArray* child(struct ArrowArray* array, struct ArrowSchema* schema, enum dnswire_column column, const char* format)
+{
+    assert(!strcmp(schema->children[column]->name, dnswire_column_string[column]));
+    assert(!strcmp(schema->children[column]->format, format));
+    assert(array->children[column]->length == array->length);
+    return array->children[column];
+}
+
+static void check(struct ArrowArray* array, struct ArrowSchema* schema, size_t first)
+{
+    struct ArrowArray* a;
+    const uint64_t*    values;
+    const uint32_t*    offsets;
+    const uint8_t*     valid;
+    const char*        data;
+    char               id[32];
+    int64_t            i, nulls = 0;
+
+    assert(!strcmp(schema->format, "+s"));
+    assert(schema->n_children == DNSWIRE_COLUMNS);
+    assert(array->n_children == DNSWIRE_COLUMNS);
+    assert(array->null_count == 0);
+
+    a      = child(array, schema, dnswire_column_query_port, "L");
+    values = a->buffers[1];
+    assert(a->n_buffers == 2 && a->null_count == 0);
+    for (i = 0; i < a->length; i++) {
+        assert(values[i] == 1000 + first + i);
+    }
+
+    a      = child(array, schema, dnswire_column_query_time_sec, "L");
+    values = a->buffers[1];
+    for (i = 0; i < a->length; i++) {
+        assert(values[i] == 1600000000 + first + i);
+    }
+
+    a      = child(array, schema, dnswire_column_response_port, "L");
+    valid  = a->buffers[0];
+    values = a->buffers[1];
+    for (i = 0; i < a->length; i++) {
+        bool present = (first + i) % 4;
+        assert(((valid[i / 8] >> (i % 8)) & 1) == present);
+        assert(values[i] == (present ? 53 : 0));
+        nulls += !present;
+    }
+    assert(a->null_count == nulls);
+
+    a       = child(array, schema, dnswire_column_identity, "z");
+    offsets = a->buffers[1];
+    data    = a->buffers[2];
+    assert(a->n_buffers == 3 && a->null_count == 0);
+    for (i = 0; i < a->length; i++) {
+        snprintf(id, sizeof(id), "%zu", first + i);
+        assert(offsets[i + 1] - offsets[i] == strlen(id));
+        assert(!memcmp(&data[offsets[i]], id, strlen(id)));
+    }
+
+    a = child(array, schema, dnswire_column_query_zone, "z");
+    assert(a->null_count == a->length);
+}
+
+int main(void)
+{
+    struct dnswire_batch  b;
+    struct dnswire_reader r;
+    struct ArrowArray     array;
+    struct ArrowSchema    schema;
+    enum dnswire_result   res;
+    size_t                n = 0;
+    int                   fd;
+
+    create_file();
+
+    assert(dnswire_batch_init(&b, CAPACITY) == dnswire_ok);
+    assert(dnswire_reader_init(&r) == dnswire_ok);
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+
+    /*
+     * Read full batches and export them, the last batch has what is left
+     * when the stream ends.
+     */
+    do {
+        // again is returned when the reader made progress without a message
+        do {
+            res = dnswire_batch_read(&b, &r, fd);
+        } while (res == dnswire_again);
+        if (res == dnswire_ok) {
+            assert(dnswire_batch_is_full(b));
+        } else {
+            assert(res == dnswire_endofdata);
+            assert(dnswire_batch_rows(b) == MESSAGES % CAPACITY);
+        }
+        assert(dnswire_batch_column(b, dnswire_column_query_port)->rows == dnswire_batch_rows(b));
+
+        size_t rows = dnswire_batch_rows(b);
+        assert(dnswire_batch_export(&b, &array, &schema) == dnswire_ok);
+        assert(dnswire_batch_rows(b) == 0);
+        assert(array.length == (int64_t)rows);
+        check(&array, &schema, n);
+        n += rows;
+
+        array.release(&array);
+        assert(!array.release);
+        schema.release(&schema);
+        assert(!schema.release);
+    } while (res == dnswire_ok);
+    assert(n == MESSAGES);
+
+    dnswire_reader_destroy(r);
+    close(fd);
+
+    /*
+     * A consumer can move a child out and release the parent.
+     */
+    struct dnstap d = DNSTAP_INITIALIZER;
+    struct ArrowArray moved;
+    char              id[32];
+
+    create_dnstap(&d, "");
+    for (n = 0; n < CAPACITY; n++) {
+        set_message(&d, n, id, sizeof(id));
+        assert(dnswire_batch_add(&b, &d) == dnswire_ok);
+    }
+    assert(dnswire_batch_add(&b, &d) == dnswire_error);
+    assert(dnswire_batch_export(&b, &array, 0) == dnswire_ok);
+    moved = *array.children[dnswire_column_query_port];
+    array.children[dnswire_column_query_port]->release = 0;
+    array.release(&array);
+    assert(moved.length == CAPACITY);
+    assert(((const uint64_t*)moved.buffers[1])[CAPACITY - 1] == 1000 + CAPACITY - 1);
+    moved.release(&moved);
+
+    // the batch is reusable after an export
+    assert(dnswire_batch_add(&b, &d) == dnswire_ok);
+
+    // bytes beyond what Arrow offsets can hold fail without adding a row
+    dnstap_message_set_response_message(d, dns_wire_format_placeholder, (size_t)INT32_MAX);
+    assert(dnswire_batch_add(&b, &d) == dnswire_error);
+    assert(dnswire_batch_rows(b) == 1);
+    for (n = 0; n < DNSWIRE_COLUMNS; n++) {
+        assert(dnswire_batch_column(b, n)->rows == 1);
+    }
+    assert(dnswire_batch_column(b, dnswire_column_identity)->data_len == strlen(id));
+    dnstap_message_set_response_message(d, dns_wire_format_placeholder, sizeof(dns_wire_format_placeholder) - 1);
+    assert(dnswire_batch_add(&b, &d) == dnswire_ok);
+    assert(dnswire_batch_clear(&b) == dnswire_ok);
+    assert(dnswire_batch_rows(b) == 0);
+
+    /*
+     * Single columns can be exported as well.
+     */
+    assert(dnswire_batch_add(&b, &d) == dnswire_ok);
+    assert(dnswire_column_data_export(dnswire_batch_column(b, dnswire_column_version), dnswire_column_version, &array, &schema) == dnswire_ok);
+    assert(!strcmp(schema.format, "z") && !strcmp(schema.name, "version"));
+    assert(array.length == 1 && array.null_count == 0);
+    assert(((const uint32_t*)array.buffers[1])[1] == strlen(DNSWIRE_VERSION_STRING));
+    array.release(&array);
+    schema.release(&schema);
+
+    dnswire_batch_destroy(&b);
+    unlink(FILE_NAME);
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include <dnswire/blockfile.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+#define FILE_NAME "test_blockfile.dnswblk"
+#define MESSAGES 5000
+
+// mostly increasing with some messages a bit out of order
+static uint64_t msg_time(size_t n)
+{
+    return 1000 + n / 10 - (n % 7 ? 0 : 5);
+}
+
+static size_t msg_id(const struct dnstap* d)
+{
+    char id[32];
+
+    assert(dnstap_identity_length(*d) < sizeof(id));
+    memcpy(id, dnstap_identity(*d), dnstap_identity_length(*d));
+    id[dnstap_identity_length(*d)] = 0;
+    return strtoul(id, 0, 10);
+}
+
+static size_t create_file(enum dnswire_compression compression)
+{
+    struct dnswire_blockfile_writer w;
+    struct dnstap                   d = DNSTAP_INITIALIZER;
+    char                            id[32];
+    size_t                          n, blocks;
+    int                             fd;
+
+    assert((fd = open(FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_blockfile_writer_init(&w, compression) == dnswire_ok);
+    dnswire_blockfile_writer_set_block_size(w, 16 * 1024);
+    assert(dnswire_blockfile_writer_open(&w, fd) == dnswire_ok);
+
+    create_dnstap(&d, "");
+    for (n = 1; n <= MESSAGES; n++) {
+        snprintf(id, sizeof(id), "%zu", n);
+        dnstap_set_identity_string(d, id);
+        dnstap_message_set_query_time_sec(d, msg_time(n));
+        dnstap_message_set_response_time_sec(d, msg_time(n));
+        assert(dnswire_blockfile_writer_write(&w, &d) == dnswire_ok);
+    }
+    assert(dnswire_blockfile_writer_close(&w) == dnswire_ok);
+    blocks = dnswire_blockfile_writer_blocks(w);
+    dnswire_blockfile_writer_destroy(&w);
+    close(fd);
+
+    return blocks;
+}
+
+struct counts {
+    pthread_mutex_t lock;
+    size_t*         per_block;
+    size_t          total;
+};
+
+static void count(size_t block, const struct dnstap* d, void* ctx)
+{
+    struct counts* c = ctx;
+
+    assert(msg_id(d) > 0 && msg_id(d) <= MESSAGES);
+    pthread_mutex_lock(&c->lock);
+    c->per_block[block]++;
+    c->total++;
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void test(enum dnswire_compression compression)
+{
+    struct dnswire_blockfile_reader r;
+    enum dnswire_result             res;
+    size_t                          blocks, n, i;
+    int                             fd;
+
+    blocks = create_file(compression);
+    printf("%s: %zu blocks\n", dnswire_compression_string[compression], blocks);
+    assert(blocks > 1);
+
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_blockfile_reader_init(&r) == dnswire_ok);
+    assert(dnswire_blockfile_reader_open(&r, fd) == dnswire_ok);
+    assert(dnswire_blockfile_reader_compression(r) == compression);
+    assert(dnswire_blockfile_reader_blocks(r) == blocks);
+
+    /*
+     * Read all in order.
+     */
+    n = 0;
+    while ((res = dnswire_blockfile_reader_next(&r)) == dnswire_have_dnstap) {
+        assert(msg_id(dnswire_blockfile_reader_dnstap(r)) == ++n);
+    }
+    assert(res == dnswire_endofdata);
+    assert(n == MESSAGES);
+
+    /*
+     * Seek to a time, the first message read must be at or before it and
+     * no message at or after it may have been skipped.
+     */
+    uint64_t t = msg_time(MESSAGES / 2);
+    assert(dnswire_blockfile_reader_seek_time(&r, t) == dnswire_ok);
+    assert(r.start > 0);
+    assert(dnswire_blockfile_reader_next(&r) == dnswire_have_dnstap);
+    size_t first = msg_id(dnswire_blockfile_reader_dnstap(r));
+    for (n = 1; n < first; n++) {
+        assert(msg_time(n) < t);
+    }
+    assert(dnswire_blockfile_reader_seek_time(&r, msg_time(MESSAGES) + 1) == dnswire_endofdata);
+    assert(dnswire_blockfile_reader_next(&r) == dnswire_endofdata);
+
+    /*
+     * Process all blocks in parallel.
+     */
+    struct counts c = { .total = 0 };
+    pthread_mutex_init(&c.lock, 0);
+    assert((c.per_block = calloc(blocks, sizeof(size_t))));
+    dnswire_blockfile_reader_set_callback(r, count, &c);
+    assert(dnswire_blockfile_reader_seek(&r, 0) == dnswire_ok);
+    assert(dnswire_blockfile_reader_run(&r, 4) == dnswire_ok);
+    assert(c.total == MESSAGES);
+    for (i = 0; i < blocks; i++) {
+        assert(c.per_block[i] == dnswire_blockfile_reader_block(r, i)->frames);
+    }
+
+    // from a block onward only
+    memset(c.per_block, 0, blocks * sizeof(size_t));
+    c.total = 0;
+    assert(dnswire_blockfile_reader_seek(&r, blocks - 1) == dnswire_ok);
+    assert(dnswire_blockfile_reader_run(&r, 4) == dnswire_ok);
+    assert(c.total == dnswire_blockfile_reader_block(r, blocks - 1)->frames);
+    assert(dnswire_blockfile_reader_seek(&r, blocks + 1) == dnswire_error);
+
+    free(c.per_block);
+    pthread_mutex_destroy(&c.lock);
+    dnswire_blockfile_reader_destroy(&r);
+    close(fd);
+}
+
+int main(void)
+{
+    struct dnswire_blockfile_reader r;
+    enum dnswire_compression        compression;
+    int                             fd;
+
+    for (compression = dnswire_compression_none; compression <= dnswire_compression_lz4; compression++) {
+        if (!dnswire_compression_is_available(compression)) {
+            printf("%s: not available\n", dnswire_compression_string[compression]);
+            continue;
+        }
+        test(compression);
+    }
+
+    /*
+     * A truncated file has no trailer.
+     */
+    create_file(dnswire_compression_none);
+    assert(truncate(FILE_NAME, 1000) == 0);
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_blockfile_reader_init(&r) == dnswire_ok);
+    assert(dnswire_blockfile_reader_open(&r, fd) == dnswire_error);
+    dnswire_blockfile_reader_destroy(&r);
+    close(fd);
+    unlink(FILE_NAME);
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <dnswire/collector.h>
+#include <dnswire/writer.h>
+
+#include <assert.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+static size_t received[2];
+
+static void callback(size_t shard, const struct dnstap* d, void* ctx)
+{
+    assert(shard < 2);
+    assert(ctx == received);
+    assert(dnstap_has_identity(*d));
+
+    // only called from the shard's own thread
+    received[shard]++;
+}
+
+static void send_dnstaps(struct dnswire_collector* c, bool bidirectional, size_t num)
+{
+    struct dnswire_writer w;
+    struct dnstap         d = DNSTAP_INITIALIZER;
+    int                   fd;
+
+    create_dnstap(&d, "test_collector");
+
+    assert((fd = socket(c->addr.ss_family, SOCK_STREAM, 0)) > -1);
+    assert(!connect(fd, (struct sockaddr*)&c->addr, c->addrlen));
+    assert(dnswire_writer_init(&w) == dnswire_ok);
+    assert(dnswire_writer_set_bidirectional(&w, bidirectional) == dnswire_ok);
+    dnswire_writer_set_dnstap(w, &d);
+
+    while (1) {
+        enum dnswire_result res = dnswire_writer_write(&w, fd);
+        if (res == dnswire_ok) {
+            if (!--num) {
+                assert(dnswire_writer_stop(&w) == dnswire_ok);
+            }
+        } else if (res == dnswire_endofdata) {
+            break;
+        } else {
+            assert(res == dnswire_again);
+        }
+    }
+
+    dnswire_writer_destroy(w);
+    close(fd);
+}
+
+static void totals(struct dnswire_collector* c, struct dnswire_collector_stats* t)
+{
+    struct dnswire_collector_stats s;
+    size_t                         i;
+
+    memset(t, 0, sizeof(*t));
+    for (i = 0; i < dnswire_collector_shards(*c); i++) {
+        dnswire_collector_stats(c, i, &s);
+        t->accepted += s.accepted;
+        t->active += s.active;
+        t->closed += s.closed;
+        t->errors += s.errors;
+        t->dnstaps += s.dnstaps;
+    }
+}
+
+int main(void)
+{
+    struct dnswire_collector       c;
+    struct dnswire_collector_stats t, s;
+    struct sockaddr_in             addr;
+    size_t                         i, wait;
+    int                            fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert(dnswire_collector_init(&c, (struct sockaddr*)&addr, sizeof(addr), 2) == dnswire_ok);
+    assert(dnswire_collector_shards(c) == 2);
+    dnswire_collector_allow_bidirectional(c, true);
+    dnswire_collector_set_callback(c, callback, received);
+    assert(dnswire_collector_run(&c, 0) == dnswire_error);
+    assert(dnswire_collector_listen(&c) == dnswire_ok);
+    assert(((struct sockaddr_in*)&c.addr)->sin_port);
+    assert(dnswire_collector_start(&c) == dnswire_ok);
+
+    for (i = 0; i < 5; i++) {
+        send_dnstaps(&c, i % 2, 3);
+    }
+    // closed without stopping the stream
+    assert((fd = socket(AF_INET, SOCK_STREAM, 0)) > -1);
+    assert(!connect(fd, (struct sockaddr*)&c.addr, c.addrlen));
+    close(fd);
+
+    for (wait = 0; wait < 500; wait++) {
+        totals(&c, &t);
+        if (t.closed + t.errors == 6) {
+            break;
+        }
+        usleep(10000);
+    }
+    assert(dnswire_collector_stop(&c) == dnswire_ok);
+    assert(dnswire_collector_join(&c) == dnswire_ok);
+
+    totals(&c, &t);
+    assert(t.accepted == 6);
+    assert(t.active == 0);
+    assert(t.closed == 5);
+    assert(t.errors == 1);
+    assert(t.dnstaps == 15);
+    for (i = 0; i < 2; i++) {
+        dnswire_collector_stats(&c, i, &s);
+        assert(s.dnstaps == received[i]);
+    }
+
+    dnswire_collector_destroy(&c);
+
+    return 0;
+}
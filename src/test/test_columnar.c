@@ -0,0 +1,184 @@
+#include <dnswire/columnar.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+#define FILE_NAME "test_columnar.dnswcol"
+#define MESSAGES 10000
+#define GROUP_ROWS 4096
+
+static void create_file(enum dnswire_compression compression)
+{
+    struct dnswire_columnar_writer w;
+    struct dnstap                  d = DNSTAP_INITIALIZER;
+    char                           id[32];
+    uint8_t                        dns[12 + sizeof(dns_wire_format_placeholder)];
+    size_t                         n;
+    int                            fd;
+
+    assert((fd = open(FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_columnar_writer_init(&w, compression) == dnswire_ok);
+    dnswire_columnar_writer_set_group_rows(w, GROUP_ROWS);
+    assert(dnswire_columnar_writer_open(&w, fd) == dnswire_ok);
+
+    create_dnstap(&d, "");
+    memset(dns, 0, sizeof(dns));
+    memcpy(&dns[12], dns_wire_format_placeholder, sizeof(dns_wire_format_placeholder));
+    dns[2] = 0x01;
+    dns[5] = 1;
+    for (n = 0; n < MESSAGES; n++) {
+        snprintf(id, sizeof(id), "%zu", n);
+        dnstap_set_identity_string(d, id);
+        dnstap_message_set_query_port(d, 1000 + n % 20);
+        dnstap_message_set_query_time_sec(d, 1600000000 + n / 100);
+        dnstap_message_set_query_time_nsec(d, n * 1000);
+        d.message.has_response_port = n % 3 ? true : false;
+        dns[0] = n >> 8;
+        dns[1] = n;
+        dnstap_message_set_query_message(d, dns, sizeof(dns));
+        assert(dnswire_columnar_writer_write(&w, &d) == dnswire_ok);
+    }
+    assert(dnswire_columnar_writer_close(&w) == dnswire_ok);
+    assert(w.num_groups == (MESSAGES + GROUP_ROWS - 1) / GROUP_ROWS);
+    dnswire_columnar_writer_destroy(&w);
+    close(fd);
+}
+
+static void test(enum dnswire_compression compression)
+{
+    struct dnswire_columnar_reader r;
+    struct dnswire_column_data     c = DNSWIRE_COLUMN_DATA_INITIALIZER;
+    struct stat                    st;
+    size_t                         g, i, n;
+    char                           id[32];
+    int                            fd;
+
+    create_file(compression);
+    assert(stat(FILE_NAME, &st) == 0);
+
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_columnar_reader_init(&r) == dnswire_ok);
+    assert(dnswire_columnar_reader_open(&r, fd) == dnswire_ok);
+    assert(dnswire_columnar_reader_groups(r) == (MESSAGES + GROUP_ROWS - 1) / GROUP_ROWS);
+
+    /*
+     * Scanning two columns should only read a small part of the file.
+     */
+    for (g = 0, n = 0; g < dnswire_columnar_reader_groups(r); g++) {
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_query_time_sec, &c) == dnswire_ok);
+        for (i = 0; i < c.rows; i++) {
+            assert(dnswire_column_data_is_present(c, i));
+            assert(dnswire_column_data_value(c, i) == 1600000000 + (n + i) / 100);
+        }
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_query_port, &c) == dnswire_ok);
+        for (i = 0; i < c.rows; i++) {
+            assert(dnswire_column_data_value(c, i) == 1000 + (n + i) % 20);
+        }
+        n += c.rows;
+    }
+    assert(n == MESSAGES);
+    printf("%s: file %zu bytes, scan of 2 columns read %zu bytes\n", dnswire_compression_string[compression], (size_t)st.st_size, dnswire_columnar_reader_bytes_read(r));
+    assert(dnswire_columnar_reader_bytes_read(r) * 20 < (size_t)st.st_size);
+
+    for (g = 0, n = 0; g < dnswire_columnar_reader_groups(r); g++) {
+        size_t rows = dnswire_columnar_reader_group_rows(r, g);
+
+        // unique values are not dictionary encoded
+        assert(r.groups[g].chunks[dnswire_column_identity].encoding == dnswire_column_encoding_plain);
+        assert(r.groups[g].chunks[dnswire_column_query_port].encoding == dnswire_column_encoding_dict);
+        assert(r.groups[g].chunks[dnswire_column_query_time_sec].encoding == dnswire_column_encoding_delta);
+
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_identity, &c) == dnswire_ok);
+        assert(c.rows == rows);
+        for (i = 0; i < rows; i++) {
+            snprintf(id, sizeof(id), "%zu", n + i);
+            assert(dnswire_column_data_length(c, i) == strlen(id));
+            assert(!memcmp(dnswire_column_data_bytes(c, i), id, strlen(id)));
+        }
+
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_query_time_nsec, &c) == dnswire_ok);
+        for (i = 0; i < rows; i++) {
+            assert(dnswire_column_data_value(c, i) == (n + i) * 1000);
+        }
+
+        // missing values
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_response_port, &c) == dnswire_ok);
+        for (i = 0; i < rows; i++) {
+            assert(dnswire_column_data_is_present(c, i) == ((n + i) % 3 ? 1 : 0));
+            assert(dnswire_column_data_value(c, i) == ((n + i) % 3 ? 53 : 0));
+        }
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_query_zone, &c) == dnswire_ok);
+        for (i = 0; i < rows; i++) {
+            assert(!dnswire_column_data_is_present(c, i));
+            assert(!dnswire_column_data_length(c, i));
+        }
+
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_query_message, &c) == dnswire_ok);
+        for (i = 0; i < rows; i++) {
+            assert(dnswire_column_data_length(c, i) == 12 + sizeof(dns_wire_format_placeholder));
+            assert(!memcmp(dnswire_column_data_bytes(c, i) + 12, dns_wire_format_placeholder, sizeof(dns_wire_format_placeholder)));
+        }
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_policy_type, &c) == dnswire_ok);
+        for (i = 0; i < rows; i++) {
+            assert(dnswire_column_data_length(c, i) == 3 && !memcmp(dnswire_column_data_bytes(c, i), "RPZ", 3));
+        }
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_policy_action, &c) == dnswire_ok);
+        for (i = 0; i < rows; i++) {
+            assert(dnswire_column_data_value(c, i) == DNSTAP_POLICY_ACTION_DROP);
+        }
+
+        // parsed DNS header
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_dns_id, &c) == dnswire_ok);
+        for (i = 0; i < rows; i++) {
+            assert(dnswire_column_data_value(c, i) == ((n + i) & 0xffff));
+        }
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_dns_flags, &c) == dnswire_ok);
+        for (i = 0; i < rows; i++) {
+            assert(dnswire_column_data_value(c, i) == 0x0100);
+        }
+        assert(dnswire_columnar_reader_read(&r, g, dnswire_column_dns_qdcount, &c) == dnswire_ok);
+        for (i = 0; i < rows; i++) {
+            assert(dnswire_column_data_value(c, i) == 1);
+        }
+        n += rows;
+    }
+
+    dnswire_column_data_destroy(&c);
+    dnswire_columnar_reader_destroy(&r);
+    close(fd);
+}
+
+int main(void)
+{
+    struct dnswire_columnar_reader r;
+    enum dnswire_compression       compression;
+    int                            fd;
+
+    for (compression = dnswire_compression_none; compression <= dnswire_compression_lz4; compression++) {
+        if (!dnswire_compression_is_available(compression)) {
+            printf("%s: not available\n", dnswire_compression_string[compression]);
+            continue;
+        }
+        test(compression);
+    }
+
+    /*
+     * A truncated file has no trailer.
+     */
+    create_file(dnswire_compression_none);
+    assert(truncate(FILE_NAME, 1000) == 0);
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_columnar_reader_init(&r) == dnswire_ok);
+    assert(dnswire_columnar_reader_open(&r, fd) == dnswire_error);
+    dnswire_columnar_reader_destroy(&r);
+    close(fd);
+    unlink(FILE_NAME);
+
+    return 0;
+}
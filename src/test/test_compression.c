@@ -0,0 +1,205 @@
+#include <dnswire/compression.h>
+#include <dnswire/reader.h>
+#include <dnswire/writer.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+#define PATH "test_compression.dnstap"
+#define NUM 5000
+
+static off_t write_file(enum dnswire_compression compression)
+{
+    struct dnswire_writer     w;
+    struct dnswire_compressor c;
+    struct dnstap             d = DNSTAP_INITIALIZER;
+    enum dnswire_result       res;
+    struct stat               st;
+    size_t                    n = 0;
+    int                       fd;
+
+    create_dnstap(&d, "test_compression");
+
+    assert((fd = open(PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_writer_init(&w) == dnswire_ok);
+    dnswire_writer_set_dnstap(w, &d);
+    if (compression != dnswire_compression_none) {
+        assert(dnswire_compressor_init(&c, compression) == dnswire_ok);
+        // small batches so that the background thread is used
+        dnswire_compressor_set_buf_size(c, 4096);
+        assert(dnswire_compressor_open(&c, fd) == dnswire_ok);
+        dnswire_writer_set_compressor(w, &c);
+    }
+
+    while (n < NUM) {
+        res = dnswire_writer_write(&w, fd);
+        if (res == dnswire_ok) {
+            n++;
+        } else {
+            assert(res == dnswire_again);
+        }
+    }
+    assert(dnswire_writer_stop(&w) == dnswire_ok);
+    while ((res = dnswire_writer_write(&w, fd)) != dnswire_endofdata) {
+        assert(res == dnswire_again);
+    }
+    dnswire_writer_destroy(w);
+
+    if (compression != dnswire_compression_none) {
+        assert(dnswire_compressor_close(&c) == dnswire_ok);
+        printf("%s: in %zu out %zu batches %zu stalls %zu\n", dnswire_compression_string[compression], c.bytes_in, c.bytes_out, c.batches, c.stalls);
+        assert(c.bytes_out < c.bytes_in);
+        dnswire_compressor_destroy(&c);
+    }
+    close(fd);
+
+    assert(!stat(PATH, &st));
+    return st.st_size;
+}
+
+static size_t read_file(enum dnswire_compression compression)
+{
+    struct dnswire_reader       r;
+    struct dnswire_decompressor dc;
+    enum dnswire_result         res;
+    size_t                      n = 0;
+    int                         fd;
+
+    assert((fd = open(PATH, O_RDONLY)) > -1);
+    assert(dnswire_reader_init(&r) == dnswire_ok);
+    assert(dnswire_decompressor_init(&dc) == dnswire_ok);
+    dnswire_reader_set_decompressor(r, &dc);
+
+    while ((res = dnswire_reader_read(&r, fd)) != dnswire_endofdata) {
+        if (res == dnswire_have_dnstap) {
+            assert(dnstap_identity_length(*dnswire_reader_dnstap(r)) == 16);
+            n++;
+            continue;
+        }
+        assert(res == dnswire_again || res == dnswire_need_more);
+    }
+    assert(dnswire_decompressor_compression(dc) == compression);
+    assert(dnswire_reader_seek(&r, fd, 0) == dnswire_error);
+
+    dnswire_decompressor_destroy(&dc);
+    dnswire_reader_destroy(r);
+    close(fd);
+
+    return n;
+}
+
+/*
+ * Over a bidirectional socket only the data direction is compressed, the
+ * compressor is flushed when waiting for ACCEPT and FINISH.
+ */
+static void bidirectional(enum dnswire_compression compression)
+{
+    struct dnswire_writer       w;
+    struct dnswire_reader       r;
+    struct dnswire_compressor   c;
+    struct dnswire_decompressor dc;
+    struct dnstap               d = DNSTAP_INITIALIZER;
+    enum dnswire_result         res;
+    size_t                      sent = 0, received = 0;
+    int                         fds[2], writer_done = 0, reader_done = 0;
+
+    create_dnstap(&d, "test_compression");
+
+    assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+    assert(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+
+    assert(dnswire_writer_init(&w) == dnswire_ok);
+    assert(dnswire_writer_set_bidirectional(&w, true) == dnswire_ok);
+    dnswire_writer_set_dnstap(w, &d);
+    assert(dnswire_compressor_init(&c, compression) == dnswire_ok);
+    assert(dnswire_compressor_open(&c, fds[0]) == dnswire_ok);
+    dnswire_writer_set_compressor(w, &c);
+
+    assert(dnswire_reader_init(&r) == dnswire_ok);
+    assert(dnswire_reader_allow_bidirectional(&r, true) == dnswire_ok);
+    assert(dnswire_decompressor_init(&dc) == dnswire_ok);
+    dnswire_reader_set_decompressor(r, &dc);
+
+    while (!writer_done || !reader_done) {
+        if (!writer_done) {
+            if (sent == NUM) {
+                assert(dnswire_writer_stop(&w) == dnswire_ok);
+                sent++;
+            }
+            res = dnswire_writer_write(&w, fds[0]);
+            if (res == dnswire_ok && sent < NUM && dnswire_writer_is_started(w)) {
+                sent++;
+            } else if (res == dnswire_endofdata) {
+                writer_done = 1;
+            } else {
+                assert(res != dnswire_error);
+            }
+        }
+        if (!reader_done) {
+            res = dnswire_reader_read(&r, fds[1]);
+            if (res == dnswire_have_dnstap) {
+                received++;
+            } else if (res == dnswire_endofdata) {
+                reader_done = 1;
+            } else {
+                assert(res != dnswire_error);
+            }
+        }
+    }
+    assert(received == NUM);
+    assert(dnswire_decompressor_compression(dc) == compression);
+
+    assert(dnswire_compressor_close(&c) == dnswire_ok);
+    dnswire_compressor_destroy(&c);
+    dnswire_writer_destroy(w);
+    dnswire_decompressor_destroy(&dc);
+    dnswire_reader_destroy(r);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(void)
+{
+    struct dnswire_compressor c;
+    off_t                     plain;
+    uint8_t                   zstd[] = { 0x28, 0xb5, 0x2f, 0xfd }, lz4[] = { 0x04, 0x22, 0x4d, 0x18 }, none[] = { 0, 0, 0, 0 };
+
+    assert(dnswire_compression_detect(zstd, sizeof(zstd)) == dnswire_compression_zstd);
+    assert(dnswire_compression_detect(lz4, sizeof(lz4)) == dnswire_compression_lz4);
+    assert(dnswire_compression_detect(none, sizeof(none)) == dnswire_compression_none);
+    assert(dnswire_compression_detect(zstd, 3) == dnswire_compression_none);
+    assert(dnswire_compressor_init(&c, dnswire_compression_none) == dnswire_error);
+
+    /*
+     * Uncompressed files are passed through the decompressor.
+     */
+    plain = write_file(dnswire_compression_none);
+    assert(read_file(dnswire_compression_none) == NUM);
+
+    /*
+     * Test each compression the library was built with.
+     */
+    enum dnswire_compression compression;
+    for (compression = dnswire_compression_zstd; compression <= dnswire_compression_lz4; compression++) {
+        if (dnswire_compressor_init(&c, compression) != dnswire_ok) {
+            printf("%s: not available\n", dnswire_compression_string[compression]);
+            continue;
+        }
+        dnswire_compressor_destroy(&c);
+
+        assert(write_file(compression) < plain);
+        assert(read_file(compression) == NUM);
+        bidirectional(compression);
+    }
+
+    unlink(PATH);
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include <dnswire/dns.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// query for GoOgLe.com IN A with RD set
+static const uint8_t query[] = {
+    0x85, 0x20, 0x01, 0x20, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+    0x06, 'G', 'o', 'O', 'g', 'L', 'e', 0x03, 'c', 'o', 'm', 0x00,
+    0x00, 0x01, 0x00, 0x01,
+    // OPT
+    0x00, 0x00, 0x29, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+// response NXDOMAIN without question
+static const uint8_t response[] = {
+    0x12, 0x34, 0x81, 0x83, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+// response for example.com A with a compressed answer, an authority
+// record and OPT with DO, ECS 192.0.2.0/24 scope 24 and a cookie
+static const uint8_t response_edns[] = {
+    0xab, 0xcd, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x01, 0x00, 0x01,
+    0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00,
+    0x00, 0x01, 0x00, 0x01,
+    // answers
+    0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x04, 192, 0, 2, 1,
+    0x03, 'w', 'w', 'w', 0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x04, 192, 0, 2, 2,
+    // authority
+    0xc0, 0x0c, 0x00, 0x02, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x02, 0xc0, 0x0c,
+    // OPT
+    0x00, 0x00, 0x29, 0x04, 0xd0, 0x01, 0x00, 0x80, 0x00, 0x00, 0x17,
+    0x00, 0x08, 0x00, 0x07, 0x00, 0x01, 24, 24, 192, 0, 2,
+    0x00, 0x0a, 0x00, 0x08, 1, 2, 3, 4, 5, 6, 7, 8
+};
+
+static void lower_ref(uint8_t* out, const uint8_t* in, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        out[i] = in[i] >= 'A' && in[i] <= 'Z' ? in[i] + 32 : in[i];
+    }
+}
+
+int main(void)
+{
+    struct dnswire_dns  d;
+    enum dnswire_result results[4];
+    uint8_t             buf[512], in[300], out[300], ref[300];
+    char                text[300];
+    size_t              i, len, off;
+
+    assert(dnswire_dns_parse(&d, query, sizeof(query)) == dnswire_ok);
+    assert(d.id == 0x8520);
+    assert(!dnswire_dns_qr(d) && dnswire_dns_opcode(d) == 0 && dnswire_dns_rd(d) && dnswire_dns_ad(d));
+    assert(d.qdcount == 1 && d.ancount == 0 && d.nscount == 0 && d.arcount == 1);
+    assert(d.has_question);
+    assert(d.qname == &query[12] && d.qname_length == 12 && d.labels == 2);
+    assert(d.qtype == 1 && d.qclass == 1);
+    assert(d.end == 28);
+
+    assert(dnswire_dns_name_string(d.qname, d.qname_length, text, sizeof(text)) == 11);
+    assert(!strcmp(text, "GoOgLe.com."));
+    memcpy(buf, d.qname, d.qname_length);
+    dnswire_dns_name_lower(buf, buf, d.qname_length);
+    assert(!memcmp(buf, "\x06google\x03" "com", 12));
+
+    assert(dnswire_dns_parse(&d, response, sizeof(response)) == dnswire_ok);
+    assert(dnswire_dns_qr(d) && dnswire_dns_rcode(d) == 3 && dnswire_dns_ra(d));
+    assert(!d.has_question && d.end == 12);
+
+    /*
+     * Truncated and invalid messages.
+     */
+    for (len = 0; len < 28; len++) {
+        assert(dnswire_dns_parse(&d, query, len) == dnswire_error);
+    }
+    memcpy(buf, query, sizeof(query));
+    buf[12] = 0xc0; // pointer
+    assert(dnswire_dns_parse(&d, buf, sizeof(query)) == dnswire_error);
+    buf[12] = 64;
+    assert(dnswire_dns_parse(&d, buf, sizeof(query)) == dnswire_error);
+
+    // longest name, 255 bytes, and one too long
+    memset(buf, 0, sizeof(buf));
+    buf[5] = 1;
+    for (off = 12, i = 0; i < 4; i++, off += 64) {
+        buf[off] = i < 3 ? 63 : 61;
+        memset(&buf[off + 1], 'A', buf[off]);
+    }
+    assert(dnswire_dns_parse(&d, buf, 12 + 255 + 4) == dnswire_ok);
+    assert(d.qname_length == 255 && d.labels == 4);
+    buf[12 + 192] = 62;
+    assert(dnswire_dns_parse(&d, buf, 12 + 256 + 4) == dnswire_error);
+
+    /*
+     * Batch.
+     */
+    const uint8_t* msgs[4] = { query, response, query, response };
+    size_t         lens[4] = { sizeof(query), sizeof(response), 20, 11 };
+    struct dnswire_dns ds[4];
+    assert(dnswire_dns_parse_batch(ds, results, msgs, lens, 4) == 2);
+    assert(results[0] == dnswire_ok && results[1] == dnswire_ok);
+    assert(results[2] == dnswire_error && results[3] == dnswire_error);
+    assert(ds[0].qtype == 1 && ds[1].id == 0x1234);
+
+    /*
+     * EDNS0.
+     */
+    struct dnswire_dns_edns e;
+
+    assert(dnswire_dns_parse(&d, query, sizeof(query)) == dnswire_ok);
+    assert(dnswire_dns_edns(&e, &d, query, sizeof(query)) == dnswire_ok);
+    assert(e.present && e.udp_size == 4096 && !e.do_bit && !e.options);
+    assert(!e.has_ecs && !e.has_cookie);
+
+    assert(dnswire_dns_parse(&d, response_edns, sizeof(response_edns)) == dnswire_ok);
+    assert(dnswire_dns_edns(&e, &d, response_edns, sizeof(response_edns)) == dnswire_ok);
+    assert(e.present && e.udp_size == 1232 && e.do_bit && e.version == 0);
+    assert(dnswire_dns_edns_rcode(d, e) == 16);
+    assert(e.options == 2);
+    assert(e.has_ecs && e.ecs_family == 1 && e.ecs_source == 24 && e.ecs_scope == 24);
+    assert(e.ecs_address_length == 3 && !memcmp(e.ecs_address, "\xc0\x00\x02", 3));
+    assert(e.has_cookie && e.cookie_length == 8 && e.cookie[7] == 8);
+
+    // truncated in the OPT options and in the records before it
+    assert(dnswire_dns_edns(&e, &d, response_edns, sizeof(response_edns) - 1) == dnswire_error);
+    assert(dnswire_dns_edns(&e, &d, response_edns, 60) == dnswire_error);
+
+    // no additional records, or not parsed
+    assert(dnswire_dns_parse(&d, response, sizeof(response)) == dnswire_ok);
+    assert(dnswire_dns_edns(&e, &d, response, sizeof(response)) == dnswire_ok && !e.present);
+    assert(dnswire_dns_parse(&d, query, 20) == dnswire_error);
+    assert(dnswire_dns_edns(&e, &d, query, 20) == dnswire_error);
+
+    const uint8_t*          emsgs[3] = { query, response_edns, response };
+    size_t                  elens[3] = { sizeof(query), sizeof(response_edns), sizeof(response) };
+    struct dnswire_dns_edns es[3];
+    assert(dnswire_dns_parse_batch(ds, results, emsgs, elens, 3) == 3);
+    assert(dnswire_dns_edns_batch(es, results, ds, emsgs, elens, 3) == 2);
+    assert(results[0] == dnswire_ok && results[1] == dnswire_ok && results[2] == dnswire_ok);
+    assert(es[0].present && es[1].has_ecs && !es[2].present);
+
+    /*
+     * Header statistics match counting parsed messages one at a time.
+     */
+    struct dnswire_dns_stats stats, ref_stats, merged;
+    const uint8_t*           smsgs[1000];
+    size_t                   slens[1000];
+
+    memset(&ref_stats, 0, sizeof(ref_stats));
+    for (i = 0; i < 1000; i++) {
+        smsgs[i] = i % 3 == 0 ? query : i % 3 == 1 ? response : response_edns;
+        slens[i] = i % 3 == 0 ? sizeof(query) : i % 3 == 1 ? sizeof(response) : sizeof(response_edns);
+        if (i % 50 == 0) {
+            slens[i] = 11;
+        } else if (i % 50 == 1 && slens[i] > 20) {
+            slens[i] = 20;
+        }
+        if (dnswire_dns_parse(&d, smsgs[i], slens[i]) == dnswire_error && slens[i] < 12) {
+            ref_stats.invalid++;
+            continue;
+        }
+        ref_stats.messages++;
+        ref_stats.qr += dnswire_dns_qr(d);
+        ref_stats.rd += dnswire_dns_rd(d);
+        ref_stats.ra += dnswire_dns_ra(d);
+        ref_stats.ad += dnswire_dns_ad(d);
+        ref_stats.opcode[dnswire_dns_opcode(d)]++;
+        ref_stats.rcode[dnswire_dns_rcode(d)]++;
+        if (d.has_question) {
+            ref_stats.questions++;
+            ref_stats.qtype[d.qtype]++;
+        }
+    }
+    dnswire_dns_stats_clear(&stats);
+    dnswire_dns_stats_add(&stats, smsgs, slens, 1000);
+    assert(!memcmp(&stats, &ref_stats, sizeof(stats)));
+    assert(stats.messages == 980 && stats.invalid == 20 && stats.rcode[3] > 0 && stats.qtype[1] > 0);
+
+    // the same in two parts, merged
+    dnswire_dns_stats_clear(&merged);
+    dnswire_dns_stats_add(&merged, smsgs, slens, 333);
+    dnswire_dns_stats_clear(&stats);
+    dnswire_dns_stats_add(&stats, &smsgs[333], &slens[333], 1000 - 333);
+    dnswire_dns_stats_merge(&merged, &stats);
+    assert(!memcmp(&merged, &ref_stats, sizeof(stats)));
+
+    // from a column of messages
+    struct dnswire_column_data column = DNSWIRE_COLUMN_DATA_INITIALIZER;
+    assert(dnswire_column_data_reset(&column, dnswire_column_query_message, 1000) == dnswire_ok);
+    assert((column.data = malloc(1000 * sizeof(response_edns))));
+    column.data_size = 1000 * sizeof(response_edns);
+    for (i = 0, off = 0; i < 1000; i++) {
+        if (slens[i] >= 12) {
+            column.present[i / 8] |= 1 << (i % 8);
+            memcpy(&column.data[off], smsgs[i], slens[i]);
+            off += slens[i];
+        }
+        column.offsets[i + 1] = off;
+    }
+    column.rows = 1000;
+    dnswire_dns_stats_clear(&stats);
+    dnswire_dns_stats_add_column(&stats, &column);
+    ref_stats.invalid = 0;
+    assert(!memcmp(&stats, &ref_stats, sizeof(stats)));
+    dnswire_column_data_destroy(&column);
+
+    /*
+     * Lowercasing matches the reference for all bytes, lengths and
+     * alignments (covering the SIMD kernels and their tails).
+     */
+    for (i = 0; i < sizeof(in); i++) {
+        in[i] = i * 7 + 3;
+    }
+    for (off = 0; off < 4; off++) {
+        for (len = 0; len + off <= sizeof(in); len += len < 70 ? 1 : 37) {
+            memset(out, 0xaa, sizeof(out));
+            dnswire_dns_name_lower(&out[off], &in[off], len);
+            lower_ref(ref, &in[off], len);
+            assert(!memcmp(&out[off], ref, len));
+            assert(!off || out[off - 1] == 0xaa);
+            assert(len + off == sizeof(out) || out[off + len] == 0xaa);
+        }
+    }
+
+    /*
+     * Text form.
+     */
+    assert(dnswire_dns_name_string((const uint8_t*)"", 1, text, sizeof(text)) == 1 && !strcmp(text, "."));
+    assert(dnswire_dns_name_string((const uint8_t*)"\x03" "a.b\x01\x07", 7, text, sizeof(text)) == 10);
+    assert(!strcmp(text, "a\\.b.\\007."));
+    assert(dnswire_dns_name_string(query + 12, 12, text, 11) == -1);
+    assert(dnswire_dns_name_string(query + 12, 11, text, sizeof(text)) == -1);
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include <dnswire/hll.h>
+#include <dnswire/batch.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BATCH 1000
+
+static void check(const struct dnswire_hll* h, uint64_t n)
+{
+    uint64_t e = dnswire_hll_estimate(h);
+
+    printf("%lu: %lu\n", (unsigned long)n, (unsigned long)e);
+    // well within 5 standard errors of 0.8%
+    assert(e >= n - n / 25 && e <= n + n / 25);
+}
+
+int main(void)
+{
+    struct dnswire_hll h, a, b, c;
+    uint32_t           i, v, values[BATCH];
+    const uint8_t*     ptrs[BATCH];
+    size_t             lens[BATCH];
+    uint8_t            buf[DNSWIRE_HLL_HEADER_SIZE + (1 << DNSWIRE_HLL_DEFAULT_PRECISION)];
+
+    assert(dnswire_hll_init(&h, DNSWIRE_HLL_DEFAULT_PRECISION) == dnswire_ok);
+    assert(dnswire_hll_estimate(&h) == 0);
+
+    for (i = 0; i < 100; i++) {
+        dnswire_hll_add(&h, (uint8_t*)&i, sizeof(i));
+        dnswire_hll_add(&h, (uint8_t*)&i, sizeof(i));
+    }
+    check(&h, 100);
+    for (; i < 10000; i++) {
+        dnswire_hll_add(&h, (uint8_t*)&i, sizeof(i));
+    }
+    check(&h, 10000);
+    for (; i < 1000000; i++) {
+        dnswire_hll_add(&h, (uint8_t*)&i, sizeof(i));
+    }
+    check(&h, 1000000);
+
+    /*
+     * Adding in batches gives the same registers, and so does merging
+     * two halves.
+     */
+    assert(dnswire_hll_init(&a, DNSWIRE_HLL_DEFAULT_PRECISION) == dnswire_ok);
+    assert(dnswire_hll_init(&b, DNSWIRE_HLL_DEFAULT_PRECISION) == dnswire_ok);
+    for (i = 0; i < 1000000; i += BATCH) {
+        for (v = 0; v < BATCH; v++) {
+            values[v] = i + v;
+            ptrs[v]   = (uint8_t*)&values[v];
+            lens[v]   = sizeof(uint32_t);
+        }
+        dnswire_hll_add_batch((i / BATCH) & 1 ? &b : &a, ptrs, lens, BATCH);
+        // the start of the batch again, already counted
+        dnswire_hll_add_batch((i / BATCH) & 1 ? &b : &a, ptrs, lens, 10);
+    }
+    assert(dnswire_hll_estimate(&a) < 600000);
+    assert(dnswire_hll_merge(&a, &b) == dnswire_ok);
+    assert(!memcmp(a.registers, h.registers, h.size));
+    assert(dnswire_hll_estimate(&a) == dnswire_hll_estimate(&h));
+
+    /*
+     * A serialized sketch is restored or merged as is.
+     */
+    assert(dnswire_hll_serialize(&h, buf, sizeof(buf) - 1) == -1);
+    assert(dnswire_hll_serialize(&h, buf, sizeof(buf)) == sizeof(buf));
+    assert(dnswire_hll_deserialize(&c, buf, sizeof(buf)) == dnswire_ok);
+    assert(c.precision == h.precision);
+    assert(!memcmp(c.registers, h.registers, h.size));
+    dnswire_hll_destroy(&c);
+
+    dnswire_hll_clear(&b);
+    assert(dnswire_hll_merge_serialized(&b, buf, sizeof(buf)) == dnswire_ok);
+    assert(dnswire_hll_estimate(&b) == dnswire_hll_estimate(&h));
+    assert(dnswire_hll_merge_serialized(&b, buf, sizeof(buf) - 1) == dnswire_error);
+    buf[DNSWIRE_HLL_HEADER_SIZE] = 64;
+    assert(dnswire_hll_deserialize(&c, buf, sizeof(buf)) == dnswire_error);
+
+    assert(dnswire_hll_init(&c, 10) == dnswire_ok);
+    assert(dnswire_hll_merge(&c, &h) == dnswire_error);
+    dnswire_hll_destroy(&c);
+    assert(dnswire_hll_init(&c, 3) == dnswire_error);
+    assert(dnswire_hll_init(&c, 19) == dnswire_error);
+
+    dnswire_hll_destroy(&a);
+    dnswire_hll_destroy(&b);
+    dnswire_hll_destroy(&h);
+
+    /*
+     * The query addresses of a batch.
+     */
+    struct dnswire_batch batch;
+    struct dnstap        d = DNSTAP_INITIALIZER;
+    uint8_t              address[4] = { 10, 0, 0, 0 };
+
+    assert(dnswire_batch_init(&batch, 600) == dnswire_ok);
+    dnstap_set_type(d, DNSTAP_TYPE_MESSAGE);
+    dnstap_message_set_type(d, DNSTAP_MESSAGE_TYPE_CLIENT_QUERY);
+    for (i = 0; i < 600; i++) {
+        address[2] = (i % 200) >> 8;
+        address[3] = i % 200;
+        dnstap_message_set_query_address(d, address, sizeof(address));
+        d.message.has_query_address = i % 3 ? true : false;
+        assert(dnswire_batch_add(&batch, &d) == dnswire_ok);
+    }
+    assert(dnswire_hll_init(&h, 12) == dnswire_ok);
+    dnswire_hll_add_column(&h, dnswire_batch_column(batch, dnswire_column_query_address));
+    // every address is present in one of the three rounds
+    check(&h, 200);
+    dnswire_hll_destroy(&h);
+    dnswire_batch_destroy(&batch);
+
+    /*
+     * A sketch per key, with a limited number of keys.
+     */
+    struct dnswire_hll_group g;
+    static const char*       zones[] = { "example.com", "example.net", "example.org" };
+
+    assert(dnswire_hll_group_init(&g, 10, 2) == dnswire_ok);
+    for (i = 0; i < 3000; i++) {
+        const char* zone = zones[i % 3];
+        v                = i % 3 ? i : i % 30;
+        assert(dnswire_hll_group_add(&g, (uint8_t*)zone, strlen(zone), (uint8_t*)&v, sizeof(v)) == (i % 3 == 2 ? dnswire_again : dnswire_ok));
+    }
+    assert(dnswire_hll_group_entries(g) == 2);
+    assert(dnswire_hll_group_dropped(g) == 1000);
+    assert(dnswire_hll_group_get(&g, (uint8_t*)"example.org", 11) == 0);
+    assert(dnswire_hll_estimate(dnswire_hll_group_get(&g, (uint8_t*)"example.com", 11)) == 10);
+    check(dnswire_hll_group_get(&g, (uint8_t*)"example.net", 11), 1000);
+    assert(dnswire_hll_group_entry(g, 0)->length == 11);
+
+    dnswire_hll_group_clear(&g);
+    assert(dnswire_hll_group_entries(g) == 0);
+    assert(dnswire_hll_group_add(&g, (uint8_t*)"example.org", 11, (uint8_t*)&v, sizeof(v)) == dnswire_ok);
+    assert(dnswire_hll_estimate(dnswire_hll_group_get(&g, (uint8_t*)"example.org", 11)) == 1);
+
+    // an empty key and value, such as a missing identity
+    assert(dnswire_hll_group_add(&g, 0, 0, 0, 0) == dnswire_ok);
+    assert(dnswire_hll_group_add(&g, 0, 0, 0, 0) == dnswire_ok);
+    assert(dnswire_hll_estimate(dnswire_hll_group_get(&g, 0, 0)) == 1);
+    dnswire_hll_group_destroy(&g);
+
+    return 0;
+}
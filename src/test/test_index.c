@@ -0,0 +1,344 @@
+#include <dnswire/index.h>
+#include <dnswire/reader.h>
+#include <dnswire/writer.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+#define FILE_NAME "test_index.dnstap"
+#define INDEX_NAME "test_index.idx"
+#define BLOOM_FILE_NAME "test_index_bloom.dnstap"
+#define BLOOM_INDEX_NAME "test_index_bloom.idx"
+#define MESSAGES 5000
+#define BLOCK_FRAMES 100
+
+// mostly increasing with some messages a bit out of order
+static uint64_t msg_time(size_t n)
+{
+    return 1000 + n / 10 - (n % 7 ? 0 : 5);
+}
+
+static void create_file(struct dnswire_index* index)
+{
+    struct dnswire_writer w;
+    struct dnstap         d = DNSTAP_INITIALIZER;
+    char                  id[32];
+    size_t                n = 1;
+    int                   fd;
+
+    assert((fd = open(FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_writer_init(&w) == dnswire_ok);
+    dnswire_writer_set_index(w, index);
+    create_dnstap(&d, "");
+    snprintf(id, sizeof(id), "%zu", n);
+    dnstap_set_identity_string(d, id);
+    dnstap_message_set_query_time_sec(d, msg_time(n));
+    dnstap_message_set_response_time_sec(d, msg_time(n));
+    dnswire_writer_set_dnstap(w, &d);
+
+    while (1) {
+        enum dnswire_result res = dnswire_writer_write(&w, fd);
+        if (res == dnswire_ok) {
+            if (n == MESSAGES) {
+                assert(dnswire_writer_stop(&w) == dnswire_ok);
+                continue;
+            }
+            snprintf(id, sizeof(id), "%zu", ++n);
+            dnstap_set_identity_string(d, id);
+            dnstap_message_set_query_time_sec(d, msg_time(n));
+            dnstap_message_set_response_time_sec(d, msg_time(n));
+            dnswire_writer_set_dnstap(w, &d);
+        } else if (res == dnswire_endofdata) {
+            break;
+        } else {
+            assert(res == dnswire_again);
+        }
+    }
+
+    // the STOP frame is not indexed
+    assert(index->end + 12 == dnswire_writer_offset(w));
+
+    dnswire_writer_destroy(w);
+    close(fd);
+}
+
+static void same(const struct dnswire_index* a, const struct dnswire_index* b)
+{
+    size_t i;
+
+    assert(a->block_frames == b->block_frames);
+    assert(a->end == b->end);
+    assert(dnswire_index_blocks(*a) == dnswire_index_blocks(*b));
+    for (i = 0; i < dnswire_index_blocks(*a); i++) {
+        assert(a->blocks[i].offset == b->blocks[i].offset);
+        assert(a->blocks[i].frames == b->blocks[i].frames);
+        assert(a->blocks[i].min == b->blocks[i].min);
+        assert(a->blocks[i].max == b->blocks[i].max);
+        assert(a->blocks[i].seek == b->blocks[i].seek);
+    }
+}
+
+/*
+ * Seek to `t` and read to the end, all messages at or after `t` must be
+ * found without reading every frame.
+ */
+static void seek_time(const struct dnswire_index* index, uint64_t t)
+{
+    struct dnswire_reader r;
+    enum dnswire_result   res;
+    size_t                n, frames = 0, found = 0, expected = 0;
+    int                   fd;
+    char                  id[32];
+
+    for (n = 1; n <= MESSAGES; n++) {
+        if (msg_time(n) >= t) {
+            expected++;
+        }
+    }
+
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_reader_init(&r) == dnswire_ok);
+    assert(dnswire_reader_seek_time(&r, fd, index, t) == dnswire_ok);
+
+    while ((res = dnswire_reader_read(&r, fd)) != dnswire_endofdata) {
+        if (res != dnswire_have_dnstap) {
+            assert(res == dnswire_again || res == dnswire_need_more);
+            continue;
+        }
+        const struct dnstap* d = dnswire_reader_dnstap(r);
+
+        frames++;
+        memcpy(id, dnstap_identity(*d), dnstap_identity_length(*d));
+        id[dnstap_identity_length(*d)] = 0;
+        n                              = strtoul(id, 0, 10);
+        assert(dnstap_message_query_time_sec(*d) == msg_time(n));
+        if (msg_time(n) >= t) {
+            found++;
+        }
+    }
+    assert(found == expected);
+    if (t > msg_time(BLOCK_FRAMES * 2)) {
+        assert(frames < MESSAGES);
+    }
+
+    dnswire_reader_destroy(r);
+    close(fd);
+}
+
+/*
+ * Each message has its own client address and one of 1000 names.
+ */
+static void bloom_message(struct dnstap* d, size_t n, uint8_t address[4], uint8_t query[64])
+{
+    char   name[32];
+    size_t len;
+
+    address[0] = 10;
+    address[1] = 0;
+    address[2] = n >> 8;
+    address[3] = n;
+    dnstap_message_set_query_address(*d, address, 4);
+
+    memset(query, 0, 12);
+    // QDCOUNT 1 and the name h<n>.Example.COM
+    query[5]  = 1;
+    len       = snprintf(name, sizeof(name), "h%zu", n % 1000);
+    query[12] = len;
+    memcpy(&query[13], name, len);
+    memcpy(&query[13 + len], "\7Example\3COM\0\0\1\0\1", 17);
+    dnstap_message_set_query_message(*d, query, 13 + len + 17);
+}
+
+static void test_bloom(void)
+{
+    struct dnswire_writer w;
+    struct dnswire_reader r;
+    struct dnswire_index  written, loaded, built;
+    struct dnstap         d = DNSTAP_INITIALIZER;
+    uint8_t               address[4], query[64], lookup[4] = { 10, 0, 1234 >> 8, 1234 & 0xff };
+    size_t                n = 1, i, blocks, matches;
+    int                   fd;
+
+    assert(dnswire_index_init(&written, BLOCK_FRAMES) == dnswire_ok);
+    assert(dnswire_index_set_bloom_size(&written, DNSWIRE_INDEX_MAX_BLOOM_SIZE + 1) == dnswire_error);
+    assert(dnswire_index_set_bloom_size(&written, 256) == dnswire_ok);
+
+    assert((fd = open(BLOOM_FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_writer_init(&w) == dnswire_ok);
+    dnswire_writer_set_index(w, &written);
+    create_dnstap(&d, "test_index");
+    bloom_message(&d, n, address, query);
+    dnswire_writer_set_dnstap(w, &d);
+    while (1) {
+        enum dnswire_result res = dnswire_writer_write(&w, fd);
+        if (res == dnswire_ok) {
+            if (n == MESSAGES) {
+                assert(dnswire_writer_stop(&w) == dnswire_ok);
+                continue;
+            }
+            bloom_message(&d, ++n, address, query);
+            dnswire_writer_set_dnstap(w, &d);
+        } else if (res == dnswire_endofdata) {
+            break;
+        } else {
+            assert(res == dnswire_again);
+        }
+    }
+    dnswire_writer_destroy(w);
+    close(fd);
+    assert(dnswire_index_set_bloom_size(&written, 128) == dnswire_error);
+
+    // the filters are kept in the index file and built the same way
+    assert((fd = open(BLOOM_INDEX_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_index_save(&written, fd) == dnswire_ok);
+    close(fd);
+    assert(dnswire_index_init(&loaded, BLOCK_FRAMES) == dnswire_ok);
+    assert((fd = open(BLOOM_INDEX_NAME, O_RDONLY)) > -1);
+    assert(dnswire_index_load(&loaded, fd) == dnswire_ok);
+    close(fd);
+    same(&written, &loaded);
+    assert(loaded.bloom_size == 256);
+    assert(!memcmp(written.blooms, loaded.blooms, dnswire_index_blocks(loaded) * 2 * 256));
+
+    assert(dnswire_index_init(&built, BLOCK_FRAMES) == dnswire_ok);
+    assert(dnswire_index_set_bloom_size(&built, 256) == dnswire_ok);
+    assert((fd = open(BLOOM_FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_index_build(&built, fd) == dnswire_ok);
+    close(fd);
+    same(&written, &built);
+    assert(!memcmp(written.blooms, built.blooms, dnswire_index_blocks(built) * 2 * 256));
+
+    // one client, only read the blocks that may have it
+    assert((fd = open(BLOOM_FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_reader_init(&r) == dnswire_ok);
+    for (i = 0, blocks = 0, matches = 0; i < dnswire_index_blocks(loaded); i++) {
+        if (!dnswire_index_may_have_address(&loaded, i, lookup, sizeof(lookup))) {
+            continue;
+        }
+        blocks++;
+        assert(dnswire_reader_seek(&r, fd, dnswire_index_block(loaded, i)->offset) == dnswire_ok);
+        for (n = dnswire_index_block(loaded, i)->frames; n;) {
+            enum dnswire_result res = dnswire_reader_read(&r, fd);
+            if (res == dnswire_have_dnstap) {
+                if (!memcmp(dnstap_message_query_address(*dnswire_reader_dnstap(r)), lookup, sizeof(lookup))) {
+                    matches++;
+                }
+                n--;
+                continue;
+            }
+            assert(res == dnswire_again || res == dnswire_need_more);
+        }
+    }
+    assert(matches == 1);
+    assert(blocks < 5);
+    dnswire_reader_destroy(r);
+    close(fd);
+
+    // one name, case insensitive and with or without the trailing dot
+    for (i = 0, blocks = 0, matches = 0; i < dnswire_index_blocks(loaded); i++) {
+        if (dnswire_index_may_have_qname(&loaded, i, "H7.example.com.")) {
+            assert(dnswire_index_may_have_qname(&loaded, i, "h7.EXAMPLE.COM"));
+            blocks++;
+        }
+        // n = 7, 1007, 2007, 3007 and 4007
+        if (i == 0 || i == 10 || i == 20 || i == 30 || i == 40) {
+            assert(dnswire_index_may_have_qname(&loaded, i, "h7.example.com"));
+        }
+    }
+    assert(blocks >= 5 && blocks < 10);
+    assert(!dnswire_index_may_have_qname(&loaded, 0, "h7..example.com"));
+
+    dnswire_index_destroy(&written);
+    dnswire_index_destroy(&loaded);
+    dnswire_index_destroy(&built);
+}
+
+/*
+ * Load the index with a 32 bit field of the header replaced, restoring it
+ * afterwards.
+ */
+static void corrupt_header(off_t at, uint32_t value)
+{
+    struct dnswire_index index;
+    uint8_t              orig[4], buf[4] = { value >> 24, value >> 16, value >> 8, value };
+    int                  fd;
+
+    assert((fd = open(INDEX_NAME, O_RDWR)) > -1);
+    assert(pread(fd, orig, sizeof(orig), at) == sizeof(orig));
+    assert(pwrite(fd, buf, sizeof(buf), at) == sizeof(buf));
+    assert(lseek(fd, 0, SEEK_SET) == 0);
+    assert(dnswire_index_init(&index, BLOCK_FRAMES) == dnswire_ok);
+    assert(dnswire_index_load(&index, fd) == dnswire_error);
+    assert(!index.blocks && !index.blooms);
+    assert(pwrite(fd, orig, sizeof(orig), at) == sizeof(orig));
+    dnswire_index_destroy(&index);
+    close(fd);
+}
+
+int main(void)
+{
+    struct dnswire_index written, loaded, built;
+    uint64_t             offset;
+    int                  fd;
+
+    assert(dnswire_index_init(&written, 0) == dnswire_error);
+    assert(dnswire_index_init(&written, BLOCK_FRAMES) == dnswire_ok);
+    create_file(&written);
+    assert(dnswire_index_blocks(written) == MESSAGES / BLOCK_FRAMES);
+    assert(dnswire_index_block(written, 0)->frames == BLOCK_FRAMES);
+
+    assert((fd = open(INDEX_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_index_save(&written, fd) == dnswire_ok);
+    close(fd);
+    assert(dnswire_index_init(&loaded, DNSWIRE_INDEX_DEFAULT_BLOCK_FRAMES) == dnswire_ok);
+    assert((fd = open(INDEX_NAME, O_RDONLY)) > -1);
+    assert(dnswire_index_load(&loaded, fd) == dnswire_ok);
+    close(fd);
+    same(&written, &loaded);
+
+    // the indexer gives the same index for the file
+    assert(dnswire_index_init(&built, BLOCK_FRAMES) == dnswire_ok);
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_index_build(&built, fd) == dnswire_ok);
+    close(fd);
+    same(&written, &built);
+
+    assert(dnswire_index_find(&loaded, 0, &offset) == dnswire_ok);
+    assert(offset == dnswire_index_block(loaded, 0)->offset);
+    assert(dnswire_index_find(&loaded, msg_time(MESSAGES) + 1, &offset) == dnswire_endofdata);
+    assert(offset == loaded.end);
+
+    seek_time(&loaded, 0);
+    seek_time(&loaded, 1250);
+    seek_time(&loaded, 1450);
+    seek_time(&loaded, msg_time(MESSAGES));
+    seek_time(&loaded, msg_time(MESSAGES) + 1);
+
+    // not an index
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_index_load(&loaded, fd) == dnswire_error);
+    close(fd);
+
+    // corrupt headers are rejected before allocating for the blocks
+    corrupt_header(8, 0);
+    corrupt_header(8, DNSWIRE_INDEX_MAX_BLOCK_FRAMES + 1);
+    corrupt_header(12, 0xffffffff);
+    corrupt_header(20, MESSAGES / BLOCK_FRAMES + 1);
+    assert((fd = open(INDEX_NAME, O_RDONLY)) > -1);
+    assert(dnswire_index_load(&loaded, fd) == dnswire_ok);
+    close(fd);
+    same(&written, &loaded);
+
+    dnswire_index_destroy(&written);
+    dnswire_index_destroy(&loaded);
+    dnswire_index_destroy(&built);
+
+    test_bloom();
+
+    return 0;
+}
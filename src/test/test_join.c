@@ -0,0 +1,163 @@
+#include <dnswire/join.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define QUERIES 10000
+#define BASE 1600000000ULL
+
+static uint8_t query_address[4]    = { 10, 0, 0, 1 };
+static uint8_t response_address[4] = { 10, 0, 0, 53 };
+
+static uint64_t expect_latency;
+static size_t   calls;
+
+static void set_message(struct dnstap* d, uint8_t* dns, enum dnstap_message_type type, uint16_t port, uint16_t id, uint64_t time)
+{
+    dnstap_set_type(*d, DNSTAP_TYPE_MESSAGE);
+    dnstap_message_set_type(*d, type);
+    dnstap_message_set_socket_protocol(*d, DNSTAP_SOCKET_PROTOCOL_UDP);
+    dnstap_message_set_query_address(*d, query_address, sizeof(query_address));
+    dnstap_message_set_response_address(*d, response_address, sizeof(response_address));
+    dnstap_message_set_query_port(*d, port);
+    dnstap_message_set_response_port(*d, 53);
+
+    memset(dns, 0, 12);
+    dns[0] = id >> 8;
+    dns[1] = id;
+    if (type & 1) {
+        dnstap_message_set_query_time_sec(*d, time / 1000000000);
+        dnstap_message_set_query_time_nsec(*d, time % 1000000000);
+        dnstap_message_set_query_message(*d, dns, 12);
+        d->message.has_response_time_sec  = false;
+        d->message.has_response_time_nsec = false;
+        d->message.has_response_message   = false;
+    } else {
+        dns[2] = 0x80;
+        dnstap_message_set_response_time_sec(*d, time / 1000000000);
+        dnstap_message_set_response_time_nsec(*d, time % 1000000000);
+        dnstap_message_set_response_message(*d, dns, 12);
+        d->message.has_query_time_sec  = false;
+        d->message.has_query_time_nsec = false;
+        d->message.has_query_message   = false;
+    }
+}
+
+static void match(const struct dnswire_join_match* m, void* ctx)
+{
+    assert(ctx == &calls);
+    assert(m->response);
+    assert(m->latency == expect_latency);
+    assert(m->response_time - m->query_time == m->latency);
+    calls++;
+}
+
+static uint64_t query_time(size_t i)
+{
+    return BASE * 1000000000ULL + i * 1000000ULL;
+}
+
+int main(void)
+{
+    struct dnswire_join j;
+    struct dnstap       d = DNSTAP_INITIALIZER;
+    uint8_t             dns[12];
+    size_t              i, responses = 0;
+
+    /*
+     * Queries 1ms apart, each answered after (i % 100) * 10us except
+     * every 7th that is never answered, responses are 10 queries behind.
+     */
+    assert(dnswire_join_init(&j, QUERIES, 1000000000ULL) == dnswire_ok);
+    dnswire_join_set_callback(j, match, &calls);
+
+    for (i = 0; i < QUERIES + 10; i++) {
+        if (i < QUERIES) {
+            set_message(&d, dns, DNSTAP_MESSAGE_TYPE_CLIENT_QUERY, 1024 + i % 5000, i, query_time(i));
+            assert(dnswire_join_add(&j, &d) == dnswire_ok);
+        }
+        if (i >= 10 && (i - 10) % 7) {
+            size_t q       = i - 10;
+            expect_latency = (q % 100) * 10000ULL;
+            set_message(&d, dns, DNSTAP_MESSAGE_TYPE_CLIENT_RESPONSE, 1024 + q % 5000, q, query_time(q) + expect_latency);
+            assert(dnswire_join_add(&j, &d) == dnswire_ok);
+            responses++;
+        }
+    }
+
+    assert(dnswire_join_queries(j) == QUERIES);
+    assert(dnswire_join_responses(j) == responses);
+    assert(dnswire_join_matched(j) == responses);
+    assert(calls == responses);
+    assert(dnswire_join_unmatched(j) == 0);
+    assert(dnswire_join_duplicates(j) == 0);
+    assert(dnswire_join_dropped(j) == 0);
+    assert(dnswire_join_ignored(j) == 0);
+    // the sweep expires as it goes, a full expire leaves only the last second
+    assert(dnswire_join_expired(j) > 0);
+    assert(dnswire_join_expired(j) + dnswire_join_outstanding(j) == QUERIES - responses);
+    dnswire_join_expire(&j, 0);
+    assert(dnswire_join_expired(j) + dnswire_join_outstanding(j) == QUERIES - responses);
+    assert(dnswire_join_outstanding(j) <= 1000 / 7 + 1);
+
+    const struct dnswire_join_histogram* h = dnswire_join_histogram(j);
+    assert(h->count == responses);
+    assert(h->min == 0);
+    assert(h->max == 990000);
+    uint64_t p50 = dnswire_join_histogram_percentile(h, 0.5);
+    printf("p50 %lu p99 %lu\n", (unsigned long)p50, (unsigned long)dnswire_join_histogram_percentile(h, 0.99));
+    assert(p50 >= 490000 && p50 <= 500000 * 1.125);
+    assert(dnswire_join_histogram_percentile(h, 1.0) == h->max);
+
+    /*
+     * A response from a resolver does not match a client query, and a
+     * response without a query is unmatched.
+     */
+    set_message(&d, dns, DNSTAP_MESSAGE_TYPE_CLIENT_QUERY, 1, 1, query_time(QUERIES));
+    assert(dnswire_join_add(&j, &d) == dnswire_ok);
+    set_message(&d, dns, DNSTAP_MESSAGE_TYPE_RESOLVER_RESPONSE, 1, 1, query_time(QUERIES));
+    assert(dnswire_join_add(&j, &d) == dnswire_ok);
+    set_message(&d, dns, DNSTAP_MESSAGE_TYPE_CLIENT_RESPONSE, 1, 2, query_time(QUERIES));
+    assert(dnswire_join_add(&j, &d) == dnswire_ok);
+    assert(dnswire_join_unmatched(j) == 2);
+    set_message(&d, dns, DNSTAP_MESSAGE_TYPE_CLIENT_QUERY, 1, 1, query_time(QUERIES + 1));
+    assert(dnswire_join_add(&j, &d) == dnswire_ok);
+    assert(dnswire_join_duplicates(j) == 1);
+
+    // messages without a DNS message or time are ignored
+    set_message(&d, dns, DNSTAP_MESSAGE_TYPE_CLIENT_QUERY, 1, 1, query_time(QUERIES));
+    d.message.has_query_message = false;
+    assert(dnswire_join_add(&j, &d) == dnswire_again);
+    assert(dnswire_join_ignored(j) == 1);
+
+    dnswire_join_expire(&j, UINT64_MAX);
+    assert(dnswire_join_outstanding(j) == 0);
+    assert(dnswire_join_expired(j) == QUERIES - responses + 1);
+    dnswire_join_destroy(&j);
+
+    /*
+     * The table never grows, when full queries are dropped until older
+     * ones expire.
+     */
+    assert(dnswire_join_init(&j, 8, 1000000000ULL) == dnswire_ok);
+    for (i = 0; i < 20; i++) {
+        set_message(&d, dns, DNSTAP_MESSAGE_TYPE_RESOLVER_QUERY, 1024 + i, i, query_time(0));
+        assert(dnswire_join_add(&j, &d) == dnswire_ok);
+    }
+    assert(dnswire_join_outstanding(j) == 8);
+    assert(dnswire_join_dropped(j) == 12);
+    set_message(&d, dns, DNSTAP_MESSAGE_TYPE_RESOLVER_QUERY, 1, 1, query_time(2000));
+    assert(dnswire_join_add(&j, &d) == dnswire_ok);
+    assert(dnswire_join_dropped(j) == 12);
+    assert(dnswire_join_expired(j) > 0);
+    assert(dnswire_join_outstanding(j) == 9 - dnswire_join_expired(j));
+    dnswire_join_expire(&j, 0);
+    assert(dnswire_join_expired(j) == 8);
+    assert(dnswire_join_outstanding(j) == 1);
+    dnswire_join_destroy(&j);
+
+    assert(dnswire_join_init(&j, 0, 0) == dnswire_error);
+
+    return 0;
+}
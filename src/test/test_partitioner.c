@@ -0,0 +1,200 @@
+#include <dnswire/partitioner.h>
+#include <dnswire/writer.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+#define FILE_NAME "test_partitioner.dnstap"
+#define BAD_FILE_NAME "test_partitioner_bad.dnstap"
+#define MESSAGES 5000
+#define PARTS 8
+
+static void create_file(void)
+{
+    struct dnswire_writer w;
+    struct dnstap         d = DNSTAP_INITIALIZER;
+    char                  id[32];
+    size_t                n = 1;
+    int                   fd;
+
+    assert((fd = open(FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_writer_init(&w) == dnswire_ok);
+    create_dnstap(&d, "");
+    snprintf(id, sizeof(id), "%zu", n);
+    dnstap_set_identity_string(d, id);
+    dnswire_writer_set_dnstap(w, &d);
+
+    while (1) {
+        enum dnswire_result res = dnswire_writer_write(&w, fd);
+        if (res == dnswire_ok) {
+            if (n == MESSAGES) {
+                assert(dnswire_writer_stop(&w) == dnswire_ok);
+                continue;
+            }
+            snprintf(id, sizeof(id), "%zu", ++n);
+            dnstap_set_identity_string(d, id);
+            dnswire_writer_set_dnstap(w, &d);
+        } else if (res == dnswire_endofdata) {
+            break;
+        } else {
+            assert(res == dnswire_again);
+        }
+    }
+
+    dnswire_writer_destroy(w);
+    close(fd);
+}
+
+// per partition results, combined once all are done
+static size_t last[PARTS], sum[PARTS];
+
+static void callback(size_t part, const struct dnstap* d, void* ctx)
+{
+    char   id[32];
+    size_t n;
+
+    assert(part < PARTS);
+    assert(ctx == last);
+    assert(dnstap_identity_length(*d) < sizeof(id));
+    memcpy(id, dnstap_identity(*d), dnstap_identity_length(*d));
+    id[dnstap_identity_length(*d)] = 0;
+    n                              = strtoul(id, 0, 10);
+
+    // in order within a partition
+    assert(n > last[part]);
+    last[part] = n;
+    sum[part] += n;
+}
+
+static void test_file(const char* file, bool use_mmap, size_t parts, size_t errors)
+{
+    struct dnswire_partitioner p;
+    struct dnswire_partition*  part;
+    size_t                     i, frames = 0, dnstaps = 0, errs = 0, total = 0;
+    int                        fd;
+
+    memset(last, 0, sizeof(last));
+    memset(sum, 0, sizeof(sum));
+
+    assert((fd = open(file, O_RDONLY)) > -1);
+    assert(dnswire_partitioner_init(&p, fd, use_mmap) == dnswire_ok);
+    assert(dnswire_partitioner_is_mapped(p) == use_mmap);
+    dnswire_partitioner_set_callback(p, callback, last);
+    assert(dnswire_partitioner_scan(&p, parts) == dnswire_ok);
+    assert(p.stopped);
+    assert(dnswire_partitioner_partitions(p) == parts);
+
+    for (i = 0; i < parts; i++) {
+        part = dnswire_partitioner_partition(p, i);
+        assert(part->frames);
+        if (i) {
+            // ranges follow each other
+            struct dnswire_partition* prev = dnswire_partitioner_partition(p, i - 1);
+            assert(prev->offset + prev->length == part->offset);
+        }
+        frames += part->frames;
+    }
+    assert(frames == MESSAGES + errors);
+
+    assert(dnswire_partitioner_run(&p) == dnswire_ok);
+    for (i = 0; i < parts; i++) {
+        part = dnswire_partitioner_partition(p, i);
+        assert(part->result == dnswire_ok);
+        dnstaps += part->dnstaps;
+        errs += part->errors;
+        total += sum[i];
+    }
+    assert(dnstaps == MESSAGES);
+    assert(errs == errors);
+    assert(total == (size_t)MESSAGES * (MESSAGES + 1) / 2);
+
+    // a single partition processed in this thread
+    memset(last, 0, sizeof(last));
+    assert(dnswire_partitioner_scan(&p, 1) == dnswire_ok);
+    assert(dnswire_partitioner_partitions(p) == 1);
+    assert(dnswire_partitioner_process(&p, 0) == dnswire_ok);
+    assert(dnswire_partitioner_partition(p, 0)->dnstaps == MESSAGES);
+    assert(last[0] == MESSAGES);
+
+    dnswire_partitioner_destroy(&p);
+    close(fd);
+}
+
+/*
+ * Copy the file with a frame that is not DNSTAP after the START frame.
+ */
+static void create_bad_file(void)
+{
+    struct dnswire_partitioner p;
+    uint8_t                    buf[4096], bad[] = { 0, 0, 0, 3, 0xff, 0xff, 0xff };
+    ssize_t                    n;
+    size_t                     start;
+    int                        in, out;
+
+    assert((in = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_partitioner_init(&p, in, true) == dnswire_ok);
+    assert(dnswire_partitioner_scan(&p, 1) == dnswire_ok);
+    start = dnswire_partitioner_partition(p, 0)->offset;
+    dnswire_partitioner_destroy(&p);
+
+    assert((out = open(BAD_FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(start <= sizeof(buf));
+    assert(read(in, buf, start) == (ssize_t)start);
+    assert(write(out, buf, start) == (ssize_t)start);
+    assert(write(out, bad, sizeof(bad)) == sizeof(bad));
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        assert(write(out, buf, n) == n);
+    }
+    close(in);
+    close(out);
+}
+
+static void test_truncated(void)
+{
+    struct dnswire_partitioner p;
+    struct stat                st;
+    size_t                     i, frames = 0;
+    int                        fd;
+
+    // drop the STOP frame (12 bytes) and half of the last frame
+    assert((fd = open(BAD_FILE_NAME, O_RDWR)) > -1);
+    assert(!fstat(fd, &st));
+    assert(!ftruncate(fd, st.st_size - 20));
+
+    assert(dnswire_partitioner_init(&p, fd, false) == dnswire_ok);
+    assert(dnswire_partitioner_scan(&p, 4) == dnswire_ok);
+    assert(!p.stopped);
+    for (i = 0; i < dnswire_partitioner_partitions(p); i++) {
+        frames += dnswire_partitioner_partition(p, i)->frames;
+    }
+    assert(frames == MESSAGES);
+    assert(dnswire_partitioner_run(&p) == dnswire_ok);
+    dnswire_partitioner_destroy(&p);
+
+    // not DNSTAP at all
+    assert(!ftruncate(fd, 0));
+    assert(pwrite(fd, "not a dnstap file", 17, 0) == 17);
+    assert(dnswire_partitioner_init(&p, fd, true) == dnswire_ok);
+    assert(dnswire_partitioner_scan(&p, 4) == dnswire_error);
+    dnswire_partitioner_destroy(&p);
+    close(fd);
+}
+
+int main(void)
+{
+    create_file();
+    test_file(FILE_NAME, true, PARTS, 0);
+    test_file(FILE_NAME, false, PARTS, 0);
+
+    create_bad_file();
+    test_file(BAD_FILE_NAME, true, 3, 1);
+    test_file(BAD_FILE_NAME, false, 3, 1);
+    test_truncated();
+
+    return 0;
+}
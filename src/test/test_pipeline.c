@@ -0,0 +1,118 @@
+#include <dnswire/pipeline.h>
+#include <dnswire/writer.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+#define FILE_NAME "test_pipeline.dnstap"
+#define MESSAGES 5000
+
+static void create_file(void)
+{
+    struct dnswire_writer w;
+    struct dnstap         d = DNSTAP_INITIALIZER;
+    char                  id[32];
+    size_t                n = 1;
+    int                   fd;
+
+    assert((fd = open(FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_writer_init(&w) == dnswire_ok);
+    create_dnstap(&d, "");
+    snprintf(id, sizeof(id), "%zu", n);
+    dnstap_set_identity_string(d, id);
+    dnswire_writer_set_dnstap(w, &d);
+
+    while (1) {
+        enum dnswire_result res = dnswire_writer_write(&w, fd);
+        if (res == dnswire_ok) {
+            if (n == MESSAGES) {
+                assert(dnswire_writer_stop(&w) == dnswire_ok);
+                continue;
+            }
+            snprintf(id, sizeof(id), "%zu", ++n);
+            dnstap_set_identity_string(d, id);
+            dnswire_writer_set_dnstap(w, &d);
+        } else if (res == dnswire_endofdata) {
+            break;
+        } else {
+            assert(res == dnswire_again);
+        }
+    }
+
+    dnswire_writer_destroy(w);
+    close(fd);
+}
+
+static size_t identity(const struct dnstap* d)
+{
+    char id[32];
+
+    assert(dnstap_identity_length(*d) < sizeof(id));
+    memcpy(id, dnstap_identity(*d), dnstap_identity_length(*d));
+    id[dnstap_identity_length(*d)] = 0;
+
+    return strtoul(id, 0, 10);
+}
+
+static void test_pipeline(size_t threads, size_t window, size_t stop_at)
+{
+    struct dnswire_pipeline       p;
+    struct dnswire_pipeline_stats stats;
+    enum dnswire_result           res;
+    size_t                        n = 0;
+    int                           fd;
+
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_pipeline_init(&p, threads, window) == dnswire_ok);
+    assert(dnswire_pipeline_threads(p) == threads);
+    assert(dnswire_pipeline_window(p) == window);
+    assert(dnswire_pipeline_start(&p, fd) == dnswire_ok);
+
+    while ((res = dnswire_pipeline_next(&p)) == dnswire_have_dnstap) {
+        // messages come out in the order of the stream
+        assert(identity(dnswire_pipeline_dnstap(p)) == ++n);
+        if (n == stop_at) {
+            break;
+        }
+    }
+    dnswire_pipeline_stats(&p, &stats);
+    assert(stats.dnstaps == n);
+    assert(stats.frames <= n + window);
+    assert(!stats.errors);
+
+    if (stop_at) {
+        assert(n == stop_at);
+        assert(dnswire_pipeline_stop(&p) == dnswire_ok);
+        assert(dnswire_pipeline_next(&p) == dnswire_error);
+    } else {
+        assert(res == dnswire_endofdata);
+        assert(n == MESSAGES);
+        assert(stats.frames == MESSAGES);
+        assert(dnswire_pipeline_next(&p) == dnswire_endofdata);
+        assert(dnswire_pipeline_stop(&p) == dnswire_ok);
+    }
+
+    dnswire_pipeline_destroy(&p);
+    close(fd);
+}
+
+int main(void)
+{
+    struct dnswire_pipeline p;
+
+    assert(dnswire_pipeline_init(&p, 0, 1) == dnswire_error);
+    assert(dnswire_pipeline_init(&p, 1, 0) == dnswire_error);
+
+    create_file();
+
+    test_pipeline(1, 1, 0);
+    test_pipeline(4, 8, 0);
+    test_pipeline(8, DNSWIRE_PIPELINE_DEFAULT_WINDOW, 0);
+    test_pipeline(4, 16, 100);
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include <dnswire/pool.h>
+#include <dnswire/collector.h>
+#include <dnswire/writer.h>
+
+#include <assert.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+#define SOURCES 4
+
+static size_t frames[SOURCES] = { 2000, 50, 50, 50 };
+static size_t last[SOURCES];
+static size_t count[SOURCES];
+static bool   ordered;
+
+static void callback(size_t worker, void* source_ctx, const struct dnstap* d, void* ctx)
+{
+    size_t s, n;
+    char   id[32];
+
+    assert(ctx == count);
+    assert(dnstap_identity_length(*d) < sizeof(id));
+    memcpy(id, dnstap_identity(*d), dnstap_identity_length(*d));
+    id[dnstap_identity_length(*d)] = 0;
+    assert(sscanf(id, "%zu:%zu", &s, &n) == 2);
+    assert(s < SOURCES);
+    assert(source_ctx == &frames[s]);
+
+    if (ordered) {
+        // batches of a source are never decoded in parallel
+        assert(n == last[s] + 1);
+        last[s] = n;
+    }
+    __atomic_add_fetch(&count[s], 1, __ATOMIC_RELAXED);
+}
+
+static void test_pool(size_t workers, bool order)
+{
+    struct dnswire_pool         pool;
+    struct dnswire_pool_stats   stats;
+    struct dnswire_pool_source* sources[SOURCES];
+    struct dnswire_pool_batch*  batches[SOURCES] = { 0 };
+    struct dnstap               d                = DNSTAP_INITIALIZER;
+    uint8_t                     buf[512];
+    char                        id[32];
+    size_t                      s, n, total = 0, dnstaps = 0, errors = 0;
+
+    ordered = order;
+    memset(last, 0, sizeof(last));
+    memset(count, 0, sizeof(count));
+
+    assert(dnswire_pool_init(&pool, workers, 2, order) == dnswire_ok);
+    assert(dnswire_pool_workers(pool) == workers);
+    dnswire_pool_set_callback(pool, callback, count);
+    assert(dnswire_pool_start(&pool) == dnswire_ok);
+
+    for (s = 0; s < SOURCES; s++) {
+        assert((sources[s] = dnswire_pool_source_new(&frames[s])));
+    }
+    create_dnstap(&d, "");
+
+    for (n = 1; n <= frames[0]; n++) {
+        for (s = 0; s < SOURCES; s++) {
+            if (n > frames[s]) {
+                continue;
+            }
+            snprintf(id, sizeof(id), "%zu:%zu", s, n);
+            dnstap_set_identity_string(d, id);
+            assert(dnstap_encode_protobuf_size(&d) <= sizeof(buf));
+            assert(dnswire_pool_add(&pool, &batches[s], sources[s], buf, dnstap_encode_protobuf(&d, buf)) == dnswire_ok);
+            total++;
+        }
+    }
+    // not a DNSTAP message
+    assert(dnswire_pool_add(&pool, &batches[1], sources[1], (const uint8_t*)"\xff\xff\xff", 3) == dnswire_ok);
+
+    for (s = 0; s < SOURCES; s++) {
+        assert(dnswire_pool_flush(&pool, &batches[s]) == dnswire_ok);
+        assert(!batches[s]);
+        dnswire_pool_source_unref(sources[s]);
+    }
+    assert(dnswire_pool_drain(&pool) == dnswire_ok);
+    assert(!pool.queued);
+
+    for (s = 0; s < SOURCES; s++) {
+        assert(count[s] == frames[s]);
+        if (order) {
+            assert(last[s] == frames[s]);
+        }
+    }
+    for (n = 0; n < workers; n++) {
+        dnswire_pool_stats(&pool, n, &stats);
+        dnstaps += stats.dnstaps;
+        errors += stats.errors;
+    }
+    assert(dnstaps == total);
+    assert(errors == 1);
+
+    assert(dnswire_pool_stop(&pool) == dnswire_ok);
+    // empty batches are just freed, others fail once stopped
+    assert(dnswire_pool_submit(&pool, dnswire_pool_batch_new(0, 0)) == dnswire_ok);
+    batches[0] = dnswire_pool_batch_new(0, 0);
+    assert(dnswire_pool_batch_add(batches[0], buf, 1) == dnswire_ok);
+    assert(dnswire_pool_flush(&pool, &batches[0]) == dnswire_error);
+    dnswire_pool_destroy(&pool);
+}
+
+static size_t collected;
+
+static void collect(size_t worker, void* source_ctx, const struct dnstap* d, void* ctx)
+{
+    struct dnswire_collector*       c     = ctx;
+    struct dnswire_collector_shard* shard = source_ctx;
+
+    assert(shard->collector == c);
+    assert(dnstap_has_identity(*d));
+    __atomic_add_fetch(&collected, 1, __ATOMIC_RELAXED);
+}
+
+static void test_collector(void)
+{
+    struct dnswire_collector       c;
+    struct dnswire_collector_stats s;
+    struct dnswire_pool            pool;
+    struct dnswire_writer          w;
+    struct dnstap                  d = DNSTAP_INITIALIZER;
+    struct sockaddr_in             addr;
+    size_t                         i, num, wait;
+    int                            fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    assert(dnswire_pool_init(&pool, 2, DNSWIRE_POOL_DEFAULT_DEQUE_SIZE, true) == dnswire_ok);
+    dnswire_pool_set_callback(pool, collect, &c);
+    assert(dnswire_pool_start(&pool) == dnswire_ok);
+
+    assert(dnswire_collector_init(&c, (struct sockaddr*)&addr, sizeof(addr), 2) == dnswire_ok);
+    dnswire_collector_set_pool(c, &pool);
+    assert(dnswire_collector_listen(&c) == dnswire_ok);
+    assert(dnswire_collector_start(&c) == dnswire_ok);
+
+    create_dnstap(&d, "test_pool");
+    for (i = 0; i < 3; i++) {
+        assert((fd = socket(AF_INET, SOCK_STREAM, 0)) > -1);
+        assert(!connect(fd, (struct sockaddr*)&c.addr, c.addrlen));
+        assert(dnswire_writer_init(&w) == dnswire_ok);
+        dnswire_writer_set_dnstap(w, &d);
+        for (num = 300; num;) {
+            enum dnswire_result res = dnswire_writer_write(&w, fd);
+            if (res == dnswire_ok) {
+                if (!--num) {
+                    assert(dnswire_writer_stop(&w) == dnswire_ok);
+                }
+            } else {
+                assert(res == dnswire_again);
+            }
+        }
+        while (dnswire_writer_write(&w, fd) != dnswire_endofdata)
+            ;
+        dnswire_writer_destroy(w);
+        close(fd);
+    }
+
+    for (wait = 0; wait < 500; wait++) {
+        size_t closed = 0;
+        for (i = 0; i < 2; i++) {
+            dnswire_collector_stats(&c, i, &s);
+            closed += s.closed;
+        }
+        if (closed == 3) {
+            break;
+        }
+        usleep(10000);
+    }
+    assert(dnswire_collector_stop(&c) == dnswire_ok);
+    assert(dnswire_collector_join(&c) == dnswire_ok);
+    assert(dnswire_pool_drain(&pool) == dnswire_ok);
+    assert(collected == 900);
+
+    num = 0;
+    for (i = 0; i < 2; i++) {
+        dnswire_collector_stats(&c, i, &s);
+        num += s.dnstaps;
+    }
+    assert(num == 900);
+
+    dnswire_collector_destroy(&c);
+    assert(dnswire_pool_stop(&pool) == dnswire_ok);
+    dnswire_pool_destroy(&pool);
+}
+
+int main(void)
+{
+    test_pool(1, true);
+    test_pool(4, true);
+    test_pool(4, false);
+    test_collector();
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <dnswire/publisher.h>
+#include <dnswire/reader.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "count_dnstap.c"
+
+int main(int argc, const char* argv[])
+{
+    assert(argc > 1);
+
+    struct dnswire_publisher         p;
+    struct dnswire_publisher_client *fast, *slow, *popper;
+    struct dnswire_reader            r;
+    struct dnswire_frame*            f;
+    int                              fds[2], fd;
+    size_t                           n = 0;
+
+    assert(dnswire_publisher_init(&p) == dnswire_ok);
+    dnswire_publisher_set_queue_size(p, 4);
+    dnswire_publisher_set_max_drops(p, 2);
+
+    assert((fd = open("test_publisher.dnstap", O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert((fast = dnswire_publisher_add_client(&p, fd, 0)));
+    assert(pipe(fds) == 0);
+    assert((slow = dnswire_publisher_add_client(&p, fds[1], 0)));
+    assert((popper = dnswire_publisher_add_client(&p, -1, &n)));
+    assert(dnswire_publisher_num_clients(p) == 3);
+    assert(popper->ctx == &n);
+
+    // START is queued for all clients
+    assert(dnswire_frame_queue_length(fast->queue) == 1);
+    assert((f = dnswire_publisher_pop(&p, popper)));
+    assert(f == p.start && f->refs == 4);
+    dnswire_frame_unref(f);
+    assert(!dnswire_publisher_pop(&p, popper));
+
+    // publish the same messages many times, the slow client never writes
+    FILE* fp = fopen(argv[1], "r");
+    assert(fp);
+    assert(dnswire_reader_init(&r) == dnswire_ok);
+    while (n < 6) {
+        enum dnswire_result res = dnswire_reader_fread(&r, fp);
+        if (res == dnswire_have_dnstap) {
+            assert(dnswire_publisher_publish_dnstap(&p, dnswire_reader_dnstap(r)) == dnswire_ok);
+            n++;
+
+            assert(dnswire_publisher_write(&p, fast) == dnswire_ok);
+            assert((f = dnswire_publisher_pop(&p, popper)));
+            assert(f->refs == 1 || f->refs == 2);
+            dnswire_frame_unref(f);
+        } else if (res == dnswire_endofdata) {
+            rewind(fp);
+            dnswire_reader_destroy(r);
+            assert(dnswire_reader_init(&r) == dnswire_ok);
+        } else {
+            assert(res == dnswire_again || res == dnswire_need_more);
+        }
+    }
+    dnswire_reader_destroy(r);
+    fclose(fp);
+
+    assert(p.published == 6);
+    assert(slow->state == dnswire_publisher_client_evicted);
+    assert(dnswire_frame_queue_is_empty(slow->queue));
+    assert(slow->queue.dropped == 3);
+    assert(p.evicted == 1);
+    assert(dnswire_publisher_write(&p, slow) == dnswire_error);
+    assert(fast->queue.written == 7 && !fast->queue.dropped);
+    dnswire_publisher_remove_client(&p, slow);
+    assert(dnswire_publisher_num_clients(p) == 2);
+    close(fds[0]);
+    close(fds[1]);
+
+    // nothing is published to stopping clients
+    assert(dnswire_publisher_stop(&p) == dnswire_ok);
+    assert((f = dnswire_frame_new(1)));
+    assert(dnswire_publisher_publish(&p, f) == dnswire_ok);
+    assert(f->refs == 1);
+    dnswire_frame_unref(f);
+
+    assert(dnswire_publisher_write(&p, fast) == dnswire_endofdata);
+    assert(fast->state == dnswire_publisher_client_done);
+    assert((f = dnswire_publisher_pop(&p, popper)));
+    assert(f == p.stop);
+    dnswire_frame_unref(f);
+    assert(!dnswire_publisher_pop(&p, popper));
+    assert(popper->state == dnswire_publisher_client_done);
+    close(fd);
+
+    dnswire_publisher_destroy(&p);
+    assert(!p.clients && !p.num_clients);
+
+    assert(count_dnstap("test_publisher.dnstap") == 6);
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include <dnswire/query.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+#define FILE_NAME "test_query.dnswcol"
+#define MESSAGES 10000
+#define GROUP_ROWS 1000
+
+static void create_file(void)
+{
+    struct dnswire_columnar_writer w;
+    struct dnstap                  d = DNSTAP_INITIALIZER;
+    char                           id[32];
+    uint8_t                        address[4] = { 10, 0, 0, 0 };
+    size_t                         n;
+    int                            fd;
+
+    assert((fd = open(FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_columnar_writer_init(&w, dnswire_compression_none) == dnswire_ok);
+    dnswire_columnar_writer_set_group_rows(w, GROUP_ROWS);
+    assert(dnswire_columnar_writer_open(&w, fd) == dnswire_ok);
+
+    create_dnstap(&d, "");
+    for (n = 0; n < MESSAGES; n++) {
+        snprintf(id, sizeof(id), "server%zu", n % 3);
+        dnstap_set_identity_string(d, id);
+        // port 1000 + n % 20 for all but every 10th message which has 53
+        dnstap_message_set_query_port(d, n % 10 ? 1000 + n % 20 : 53);
+        dnstap_message_set_query_time_sec(d, 1600000000 + n / 10);
+        address[3] = n % 2;
+        dnstap_message_set_query_address(d, address, sizeof(address));
+        assert(dnswire_columnar_writer_write(&w, &d) == dnswire_ok);
+    }
+    assert(dnswire_columnar_writer_close(&w) == dnswire_ok);
+    dnswire_columnar_writer_destroy(&w);
+    close(fd);
+}
+
+struct rows {
+    size_t given;
+};
+
+static void row(const struct dnswire_column_data* columns, size_t i, void* ctx)
+{
+    struct rows* r = ctx;
+
+    assert(dnswire_column_data_value(columns[dnswire_column_query_time_sec], i) >= 1600000500);
+    assert(dnswire_column_data_value(columns[dnswire_column_query_port], i) == 53);
+    assert(dnswire_column_data_length(columns[dnswire_column_identity], i) == 7);
+    r->given++;
+}
+
+int main(void)
+{
+    struct dnswire_columnar_reader r;
+    struct dnswire_query           q;
+    uint8_t                        address[4] = { 10, 0, 0, 1 };
+    int                            fd;
+
+    create_file();
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_columnar_reader_init(&r) == dnswire_ok);
+    assert(dnswire_columnar_reader_open(&r, fd) == dnswire_ok);
+    assert(dnswire_columnar_reader_groups(r) == MESSAGES / GROUP_ROWS);
+
+    /*
+     * Count over a time range, only the groups in the range are read and
+     * only the time column of those.
+     */
+    assert(dnswire_query_init(&q) == dnswire_ok);
+    assert(dnswire_query_add_filter(&q, dnswire_column_query_time_sec, dnswire_query_ge, 1600000250) == dnswire_ok);
+    assert(dnswire_query_add_filter(&q, dnswire_column_query_time_sec, dnswire_query_lt, 1600000450) == dnswire_ok);
+    assert(dnswire_query_run(&q, &r, 4) == dnswire_ok);
+    assert(dnswire_query_matched(q) == 2000);
+    assert(dnswire_query_scanned(q) == 3);
+    assert(dnswire_query_skipped(q) == 7);
+    printf("time range: matched %zu, scanned %zu, skipped %zu, read %zu\n", dnswire_query_matched(q), dnswire_query_scanned(q), dnswire_query_skipped(q), dnswire_query_bytes_read(q));
+    assert(dnswire_query_groups(q) == 0);
+
+    // running again gives the same
+    assert(dnswire_query_run(&q, &r, 1) == dnswire_ok);
+    assert(dnswire_query_matched(q) == 2000);
+    dnswire_query_destroy(&q);
+
+    /*
+     * Top 3 ports for a client address.
+     */
+    assert(dnswire_query_init(&q) == dnswire_ok);
+    assert(dnswire_query_add_filter_bytes(&q, dnswire_column_query_address, dnswire_query_eq, address, sizeof(address)) == dnswire_ok);
+    dnswire_query_set_group_by(q, dnswire_column_query_port);
+    dnswire_query_set_limit(q, 3);
+    assert(dnswire_query_run(&q, &r, 4) == dnswire_ok);
+    assert(dnswire_query_matched(q) == MESSAGES / 2);
+    assert(dnswire_query_groups(q) == 3);
+    // odd messages have odd ports 1001..1019 (not 53 as n % 10 != 0)
+    assert(dnswire_query_group(q, 0)->value == 1001 && dnswire_query_group(q, 0)->count == MESSAGES / 20);
+    assert(dnswire_query_group(q, 1)->value == 1003);
+    assert(dnswire_query_group(q, 2)->value == 1005);
+    dnswire_query_destroy(&q);
+
+    /*
+     * Group by a bytes column.
+     */
+    assert(dnswire_query_init(&q) == dnswire_ok);
+    assert(dnswire_query_add_filter(&q, dnswire_column_query_port, dnswire_query_eq, 53) == dnswire_ok);
+    dnswire_query_set_group_by(q, dnswire_column_identity);
+    assert(dnswire_query_run(&q, &r, 3) == dnswire_ok);
+    assert(dnswire_query_matched(q) == MESSAGES / 10);
+    assert(dnswire_query_groups(q) == 3);
+    assert(dnswire_query_group(q, 0)->count + dnswire_query_group(q, 1)->count + dnswire_query_group(q, 2)->count == MESSAGES / 10);
+    assert(dnswire_query_group(q, 0)->count >= dnswire_query_group(q, 1)->count);
+    assert(dnswire_query_group(q, 0)->length == 7 && !memcmp(dnswire_query_group(q, 0)->bytes, "server", 6));
+    dnswire_query_destroy(&q);
+
+    /*
+     * Project the first rows.
+     */
+    struct rows rows = { 0 };
+    assert(dnswire_query_init(&q) == dnswire_ok);
+    assert(dnswire_query_add_filter(&q, dnswire_column_query_time_sec, dnswire_query_ge, 1600000500) == dnswire_ok);
+    assert(dnswire_query_add_filter(&q, dnswire_column_query_port, dnswire_query_eq, 53) == dnswire_ok);
+    assert(dnswire_query_add_project(&q, dnswire_column_identity) == dnswire_ok);
+    assert(dnswire_query_add_project(&q, dnswire_column_query_time_sec) == dnswire_ok);
+    dnswire_query_set_limit(q, 25);
+    dnswire_query_set_callback(q, row, &rows);
+    assert(dnswire_query_run(&q, &r, 4) == dnswire_ok);
+    assert(rows.given == 25);
+    dnswire_query_destroy(&q);
+
+    /*
+     * Nothing matches, no group is read.
+     */
+    assert(dnswire_query_init(&q) == dnswire_ok);
+    assert(dnswire_query_add_filter(&q, dnswire_column_query_port, dnswire_query_gt, 2000) == dnswire_ok);
+    assert(dnswire_query_run(&q, &r, 2) == dnswire_ok);
+    assert(dnswire_query_matched(q) == 0);
+    assert(dnswire_query_skipped(q) == MESSAGES / GROUP_ROWS);
+    assert(dnswire_query_bytes_read(q) == 0);
+
+    // invalid filters
+    assert(dnswire_query_add_filter(&q, dnswire_column_identity, dnswire_query_eq, 0) == dnswire_error);
+    assert(dnswire_query_add_filter_bytes(&q, dnswire_column_identity, dnswire_query_lt, address, 1) == dnswire_error);
+    assert(dnswire_query_add_filter_bytes(&q, dnswire_column_query_port, dnswire_query_eq, address, 1) == dnswire_error);
+    dnswire_query_destroy(&q);
+
+    dnswire_columnar_reader_destroy(&r);
+    close(fd);
+    unlink(FILE_NAME);
+
+    return 0;
+}
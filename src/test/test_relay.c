@@ -0,0 +1,113 @@
+#include <dnswire/relay.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "count_dnstap.c"
+
+int main(int argc, const char* argv[])
+{
+    assert(argc > 1);
+
+    int                        fds[2];
+    uint8_t                    payload[] = "payload";
+    struct dnswire_frame*      f;
+    struct dnswire_frame_queue q;
+
+    // frame
+    assert((f = dnswire_frame_copy(payload, sizeof(payload))));
+    assert(f->length == TINYFRAME_HEADER_SIZE + sizeof(payload));
+    assert(dnswire_frame_payload_length(f) == sizeof(payload));
+    assert(!memcmp(dnswire_frame_payload(f), payload, sizeof(payload)));
+    assert(dnswire_frame_ref(f) == f);
+    assert(f->refs == 2);
+    dnswire_frame_unref(f);
+
+    // queue
+    assert(dnswire_frame_queue_init(&q, 2, dnswire_frame_queue_drop_oldest + 1) == dnswire_error);
+    assert(dnswire_frame_queue_init(&q, 2, dnswire_frame_queue_drop_newest) == dnswire_ok);
+    assert(dnswire_frame_queue_push(&q, f) == dnswire_ok);
+    assert(dnswire_frame_queue_push(&q, f) == dnswire_ok);
+    assert(dnswire_frame_queue_is_full(q));
+    assert(dnswire_frame_queue_push(&q, f) == dnswire_again);
+    assert(q.dropped == 1 && q.queued == 2 && f->refs == 3);
+    assert(dnswire_frame_queue_write(&q, -1) == dnswire_error);
+    assert(pipe(fds) == 0);
+    assert(dnswire_frame_queue_write(&q, fds[1]) == dnswire_ok);
+    assert(q.written == 2 && q.bytes == 2 * f->length && f->refs == 1);
+    assert(dnswire_frame_queue_write(&q, fds[1]) == dnswire_ok);
+    dnswire_frame_queue_destroy(&q);
+
+    // queue, never drop a partially written frame
+    assert(dnswire_frame_queue_init(&q, 2, dnswire_frame_queue_drop_oldest) == dnswire_ok);
+    assert(dnswire_frame_queue_push(&q, f) == dnswire_ok);
+    assert(dnswire_frame_queue_push(&q, f) == dnswire_ok);
+    q.offset = 1;
+    assert(dnswire_frame_queue_push(&q, f) == dnswire_again);
+    assert(q.dropped == 1 && q.len == 2 && q.offset == 1);
+    assert(dnswire_frame_queue_write(&q, fds[1]) == dnswire_ok);
+    assert(q.bytes == 2 * f->length - 1);
+    dnswire_frame_queue_destroy(&q);
+    assert(dnswire_frame_queue_init(&q, 1, dnswire_frame_queue_drop_oldest) == dnswire_ok);
+    assert(dnswire_frame_queue_push(&q, f) == dnswire_ok);
+    q.offset = 1;
+    assert(dnswire_frame_queue_push(&q, f) == dnswire_again);
+    assert(q.dropped == 1 && q.len == 1);
+    dnswire_frame_queue_destroy(&q);
+    assert(f->refs == 1);
+    dnswire_frame_unref(f);
+    close(fds[0]);
+    close(fds[1]);
+
+    // relay to two files and one stalled destination
+    struct dnswire_relay r;
+    int                  in, out1, out2;
+    assert(dnswire_relay_init(&r) == dnswire_ok);
+    assert((in = open(argv[1], O_RDONLY)) != -1);
+    assert((out1 = open("test_relay1.dnstap", O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1);
+    assert((out2 = open("test_relay2.dnstap", O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1);
+    assert(pipe(fds) == 0);
+    assert(dnswire_relay_add_destination(&r, out1, false, 16, dnswire_frame_queue_drop_newest) == dnswire_ok);
+    assert(dnswire_relay_add_destination(&r, out2, false, 16, dnswire_frame_queue_drop_oldest) == dnswire_ok);
+    assert(dnswire_relay_add_destination(&r, fds[1], false, 1, dnswire_frame_queue_drop_oldest) == dnswire_ok);
+    assert(dnswire_relay_destinations(r) == 3);
+
+    enum dnswire_result res;
+    while ((res = dnswire_relay_read(&r, in)) != dnswire_endofdata) {
+        assert(res != dnswire_error);
+        assert(dnswire_relay_write(&r, 0) != dnswire_error);
+    }
+    assert(dnswire_relay_received(r) == 2);
+    assert(dnswire_relay_destination(r, 2)->queue.dropped == 1);
+    assert(dnswire_relay_destination(r, 2)->stop);
+
+    while ((res = dnswire_relay_write(&r, 0)) != dnswire_endofdata) {
+        assert(res != dnswire_error);
+    }
+    while ((res = dnswire_relay_write(&r, 1)) != dnswire_endofdata) {
+        assert(res != dnswire_error);
+    }
+    assert(dnswire_relay_write(&r, 1) == dnswire_endofdata);
+    assert(dnswire_relay_destination(r, 0)->queue.written == 2);
+    assert(dnswire_relay_destination(r, 1)->queue.written == 2);
+
+    // a failing destination does not affect the others
+    r.destinations[2].fd = -1;
+    assert(dnswire_relay_write(&r, 2) == dnswire_error);
+    assert(dnswire_relay_destination(r, 2)->state == dnswire_relay_destination_failed);
+    assert(dnswire_relay_write(&r, 2) == dnswire_error);
+
+    dnswire_relay_destroy(&r);
+    close(in);
+    close(out1);
+    close(out2);
+    close(fds[0]);
+    close(fds[1]);
+
+    assert(count_dnstap("test_relay1.dnstap") == 2);
+    assert(count_dnstap("test_relay2.dnstap") == 2);
+
+    return 0;
+}
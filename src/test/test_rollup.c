@@ -0,0 +1,229 @@
+#include <dnswire/rollup.h>
+#include <dnswire/reader.h>
+#include <dnswire/writer.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_NAME "test_rollup.dnstap"
+#define ROLLUP_NAME "test_rollup.dnswrlp"
+#define MESSAGES 600
+#define BASE 1600000020
+
+/*
+ * Two messages per second starting on a minute, queries and responses
+ * from two identities, responses with RCODE 0, 2 or 3.
+ */
+static uint8_t dns[12];
+
+static void set_message(struct dnstap* d, size_t n)
+{
+    bool        response = n & 1;
+    uint64_t    sec      = BASE + n / 2;
+    const char* identity = n & 2 ? "b" : "a";
+
+    dnstap_set_type(*d, DNSTAP_TYPE_MESSAGE);
+    dnstap_set_identity_string(*d, identity);
+    if (response) {
+        dnstap_message_set_type(*d, DNSTAP_MESSAGE_TYPE_CLIENT_RESPONSE);
+    } else {
+        dnstap_message_set_type(*d, DNSTAP_MESSAGE_TYPE_CLIENT_QUERY);
+    }
+    dnstap_message_set_socket_protocol(*d, DNSTAP_SOCKET_PROTOCOL_UDP);
+    memset(dns, 0, sizeof(dns));
+    dns[3] = response ? ((n / 2) % 3 ? (n / 2) % 3 + 1 : 0) : 0;
+    if (response) {
+        dnstap_message_set_response_time_sec(*d, sec);
+        dnstap_message_set_response_message(*d, dns, sizeof(dns));
+        d->message.has_query_time_sec = false;
+        d->message.has_query_message  = false;
+    } else {
+        dnstap_message_set_query_time_sec(*d, sec);
+        dnstap_message_set_query_message(*d, dns, sizeof(dns));
+        d->message.has_response_time_sec = false;
+        d->message.has_response_message  = false;
+    }
+}
+
+static void create_file(void)
+{
+    struct dnswire_writer w;
+    struct dnstap         d = DNSTAP_INITIALIZER;
+    size_t                n = 0;
+    int                   fd;
+
+    assert((fd = open(FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_writer_init(&w) == dnswire_ok);
+    set_message(&d, n);
+    dnswire_writer_set_dnstap(w, &d);
+
+    while (1) {
+        enum dnswire_result res = dnswire_writer_write(&w, fd);
+        if (res == dnswire_ok) {
+            if (++n == MESSAGES) {
+                assert(dnswire_writer_stop(&w) == dnswire_ok);
+                continue;
+            }
+            set_message(&d, n);
+            dnswire_writer_set_dnstap(w, &d);
+        } else if (res == dnswire_endofdata) {
+            break;
+        } else {
+            assert(res == dnswire_again);
+        }
+    }
+
+    dnswire_writer_destroy(w);
+    close(fd);
+}
+
+int main(void)
+{
+    struct dnswire_rollup        r, loaded;
+    struct dnswire_rollup_bucket b = DNSWIRE_ROLLUP_BUCKET_INITIALIZER;
+    struct dnswire_reader        reader;
+    struct dnstap                d = DNSTAP_INITIALIZER;
+    enum dnswire_result          res;
+    size_t                       i, buckets = 0, messages = 0, bytes = 0;
+    int                          fd, out, fds[2];
+    uint8_t                      buf[16];
+
+    create_file();
+
+    assert(dnswire_rollup_init(&r, 0) == dnswire_ok);
+    assert(dnswire_rollup_add_dimension(&r, dnswire_rollup_identity) == dnswire_ok);
+    assert(dnswire_rollup_add_dimension(&r, dnswire_rollup_message_type) == dnswire_ok);
+    assert(dnswire_rollup_add_dimension(&r, dnswire_rollup_rcode) == dnswire_ok);
+    assert(dnswire_rollup_add_dimension(&r, dnswire_rollup_rcode) == dnswire_error);
+    assert((out = open(ROLLUP_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    dnswire_rollup_set_fd(r, out);
+
+    /*
+     * The reader counts every message it decodes.
+     */
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_reader_init(&reader) == dnswire_ok);
+    dnswire_reader_set_rollup(reader, &r);
+    while ((res = dnswire_reader_read(&reader, fd)) != dnswire_endofdata) {
+        assert(res == dnswire_have_dnstap || res == dnswire_again || res == dnswire_need_more);
+    }
+    dnswire_reader_destroy(reader);
+    close(fd);
+
+    // 5 minutes, the last two are still open
+    assert(dnswire_rollup_flushed(r) == 3);
+    assert(dnswire_rollup_add_dimension(&r, dnswire_rollup_qtype) == dnswire_error);
+
+    // a message for the previous minute is still counted, older is late
+    set_message(&d, MESSAGES - 239);
+    assert(dnswire_rollup_add(&r, &d) == dnswire_ok);
+    set_message(&d, 0);
+    assert(dnswire_rollup_add(&r, &d) == dnswire_ok);
+    assert(dnswire_rollup_late(r) == 1);
+    assert(dnswire_rollup_ignored(r) == 0);
+    assert(dnswire_rollup_dropped(r) == 0);
+    assert(dnswire_rollup_failed(r) == 0);
+
+    assert(dnswire_rollup_flush(&r) == dnswire_ok);
+    assert(dnswire_rollup_flushed(r) == 5);
+    dnswire_rollup_destroy(&r);
+    close(out);
+
+    /*
+     * Read back the side file, each minute has 60 queries and 60
+     * responses (61 for the fourth), split over two identities.
+     */
+    assert((fd = open(ROLLUP_NAME, O_RDONLY)) > -1);
+    assert(dnswire_rollup_init(&loaded, 0) == dnswire_ok);
+    assert(dnswire_rollup_load(&loaded, fd) == dnswire_ok);
+    assert(loaded.interval == 60);
+    assert(loaded.num_dimensions == 3);
+    while ((res = dnswire_rollup_read(&loaded, &b, fd)) == dnswire_ok) {
+        size_t queries = 0, responses = 0, nxdomain = 0;
+
+        assert(b.start == BASE + buckets * 60);
+        for (i = 0; i < b.num_groups; i++) {
+            const uint8_t* id;
+            size_t         len;
+
+            assert((id = dnswire_rollup_group_identity(&loaded, &b, i, &len)));
+            assert(len == 1 && (id[0] == 'a' || id[0] == 'b'));
+            if (dnswire_rollup_group_value(&loaded, &b, i, dnswire_rollup_message_type) == DNSTAP_MESSAGE_TYPE_CLIENT_QUERY) {
+                assert(dnswire_rollup_group_value(&loaded, &b, i, dnswire_rollup_rcode) == DNSWIRE_ROLLUP_NONE);
+                queries += b.groups[i].messages;
+            } else {
+                uint16_t rcode = dnswire_rollup_group_value(&loaded, &b, i, dnswire_rollup_rcode);
+                assert(rcode == 0 || rcode == 2 || rcode == 3);
+                if (rcode == 3) {
+                    nxdomain += b.groups[i].messages;
+                }
+                responses += b.groups[i].messages;
+            }
+            assert(dnswire_rollup_group_value(&loaded, &b, i, dnswire_rollup_qtype) == DNSWIRE_ROLLUP_NONE);
+            messages += b.groups[i].messages;
+            bytes += b.groups[i].bytes;
+        }
+        assert(queries == 60);
+        assert(responses == (buckets == 3 ? 61 : 60));
+        assert(nxdomain == 20);
+        buckets++;
+    }
+    assert(res == dnswire_endofdata);
+    assert(buckets == 5);
+    assert(messages == MESSAGES + 1);
+    assert(bytes == (MESSAGES + 1) * sizeof(dns));
+
+    // a side file cut short in the dimensions does not load
+    assert(lseek(fd, 0, SEEK_SET) == 0);
+    assert(read(fd, buf, 16) == 16);
+    close(fd);
+    assert(pipe(fds) == 0);
+    assert(write(fds[1], buf, 16) == 16);
+    close(fds[1]);
+    assert(dnswire_rollup_load(&loaded, fds[0]) == dnswire_error);
+    close(fds[0]);
+
+    /*
+     * Failing to write the side file does not fail the reader, the
+     * messages are still returned and counted as failed.
+     */
+    assert(dnswire_rollup_init(&r, 1) == dnswire_ok);
+    assert((out = open(ROLLUP_NAME, O_RDONLY)) > -1);
+    dnswire_rollup_set_fd(r, out);
+    assert((fd = open(FILE_NAME, O_RDONLY)) > -1);
+    assert(dnswire_reader_init(&reader) == dnswire_ok);
+    dnswire_reader_set_rollup(reader, &r);
+    messages = 0;
+    while ((res = dnswire_reader_read(&reader, fd)) != dnswire_endofdata) {
+        if (res == dnswire_have_dnstap) {
+            messages++;
+        } else {
+            assert(res == dnswire_again || res == dnswire_need_more);
+        }
+    }
+    assert(messages == MESSAGES);
+    assert(dnswire_rollup_failed(r) > 0);
+    dnswire_reader_destroy(reader);
+    dnswire_rollup_destroy(&r);
+    close(fd);
+    close(out);
+
+    // without dimensions each interval has one group with the totals
+    assert(dnswire_rollup_init(&r, 0) == dnswire_ok);
+    set_message(&d, 0);
+    assert(dnswire_rollup_add(&r, &d) == dnswire_ok);
+    set_message(&d, 2);
+    assert(dnswire_rollup_add(&r, &d) == dnswire_ok);
+    assert(r.buckets[r.current].num_groups == 1);
+    assert(r.buckets[r.current].groups[0].length == 0);
+    assert(r.buckets[r.current].groups[0].messages == 2);
+    dnswire_rollup_destroy(&r);
+
+    dnswire_rollup_bucket_destroy(&b);
+    dnswire_rollup_destroy(&loaded);
+
+    return 0;
+}
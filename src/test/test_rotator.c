@@ -0,0 +1,159 @@
+#include <dnswire/rotator.h>
+#include <dnswire/reader.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+
+#define PATH "test_rotator.dnstap"
+
+/*
+ * Read a rotated file and return the number of messages, the file must be
+ * complete with START and STOP.
+ */
+static size_t messages(size_t seq)
+{
+    struct dnswire_reader r;
+    enum dnswire_result   res;
+    char                  name[64];
+    size_t                n = 0;
+    int                   fd;
+
+    snprintf(name, sizeof(name), "%s.%zu", PATH, seq);
+    assert((fd = open(name, O_RDONLY)) > -1);
+    assert(dnswire_reader_init(&r) == dnswire_ok);
+    while ((res = dnswire_reader_read(&r, fd)) != dnswire_endofdata) {
+        if (res == dnswire_have_dnstap) {
+            n++;
+            continue;
+        }
+        assert(res == dnswire_again || res == dnswire_need_more);
+    }
+    dnswire_reader_destroy(r);
+    close(fd);
+    unlink(name);
+
+    return n;
+}
+
+static bool exists(size_t seq)
+{
+    char        name[64];
+    struct stat st;
+
+    snprintf(name, sizeof(name), "%s.%zu", PATH, seq);
+    return !stat(name, &st);
+}
+
+static off_t file_size(size_t seq)
+{
+    char        name[64];
+    struct stat st;
+
+    snprintf(name, sizeof(name), "%s.%zu", PATH, seq);
+    assert(!stat(name, &st));
+    return st.st_size;
+}
+
+int main(void)
+{
+    struct dnswire_rotator r;
+    struct dnstap          d = DNSTAP_INITIALIZER;
+    size_t                 i, n;
+
+    create_dnstap(&d, "test_rotator");
+
+    // by frames, with preallocation
+    assert(dnswire_rotator_init(&r, PATH) == dnswire_ok);
+    dnswire_rotator_set_max_frames(r, 100);
+    dnswire_rotator_set_preallocate(r, 1024 * 1024);
+    assert(dnswire_rotator_write(&r, &d) == dnswire_error);
+    assert(dnswire_rotator_open(&r) == dnswire_ok);
+    assert(!strcmp(dnswire_rotator_file(r), PATH ".0"));
+    for (i = 0; i < 350; i++) {
+        assert(dnswire_rotator_write(&r, &d) == dnswire_ok);
+    }
+    assert(!strcmp(dnswire_rotator_file(r), PATH ".3"));
+    assert(r.rotations == 3);
+    assert(r.files == 4);
+    assert(dnswire_rotator_close(&r) == dnswire_ok);
+    dnswire_rotator_destroy(&r);
+
+    // truncated to the real size and the unused preopened file is removed
+    assert(file_size(0) < 1024 * 1024);
+    assert(!exists(4));
+    assert(messages(0) == 100);
+    assert(messages(1) == 100);
+    assert(messages(2) == 100);
+    assert(messages(3) == 50);
+
+    // by size
+    assert(dnswire_rotator_init(&r, PATH) == dnswire_ok);
+    dnswire_rotator_set_max_bytes(r, 10000);
+    assert(dnswire_rotator_open(&r) == dnswire_ok);
+    for (i = 0; i < 1000; i++) {
+        assert(dnswire_rotator_write(&r, &d) == dnswire_ok);
+    }
+    n = r.files;
+    assert(n > 2);
+    assert(dnswire_rotator_close(&r) == dnswire_ok);
+    dnswire_rotator_destroy(&r);
+    for (i = 0; i < n - 1; i++) {
+        assert(file_size(i) >= 10000);
+        assert(file_size(i) < 10000 + 512);
+    }
+    for (i = 0, n = 0; exists(i); i++) {
+        n += messages(i);
+    }
+    assert(n == 1000);
+
+    // by interval, rotates even if nothing is written
+    assert(dnswire_rotator_init(&r, PATH) == dnswire_ok);
+    dnswire_rotator_set_interval(r, 1);
+    assert(dnswire_rotator_open(&r) == dnswire_ok);
+    assert(dnswire_rotator_write(&r, &d) == dnswire_ok);
+    for (i = 0; i < 300 && !r.rotations; i++) {
+        usleep(10000);
+        assert(dnswire_rotator_check(&r) == dnswire_ok);
+    }
+    assert(r.rotations);
+    assert(dnswire_rotator_write(&r, &d) == dnswire_ok);
+    assert(dnswire_rotator_close(&r) == dnswire_ok);
+    dnswire_rotator_destroy(&r);
+    for (i = 0, n = 0; exists(i); i++) {
+        n += messages(i);
+    }
+    assert(n == 2);
+
+    // a new run continues after the files of the previous one
+    assert(dnswire_rotator_init(&r, PATH) == dnswire_ok);
+    dnswire_rotator_set_max_frames(r, 10);
+    assert(dnswire_rotator_open(&r) == dnswire_ok);
+    for (i = 0; i < 25; i++) {
+        assert(dnswire_rotator_write(&r, &d) == dnswire_ok);
+    }
+    assert(dnswire_rotator_close(&r) == dnswire_ok);
+    assert(exists(2) && !exists(3));
+
+    assert(dnswire_rotator_open(&r) == dnswire_ok);
+    assert(!strcmp(dnswire_rotator_file(r), PATH ".3"));
+    for (i = 0; i < 15; i++) {
+        assert(dnswire_rotator_write(&r, &d) == dnswire_ok);
+    }
+    assert(!strcmp(dnswire_rotator_file(r), PATH ".4"));
+    assert(dnswire_rotator_close(&r) == dnswire_ok);
+    dnswire_rotator_destroy(&r);
+
+    assert(messages(0) == 10);
+    assert(messages(1) == 10);
+    assert(messages(2) == 5);
+    assert(messages(3) == 10);
+    assert(messages(4) == 5);
+    assert(!exists(5));
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <dnswire/spool.h>
+#include <dnswire/reader.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "count_dnstap.c"
+
+static int collector = -1;
+
+static int _connect(void* ctx)
+{
+    (*(size_t*)ctx)++;
+    return collector > -1 ? dup(collector) : -1;
+}
+
+static void write_dnstaps(struct dnswire_spool* s, const char* file, size_t num)
+{
+    FILE* fp = fopen(file, "r");
+    assert(fp);
+
+    struct dnswire_reader r;
+    assert(dnswire_reader_init(&r) == dnswire_ok);
+
+    while (num) {
+        enum dnswire_result res = dnswire_reader_fread(&r, fp);
+        if (res == dnswire_have_dnstap) {
+            assert(dnswire_spool_write_dnstap(s, dnswire_reader_dnstap(r)) == dnswire_ok);
+            num--;
+        } else if (res == dnswire_endofdata) {
+            rewind(fp);
+            dnswire_reader_destroy(r);
+            assert(dnswire_reader_init(&r) == dnswire_ok);
+        } else {
+            assert(res == dnswire_again || res == dnswire_need_more);
+        }
+    }
+
+    dnswire_reader_destroy(r);
+    fclose(fp);
+}
+
+int main(int argc, const char* argv[])
+{
+    assert(argc > 1);
+
+    struct dnswire_spool s;
+    size_t               attempts = 0;
+    int                  fds[2], fd;
+    off_t                pending;
+
+    signal(SIGPIPE, SIG_IGN);
+    unlink("test_spool.spool");
+
+    assert(dnswire_spool_init(&s, "test_spool.spool") == dnswire_ok);
+    dnswire_spool_set_connect(s, _connect, &attempts);
+    dnswire_spool_set_reconnect_interval(s, 0);
+    dnswire_spool_set_sync_frames(s, 2);
+    assert(dnswire_spool_set_queue_size(&s, 0) == dnswire_error);
+    assert(dnswire_spool_set_queue_size(&s, 2) == dnswire_ok);
+
+    // collector is down, everything goes to the spool with group commit
+    assert(dnswire_spool_run(&s) == dnswire_again);
+    assert(attempts == 1 && s.state == dnswire_spool_disconnected);
+    write_dnstaps(&s, argv[1], 5);
+    assert(s.spooled == 5 && s.syncs == 2 && s.unsynced == 1);
+    assert(dnswire_spool_sync(&s) == dnswire_ok);
+    assert(s.syncs == 3 && !s.unsynced);
+    pending = dnswire_spool_pending(s);
+    assert(pending > 0);
+
+    // collector is broken, the handshake fails and nothing is lost
+    assert(pipe(fds) == 0);
+    close(fds[0]);
+    collector = fds[1];
+    assert(dnswire_spool_run(&s) == dnswire_again);
+    assert(s.connects == 1 && s.state == dnswire_spool_disconnected);
+    assert(dnswire_spool_pending(s) == pending);
+    close(fds[1]);
+    dnswire_spool_destroy(&s);
+
+    // reopening the spool truncates a partially written frame
+    assert((fd = open("test_spool.spool", O_WRONLY | O_APPEND)) > -1);
+    assert(write(fd, "\0\0\1\0abc", 7) == 7);
+    close(fd);
+    assert(dnswire_spool_init(&s, "test_spool.spool") == dnswire_ok);
+    assert(dnswire_spool_pending(s) == pending);
+    dnswire_spool_set_connect(s, _connect, &attempts);
+    dnswire_spool_set_reconnect_interval(s, 0);
+    assert(dnswire_spool_set_queue_size(&s, 2) == dnswire_ok);
+    dnswire_spool_set_replay_rate(s, 1024 * 1024);
+    s.tokens = 1024 * 1024;
+
+    // collector is back, the spool is replayed and then live frames are queued
+    assert((collector = open("test_spool.dnstap", O_WRONLY | O_CREAT | O_TRUNC, 0644)) > -1);
+    assert(dnswire_spool_run(&s) == dnswire_ok);
+    assert(dnswire_spool_is_connected(s));
+    assert(s.replayed == 5 && !dnswire_spool_pending(s) && !s.read_at);
+    write_dnstaps(&s, argv[1], 2);
+    assert(!s.spooled && dnswire_frame_queue_length(s.queue) == 2);
+    write_dnstaps(&s, argv[1], 1);
+    assert(s.spooled == 1);
+    assert(dnswire_spool_run(&s) == dnswire_ok);
+    assert(s.replayed == 6 && !dnswire_spool_pending(s));
+
+    // a frame larger than the replay rate is still replayed
+    dnswire_spool_set_replay_rate(s, 1);
+    s.tokens = 0;
+    write_dnstaps(&s, argv[1], 3);
+    assert(s.spooled == 2 && dnswire_spool_pending(s) > 1);
+    s.last_refill = 0;
+    assert(dnswire_spool_run(&s) == dnswire_ok);
+    assert(s.replayed == 7 && !dnswire_spool_pending(s) && !s.read_at);
+
+    assert(dnswire_spool_stop(&s) == dnswire_ok);
+    assert(dnswire_spool_run(&s) == dnswire_endofdata);
+    assert(s.state == dnswire_spool_done);
+    assert(dnswire_spool_write_dnstap(&s, &(struct dnstap)DNSTAP_INITIALIZER) == dnswire_error);
+    dnswire_spool_destroy(&s);
+    close(collector);
+
+    assert(count_dnstap("test_spool.dnstap") == 11);
+
+    return 0;
+}
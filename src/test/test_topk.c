@@ -0,0 +1,172 @@
+#include <dnswire/topk.h>
+#include <dnswire/batch.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define KEYS 1000
+#define COUNTERS 100
+#define NOISE 20000
+
+/*
+ * Key i is seen 10000 / i times, mixed with keys only seen once.
+ */
+static void feed(struct dnswire_topk* t, size_t part, size_t parts)
+{
+    size_t   i, n, seen = 0;
+    uint32_t key;
+
+    for (n = 0; n < 10000; n++) {
+        for (i = 1; i <= KEYS && n < 10000 / i; i++) {
+            if (seen++ % parts == part) {
+                key = i;
+                assert(dnswire_topk_add(t, (uint8_t*)&key, sizeof(key), 1) == dnswire_ok);
+            }
+            if (i == 1 && n < NOISE / 10) {
+                size_t k;
+                for (k = 0; k < 10; k++) {
+                    if (seen++ % parts == part) {
+                        key = KEYS + 1 + n * 10 + k;
+                        assert(dnswire_topk_add(t, (uint8_t*)&key, sizeof(key), 1) == dnswire_ok);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void check_top(const struct dnswire_topk* t)
+{
+    struct dnswire_topk_counter top[10];
+    uint32_t                    key;
+    size_t                      i;
+
+    assert(dnswire_topk_snapshot(t, top, 10) == 10);
+    for (i = 0; i < 10; i++) {
+        assert(top[i].length == sizeof(key));
+        memcpy(&key, top[i].key, sizeof(key));
+        assert(key == i + 1);
+        assert(top[i].count >= 10000 / (i + 1));
+        assert(top[i].count - top[i].error <= 10000 / (i + 1));
+    }
+}
+
+static uint8_t address[2][4] = { { 10, 0, 0, 1 }, { 10, 0, 0, 2 } };
+
+static void set_message(struct dnstap* d, uint8_t* dns, size_t* len, const char* name, size_t client, int rcode)
+{
+    enum dnstap_message_type type = rcode < 0 ? DNSTAP_MESSAGE_TYPE_CLIENT_QUERY : DNSTAP_MESSAGE_TYPE_CLIENT_RESPONSE;
+    const char*              p    = name;
+    size_t                   l    = 12;
+
+    memset(dns, 0, 12);
+    dns[3] = rcode;
+    dns[5] = 1;
+    while (*p) {
+        const char* dot = strchr(p, '.');
+        size_t      n   = dot ? (size_t)(dot - p) : strlen(p);
+        dns[l++]        = n;
+        memcpy(&dns[l], p, n);
+        l += n;
+        p += n + (dot ? 1 : 0);
+    }
+    dns[l++] = 0;
+    memset(&dns[l], 0, 4);
+    dns[l + 1] = 1;
+    dns[l + 3] = 1;
+    *len       = l + 4;
+
+    dnstap_set_type(*d, DNSTAP_TYPE_MESSAGE);
+    dnstap_message_set_type(*d, type);
+    dnstap_message_set_query_address(*d, address[client], sizeof(address[client]));
+    if (rcode < 0) {
+        dnstap_message_set_query_message(*d, dns, *len);
+        d->message.has_response_message = false;
+    } else {
+        dnstap_message_set_response_message(*d, dns, *len);
+        d->message.has_query_message = false;
+    }
+}
+
+int main(void)
+{
+    struct dnswire_topk         t, parts[4];
+    struct dnswire_topk_counter top[4];
+    size_t                      i;
+
+    assert(dnswire_topk_init(&t, dnswire_topk_client, COUNTERS) == dnswire_ok);
+    feed(&t, 0, 1);
+    printf("total %lu used %zu\n", (unsigned long)dnswire_topk_total(t), dnswire_topk_used(t));
+    assert(dnswire_topk_used(t) == COUNTERS);
+    check_top(&t);
+
+    /*
+     * Each worker counts its own part of the stream, merged they give the
+     * same top keys.
+     */
+    for (i = 0; i < 4; i++) {
+        assert(dnswire_topk_init(&parts[i], dnswire_topk_client, COUNTERS) == dnswire_ok);
+        feed(&parts[i], i, 4);
+    }
+    for (i = 1; i < 4; i++) {
+        assert(dnswire_topk_merge(&parts[0], &parts[i]) == dnswire_ok);
+    }
+    assert(dnswire_topk_total(parts[0]) == dnswire_topk_total(t));
+    check_top(&parts[0]);
+    for (i = 0; i < 4; i++) {
+        dnswire_topk_destroy(&parts[i]);
+    }
+
+    dnswire_topk_clear(&t);
+    assert(dnswire_topk_used(t) == 0);
+    assert(dnswire_topk_snapshot(&t, top, 4) == 0);
+    dnswire_topk_destroy(&t);
+
+    /*
+     * QNAMEs are counted lowercased, client and RCODE only from responses.
+     */
+    struct dnswire_topk  names, rcodes;
+    struct dnswire_batch b;
+    struct dnstap        d = DNSTAP_INITIALIZER;
+    uint8_t              dns[64];
+    size_t               len;
+    static const char*   qnames[] = { "www.example.com", "WWW.Example.COM", "a.example.net", "www.example.com" };
+    static const int     codes[]  = { -1, 3, 0, 3 };
+
+    assert(dnswire_topk_init(&names, dnswire_topk_qname, 8) == dnswire_ok);
+    assert(dnswire_topk_init(&rcodes, dnswire_topk_client_rcode, 8) == dnswire_ok);
+    assert(dnswire_batch_init(&b, 16) == dnswire_ok);
+    for (i = 0; i < 4; i++) {
+        set_message(&d, dns, &len, qnames[i], i & 1, codes[i]);
+        assert(dnswire_topk_add_dnstap(&names, &d) == dnswire_ok);
+        assert(dnswire_topk_add_dnstap(&rcodes, &d) == (codes[i] < 0 ? dnswire_again : dnswire_ok));
+        assert(dnswire_batch_add(&b, &d) == dnswire_ok);
+    }
+
+    assert(dnswire_topk_snapshot(&names, top, 4) == 2);
+    assert(top[0].count == 3);
+    assert(top[0].length == 17 && !memcmp(top[0].key, "\3www\7example\3com", 17));
+    assert(top[1].count == 1);
+    assert(dnswire_topk_snapshot(&rcodes, top, 4) == 2);
+    assert(top[0].count == 2 && top[0].length == 5 && !memcmp(top[0].key, "\12\0\0\2\3", 5));
+
+    // the same from the columns of a batch
+    dnswire_topk_clear(&names);
+    dnswire_topk_clear(&rcodes);
+    assert(dnswire_topk_add_columns(&names, b.columns) == dnswire_ok);
+    assert(dnswire_topk_add_columns(&rcodes, b.columns) == dnswire_ok);
+    assert(dnswire_topk_snapshot(&names, top, 4) == 2);
+    assert(top[0].count == 3);
+    assert(dnswire_topk_snapshot(&rcodes, top, 4) == 2);
+    assert(top[0].count == 2);
+    assert(dnswire_topk_total(rcodes) == 3);
+
+    assert(dnswire_topk_merge(&names, &rcodes) == dnswire_error);
+
+    dnswire_batch_destroy(&b);
+    dnswire_topk_destroy(&names);
+    dnswire_topk_destroy(&rcodes);
+
+    return 0;
+}
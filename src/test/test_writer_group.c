@@ -0,0 +1,93 @@
+#include <dnswire/writer_group.h>
+#include <dnswire/reader.h>
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "create_dnstap.c"
+#include "count_dnstap.c"
+
+int main(void)
+{
+    struct dnswire_writer_group g;
+    struct dnstap               d = DNSTAP_INITIALIZER;
+    uint8_t                     a1[4] = { 10, 0, 0, 1 }, a2[4] = { 10, 0, 0, 2 };
+    const char*                 files[3] = { "test_writer_group1.dnstap", "test_writer_group2.dnstap", "test_writer_group3.dnstap" };
+    size_t                      i, sum, done;
+
+    create_dnstap(&d, "test_writer_group");
+
+    assert(dnswire_writer_group_init(&g, dnswire_writer_group_client_address + 1) == dnswire_error);
+
+    // round-robin, failover and no active connection
+    assert(dnswire_writer_group_init(&g, dnswire_writer_group_round_robin) == dnswire_ok);
+    assert(dnswire_writer_group_write_dnstap(&g, &d) == dnswire_error);
+    for (i = 0; i < 3; i++) {
+        assert(dnswire_writer_group_add_connection(&g, -1, false, 16, dnswire_frame_queue_drop_newest) == dnswire_ok);
+    }
+    assert(dnswire_writer_group_connections(g) == 3);
+    for (i = 0; i < 6; i++) {
+        assert(dnswire_writer_group_write_dnstap(&g, &d) == dnswire_ok);
+    }
+    for (i = 0; i < 3; i++) {
+        assert(dnswire_frame_queue_length(dnswire_writer_group_connection(g, i)->queue) == 2);
+    }
+    assert(dnswire_writer_group_write(&g, 0) == dnswire_error);
+    assert(dnswire_writer_group_connection(g, 0)->state == dnswire_relay_destination_failed);
+    for (i = 0; i < 4; i++) {
+        assert(dnswire_writer_group_write_dnstap(&g, &d) == dnswire_ok);
+    }
+    assert(dnswire_frame_queue_length(dnswire_writer_group_connection(g, 0)->queue) == 0);
+    assert(dnswire_frame_queue_length(dnswire_writer_group_connection(g, 1)->queue) == 4);
+    assert(dnswire_frame_queue_length(dnswire_writer_group_connection(g, 2)->queue) == 4);
+    assert(dnswire_writer_group_write(&g, 1) == dnswire_error);
+    assert(dnswire_writer_group_write(&g, 2) == dnswire_error);
+    assert(dnswire_writer_group_write_dnstap(&g, &d) == dnswire_error);
+    assert(g.unrouted == 2);
+    dnswire_writer_group_destroy(&g);
+
+    // by client address, each client's messages stays on one connection
+    assert(dnswire_writer_group_init(&g, dnswire_writer_group_client_address) == dnswire_ok);
+    for (i = 0; i < 3; i++) {
+        int fd = open(files[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        assert(fd > -1);
+        assert(dnswire_writer_group_add_connection(&g, fd, false, 16, dnswire_frame_queue_drop_newest) == dnswire_ok);
+    }
+    for (i = 0; i < 4; i++) {
+        dnstap_message_set_query_address(d, a1, sizeof(a1));
+        assert(dnswire_writer_group_write_dnstap(&g, &d) == dnswire_ok);
+        dnstap_message_set_query_address(d, a2, sizeof(a2));
+        assert(dnswire_writer_group_write_dnstap(&g, &d) == dnswire_ok);
+    }
+    for (sum = 0, i = 0; i < 3; i++) {
+        size_t len = dnswire_frame_queue_length(dnswire_writer_group_connection(g, i)->queue);
+        assert(len == 0 || len == 4 || len == 8);
+        sum += len;
+    }
+    assert(sum == 8);
+
+    assert(dnswire_writer_group_stop(&g) == dnswire_ok);
+    assert(dnswire_writer_group_write_dnstap(&g, &d) == dnswire_error);
+    do {
+        for (done = 0, i = 0; i < 3; i++) {
+            enum dnswire_result res = dnswire_writer_group_write(&g, i);
+            assert(res != dnswire_error);
+            if (res == dnswire_endofdata) {
+                done++;
+            }
+        }
+    } while (done < 3);
+    for (i = 0; i < 3; i++) {
+        close(dnswire_writer_group_connection(g, i)->fd);
+    }
+    dnswire_writer_group_destroy(&g);
+
+    for (sum = 0, i = 0; i < 3; i++) {
+        sum += count_dnstap(files[i]);
+    }
+    assert(sum == 8);
+
+    return 0;
+}
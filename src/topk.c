@@ -0,0 +1,473 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/topk.h"
+#include "dnswire/dns.h"
+#include "dnswire/trace.h"
+
+#include <assert.h>
+#include <string.h>
+
+const char* const dnswire_topk_key_string[] = {
+    "qname",
+    "client",
+    "client_rcode",
+};
+
+enum dnswire_result dnswire_topk_init(struct dnswire_topk* handle, enum dnswire_topk_key key, size_t capacity)
+{
+    assert(handle);
+
+    size_t size = 16;
+
+    memset(handle, 0, sizeof(struct dnswire_topk));
+
+    if (!capacity || capacity > UINT32_MAX / 2) {
+        return dnswire_error;
+    }
+    while (size < capacity * 2) {
+        size *= 2;
+    }
+
+    if (!(handle->counters = malloc(capacity * sizeof(struct dnswire_topk_counter)))
+        || !(handle->heap = malloc(capacity * sizeof(uint32_t)))
+        || !(handle->index = calloc(size, sizeof(uint32_t)))) {
+        dnswire_topk_destroy(handle);
+        return dnswire_error;
+    }
+    handle->key        = key;
+    handle->capacity   = capacity;
+    handle->index_size = size;
+
+    __trace("%s capacity %zu index %zu", dnswire_topk_key_string[key], capacity, size);
+
+    return dnswire_ok;
+}
+
+void dnswire_topk_destroy(struct dnswire_topk* handle)
+{
+    assert(handle);
+
+    free(handle->counters);
+    free(handle->heap);
+    free(handle->index);
+    handle->counters = 0;
+    handle->heap     = 0;
+    handle->index    = 0;
+    handle->used     = 0;
+}
+
+void dnswire_topk_clear(struct dnswire_topk* handle)
+{
+    assert(handle);
+    assert(handle->index);
+
+    memset(handle->index, 0, handle->index_size * sizeof(uint32_t));
+    handle->used  = 0;
+    handle->total = 0;
+}
+
+static inline uint32_t _hash(const uint8_t* key, size_t len)
+{
+    uint64_t h = len * 0x9e3779b97f4a7c15ULL, w;
+
+    while (len >= 8) {
+        memcpy(&w, key, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+        key += 8;
+        len -= 8;
+    }
+    if (len) {
+        w = 0;
+        memcpy(&w, key, len);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+
+    return (uint32_t)h;
+}
+
+/*
+ * The min-heap of counter indexes, each counter knows its position.
+ */
+
+static inline void _swap(struct dnswire_topk* handle, size_t a, size_t b)
+{
+    uint32_t t = handle->heap[a];
+
+    handle->heap[a]                        = handle->heap[b];
+    handle->heap[b]                        = t;
+    handle->counters[handle->heap[a]].heap = a;
+    handle->counters[handle->heap[b]].heap = b;
+}
+
+static void _sift_up(struct dnswire_topk* handle, size_t pos)
+{
+    while (pos) {
+        size_t parent = (pos - 1) / 2;
+
+        if (handle->counters[handle->heap[parent]].count <= handle->counters[handle->heap[pos]].count) {
+            break;
+        }
+        _swap(handle, parent, pos);
+        pos = parent;
+    }
+}
+
+static void _sift_down(struct dnswire_topk* handle, size_t pos)
+{
+    while (1) {
+        size_t l = pos * 2 + 1, r = l + 1, min = pos;
+
+        if (l < handle->used && handle->counters[handle->heap[l]].count < handle->counters[handle->heap[min]].count) {
+            min = l;
+        }
+        if (r < handle->used && handle->counters[handle->heap[r]].count < handle->counters[handle->heap[min]].count) {
+            min = r;
+        }
+        if (min == pos) {
+            break;
+        }
+        _swap(handle, pos, min);
+        pos = min;
+    }
+}
+
+/*
+ * Find the slot of a key in the index, or the empty slot where it would
+ * be inserted.
+ */
+static inline size_t _find(const struct dnswire_topk* handle, const uint8_t* key, size_t len, uint32_t hash)
+{
+    size_t mask = handle->index_size - 1, i;
+
+    for (i = hash & mask; handle->index[i]; i = (i + 1) & mask) {
+        const struct dnswire_topk_counter* c = &handle->counters[handle->index[i] - 1];
+
+        if (c->hash == hash && c->length == len && !memcmp(c->key, key, len)) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/*
+ * Remove a counter from the index by shifting back the entries after it
+ * that are not at their home slot.
+ */
+static void _unindex(struct dnswire_topk* handle, uint32_t counter)
+{
+    size_t mask = handle->index_size - 1, i, k;
+
+    for (i = handle->counters[counter].hash & mask; handle->index[i] != counter + 1; i = (i + 1) & mask)
+        ;
+
+    for (k = i;;) {
+        k = (k + 1) & mask;
+        if (!handle->index[k]) {
+            break;
+        }
+
+        size_t home = handle->counters[handle->index[k] - 1].hash & mask;
+        if (k > i ? (home <= i || home > k) : (home <= i && home > k)) {
+            handle->index[i] = handle->index[k];
+            i                = k;
+        }
+    }
+    handle->index[i] = 0;
+}
+
+static void _add(struct dnswire_topk* handle, const uint8_t* key, size_t len, uint64_t count, uint64_t error)
+{
+    uint32_t                     hash = _hash(key, len), n;
+    size_t                       slot = _find(handle, key, len, hash);
+    struct dnswire_topk_counter* c;
+
+    handle->total += count;
+
+    if (handle->index[slot]) {
+        c = &handle->counters[handle->index[slot] - 1];
+        c->count += count;
+        c->error += error;
+        _sift_down(handle, c->heap);
+        return;
+    }
+
+    if (handle->used < handle->capacity) {
+        n        = handle->used++;
+        c        = &handle->counters[n];
+        c->count = count;
+        c->error = error;
+        c->heap  = n;
+
+        handle->heap[n] = n;
+        _sift_up(handle, n);
+    } else {
+        /*
+         * Replace the counter with the lowest count, the new key takes
+         * over its count as error.
+         */
+        n = handle->heap[0];
+        c = &handle->counters[n];
+        _unindex(handle, n);
+        slot = _find(handle, key, len, hash);
+
+        c->error = c->count + error;
+        c->count += count;
+        _sift_down(handle, 0);
+    }
+
+    memcpy(c->key, key, len);
+    c->length           = len;
+    c->hash             = hash;
+    handle->index[slot] = n + 1;
+}
+
+enum dnswire_result dnswire_topk_add(struct dnswire_topk* handle, const uint8_t* key, size_t len, uint64_t count)
+{
+    assert(handle);
+    assert(handle->counters);
+    assert(key || !len);
+
+    if (len > DNSWIRE_TOPK_MAX_KEY) {
+        return dnswire_error;
+    }
+
+    _add(handle, key, len, count, 0);
+
+    return dnswire_ok;
+}
+
+/*
+ * Build the key from the fields of a message, returns the length or -1
+ * if the message does not have it.
+ */
+static inline ssize_t _key(enum dnswire_topk_key type, uint8_t* key, const uint8_t* address, size_t address_len, const uint8_t* dns, size_t dns_len, const uint8_t* response, size_t response_len)
+{
+    struct dnswire_dns d;
+
+    switch (type) {
+    case dnswire_topk_qname:
+        if (!dns || dnswire_dns_parse(&d, dns, dns_len) != dnswire_ok || !d.has_question) {
+            return -1;
+        }
+        dnswire_dns_name_lower(key, d.qname, d.qname_length);
+        return d.qname_length;
+
+    case dnswire_topk_client:
+        if (!address || address_len > DNSWIRE_TOPK_MAX_KEY) {
+            return -1;
+        }
+        memcpy(key, address, address_len);
+        return address_len;
+
+    case dnswire_topk_client_rcode:
+        if (!address || address_len >= DNSWIRE_TOPK_MAX_KEY || !response || response_len < DNSWIRE_DNS_HEADER_SIZE) {
+            return -1;
+        }
+        memcpy(key, address, address_len);
+        key[address_len] = response[3] & 0xf;
+        return address_len + 1;
+    }
+
+    return -1;
+}
+
+enum dnswire_result dnswire_topk_add_dnstap(struct dnswire_topk* handle, const struct dnstap* d)
+{
+    assert(handle);
+    assert(handle->counters);
+    assert(d);
+
+    uint8_t        key[DNSWIRE_TOPK_MAX_KEY];
+    const uint8_t *address = 0, *dns = 0, *response = 0;
+    size_t         address_len = 0, dns_len = 0, response_len = 0;
+    ssize_t        len;
+
+    if (!dnstap_has_message(*d)) {
+        return dnswire_again;
+    }
+    if (dnstap_message_has_query_address(*d)) {
+        address     = dnstap_message_query_address(*d);
+        address_len = dnstap_message_query_address_length(*d);
+    }
+    if (dnstap_message_has_query_message(*d)) {
+        dns     = dnstap_message_query_message(*d);
+        dns_len = dnstap_message_query_message_length(*d);
+    }
+    if (dnstap_message_has_response_message(*d)) {
+        response     = dnstap_message_response_message(*d);
+        response_len = dnstap_message_response_message_length(*d);
+        if (!dns) {
+            dns     = response;
+            dns_len = response_len;
+        }
+    }
+
+    if ((len = _key(handle->key, key, address, address_len, dns, dns_len, response, response_len)) < 0) {
+        return dnswire_again;
+    }
+    _add(handle, key, len, 1, 0);
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_topk_add_columns(struct dnswire_topk* handle, const struct dnswire_column_data* columns)
+{
+    assert(handle);
+    assert(handle->counters);
+    assert(columns);
+
+    const struct dnswire_column_data* a = &columns[dnswire_column_query_address];
+    const struct dnswire_column_data* q = &columns[dnswire_column_query_message];
+    const struct dnswire_column_data* r = &columns[dnswire_column_response_message];
+    uint8_t                           key[DNSWIRE_TOPK_MAX_KEY];
+    size_t                            i;
+    ssize_t                           len;
+
+    /*
+     * Only the columns needed for the key are looked at, the others may
+     * not have been read.
+     */
+    for (i = 0; i < a->rows || i < q->rows || i < r->rows; i++) {
+        bool           ha = handle->key != dnswire_topk_qname && i < a->rows && dnswire_column_data_is_present(*a, i);
+        bool           hq = handle->key == dnswire_topk_qname && i < q->rows && dnswire_column_data_is_present(*q, i);
+        bool           hr = handle->key != dnswire_topk_client && i < r->rows && dnswire_column_data_is_present(*r, i);
+        const uint8_t* response = hr ? dnswire_column_data_bytes(*r, i) : 0;
+        size_t         response_len = hr ? dnswire_column_data_length(*r, i) : 0;
+
+        len = _key(handle->key, key,
+            ha ? dnswire_column_data_bytes(*a, i) : 0, ha ? dnswire_column_data_length(*a, i) : 0,
+            hq ? dnswire_column_data_bytes(*q, i) : response, hq ? dnswire_column_data_length(*q, i) : response_len,
+            response, response_len);
+        if (len >= 0) {
+            _add(handle, key, len, 1, 0);
+        }
+    }
+
+    return dnswire_ok;
+}
+
+static int _cmp(const void* a, const void* b)
+{
+    const struct dnswire_topk_counter* x = a;
+    const struct dnswire_topk_counter* y = b;
+
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+/*
+ * The lowest count of a full sketch, keys not counted may have been seen
+ * up to this many times.
+ */
+static inline uint64_t _min(const struct dnswire_topk* handle)
+{
+    return handle->used == handle->capacity ? handle->counters[handle->heap[0]].count : 0;
+}
+
+enum dnswire_result dnswire_topk_merge(struct dnswire_topk* handle, const struct dnswire_topk* from)
+{
+    assert(handle);
+    assert(handle->counters);
+    assert(from);
+    assert(from->counters);
+    assert(handle != from);
+
+    struct dnswire_topk_counter* all;
+    uint64_t                     min = _min(handle), from_min = _min(from), total;
+    size_t                       i, n = 0;
+
+    if (handle->key != from->key) {
+        return dnswire_error;
+    }
+    if (!(all = malloc((handle->used + from->used) * sizeof(struct dnswire_topk_counter) + 1))) {
+        return dnswire_error;
+    }
+
+    /*
+     * Combine the counters of both, a key only in one of them may have
+     * been seen up to the lowest count of the other.
+     */
+    for (i = 0; i < handle->used; i++) {
+        const struct dnswire_topk_counter* c    = &handle->counters[i];
+        size_t                             slot = _find(from, c->key, c->length, c->hash);
+
+        all[n] = *c;
+        if (from->index[slot]) {
+            all[n].count += from->counters[from->index[slot] - 1].count;
+            all[n].error += from->counters[from->index[slot] - 1].error;
+        } else {
+            all[n].count += from_min;
+            all[n].error += from_min;
+        }
+        n++;
+    }
+    for (i = 0; i < from->used; i++) {
+        const struct dnswire_topk_counter* c = &from->counters[i];
+
+        if (!handle->index[_find(handle, c->key, c->length, c->hash)]) {
+            all[n] = *c;
+            all[n].count += min;
+            all[n].error += min;
+            n++;
+        }
+    }
+
+    qsort(all, n, sizeof(struct dnswire_topk_counter), _cmp);
+
+    total = handle->total + from->total;
+    dnswire_topk_clear(handle);
+    for (i = 0; i < n && i < handle->capacity; i++) {
+        _add(handle, all[i].key, all[i].length, all[i].count, all[i].error);
+    }
+    handle->total = total;
+    free(all);
+
+    return dnswire_ok;
+}
+
+size_t dnswire_topk_snapshot(const struct dnswire_topk* handle, struct dnswire_topk_counter* out, size_t n)
+{
+    assert(handle);
+    assert(handle->counters);
+    assert(out || !n);
+
+    struct dnswire_topk_counter* all;
+
+    if (n >= handle->used) {
+        memcpy(out, handle->counters, handle->used * sizeof(struct dnswire_topk_counter));
+        qsort(out, handle->used, sizeof(struct dnswire_topk_counter), _cmp);
+        return handle->used;
+    }
+    if (!n || !(all = malloc(handle->used * sizeof(struct dnswire_topk_counter)))) {
+        return 0;
+    }
+    memcpy(all, handle->counters, handle->used * sizeof(struct dnswire_topk_counter));
+    qsort(all, handle->used, sizeof(struct dnswire_topk_counter), _cmp);
+    memcpy(out, all, n * sizeof(struct dnswire_topk_counter));
+    free(all);
+
+    return n;
+}
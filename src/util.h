@@ -0,0 +1,97 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __dnswire_util_h
+#define __dnswire_util_h 1
+
+/*
+ * Internal helpers shared by the implementation, not installed.
+ */
+
+// 32 bit FNV-1a
+static inline uint32_t _fnv1a32(const uint8_t* data, size_t len)
+{
+    uint32_t h = 2166136261U;
+    size_t   i;
+
+    for (i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+// 64 bit FNV-1a
+static inline uint64_t _fnv1a64(const uint8_t* data, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t   i;
+
+    for (i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/*
+ * Big-endian integers, as in DNS messages and the file formats.
+ */
+
+static inline void _put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void _put32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline void _put64(uint8_t* p, uint64_t v)
+{
+    _put32(p, v >> 32);
+    _put32(p + 4, v);
+}
+
+static inline uint16_t _get16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t _get32(const uint8_t* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint64_t _get64(const uint8_t* p)
+{
+    return (uint64_t)_get32(p) << 32 | _get32(p + 4);
+}
+
+#endif
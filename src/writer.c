@@ -22,10 +22,13 @@
 #include "config.h"
 
 #include "dnswire/writer.h"
+#include "dnswire/index.h"
+#include "dnswire/compression.h"
 #include "dnswire/trace.h"
 #include "dnswire/dnswire.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 
 const char* const dnswire_writer_state_string[] = {
@@ -69,6 +72,11 @@ static struct dnswire_writer _defaults = {
     .read_pushed = 0,
 
     .bidirectional = false,
+
+    .offset = 0,
+    .index  = 0,
+
+    .compressor = 0,
 };
 
 enum dnswire_result dnswire_writer_init(struct dnswire_writer* handle)
@@ -165,6 +173,19 @@ enum dnswire_result dnswire_writer_set_bufmax(struct dnswire_writer* handle, siz
     return dnswire_ok;
 }
 
+static ssize_t _write(struct dnswire_writer* handle, int fd, const uint8_t* data, size_t len)
+{
+    if (handle->compressor) {
+        if (dnswire_compressor_write(handle->compressor, data, len) != dnswire_ok) {
+            // callers check errno for retryable errors, this is not one
+            errno = EIO;
+            return -1;
+        }
+        return (ssize_t)len;
+    }
+    return write(fd, data, len);
+}
+
 static enum dnswire_result _encoding(struct dnswire_writer* handle)
 {
     enum dnswire_result res;
@@ -175,10 +196,15 @@ static enum dnswire_result _encoding(struct dnswire_writer* handle)
 
         switch (res) {
         case dnswire_ok:
+            if (handle->index && dnswire_index_add(handle->index, handle->offset, dnswire_encoder_encoded(handle->encoder), handle->encoder.dnstap) != dnswire_ok) {
+                return dnswire_error;
+            }
+            // fallthrough
         case dnswire_again:
         case dnswire_endofdata:
             handle->at += dnswire_encoder_encoded(handle->encoder);
             handle->left += dnswire_encoder_encoded(handle->encoder);
+            handle->offset += dnswire_encoder_encoded(handle->encoder);
             break;
 
         case dnswire_need_more: {
@@ -459,10 +485,12 @@ enum dnswire_result dnswire_writer_write(struct dnswire_writer* handle, int fd)
         }
 
     case dnswire_writer_writing_ready: {
-        ssize_t nwrote = write(fd, &handle->buf[handle->at - handle->left], handle->left);
+        ssize_t nwrote = _write(handle, fd, &handle->buf[handle->at - handle->left], handle->left);
         __trace("wrote %zd", nwrote);
         if (nwrote < 0) {
-            // TODO
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return dnswire_again;
+            }
             return dnswire_error;
         } else if (!nwrote) {
             // TODO
@@ -475,6 +503,9 @@ enum dnswire_result dnswire_writer_write(struct dnswire_writer* handle, int fd)
             break;
         }
         handle->at = 0;
+        if (handle->compressor && dnswire_compressor_flush(handle->compressor) != dnswire_ok) {
+            return dnswire_error;
+        }
         __state(handle, dnswire_writer_reading_accept);
         // fallthrough
     }
@@ -482,7 +513,9 @@ enum dnswire_result dnswire_writer_write(struct dnswire_writer* handle, int fd)
     case dnswire_writer_reading_accept: {
         ssize_t nread = read(fd, &handle->read_buf[handle->read_at + handle->read_left], handle->read_size - handle->read_at - handle->read_left);
         if (nread < 0) {
-            // TODO
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return dnswire_again;
+            }
             return dnswire_error;
         } else if (!nread) {
             // TODO
@@ -561,10 +594,12 @@ enum dnswire_result dnswire_writer_write(struct dnswire_writer* handle, int fd)
         }
 
     case dnswire_writer_writing: {
-        ssize_t nwrote = write(fd, &handle->buf[handle->at - handle->left], handle->left);
+        ssize_t nwrote = _write(handle, fd, &handle->buf[handle->at - handle->left], handle->left);
         __trace("wrote %zd", nwrote);
         if (nwrote < 0) {
-            // TODO
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return dnswire_again;
+            }
             return dnswire_error;
         } else if (!nwrote) {
             // TODO
@@ -582,10 +617,12 @@ enum dnswire_result dnswire_writer_write(struct dnswire_writer* handle, int fd)
 
     case dnswire_writer_stopping:
         if (handle->left) {
-            ssize_t nwrote = write(fd, &handle->buf[handle->at - handle->left], handle->left);
+            ssize_t nwrote = _write(handle, fd, &handle->buf[handle->at - handle->left], handle->left);
             __trace("wrote %zd", nwrote);
             if (nwrote < 0) {
-                // TODO
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    return dnswire_again;
+                }
                 return dnswire_error;
             } else if (!nwrote) {
                 // TODO
@@ -613,10 +650,12 @@ enum dnswire_result dnswire_writer_write(struct dnswire_writer* handle, int fd)
 
     case dnswire_writer_writing_stop:
         if (handle->left) {
-            ssize_t nwrote = write(fd, &handle->buf[handle->at - handle->left], handle->left);
+            ssize_t nwrote = _write(handle, fd, &handle->buf[handle->at - handle->left], handle->left);
             __trace("wrote %zd", nwrote);
             if (nwrote < 0) {
-                // TODO
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    return dnswire_again;
+                }
                 return dnswire_error;
             } else if (!nwrote) {
                 // TODO
@@ -631,6 +670,9 @@ enum dnswire_result dnswire_writer_write(struct dnswire_writer* handle, int fd)
             handle->at = 0;
         }
         if (handle->bidirectional) {
+            if (handle->compressor && dnswire_compressor_flush(handle->compressor) != dnswire_ok) {
+                return dnswire_error;
+            }
             __state(handle, dnswire_writer_reading_finish);
             return dnswire_again;
         }
@@ -640,7 +682,9 @@ enum dnswire_result dnswire_writer_write(struct dnswire_writer* handle, int fd)
     case dnswire_writer_reading_finish: {
         ssize_t nread = read(fd, &handle->read_buf[handle->read_at + handle->read_left], handle->read_size - handle->read_at - handle->read_left);
         if (nread < 0) {
-            // TODO
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return dnswire_again;
+            }
             return dnswire_error;
         } else if (!nread) {
             // TODO
@@ -0,0 +1,162 @@
+/*
+ * Author Jerry Lundström <jerry@dns-oarc.net>
+ * Copyright (c) 2019-2023, OARC, Inc.
+ * All rights reserved.
+ *
+ * This file is part of the dnswire library.
+ *
+ * dnswire library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dnswire library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with dnswire library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "dnswire/writer_group.h"
+#include "dnswire/trace.h"
+#include "util.h"
+
+#include <assert.h>
+#include <string.h>
+
+const char* const dnswire_writer_group_distribution_string[] = {
+    "round_robin",
+    "client_address",
+};
+
+enum dnswire_result dnswire_writer_group_init(struct dnswire_writer_group* handle, enum dnswire_writer_group_distribution distribution)
+{
+    assert(handle);
+
+    memset(handle, 0, sizeof(struct dnswire_writer_group));
+
+    switch (distribution) {
+    case dnswire_writer_group_round_robin:
+    case dnswire_writer_group_client_address:
+        break;
+    default:
+        return dnswire_error;
+    }
+    handle->distribution = distribution;
+
+    return dnswire_ok;
+}
+
+void dnswire_writer_group_destroy(struct dnswire_writer_group* handle)
+{
+    assert(handle);
+
+    size_t i;
+    for (i = 0; i < handle->num_connections; i++) {
+        dnswire_relay_destination_destroy(&handle->connections[i]);
+    }
+    free(handle->connections);
+    handle->connections     = 0;
+    handle->num_connections = 0;
+}
+
+enum dnswire_result dnswire_writer_group_add_connection(struct dnswire_writer_group* handle, int fd, bool bidirectional, size_t queue_size, enum dnswire_frame_queue_policy policy)
+{
+    assert(handle);
+
+    struct dnswire_relay_destination* connections = realloc(handle->connections, sizeof(struct dnswire_relay_destination) * (handle->num_connections + 1));
+    if (!connections) {
+        return dnswire_error;
+    }
+    handle->connections = connections;
+
+    if (dnswire_relay_destination_init(&handle->connections[handle->num_connections], fd, bidirectional, queue_size, policy) != dnswire_ok) {
+        return dnswire_error;
+    }
+    handle->num_connections++;
+
+    return dnswire_ok;
+}
+
+enum dnswire_result dnswire_writer_group_write_frame(struct dnswire_writer_group* handle, struct dnswire_frame* frame, const uint8_t* key, size_t len)
+{
+    assert(handle);
+    assert(frame);
+
+    size_t at, i;
+
+    if (!handle->num_connections) {
+        handle->unrouted++;
+        return dnswire_error;
+    }
+
+    bool by_key = handle->distribution == dnswire_writer_group_client_address && key && len;
+
+    at = by_key ? _fnv1a32(key, len) % handle->num_connections : handle->next;
+
+    for (i = 0; i < handle->num_connections; i++, at = (at + 1) % handle->num_connections) {
+        struct dnswire_relay_destination* c = &handle->connections[at];
+
+        if (dnswire_relay_destination_is_active(*c)) {
+            __trace("frame to connection %zu", at);
+            if (!by_key) {
+                handle->next = (at + 1) % handle->num_connections;
+            }
+            return dnswire_frame_queue_push(&c->queue, frame);
+        }
+    }
+
+    handle->unrouted++;
+    return dnswire_error;
+}
+
+enum dnswire_result dnswire_writer_group_write_dnstap(struct dnswire_writer_group* handle, const struct dnstap* dnstap)
+{
+    assert(handle);
+    assert(dnstap);
+
+    size_t len = dnstap_encode_protobuf_size(dnstap);
+    if (!len) {
+        return dnswire_error;
+    }
+
+    struct dnswire_frame* frame = dnswire_frame_new(len);
+    if (!frame) {
+        return dnswire_error;
+    }
+    dnstap_encode_protobuf(dnstap, dnswire_frame_payload(frame));
+
+    enum dnswire_result res;
+    if (dnstap_message_has_query_address(*dnstap)) {
+        res = dnswire_writer_group_write_frame(handle, frame, dnstap_message_query_address(*dnstap), dnstap_message_query_address_length(*dnstap));
+    } else {
+        res = dnswire_writer_group_write_frame(handle, frame, 0, 0);
+    }
+    dnswire_frame_unref(frame);
+
+    return res;
+}
+
+enum dnswire_result dnswire_writer_group_write(struct dnswire_writer_group* handle, size_t connection)
+{
+    assert(handle);
+    assert(connection < handle->num_connections);
+
+    return dnswire_relay_destination_write(&handle->connections[connection]);
+}
+
+enum dnswire_result dnswire_writer_group_stop(struct dnswire_writer_group* handle)
+{
+    assert(handle);
+
+    size_t i;
+    for (i = 0; i < handle->num_connections; i++) {
+        handle->connections[i].stop = true;
+    }
+
+    return dnswire_ok;
+}